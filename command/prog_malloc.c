@@ -0,0 +1,140 @@
+#include "stdio.h"
+#include "string.h"
+#include "stdint.h"
+#include "syscall.h"
+
+// 检查crt中的用户态分配器: 内存块的复用和切分, realloc原地调整, memalign对齐, calloc清0, 以及堆的扩展和归还
+
+static int32_t failures = 0;
+
+static void check(int32_t ok, const char *what){
+    printf("%s %s\n", ok ? "[ ok ]" : "[FAIL]", what);
+    if (!ok)
+        failures++;
+}
+
+// 内容只和偏移以及seed有关, 调整大小以后可以检查原来的内容是否保留
+static void fill(uint8_t *buf, uint32_t size, uint8_t seed){
+    for (uint32_t i = 0; i < size; i++)
+        buf[i] = (uint8_t) (i * 7 + seed);
+}
+
+static int32_t verify(uint8_t *buf, uint32_t size, uint8_t seed){
+    for (uint32_t i = 0; i < size; i++)
+        if (buf[i] != (uint8_t) (i * 7 + seed))
+            return 0;
+    return 1;
+}
+
+static int32_t all_zero(uint8_t *buf, uint32_t size){
+    for (uint32_t i = 0; i < size; i++)
+        if (buf[i] != 0)
+            return 0;
+    return 1;
+}
+
+
+static void test_reuse_split(void){
+    // 小内存块释放以后, 同一种大小的申请复用同一个内存块
+    uint8_t *small = malloc(40);
+    free(small);
+    check(malloc(40) == small, "small chunk is reused after free");
+    free(small);
+
+    // 小内存块把大内存块和堆顶隔开, 大内存块释放以后进入空闲链表, 而不是并入堆顶
+    uint8_t *big = malloc(12000);
+    uint8_t *guard = malloc(100);
+    free(big);
+    uint8_t *part = malloc(4000);
+    check(part == big, "free large chunk is split first fit");
+    uint8_t *rest = malloc(6000);
+    check(rest > part && rest < big + 12000, "remainder of the split chunk is allocated");
+    free(part);
+    free(rest);
+    free(guard);
+}
+
+
+static void test_realloc(void){
+    // 小内存块在本身的大小以内原地调整, 超过以后搬移
+    uint8_t *small = malloc(20);
+    fill(small, 20, 1);
+    check(realloc(small, 24) == small, "small chunk grows in place within its class");
+    uint8_t *moved = realloc(small, 100);
+    check(moved != NULL && verify(moved, 20, 1), "small chunk moves and keeps its content");
+
+    // 比空闲链表中的内存块都大, 从堆顶切分, 之后与堆顶相邻的时候原地增长
+    uint8_t *top = malloc(20000);
+    fill(top, 20000, 2);
+    check(realloc(top, 30000) == top && verify(top, 20000, 2), "chunk at the heap top grows in place");
+    check(realloc(top, 10000) == top && verify(top, 10000, 2), "large chunk shrinks in place");
+    // 缩小时切分出来的部分并入了堆顶, 所以可以再次原地增长
+    check(realloc(top, 25000) == top && verify(top, 10000, 2), "shrunk tail is merged back into the heap top");
+
+    check(realloc(moved, 0) == NULL, "realloc to 0 frees the chunk");
+    free(top);
+}
+
+
+static void test_memalign(void){
+    for (uint32_t align = 16; align <= 4096; align *= 4){
+        uint8_t *ptr = memalign(align, 300);
+        int32_t ok = ptr != NULL && (uint32_t) ptr % align == 0;
+        if (ok){
+            fill(ptr, 300, 3);
+            // 对齐以后的内存块依旧可以调整大小和释放
+            uint8_t *grown = realloc(ptr, 5000);
+            ok = grown != NULL && verify(grown, 300, 3);
+            free(grown != NULL ? grown : ptr);
+        }
+        printf("%s memalign(%d, 300)\n", ok ? "[ ok ]" : "[FAIL]", align);
+        if (!ok)
+            failures++;
+    }
+    check(memalign(24, 16) == NULL, "alignment that is not a power of 2 is rejected");
+}
+
+
+static void test_calloc(void){
+    // 复用的内存块被写脏过, 必须清0
+    uint8_t *dirty = malloc(3000);
+    memset(dirty, 0xAB, 3000);
+    free(dirty);
+    uint8_t *reused = calloc(750, 4);
+    check(reused != NULL && all_zero(reused, 3000), "calloc clears a reused chunk");
+    // 堆顶新申请的页本来就全为0
+    uint8_t *fresh = calloc(40000, 1);
+    check(fresh != NULL && all_zero(fresh, 40000), "calloc memory from fresh pages is zero");
+    check(calloc(0x10000, 0x10000) == NULL, "calloc rejects nmemb * size overflow");
+    free(reused);
+    free(fresh);
+}
+
+
+static void test_heap_top(void){
+    uint8_t *brk_before = sbrk(0);
+    uint8_t *huge = malloc(256 * 1024);
+    check(huge != NULL && (uint8_t *) sbrk(0) > brk_before, "heap grows through sbrk");
+    free(huge);
+    // 堆顶只保留UMALLOC_GROW字节, 其余的页归还给内核
+    check((uint8_t *) sbrk(0) <= brk_before + 0x5000, "free memory at the heap top is returned to the kernel");
+
+    // 内核在进程中为打开的文件分配的内存不能占用堆顶之上的虚拟页
+    int32_t fd = open("/test.txt", O_RDONLY);
+    uint8_t *after_open = malloc(512 * 1024);
+    check(after_open != NULL, "heap still grows after the kernel allocates for the process");
+    free(after_open);
+    if (fd != -1)
+        close(fd);
+}
+
+
+int main(void){
+    test_reuse_split();
+    test_realloc();
+    test_memalign();
+    test_calloc();
+    test_heap_top();
+    printf("prog_malloc: %d failures\n", failures);
+    return failures;
+}
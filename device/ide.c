@@ -467,6 +467,7 @@ void partition_scan(disk_t *hd, uint32_t ext_lba){
                 // 当前分区是主分区, 则将当前主分区信息写入到硬盘上的分区表中
                 hd->prim_parts[p_no].start_lba = ext_lba + partition->start_lba;
                 hd->prim_parts[p_no].sec_cnt = partition->sec_cnt;
+                hd->prim_parts[p_no].fs_type = partition->fs_type;
                 hd->prim_parts[p_no].my_disk = hd;
                 // 插入系统的分区队列中
                 list_append(&partition_list, &hd->prim_parts[p_no].part_tag);
@@ -480,6 +481,7 @@ void partition_scan(disk_t *hd, uint32_t ext_lba){
             } else {                                // 逻辑分区
                 hd->logic_parts[l_no].start_lba = ext_lba + partition->start_lba;
                 hd->logic_parts[l_no].sec_cnt = partition->sec_cnt;
+                hd->logic_parts[l_no].fs_type = partition->fs_type;
                 hd->logic_parts[l_no].my_disk = hd;
                 // 插入系统的分区队列中
                 list_append(&partition_list, &hd->logic_parts[l_no].part_tag);
@@ -7,12 +7,16 @@
 #include "sync.h"
 #include "super_block.h"
 
+/// @brief 分区表中交换分区的类型, 与Linux swap相同. 交换分区不会被格式化为文件系统
+#define PART_TYPE_SWAP 0x82
+
 
 /// @brief Sturcture of Disk Partition, only in memory. Initialized in init_all() and
 ///        filled in mount_partition()
 typedef struct __partition_t{
     uint32_t start_lba;                     ///< 当前分区的起始扇区LBA号
     uint32_t sec_cnt;                       ///< 当前分区占用的扇区数
+    uint8_t fs_type;                        ///< 当前分区在分区表中的类型, 例如PART_TYPE_SWAP
     struct __disk_t *my_disk;               ///< 当前分区所属的硬盘
     list_elem_t part_tag;                   ///< 当前分区在链表中的标记
     char name[8];                           ///< 当前分区的名字, 例如sda1, sda2
@@ -5,7 +5,6 @@
 #include "debug.h"
 #include "interrupt.h"
 
-#define IRQ0_FREQUENCY              100
 #define INPUT_FREQUENCY             1193180
 #define COUNTER0_VALUE              INPUT_FREQUENCY / IRQ0_FREQUENCY
 #define COUNTER0_PORT               0x40
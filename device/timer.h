@@ -1,6 +1,10 @@
 #ifndef __DEVICE_TIMER_H
 #define __DEVICE_TIMER_H
 #include "stdint.h"
+
+/// @brief 时钟中断的频率, 即每秒的tick数
+#define IRQ0_FREQUENCY 100
+
 void timer_init(void);
 
 void intr_timer_handler(void);
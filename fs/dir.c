@@ -7,6 +7,15 @@
 #include "kstdio.h"
 
 dir_t root_dir;
+kmem_cache_t dir_cache;
+
+
+/**
+ * @brief dir_cache_init用于初始化打开的目录的对象缓存
+ */
+void dir_cache_init(void){
+    kmem_cache_init(&dir_cache, "dir", sizeof(dir_t), sizeof(uint32_t), NULL);
+}
 
 
 /**
@@ -27,7 +36,9 @@ void open_root_dir(partition_t *partition){
  * @param inode_no 需要打开的目录的在partition指向的分区的inode_table中的index
  */
 dir_t *dir_open(partition_t *partition, uint32_t inode_no){
-    dir_t *pdir = (dir_t *) sys_malloc(sizeof(dir_t));
+    dir_t *pdir = (dir_t *) kmem_cache_alloc(&dir_cache);
+    if (pdir == NULL)
+        return NULL;
     pdir->inode = inode_open(partition, inode_no);
     pdir->dir_pos = 0;
     return pdir;
@@ -43,9 +54,9 @@ void dir_close(dir_t *dir){
     // 根目录不能被关闭, 因为root_dir是在内核中, 不是在内核的线程中
     if (dir == &root_dir)   
         return;
-    // 释放dir_open中sys_malloc得到的堆
+    // 将dir_open中分配的目录归还给对象缓存
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(&dir_cache, dir);
 }
 
 
@@ -11,6 +11,15 @@
 
 extern dir_t root_dir;
 
+/// @brief 打开的目录的对象缓存
+extern kmem_cache_t dir_cache;
+
+
+/**
+ * @brief dir_cache_init用于初始化打开的目录的对象缓存
+ */
+void dir_cache_init(void);
+
 
 /**
  * @brief open_root_dir用于打开分区partition中的根目录
@@ -159,19 +159,15 @@ int32_t file_create(dir_t *parent_dir, char *filename, uint8_t flag){
 
     // 因为上面已经申请到了inode_bitmap这个资源, 所以此后申请资源失败就不能直接返回了
     // 所以声明一个rollback_step用来记录要释放那些资源
-    // 此外, file_create函数未来是以系统调用的形式来让用户进程使用的, 因此这里直接sys_malloc即可, 得到的内存就是在内核线程的堆中的
+    // 此外, file_create函数未来是以系统调用的形式来让用户进程使用的, inode从对象缓存中分配, 得到的内存总是在内核空间中
     uint8_t rollback_step = 0;
-    task_struct_t *cur = running_thread();
-    uint32_t user_pgdir_bk = (uint32_t)cur->pgdir;
-    cur->pgdir = NULL;
-    inode_t *new_file_node = (inode_t *) sys_malloc(sizeof(inode_t));
+    inode_t *new_file_node = (inode_t *) kmem_cache_alloc(&inode_cache);
     if (new_file_node == NULL){
-        kprintf("file_create: sys_malloc for inode failed!\n");
+        kprintf("file_create: kmem_cache_alloc for inode failed!\n");
         rollback_step = 1;
         goto rollback;              // 因为已经申请了inode_bitmap, 所以跳到后面去释放资源
     }
     inode_init(inode_no, new_file_node);
-    cur->pgdir = (uint32_t*)user_pgdir_bk;
 
     int global_fd_idx = get_free_slot_in_global();
     if (global_fd_idx == -1){
@@ -228,7 +224,7 @@ int32_t file_create(dir_t *parent_dir, char *filename, uint8_t flag){
 rollback:
     // 释放资源是依次释放的, 申请的顺序是:
     //      1. inode_bitmap
-    //      2. 内核线程堆中的inode
+    //      2. 对象缓存中的inode
     //      3. 系统全局的open_file_table中的一个free slot
     // 所以释放资源的时候, 倒序释放
     switch (rollback_step){
@@ -237,10 +233,8 @@ rollback:
             memset(&file_table[global_fd_idx], 0, sizeof(file_desc_t));
             __attribute__ ((fallthrough));
         case 2:
-            // get_free_slot失败时, 需要释放内核线程堆中的inode
-            cur->pgdir = NULL;
-            sys_free(new_file_node);
-            cur->pgdir = (uint32_t*) user_pgdir_bk;
+            // get_free_slot失败时, 需要释放对象缓存中的inode
+            kmem_cache_free(&inode_cache, new_file_node);
             __attribute__ ((fallthrough));
         case 1:
             // sys_malloc(new_file_inode)失败时, 释放申请到的inode bitmap位
@@ -649,4 +643,44 @@ int32_t file_read(file_desc_t *file, void *buf, uint32_t count){
     sys_free(all_blocks_lba);
     sys_free(io_buf);
     return bytes_read;
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief file_read_page用于将inode指向的文件中从offset开始的一页内容直接读入page, 不经过中间的缓冲区.
+ *        文件末尾之后的部分填0. 该函数用于文件映射的缺页处理, 所以不使用文件描述符, 也不会移动文件指针
+ * 
+ * @param inode 需要读取的文件的inode
+ * @param offset 文件内的偏移, 必须按扇区对齐
+ * @param page 读取的内容将写入的页, 必须可以写入PG_SIZE个字节
+ * @return int32_t 返回从文件中读取的字节数, offset超过文件末尾的时候为0
+ */
+int32_t file_read_page(inode_t *inode, uint32_t offset, void *page){
+    ASSERT(offset % BLOCK_SIZE == 0);
+    // 映射的长度可以超过文件末尾, 此时offset可能超过文件最大的块数, 在计算块的下标之前直接返回全0的页
+    if (offset >= inode->i_size){
+        memset(page, 0, PG_SIZE);
+        return 0;
+    }
+    uint32_t size = inode->i_size - offset < PG_SIZE ? inode->i_size - offset : PG_SIZE;
+
+    // 一页最多8个扇区, 先确定所有扇区的lba. 间接块借用page读入, 只保留需要的表项
+    uint32_t sec_cnt = DIV_CEILING(size, BLOCK_SIZE);
+    uint32_t block_start_idx = offset / BLOCK_SIZE;
+    uint32_t sec_lba[PG_SIZE / BLOCK_SIZE];
+    ASSERT(block_start_idx + sec_cnt <= 140);
+    if (block_start_idx + sec_cnt > 12){
+        ASSERT(inode->i_sectors[12] != 0);
+        ide_read(current_partition->my_disk, inode->i_sectors[12], page, 1);
+    }
+    for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++){
+        uint32_t block_idx = block_start_idx + sec_idx;
+        sec_lba[sec_idx] = block_idx < 12 ? inode->i_sectors[block_idx] : ((uint32_t *) page)[block_idx - 12];
+    }
+
+    // 扇区直接读入页中, 最后一个扇区中超过文件末尾的部分和之后的扇区都要清0
+    for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++)
+        ide_read(current_partition->my_disk, sec_lba[sec_idx], (uint8_t *) page + sec_idx * BLOCK_SIZE, 1);
+    memset((uint8_t *) page + size, 0, PG_SIZE - size);
+    return size;
+}
@@ -147,4 +147,16 @@ int32_t file_write(file_desc_t *file, const void *buf, uint32_t count);
  */
 int32_t file_read(file_desc_t *file, void *buf, uint32_t count);
 
+
+/**
+ * @brief file_read_page用于将inode指向的文件中从offset开始的一页内容直接读入page, 不经过中间的缓冲区.
+ *        文件末尾之后的部分填0. 该函数用于文件映射的缺页处理, 所以不使用文件描述符, 也不会移动文件指针
+ * 
+ * @param inode 需要读取的文件的inode
+ * @param offset 文件内的偏移, 必须按扇区对齐
+ * @param page 读取的内容将写入的页, 必须可以写入PG_SIZE个字节
+ * @return int32_t 返回从文件中读取的字节数, offset超过文件末尾的时候为0
+ */
+int32_t file_read_page(inode_t *inode, uint32_t offset, void *page);
+
 #endif
\ No newline at end of file
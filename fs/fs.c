@@ -237,6 +237,11 @@ bool mount_partition(list_elem_t *elem, int arg){
 
         // 2.2 一步到位, 直接从磁盘中读取block bitmap到current_partition->block_bitmap.bits
         ide_read(hd, sb_buf->block_bitmap_lba, current_partition->block_bitmap.bits, sb_buf->block_bitmap_sects);
+        // 2.3 位图是直接从磁盘中读入的, 需要重建摘要位图
+        uint32_t *block_summary = (uint32_t*)sys_malloc(BITMAP_SUMMARY_BYTES(current_partition->block_bitmap.btmp_byte_len));
+        if (block_summary == NULL)
+            PANIC("mount_partition: sys_malloc for block bitmap summary fail!");
+        bitmap_build_summary(&current_partition->block_bitmap, block_summary);
 
 
         // 3. 加载inode_bitmap
@@ -248,6 +253,11 @@ bool mount_partition(list_elem_t *elem, int arg){
 
         // 3.2 一步到位的读取
         ide_read(hd, sb_buf->inode_bitmap_lba, current_partition->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+        // 3.3 位图是直接从磁盘中读入的, 需要重建摘要位图
+        uint32_t *inode_summary = (uint32_t*)sys_malloc(BITMAP_SUMMARY_BYTES(current_partition->inode_bitmap.btmp_byte_len));
+        if (inode_summary == NULL)
+            PANIC("mount_partition: sys_malloc for inode bitmap summary fail!");
+        bitmap_build_summary(&current_partition->inode_bitmap, inode_summary);
 
         // 初始化打开的inode链表
         list_init(&current_partition->open_inodes);
@@ -279,6 +289,10 @@ extern list_t partition_list;              ///< 磁盘中分区表的链表, 在
 void filesys_init(void){
     uint8_t channel_no = 0, dev_no = 0, partition_idx = 0;
 
+    // 初始化文件系统使用的对象缓存
+    inode_cache_init();
+    dir_cache_init();
+    pipe_cache_init();
 
     // 分配内存空间, 用于存储硬盘中读取出来的超级块
     super_block_t *sb_buf = (super_block_t*)sys_malloc(SECTOR_SIZE);
@@ -305,8 +319,10 @@ void filesys_init(void){
                 if (partition_idx == 4)
                     partition = hd->logic_parts;
                 
-                // 分区存在, 然后在处理分区
-                if (partition->sec_cnt != 0){
+                // 分区存在, 然后在处理分区. 交换分区由swap_init使用, 不能格式化
+                if (partition->sec_cnt != 0 && partition->fs_type == PART_TYPE_SWAP)
+                    kprintf("        => Partition %s: swap\n", partition->name);
+                else if (partition->sec_cnt != 0){
                     // 每次读取前都要清0
                     memset(sb_buf, 0, SECTOR_SIZE);
                     // 读取分区的超级块
@@ -595,7 +611,7 @@ int32_t sys_close(int32_t fd){
         uint32_t fd_global = fd_local2global(fd);
         if (is_pipe(fd)){
             if (--file_table[fd_global].fd_pos == 0){
-                mfree_page(PF_KERNEL, file_table[fd_global].fd_inode, 1);
+                kmem_cache_free(&pipe_cache, file_table[fd_global].fd_inode);
                 file_table[fd_global].fd_inode = NULL;
             }
             ret = 0;
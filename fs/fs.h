@@ -6,6 +6,7 @@
 #define BLOCK_SIZE                      SECTOR_SIZE     ///< 每个扇区的字节数
 #define BITS_PER_SECTOR                 4096            ///< 每个扇区的位数
 #define MAX_PATH_LEN                    512             ///< 文件路径的最大长度
+#define MAX_FILE_SIZE                   (140 * BLOCK_SIZE)  ///< 文件的最大字节数, 12个直接块和128个一级间接块
 
 #include "list.h"
 #include "stdint.h"
@@ -5,6 +5,9 @@
 #include "string.h"
 #include "interrupt.h"
 
+kmem_cache_t inode_cache;
+
+
 typedef struct __inode_position_t {
     bool multi_sec;             /// inode是否跨扇区
     uint32_t sec_lba;           /// inode所在的扇区lba地址
@@ -12,6 +15,14 @@ typedef struct __inode_position_t {
 } inode_position_t;
 
 
+/**
+ * @brief inode_cache_init用于初始化inode的对象缓存
+ */
+void inode_cache_init(void){
+    kmem_cache_init(&inode_cache, "inode", sizeof(inode_t), sizeof(uint32_t), NULL);
+}
+
+
 /**
  * @brief inode_locate用于计算给定的inode的位置信息
  * 
@@ -117,13 +128,10 @@ inode_t *inode_open(partition_t *partition, uint32_t inode_no){
     inode_locate(partition, inode_no, &inode_pos);
 
 
-    // 从内核的堆中分配内存, 来存储inode
-    task_struct_t *cur = running_thread();
-    uint32_t *cur_pgdir_backup = cur->pgdir;
-    // 伪装当前进程为内核线程, 而后分配得到的内存就位于内核空间
-    cur->pgdir = NULL;
-    inode_found = (inode_t *) sys_malloc(sizeof(inode_t));
-    cur->pgdir = cur_pgdir_backup;
+    // 从inode的对象缓存中分配内存来存储inode, 对象缓存的内存总是位于内核空间
+    inode_found = (inode_t *) kmem_cache_alloc(&inode_cache);
+    if (inode_found == NULL)
+        PANIC("inode_open: kmem_cache_alloc for inode failed!");
 
     char *inode_buf;
     if (inode_pos.multi_sec){
@@ -159,11 +167,7 @@ void inode_close(inode_t *inode){
     intr_status_t old_status = intr_disable();
     if (--(inode->i_open_cnt) == 0){
         list_remove(&inode->inode_tag);
-        task_struct_t *cur = running_thread();
-        uint32_t *cur_pagedir_backup = cur->pgdir;
-        cur->pgdir = NULL;
-        sys_free(inode);
-        cur->pgdir = cur_pagedir_backup;
+        kmem_cache_free(&inode_cache, inode);
     }
     intr_set_status(old_status);
 }
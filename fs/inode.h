@@ -3,9 +3,19 @@
 
 #include "ide.h"
 #include "list.h"
+#include "slab.h"
 #include "types.h"
 #include "stdint.h"
 
+/// @brief 内存中inode的对象缓存
+extern kmem_cache_t inode_cache;
+
+
+/**
+ * @brief inode_cache_init用于初始化inode的对象缓存
+ */
+void inode_cache_init(void);
+
 
 
 /**
@@ -24,8 +34,8 @@ void inode_sync(partition_t *partition, inode_t *inode, void *io_buf);
  * 
  * @param partition 需要打开的inode所在的分区
  * @param inode_no 需要打开的inode在所在分区的inode_table的index
- * @return inode_t* 指向打开的inode. 注意, inode_open会在内核的堆中分配一个sizeof(inode_t), 而后将磁盘中要读取的inode
- *          的信息写入到在内核堆中分配的数据
+ * @return inode_t* 指向打开的inode. 注意, inode_open会从inode的对象缓存中分配一个inode_t, 而后将磁盘中要读取的inode
+ *          的信息写入到分配得到的inode_t中
  */
 inode_t *inode_open(partition_t *partition, uint32_t inode_no);
 
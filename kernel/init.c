@@ -10,6 +10,7 @@
 #include "syscall-init.h"
 #include "ide.h"
 #include "fs.h"
+#include "swap.h"
 #include "interrupt.h"
 
 void init_all(void){
@@ -24,5 +25,6 @@ void init_all(void){
     syscall_init();
     intr_enable();              // 开启中断
     ide_init();                 // 初始化硬盘
+    swap_init();                // 初始化交换分区
     filesys_init();             // 初始化文件系统
 }
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "ksm.h"
+#include "global.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "string.h"
+#include "debug.h"
+
+/// @brief 每次调用ksm_scan最多检查的物理页数
+#define KSM_BATCH 16
+/// @brief 一轮扫描结束以后, 至少间隔的tick数才开始下一轮
+#define KSM_PASS_TICKS 100
+/// @brief 哈希表的项数, 必须是2的幂
+#define KSM_TABLE_SIZE 1024
+/// @brief 哈希表中最多使用的项数, 超过以后本轮不再记录新的页
+#define KSM_TABLE_MAX (KSM_TABLE_SIZE / 4 * 3)
+
+/**
+ * @brief ksm_entry_t是哈希表中的一项. 若page设置了PAGE_KSM, 则它是已经合并的页; 否则它是本轮扫描中见过的独占用户页,
+ *        使用之前需要重新确认它还是独占的用户页. 哈希表使用线性探测, 每轮扫描结束的时候只保留已经合并的页并重建
+ */
+typedef struct __ksm_entry_t {
+    page_t *page;                               // 物理页, 为NULL表示空项
+    uint32_t hash;                              // 加入哈希表的时候页的内容的哈希值
+} ksm_entry_t;
+
+extern uint32_t ticks;
+
+static ksm_entry_t ksm_table[KSM_TABLE_SIZE];
+/// @brief 重建哈希表时使用的临时空间
+static ksm_entry_t ksm_keep[KSM_TABLE_SIZE];
+/// @brief 哈希表中已经使用的项数
+static uint32_t table_used;
+/// @brief 下一个要检查的物理页的页帧号
+static uint32_t scan_pfn;
+/// @brief 上一轮扫描结束时的tick数
+static uint32_t pass_end_tick;
+
+static ksm_stats_t ksm_stats;
+
+
+/**
+ * @brief ksm_hash用于计算page的内容的哈希值(FNV-1a, 按32位字计算), 同时检查page是否全为0
+ *
+ * @param page 需要计算的页, 必须是内核可以访问的地址
+ * @param zero 若page全为0, 则设置为true
+ * @return uint32_t 哈希值
+ */
+static uint32_t ksm_hash(void *page, bool *zero){
+    uint32_t *words = page;
+    uint32_t hash = 2166136261U, bits = 0;
+    for (uint32_t idx = 0; idx < PG_SIZE / sizeof(uint32_t); idx++){
+        hash = (hash ^ words[idx]) * 16777619U;
+        bits |= words[idx];
+    }
+    *zero = bits == 0;
+    return hash;
+}
+
+
+/**
+ * @brief ksm_stable用于判断page是否是已经合并的页. 合并的页释放以后PAGE_KSM就被清除了
+ */
+static inline bool ksm_stable(page_t *page){
+    return (page->flags & PAGE_KSM) && page->refcount > 0;
+}
+
+
+/**
+ * @brief ksm_same用于比较物理页kpage的内容是否和content相同
+ */
+static bool ksm_same(page_t *kpage, void *content){
+    void *kcontent = kmap_page(page2phy(kpage));
+    bool same = memcmp(kcontent, content, PG_SIZE) == 0;
+    kunmap_page(kcontent);
+    return same;
+}
+
+
+/**
+ * @brief ksm_insert用于将page加入哈希表, 必须关中断调用
+ */
+static void ksm_insert(page_t *page, uint32_t hash){
+    uint32_t idx = hash & (KSM_TABLE_SIZE - 1);
+    while (ksm_table[idx].page != NULL)
+        idx = (idx + 1) & (KSM_TABLE_SIZE - 1);
+    ksm_table[idx].page = page;
+    ksm_table[idx].hash = hash;
+    table_used++;
+}
+
+
+/**
+ * @brief ksm_scan_page用于检查一个物理页, 若是独占的用户页, 则尝试合并
+ *
+ * @param page 需要检查的物理页
+ */
+static void ksm_scan_page(page_t *page){
+    // 先不关中断粗略地筛选, 大部分页在这里就排除了
+    if (!(page->flags & PAGE_LRU) || (page->flags & PAGE_KSM) || page->refcount != 1)
+        return;
+
+    // 从计算哈希值到修改页表项都要关中断, 这样比较的内容就是合并时的内容
+    intr_status_t old_status = intr_disable();
+    if (page_owner_pte(page) == NULL){
+        intr_set_status(old_status);
+        return;
+    }
+
+    void *content = kmap_page(page2phy(page));
+    bool zero;
+    uint32_t hash = ksm_hash(content, &zero);
+    if (zero){
+        kunmap_page(content);
+        if (page_merge(page, NULL))
+            ksm_stats.zero_cnt++;
+        intr_set_status(old_status);
+        return;
+    }
+
+    for (uint32_t idx = hash & (KSM_TABLE_SIZE - 1); ksm_table[idx].page != NULL; idx = (idx + 1) & (KSM_TABLE_SIZE - 1)){
+        page_t *kpage = ksm_table[idx].page;
+        if (ksm_table[idx].hash != hash || kpage == page || !ksm_same(kpage, content))
+            continue;
+        // 找到的是本轮见过的页, 先把它改为只读作为合并的目标. 它可能已经被写过或者释放了, 此时继续查找
+        if (!ksm_stable(kpage) && !page_merge(kpage, kpage))
+            continue;
+        kunmap_page(content);
+        if (page_merge(page, kpage))
+            ksm_stats.merged_cnt++;
+        intr_set_status(old_status);
+        return;
+    }
+
+    kunmap_page(content);
+    if (table_used < KSM_TABLE_MAX)
+        ksm_insert(page, hash);
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief ksm_rebuild用于在一轮扫描结束的时候重建哈希表, 只保留已经合并的页
+ */
+static void ksm_rebuild(void){
+    intr_status_t old_status = intr_disable();
+    uint32_t keep_cnt = 0;
+    for (uint32_t idx = 0; idx < KSM_TABLE_SIZE; idx++){
+        if (ksm_table[idx].page != NULL && ksm_stable(ksm_table[idx].page))
+            ksm_keep[keep_cnt++] = ksm_table[idx];
+    }
+    memset(ksm_table, 0, sizeof(ksm_table));
+    table_used = 0;
+    for (uint32_t idx = 0; idx < keep_cnt; idx++)
+        ksm_insert(ksm_keep[idx].page, ksm_keep[idx].hash);
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief ksm_scan用于扫描一批物理页并合并其中内容相同的用户页, 由idle线程在没有线程就绪的时候调用.
+ *        一轮扫描结束以后, 要过一段时间才开始下一轮
+ *
+ * @return true 扫描了一批页
+ * @return false 当前不需要扫描
+ */
+bool ksm_scan(void){
+    if (scan_pfn == 0 && ksm_stats.full_scans > 0 && ticks - pass_end_tick < KSM_PASS_TICKS)
+        return false;
+
+    for (uint32_t cnt = 0; cnt < KSM_BATCH && scan_pfn < mem_map_cnt; cnt++)
+        ksm_scan_page(&mem_map[scan_pfn++]);
+
+    if (scan_pfn == mem_map_cnt){
+        ksm_rebuild();
+        scan_pfn = 0;
+        pass_end_tick = ticks;
+        ksm_stats.full_scans++;
+    }
+    return true;
+}
+
+
+/**
+ * @brief ksm_get_stats用于获得页合并的统计信息
+ *
+ * @param stats 存放统计信息的位置
+ */
+void ksm_get_stats(ksm_stats_t *stats){
+    intr_status_t old_status = intr_disable();
+    *stats = ksm_stats;
+    stats->shared_pages = stats->sharing_pages = 0;
+    for (uint32_t idx = 0; idx < KSM_TABLE_SIZE; idx++){
+        page_t *page = ksm_table[idx].page;
+        if (page != NULL && ksm_stable(page)){
+            stats->shared_pages++;
+            stats->sharing_pages += page->refcount - 1;
+        }
+    }
+    intr_set_status(old_status);
+}
@@ -0,0 +1,45 @@
+#ifndef __KERNEL_KSM_H
+#define __KERNEL_KSM_H
+
+#include "stdint.h"
+#include "global.h"
+
+/**
+ * 页合并(kernel same-page merging)在系统空闲的时候由idle线程逐页扫描物理页, 找出内容相同的独占用户页并合并:
+ *      1. 全0的页合并到零页
+ *      2. 对每个页计算哈希值, 先在已经合并的页中查找内容相同的页, 找到则合并过去
+ *      3. 否则在本轮扫描中已经见过的页中查找, 找到内容相同的页则将它改为只读, 作为合并的目标, 然后把当前页合并过去
+ *      4. 都没有找到则记录下来, 等待本轮后面的页
+ * 合并后的页是只读的写时复制页, 写的时候复制一份, 和fork以后一样
+ */
+
+/**
+ * @brief ksm_stats_t是页合并的统计信息
+ */
+typedef struct __ksm_stats_t {
+    uint32_t shared_pages;                      // 当前作为合并目标的物理页数
+    uint32_t sharing_pages;                     // 当前合并到这些页上的页数, 即节省的物理页数
+    uint32_t merged_cnt;                        // 累计合并的页数, 不包括合并到零页的
+    uint32_t zero_cnt;                          // 累计合并到零页的页数
+    uint32_t full_scans;                        // 累计完成的扫描轮数
+} ksm_stats_t;
+
+
+/**
+ * @brief ksm_scan用于扫描一批物理页并合并其中内容相同的用户页, 由idle线程在没有线程就绪的时候调用.
+ *        一轮扫描结束以后, 要过一段时间才开始下一轮
+ *
+ * @return true 扫描了一批页
+ * @return false 当前不需要扫描
+ */
+bool ksm_scan(void);
+
+
+/**
+ * @brief ksm_get_stats用于获得页合并的统计信息
+ *
+ * @param stats 存放统计信息的位置
+ */
+void ksm_get_stats(ksm_stats_t *stats);
+
+#endif
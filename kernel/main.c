@@ -9,9 +9,11 @@
 #include "fork.h"
 #include "stdio.h"
 #include "shell.h"
+#include "exec.h"
 
 void init(void);
 bool write_user_prog(uint32_t file_size, uint32_t start_lba, char *pathname);
+static uint32_t user_prog_size(uint32_t start_lba);
 static void write_all_user_prog(void);
 
 extern void sys_clear(void);
@@ -105,10 +107,52 @@ bool write_user_prog(uint32_t file_size, uint32_t start_lba, char *pathname){
 }
 
 
+/**
+ * @brief user_prog_size reads the ELF header of the user program located on start_lba-th block on sda (JackOS.img)
+ *        and returns the size of the file. ld places the section header table at the end of the file, so the size
+ *        is the end of the section header table, the program header table or the last segment, whichever is larger
+ * 
+ * @param start_lba start lba of file on sda (JackOS.img)
+ * @return uint32_t size of the file, 0 if there is no ELF file on start_lba
+ */
+static uint32_t user_prog_size(uint32_t start_lba){
+    // program headers follow the ELF header closely, 4 sectors are far more than enough
+    uint32_t buf_secs = 4, buf_size = buf_secs * 512;
+    char *io_buf = (char *)sys_malloc(buf_size);
+    if (io_buf == NULL){
+        kprintf("sys_malloc for io_buf failed!\n");
+        return 0;
+    }
+
+    disk_t *sba = &channels[0].devices[0];
+    ide_read(sba, start_lba, (void*)io_buf, buf_secs);
+
+    Elf32_Ehdr *elf_header = (Elf32_Ehdr *)io_buf;
+    if (memcmp(elf_header->e_ident, "\177ELF", 4) || elf_header->e_phentsize != sizeof(Elf32_Phdr)
+        || elf_header->e_phoff + elf_header->e_phnum * sizeof(Elf32_Phdr) > buf_size){
+        sys_free((void*)io_buf);
+        return 0;
+    }
+
+    uint32_t file_size = elf_header->e_shoff + elf_header->e_shnum * elf_header->e_shentsize;
+    if (file_size < elf_header->e_phoff + elf_header->e_phnum * sizeof(Elf32_Phdr))
+        file_size = elf_header->e_phoff + elf_header->e_phnum * sizeof(Elf32_Phdr);
+    Elf32_Phdr *prog_header = (Elf32_Phdr *)(io_buf + elf_header->e_phoff);
+    for (uint32_t i = 0; i < elf_header->e_phnum; i++){
+        if (file_size < prog_header[i].p_offset + prog_header[i].p_filesz)
+            file_size = prog_header[i].p_offset + prog_header[i].p_filesz;
+    }
+
+    sys_free((void*)io_buf);
+    return file_size;
+}
+
+
 /**
  * @brief write all user prog from JackOS.imf to JackOS-fs.img
  * 
- * @details you can get file_size of user program via `ls -l build/xxxx` after you run `make`
+ * @details file_size of each user program is read from its ELF header on sda (JackOS.img), so it follows
+ *          the program and crt.a whenever they are rebuilt
  *          start_lba must correspond to `seek` in makefile, target `write_u_prog`
  *          you can decide pathname whatever you like, just make sure parent dir exists on sdb (JackOS-fs.img)
  */
@@ -126,22 +170,14 @@ static void write_all_user_prog(void){
     }
 
 
-    uint32_t file_sizes[] = {
-        14956,          // command/prog_no_arg.c
-        15292,          // command/prog_with_arg.c
-        15724,          // command/cat.c
-        15940,          // command/prog_pipe.c
-        16148,          // command/touch.c
-        16516           // command/echo.c
-    };
-
     uint32_t start_lbas[] = {
         30000,          // command/prog_no_arg.c
         35000,          // command/prog_with_arg.c
         40000,          // command/cat.c
         45000,          // command/prog_pipe.c
         50000,          // command/touch.c
-        55000           // command/echo.c
+        55000,          // command/echo.c
+        60000           // command/prog_malloc.c
     };
 
     char *pathnames[] = {
@@ -150,22 +186,27 @@ static void write_all_user_prog(void){
         "/cat",
         "/prog_pipe",
         "/touch",
-        "/echo"
+        "/echo",
+        "/prog_malloc"
     };
 
-    uint32_t fs = sizeof(file_sizes) / sizeof(uint32_t),
-             ss = sizeof(start_lbas) / sizeof(uint32_t),
+    uint32_t ss = sizeof(start_lbas) / sizeof(uint32_t),
              ps = sizeof(pathnames) / sizeof(char*);
     
-    if (fs != ss && ss != ps)
-        PANIC("file_sizes, start_lbas and pathnames mismatch!\n");
-
-    for (uint32_t i = 0; i < fs; i++){
-        if (write_user_prog(file_sizes[i], start_lbas[i], pathnames[i]) == -1){
-            kprintf("Write user program: %s failed! Given file size: %d, start_lba: %d\n", pathnames[i], file_sizes[i], start_lbas[i]);
+    if (ss != ps)
+        PANIC("start_lbas and pathnames mismatch!\n");
+
+    for (uint32_t i = 0; i < ss; i++){
+        uint32_t file_size = user_prog_size(start_lbas[i]);
+        if (file_size == 0){
+            kprintf("User program %s not found on lba %d!\n", pathnames[i], start_lbas[i]);
+            continue;
+        }
+        if (write_user_prog(file_size, start_lbas[i], pathnames[i]) == -1){
+            kprintf("Write user program: %s failed! File size: %d, start_lba: %d\n", pathnames[i], file_size, start_lbas[i]);
             kprintf("User program %s may already exists!\n");
         }
         else
-            kprintf("Write user program: %s Success! Given file size: %d, start_lba: %d\n", pathnames[i], file_sizes[i], start_lbas[i]);
+            kprintf("Write user program: %s Success! File size: %d, start_lba: %d\n", pathnames[i], file_size, start_lbas[i]);
     }
 }
\ No newline at end of file
@@ -5,6 +5,14 @@
 #include "string.h"
 #include "sync.h"
 #include "interrupt.h"
+#include "slab.h"
+#include "mmap.h"
+#include "swap.h"
+#include "ksm.h"
+#include "kstdio.h"
+#include "stdio.h"
+#include "timer.h"
+#include "wait_exit.h"
 // memory是系统的内存管理模块，因此需要先规划系统的物理内存
 
 // 内核运行时需要1G的物理内存，剩下3G物理内存是用户程序，由于有内存分页，因此物理内存中不必连续，虚拟内存中连续即可
@@ -68,30 +76,228 @@
 /* ================================================================================================================== */
 
 
+/// @brief 伙伴系统的最大阶数, 0~10阶, 即最大的块为2^10个页 = 4MB
+#define BUDDY_MAX_ORDER 11
+/// @brief order-0快速路径中最多缓存的单页数
+#define PCP_HIGH 32
+/// @brief order-0快速路径一次归还给伙伴系统的单页数
+#define PCP_BATCH 16
+/// @brief order-0快速路径为空时, 一次从伙伴系统中批量取出的块的阶数, 即一次取8个页
+#define PCP_REFILL_ORDER 3
+/// @brief 每个内存池中最多缓存的预先清0的单页数
+#define ZERO_HIGH 64
+/// @brief CR4的PSE位, 为1时页目录项可以直接映射4MB的大页
+#define CR4_PSE 0x00000010
+/// @brief CR4的PGE位, 为1时设置了G位的页表项在重新装入cr3的时候不会被刷新
+#define CR4_PGE 0x00000080
+/// @brief 内存池为自己的使用者保留的空闲页的比例, 空闲页少于page_cnt / POOL_WATERMARK_RATIO时不再借给另一个内存池
+#define POOL_WATERMARK_RATIO 16
+/// @brief loader.S中ards_buf的地址, 其中是E820返回的ards结构体数组
+#define ARDS_BUF_ADDR 0xb0a
+/// @brief loader.S中ards_nr的地址, 为0表示E820失败, 此时只有0xb00处的内存容量可用
+#define ARDS_NR_ADDR 0xbfe
+/// @brief ards_buf中最多存放的ards个数
+#define ARDS_MAX 12
+/// @brief ards中表示可用内存的类型, 其他的类型都不能使用
+#define ARDS_TYPE_USABLE 1
+/// @brief 低端内存的上限, 低端内存都在直接映射区中, 其上到4GB的物理内存是高端内存. 4GB以上的物理内存需要PAE的64位页表项
+///        才能映射, 目前不支持, 启动的时候只报告被忽略的大小
+#define LOW_MEM_MAX (KMAP_BASE - DIRECT_MAP_BASE)
+/// @brief 临时映射区的页数
+#define KMAP_SLOTS ((0xFFC00000 - KMAP_BASE) / PG_SIZE)
+/// @brief 内核虚拟地址位图和摘要位图只能使用MEM_BITMAP_BASE开始的16KB, 最多管理的内核虚拟页数
+#define KERNEL_VADDR_PAGES_MAX ((0x4000 - 8) * 8 * 32 / 33)
+
+
+/**
+ * @brief ards_t是BIOS的E820功能返回的地址范围描述符(Address Range Descriptor Structure)
+ */
+typedef struct __ards_t {
+    uint32_t base_low;                          // 起始地址的低32位
+    uint32_t base_high;                         // 起始地址的高32位
+    uint32_t length_low;                        // 长度的低32位
+    uint32_t length_high;                       // 长度的高32位
+    uint32_t type;                              // 地址范围的类型, 1为可用内存
+} ards_t;
+
+
+/**
+ * @brief mem_range_t是一段按页对齐的物理地址范围[start, end), 由ards转换而来, 超出4GB的部分已经截掉
+ */
+typedef struct __mem_range_t {
+    uint32_t start;                             // 起始地址, 按页对齐
+    uint32_t end;                               // 结束地址(不包括), 按页对齐
+    bool usable;                                // 是否是可用内存
+} mem_range_t;
+
+
+/**
+ * @brief pool_t是物理内存池, 内部使用二进制伙伴系统(Binary Buddy System)管理物理页
+ * 
+ * @details 伙伴系统将内存池中的物理页按照2^order个页组成一个块, 同一阶的所有空闲块链接在free_area[order]中.
+ *          分配order阶的块时, 若free_area[order]为空, 则从更高阶中拆分; 释放时若伙伴块也空闲, 则合并为更高阶的块.
+ *          因此分配和释放都是O(log n)的. 此外, 单页的申请和释放非常频繁, 因此内存池中额外缓存了若干单页(pcp, per-cpu pages),
+ *          单页的申请和释放一般只需要操作pcp这个栈即可. 需要清0的单页则优先从idle线程在空闲时预先清0的页中分配.
+ *          内核内存池和用户内存池之间可以互相借用单页: 一个内存池耗尽以后, 可以从另一个内存池中借用空闲页,
+ *          只要出借的内存池的空闲页不低于它的水位线. 借出的页释放时归还给原来的内存池. 高端内存池只用于用户页, 不参与借用
+ */
 typedef struct __pool_t {
-    bitmap_t pool_bitmap;                       // 本内存池的位图，用于管理物理内存
     uint32_t phy_addr_start;                    // 本内存池所管理的物理内存的起始地址
     uint32_t pool_size;                         // 本内存池的字节容量
+    uint32_t page_cnt;                          // 本内存池覆盖的物理页数, 包括其中的空洞
+    uint32_t total_pages;                       // 本内存池中可用的物理页数, 不包括空洞
+    uint32_t free_pages;                        // 伙伴系统中的空闲页数, 不包括pcp和预先清0的页
+    uint32_t watermark;                         // 空闲页低于水位线时不再借给另一个内存池
+    uint32_t lent_pages;                        // 借给另一个内存池的使用者的页数
+    uint32_t borrowed_pages;                    // 本内存池的使用者从另一个内存池借用的页数
+    page_t *pages;                              // 本内存池第一个物理页的描述符, 内存池中的页在mem_map中是连续的
+    list_t free_area[BUDDY_MAX_ORDER];          // 各阶空闲块链表
+    uint32_t free_cnt[BUDDY_MAX_ORDER];         // 各阶空闲块的数量
+    uint32_t pcp_pages[PCP_HIGH];               // order-0快速路径缓存的单页的页号
+    uint32_t pcp_cnt;                           // order-0快速路径缓存的单页数
+    uint32_t zero_pages[ZERO_HIGH];             // 预先清0的单页的页号
+    uint32_t zero_cnt;                          // 预先清0的单页数
     mutex_t mutex;                              // 内存池是共享变量，申请内存时候要保证互斥
 } pool_t;
 
 
 
 pool_t kernel_pool, user_pool;           /// 内核内存池和用户内存池
+pool_t high_pool;                        /// 高端内存池
+page_t *mem_map;                         /// 以页帧号为下标的物理页描述符数组
+uint32_t mem_map_cnt;                    /// 物理内存的页数
 virtual_addr_t kernel_vaddr;             /// 用于管理内核虚拟地址
 
 /// 内核不同大小内存单元的售货窗口
 mem_block_desc_t k_block_descs[MEM_UNIT_CNT];
+/// 内核堆中大内存块的统计
+static mem_large_stat_t k_large_stat;
+
+/// 用户进程的页表占用的物理页数
+static uint32_t pgtable_pages;
+
+/// 线程弹匣的对象缓存
+static kmem_cache_t mem_magazine_cache;
+
+/// 系统的内存布局
+static mem_range_t mem_ranges[ARDS_MAX];
+static uint32_t mem_range_cnt;
+
+/// 全0的物理页, 用户进程读取还没有写过的按需分配的页的时候, 只读映射到该页
+static uint32_t zero_page_phyaddr;
+
+/// 直接映射区的结束地址, [DIRECT_MAP_BASE, direct_map_end)线性映射了物理内存
+static uint32_t direct_map_end;
+
+/// 临时映射区中每一页是否已经使用, 以及下一次开始查找的位置
+static uint32_t kmap_used[KMAP_SLOTS / 32];
+static uint32_t kmap_next;
+
+/// 可以换出的用户页组成的LRU链表, 链表头就是时钟算法的指针所指的页
+static list_t lru_list;
+
+/// 用户内存池耗尽的时候每次最多换出的页数
+#define RECLAIM_BATCH 8
+/// 用户内存池耗尽的时候最多换出并重试分配的次数
+#define RECLAIM_RETRIES 4
+
+
+static bool page_table_add(void* _vaddr, void* _page_phyaddr);
+static void page_fault_init(void);
+static void direct_map_init(uint32_t all_mem);
+static void kmap_init(void);
+static void global_page_init(void);
+static void buddy_init(pool_t *m_pool, uint32_t page_cnt);
+static void mem_trace_alloc(void *ptr, uint32_t size, uint32_t site);
+static void mem_trace_free(void *ptr, uint32_t site);
+
+
+/**
+ * @brief mem_detect用于读取loader.S获得的E820内存布局, 转换为按页对齐的物理地址范围. E820失败的时候, 将0到loader.S
+ *        获得的内存容量视为一整段可用内存
+ *
+ * @return uint32_t 最高的可用内存的结束地址, 不超过4GB. 4GB以上的可用内存被忽略, 其大小会打印出来
+ */
+static uint32_t mem_detect(void){
+    uint16_t ards_nr = *(uint16_t *) ARDS_NR_ADDR;
+    ards_t *ards = (ards_t *) ARDS_BUF_ADDR;
+    uint64_t high_ignored = 0;
+    if (ards_nr == 0 || ards_nr > ARDS_MAX){
+        mem_ranges[0].start = 0;
+        mem_ranges[0].end = *(uint32_t *) 0xb00 & 0xFFFFF000;
+        mem_ranges[0].usable = true;
+        mem_range_cnt = 1;
+    } else {
+        mem_range_cnt = 0;
+        for (uint32_t idx = 0; idx < ards_nr; idx++){
+            uint64_t base = ((uint64_t) ards[idx].base_high << 32) | ards[idx].base_low;
+            uint64_t end = base + ards[idx].length_low + ((uint64_t) ards[idx].length_high << 32);
+            // 4GB以上的内存需要PAE才能访问, 目前不支持, 只统计其中可用的部分
+            if (ards[idx].type == ARDS_TYPE_USABLE && end > 0x100000000ULL)
+                high_ignored += end - (base > 0x100000000ULL ? base : 0x100000000ULL);
+            if (ards[idx].base_high != 0)
+                continue;
+            if (end > 0xFFFFF000)
+                end = 0xFFFFF000;
+            mem_range_t *range = &mem_ranges[mem_range_cnt];
+            range->usable = ards[idx].type == ARDS_TYPE_USABLE;
+            // 可用内存向内对齐, 不可用的范围向外对齐, 这样不完整的页都不会被使用
+            if (range->usable){
+                range->start = DIV_CEILING(ards[idx].base_low, PG_SIZE) * PG_SIZE;
+                range->end = (uint32_t) end & 0xFFFFF000;
+            } else {
+                range->start = ards[idx].base_low & 0xFFFFF000;
+                range->end = DIV_CEILING((uint32_t) end, PG_SIZE) * PG_SIZE;
+            }
+            if (range->start < range->end)
+                mem_range_cnt++;
+        }
+    }
+
+    uint32_t all_mem = 0;
+    put_str("    memory map:\n");
+    for (uint32_t idx = 0; idx < mem_range_cnt; idx++){
+        put_str("        "), put_int(mem_ranges[idx].start);
+        put_str(" ~ "), put_int(mem_ranges[idx].end);
+        put_str(mem_ranges[idx].usable ? " usable\n" : " reserved\n");
+        if (mem_ranges[idx].usable && mem_ranges[idx].end > all_mem)
+            all_mem = mem_ranges[idx].end;
+    }
+    if (high_ignored != 0)
+        put_str("    ignored memory above 4GB (PAE not supported), MB: 0x"), put_int((uint32_t) (high_ignored >> 20)), put_char('\n');
+    return all_mem;
+}
+
+
+/**
+ * @brief mem_pfn_usable用于判断页帧号为pfn的物理页是否是可用内存: 在某个可用的范围中, 并且不在任何不可用的范围中
+ */
+static bool mem_pfn_usable(uint32_t pfn){
+    uint32_t addr = pfn * PG_SIZE;
+    bool usable = false;
+    for (uint32_t idx = 0; idx < mem_range_cnt; idx++){
+        if (addr < mem_ranges[idx].start || addr >= mem_ranges[idx].end)
+            continue;
+        // 范围之间重叠的时候以不可用为准
+        if (!mem_ranges[idx].usable)
+            return false;
+        usable = true;
+    }
+    return usable;
+}
+
 
 /**
  * @brief mem_pool_init用于初始化内存池
  * 
  * @details 该函数干的事情:
- *              1. 初始化用户使用的物理内存Bitmap
- *              2. 初始化内核使用的物理内存Bitmap
- *              3. 初始化内核使用的虚拟内存Bitmap
+ *              1. 初始化内核使用的虚拟内存Bitmap
+ *              2. 为物理页描述符数组mem_map预留物理页, 并映射到内核堆的最开始处
+ *              3. 初始化内核物理内存池的伙伴系统
+ *              4. 初始化用户物理内存池的伙伴系统
+ *              5. 初始化高端内存池的伙伴系统
  * 
- * @param all_mem 当前系统的内存数，以字节为单位
+ * @param all_mem 最高的可用内存的结束地址，以字节为单位, 其下的空洞由mem_ranges描述
  */
 static void mem_pool_init(uint32_t all_mem){
     put_str("    mem_pool_init start\n");
@@ -107,517 +313,2043 @@ static void mem_pool_init(uint32_t all_mem){
     // 所以目前已经已经用了：1MB系统内核 + 256个物理页 * 4KB
     uint32_t page_table_size = PG_SIZE * 256;
     uint32_t used_mem = page_table_size + 0x100000;
-    uint32_t free_mem = all_mem - used_mem;
-    uint16_t all_free_page = free_mem / PG_SIZE;
 
-    // 剩下的物理页就将用为操作系统和用户进程的页，用于malloc时候分配，为了简单起见，系统和用户对半分，但系统肯定用不完
-    uint16_t kernel_free_pages = all_free_page / 2;
-    uint16_t user_free_pages = all_free_page - kernel_free_pages;
+    // 每个物理页都有一个描述符, 这些描述符紧挨着已经使用的内存存放. 空洞中的页也有描述符, 这样页帧号可以直接作为下标
+    mem_map_cnt = all_mem / PG_SIZE;
+    uint32_t node_pg_cnt = DIV_CEILING(mem_map_cnt * sizeof(page_t), PG_SIZE);
+    uint32_t kp_start = used_mem + node_pg_cnt * PG_SIZE;               // 内核内存池从物理页描述符后开始
+    // 已经使用的内存和物理页描述符必须在同一段可用内存中
+    for (uint32_t pfn = PFN(0x100000); pfn < PFN(kp_start); pfn++){
+        if (!mem_pfn_usable(pfn))
+            PANIC("mem_pool_init: not enough memory above 1MB");
+    }
+
+    // 剩下的低端内存中的可用物理页就将用为操作系统和用户进程的页，用于malloc时候分配，为了简单起见，系统和用户对半分.
+    // 一个内存池耗尽以后可以从另一个内存池中借用, 所以对半分只是初始的划分. 高端内存单独作为一个内存池, 只用于用户页
+    uint32_t low_pfn_end = PFN(all_mem < LOW_MEM_MAX ? all_mem : LOW_MEM_MAX);
+    uint32_t all_free_page = 0, high_free_pages = 0;
+    for (uint32_t pfn = PFN(kp_start); pfn < low_pfn_end; pfn++)
+        all_free_page += mem_pfn_usable(pfn);
+    for (uint32_t pfn = low_pfn_end; pfn < mem_map_cnt; pfn++)
+        high_free_pages += mem_pfn_usable(pfn);
+    uint32_t kernel_free_pages = all_free_page / 2;
+    uint32_t user_free_pages = all_free_page - kernel_free_pages;
+
+    // 两个内存池各自覆盖一段连续的物理地址, 其中的空洞不会被分配. 内核内存池到第kernel_free_pages个可用页为止
+    uint32_t up_pfn = PFN(kp_start);
+    for (uint32_t cnt = 0; cnt < kernel_free_pages; up_pfn++)
+        cnt += mem_pfn_usable(up_pfn);
+
+    // 内核虚拟内存初始化
+    // 内核可以从用户内存池中借用物理页, 所以内核虚拟地址位图按照全部的空闲物理内存大小初始化, 此外还要包括物理页描述符占用的虚拟页
+    // 内核堆不能越过直接映射区, 位图也不能超出留给它的空间
+    uint32_t kernel_vaddr_pages = all_free_page + node_pg_cnt;
+    if (kernel_vaddr_pages > (DIRECT_MAP_BASE - K_HEAP_START) / PG_SIZE)
+        kernel_vaddr_pages = (DIRECT_MAP_BASE - K_HEAP_START) / PG_SIZE;
+    if (kernel_vaddr_pages > KERNEL_VADDR_PAGES_MAX)
+        kernel_vaddr_pages = KERNEL_VADDR_PAGES_MAX;
+    kernel_vaddr.vaddr_bitmap.btmp_byte_len = DIV_CEILING(kernel_vaddr_pages, 8);
+    kernel_vaddr.vaddr_bitmap.bits = (void*) MEM_BITMAP_BASE;
+    kernel_vaddr.vaddr_start = K_HEAP_START;                            // 内核虚拟内存的起始地址为
+    // 内核虚拟地址位图的摘要位图紧挨着位图存放
+    kernel_vaddr.vaddr_bitmap.summary = (void*) (MEM_BITMAP_BASE + DIV_CEILING(kernel_vaddr.vaddr_bitmap.btmp_byte_len, 4) * 4);
+    bitmap_init(&kernel_vaddr.vaddr_bitmap);
+
+    // 将物理页描述符所在的物理页映射到内核堆的最开始处, 内核的页目录项在loader中已经全部创建了, 所以这里不会申请页表
+    uint32_t node_vaddr = K_HEAP_START, node_phyaddr = used_mem;
+    for (uint32_t pg_idx = 0; pg_idx < node_pg_cnt; pg_idx++){
+        bitmap_set(&kernel_vaddr.vaddr_bitmap, pg_idx, 1);
+        page_table_add((void*) node_vaddr, (void*) node_phyaddr);
+        node_vaddr += PG_SIZE, node_phyaddr += PG_SIZE;
+    }
+    mem_map = (page_t*) K_HEAP_START;
+    memset(mem_map, 0, node_pg_cnt * PG_SIZE);
+
+    // 内核内存池之前的页(低端1MB, 页目录表, 内核页表, 物理页描述符)永远不会被释放, 内存池中的空洞也永远不会被分配
+    for (uint32_t pfn = 0; pfn < mem_map_cnt; pfn++){
+        if (pfn < PFN(kp_start) || !mem_pfn_usable(pfn)){
+            mem_map[pfn].flags = PAGE_RESERVED;
+            mem_map[pfn].refcount = 1;
+        }
+    }
 
-    // 初始化内核物理内存池，内存池用bitmap来描述
-    uint32_t kbm_length = kernel_free_pages / 8;                        // 描述内核物理内存的bitmap (kernel bitmap)的长度
-    uint32_t kp_start = used_mem;                                       // 内核内存池从1MB + 1MB后开始
+    // 初始化内核物理内存池
     kernel_pool.phy_addr_start = kp_start;                              // 设置内核物理内存开始地址为已经使用的内存之后
     kernel_pool.pool_size = kernel_free_pages * PG_SIZE;
-    kernel_pool.pool_bitmap.btmp_byte_len = kbm_length;
-    kernel_pool.pool_bitmap.bits = (void *) MEM_BITMAP_BASE;            // 
-    bitmap_init(&kernel_pool.pool_bitmap);                              // 位图清0
+    buddy_init(&kernel_pool, up_pfn - PFN(kp_start));
 
     // 初始化用户物理内存池
-    uint32_t ubm_length = user_free_pages / 8;
-    uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE;
+    uint32_t up_start = up_pfn * PG_SIZE;
     user_pool.phy_addr_start = up_start;
     user_pool.pool_size = user_free_pages * PG_SIZE;
-    user_pool.pool_bitmap.btmp_byte_len = ubm_length;
-    user_pool.pool_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length);
-    bitmap_init(&user_pool.pool_bitmap);                                // 位图清0
+    buddy_init(&user_pool, low_pfn_end - up_pfn);
+
+    // 初始化高端内存池, 没有高端内存的时候内存池为空
+    high_pool.phy_addr_start = low_pfn_end * PG_SIZE;
+    high_pool.pool_size = high_free_pages * PG_SIZE;
+    buddy_init(&high_pool, mem_map_cnt - low_pfn_end);
 
     // print info 
-    put_str("    kernel_pool.bitmap_start: ");
-    put_int((int)kernel_pool.pool_bitmap.bits);
-    put_str(" kernel_pool.phy_addr_start: ");
+    put_str("    mem_map_start: ");
+    put_int((int)mem_map);
+    put_str(" mem_map_pages: ");
+    put_int((int)node_pg_cnt);
+    put_char('\n');
+
+    put_str("    kernel_pool.phy_addr_start: ");
     put_int((int)kernel_pool.phy_addr_start);
+    put_str(" kernel_pool.page_cnt: ");
+    put_int((int)kernel_pool.page_cnt);
     put_char('\n');
 
-    put_str("    user_pool.bitmap_start: ");
-    put_int((int)user_pool.pool_bitmap.bits);
-    put_str(" user_pool.phy_addr_start: ");
+    put_str("    user_pool.phy_addr_start: ");
     put_int((int)user_pool.phy_addr_start);
+    put_str(" user_pool.page_cnt: ");
+    put_int((int)user_pool.page_cnt);
+    put_char('\n');
+
+    put_str("    high_pool.phy_addr_start: ");
+    put_int((int)high_pool.phy_addr_start);
+    put_str(" high_pool.page_cnt: ");
+    put_int((int)high_pool.page_cnt);
     put_char('\n');
 
 
     mutex_init(&user_pool.mutex);
     mutex_init(&kernel_pool.mutex);
-    // 内核虚拟内存初始化
-    // 内核虚拟地址位图按照物理内存大小初始化
-    kernel_vaddr.vaddr_bitmap.btmp_byte_len = kbm_length;
-    // 内核虚拟地址位图也要一块内存储存，目前定位置在内核物理内存位图和用户物理内存位图后面
-    kernel_vaddr.vaddr_bitmap.bits = (void*) (MEM_BITMAP_BASE + kbm_length +ubm_length);
-    kernel_vaddr.vaddr_start = K_HEAP_START;                            // 内核虚拟内存的起始地址为
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);
+    mutex_init(&high_pool.mutex);
 
     put_str("    mem_pool_init done\n");
 }
 
 
+/**
+ * @brief direct_map_init用于开启CR4的PSE位, 并使用4MB的大页将物理内存线性映射到DIRECT_MAP_BASE开始的直接映射区
+ * 
+ * @details loader为内核空间的所有页目录项都创建了页表, 直接映射区使用的页目录项将被替换为大页, 原来的页表不再使用.
+ *          直接映射区必须在创建第一个用户进程之前建立, 因为用户进程的页目录表只在创建的时候复制内核的页目录项
+ * 
+ * @param all_mem 当前系统的内存数，以字节为单位
+ */
+static void direct_map_init(uint32_t all_mem){
+    uint32_t cr4;
+    asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE) : "memory");
+
+    // 直接映射区最多到临时映射区为止, 其上的物理内存是高端内存
+    uint32_t large_pg_cnt = DIV_CEILING(all_mem, LARGE_PG_SIZE);
+    if (large_pg_cnt > LOW_MEM_MAX / LARGE_PG_SIZE)
+        large_pg_cnt = LOW_MEM_MAX / LARGE_PG_SIZE;
+
+    uint32_t vaddr = DIRECT_MAP_BASE;
+    for (uint32_t pg_idx = 0; pg_idx < large_pg_cnt; pg_idx++){
+        *pde_addr(vaddr) = (pg_idx * LARGE_PG_SIZE) | PG_G | PG_PS | PG_US_S | PG_RW_W | PG_P_1;
+        vaddr += LARGE_PG_SIZE;
+    }
+    direct_map_end = vaddr;
+
+    // 页目录项从页表变成了大页, 重新加载cr3刷新TLB
+    asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+
+    put_str("    direct_map_end: ");
+    put_int(direct_map_end);
+    put_char('\n');
+}
+
+
+/**
+ * @brief kmap_init用于清空临时映射区的页表. 临时映射区使用loader为最后一个内核页目录项创建的页表,
+ *        所有进程共享这个页表, 所以临时映射在所有进程中都有效
+ */
+static void kmap_init(void){
+    memset(pte_addr(KMAP_BASE), 0, PG_SIZE);
+    memset(kmap_used, 0, sizeof(kmap_used));
+    kmap_next = 0;
+}
+
+
+/**
+ * @brief global_page_init用于将loader映射的内核(0xC0000000开始的1MB)设置为全局页, 并开启CR4的PGE位.
+ *        内核堆中的页在page_table_map中映射的时候就已经设置了G位
+ * 
+ * @note 页目录表自映射区域的页表项因进程而异, 不能是全局页, 所以指向页表的内核页目录项都不设置G位.
+ *       这1MB的页表也被内核页目录表的第0项用于恒等映射, 但只有内核页目录表有第0项, 用户进程的页目录表中没有
+ */
+static void global_page_init(void){
+    for (uint32_t vaddr = 0xC0000000; vaddr < K_HEAP_START; vaddr += PG_SIZE){
+        uint32_t *pte = pte_addr(vaddr);
+        if (*pte & PG_P_1)
+            *pte |= PG_G;
+    }
+
+    // 修改CR4的PGE位会刷新TLB中所有的项, 包括全局页
+    uint32_t cr4;
+    asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE) : "memory");
+}
+
+
 /**
  * @brief mem_init用于初始化系统的内存
  * 
  * @details mem_init干的事:
  *              1. 初始化系统级内存管理系统:
- *                  1.1 初始化内核使用的物理内存Bitmap
- *                  1.2 初始化用户使用的物理内存Bitmap
+ *                  1.1 初始化内核物理内存池的伙伴系统
+ *                  1.2 初始化用户物理内存池的伙伴系统
  *                  1.3 初始化内核使用的虚拟内存Bitmap
+ *                  1.4 使用4MB大页建立物理内存的直接映射区, 并初始化高端内存的临时映射区
+ *                  1.5 将内核空间的映射设置为全局页
  *              2. 初始化线程级内存管理系统
+ *              3. 初始化对象缓存以及线程的弹匣
+ *              4. 初始化缺页中断处理
  */
 void mem_init(){
     put_str("mem_init start\n");
-    uint32_t mem_byte_total = (*(uint32_t*) (0xb00));           // loader.S中获取了系统当前的内存，保存在0xb00中，现在获取该值
+    uint32_t mem_byte_total = mem_detect();                    // loader.S中获取了系统的内存布局，保存在0xb00开始的地方，现在读取
     mem_pool_init(mem_byte_total);
+    kmap_init();
+    direct_map_init(mem_byte_total);
+    global_page_init();
     block_desc_init(k_block_descs);
+    // 对象缓存依赖于内存池, 线程的弹匣从对象缓存中分配
+    kmem_init();
+    kmem_cache_init(&mem_magazine_cache, "mem_magazine", sizeof(mem_magazine_t), sizeof(uint32_t), NULL);
+    vma_init();
+    page_fault_init();
     put_str("mem_init done\n");
 }
 
 
 /* ================================================================================================================== */
-/* ================================================= 通用内存分配函数 ================================================== */
+/* ================================================== 伙伴系统物理页分配 ================================================ */
 /* ================================================================================================================== */
 
 
-// 申请一个页的流程：
-//      1. 首先需要在虚拟内存池中申请得到一个虚拟页
-//      2. 然后需要在物理内存池中申请得到一个物理页
-//      3. 最后在页表中完成虚拟页和物理页的映射, 即完成虚拟地址转物理地址
-// 举个例子：
-//      1. 首先申请虚拟内存中的一个页，假设目前可用的就是0x1000_1000~0x1000_1FFF这个页
-//      2. 然后在物理内存池中申请一个页，假设可用的物理地址就是0xD0AF_C000~0xD0AF_CFFF这个页
-//      3. 0x1000_1000虚拟地址拆出来就是：0b0001_0000_00:0b00_0000_0001:0x000
-//          3.1 首先在页目录表中查询040偏移对应的页表的物理地址，假设页表物理地址是0x12345000
-//          3.2 然后在页表物理地址中将001对应的页的物理地址s设置为0xD0AF_C000
-//      但是存在问题：
-//          1. 页目录项可能不存在，此时需要新建一个页表
-
 /**
- * @brief vaddr_get用于在指定的虚拟内存池中申请pg_cnt个虚拟页
+ * @brief buddy_push用于将页号为pg_idx的order阶空闲块插入到m_pool的空闲块链表中
  * 
- * @param pf 申请内存的内存池
- * @param pg_cnt 申请的虚拟页个数
- * @return void* 若申请成功则返回虚拟页的起始地址，失败则返回NULL
+ * @param m_pool 空闲块所属的内存池
+ * @param pg_idx 空闲块首页在内存池中的页号
+ * @param order 空闲块的阶数
  */
-static void* vaddr_get(pool_flags_t pf, uint32_t pg_cnt){
-    int vaddr_start = 0, bit_idx_start = -1;
-    uint32_t cnt = 0;
-    if (pf == PF_KERNEL){
-        // 从内核虚拟内存池中分配页
-        // 扫描虚拟内存池中的bitmap, 查看是否存在pg_cnt个连续的页
-        if ((bit_idx_start = bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt)) == -1)
-            return NULL;
-        // 设置位图中的位
-        while (cnt < pg_cnt)
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-    } else {
-        // 从用户虚拟内存池中分配页
-        task_struct_t *cur = running_thread();
-        if ((bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt)) == -1)
-            return NULL;
-        // 设置位图中的位
-        while (cnt < pg_cnt)
-            bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-
-        // 0xC000_0000 ~ 0xC000_0FFF将用于存储用户的三级栈，因此分配得到的空间覆盖这里
-        ASSERT((uint32_t) vaddr_start < (0xC0000000 - PG_SIZE));
-    }
-    return (void *) vaddr_start;
+static void buddy_push(pool_t *m_pool, uint32_t pg_idx, uint32_t order){
+    page_t *page = &m_pool->pages[pg_idx];
+    page->order = order;
+    page->flags |= PAGE_BUDDY;
+    list_push(&m_pool->free_area[order], &page->lru);
+    m_pool->free_cnt[order]++;
+    m_pool->free_pages += 1 << order;
 }
 
 
 /**
- * @brief palloc用于在m_pool指向的内存池中分配1个物理页
+ * @brief buddy_unlink用于将页号为pg_idx的order阶空闲块从m_pool的空闲块链表中摘下
  * 
- * @param m_pool 要分配物理页的内存池的地址
- * @return void* 若成功，则返回物理页第一个字节的物理地址，若失败则返回NULL
+ * @param m_pool 空闲块所属的内存池
+ * @param pg_idx 空闲块首页在内存池中的页号
+ * @param order 空闲块的阶数
  */
-static void* palloc(pool_t* m_pool){
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);
-    if (bit_idx == -1)
-        return NULL;
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);
-    uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
-    return (void*) page_phyaddr;
+static void buddy_unlink(pool_t *m_pool, uint32_t pg_idx, uint32_t order){
+    page_t *page = &m_pool->pages[pg_idx];
+    list_remove(&page->lru);
+    page->flags &= ~PAGE_BUDDY;
+    m_pool->free_cnt[order]--;
+    m_pool->free_pages -= 1 << order;
 }
 
 
 /**
- * @brief page_table_add用于在页表中添加虚拟地址所属的虚拟页与物理地址所属的物理页的映射。
- *        注意，给出虚拟地址和物理地址即可，会自动计算需要映射的虚拟页和物理页会被
- * 
- * @param _vaddr 被映射的虚拟地址
- * @param _page_phyaddr 要映射到的物理地址
+ * @brief buddy_free_range用于将内存池中[pg_start, pg_end)这段页以尽可能大的对齐块的形式释放到伙伴系统中
  * 
+ * @param m_pool 内存池
+ * @param pg_start 起始页号
+ * @param pg_end 结束页号(不包含)
  */
-static void page_table_add(void* _vaddr, void* _page_phyaddr){
-    uint32_t vaddr = (uint32_t) _vaddr;
-    uint32_t page_phyaddr = (uint32_t) _page_phyaddr;
+static void buddy_free_range(pool_t *m_pool, uint32_t pg_start, uint32_t pg_end);
 
-    // 获取页表地址和页地址，这两个包含在pde和pte中
-    // Attention 等下手动查一下页表
-    uint32_t* pt_addr = pde_addr(vaddr);
-    uint32_t* p_addr = pte_addr(vaddr);
 
-    // 直接执行*p_add可能会报错，因为*p_addr所在的页表pt_addr可能为空，所以必须要确保在页表创建完成后再执行*p_addr，否则会引起page_fault
-    // 首先确定虚拟地址的*pt_addr存在
-    if (*pt_addr & 0x00000001){
-        ASSERT(!(*p_addr & 0x00000001));            // 确保当前pte没有被使用，即
-        if (!(*p_addr & 0x00000001))
-            *p_addr = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-        else{
-            PANIC("pte repeat");
-        }
-    } else {
-        // pt_addr不存在，需要首先进行创建页目录项
-        uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool);
-        *pt_addr = (pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-        // 页表中的数据要清0，避免原有的数据被误认为是页表项
-        memset((void *) ((int)p_addr & 0xFFFFF000), 0, PG_SIZE);
-        ASSERT(!(*p_addr & 0x00000001));
-        *p_addr = (page_phyaddr | PG_US_U | PG_RW_W |PG_P_1);
+/**
+ * @brief buddy_init用于初始化m_pool的伙伴系统. 初始化后, 内存池中除了空洞以外的所有页都以尽可能大的块的形式空闲
+ * 
+ * @param m_pool 要初始化的内存池, 内存池的起始物理地址必须已经设置好了, 空洞中的页必须已经标记为PAGE_RESERVED
+ * @param page_cnt 内存池覆盖的页数, 包括空洞
+ */
+static void buddy_init(pool_t *m_pool, uint32_t page_cnt){
+    m_pool->pages = &mem_map[PFN(m_pool->phy_addr_start)];
+    m_pool->page_cnt = page_cnt;
+    m_pool->pcp_cnt = 0;
+    m_pool->zero_cnt = 0;
+    m_pool->free_pages = 0;
+    m_pool->lent_pages = m_pool->borrowed_pages = 0;
+    for (uint32_t order = 0; order < BUDDY_MAX_ORDER; order++){
+        list_init(&m_pool->free_area[order]);
+        m_pool->free_cnt[order] = 0;
+    }
+    // 只释放空洞之间的页, 空洞中的页已经标记为PAGE_RESERVED, 不会被当作伙伴块合并
+    uint32_t pg_idx = 0;
+    while (pg_idx < page_cnt){
+        while (pg_idx < page_cnt && (m_pool->pages[pg_idx].flags & PAGE_RESERVED))
+            pg_idx++;
+        uint32_t run_start = pg_idx;
+        while (pg_idx < page_cnt && !(m_pool->pages[pg_idx].flags & PAGE_RESERVED))
+            pg_idx++;
+        buddy_free_range(m_pool, run_start, pg_idx);
     }
+    m_pool->total_pages = m_pool->free_pages;
+    m_pool->watermark = m_pool->free_pages / POOL_WATERMARK_RATIO;
 }
 
 
 /**
- * @brief get_a_page用于从指定的内存池中分配一个页，并将该页与虚拟地址vaddr所属的虚拟页绑定
+ * @brief buddy_alloc用于从m_pool中分配一个order阶的块, 即2^order个物理上连续的页
  * 
- * @param pf 分配页的内存池
- * @param vaddr 需要绑定的地址
- * @return void* 被绑定后的地址，等于(void*) vaddr
+ * @param m_pool 分配的内存池
+ * @param order 要分配的块的阶数
+ * @return int32_t 若分配成功, 则返回块首页在内存池中的页号; 失败则返回-1
  */
-void *get_a_page(pool_flags_t pf, uint32_t vaddr){
-    pool_t *mem_pool = pf & PF_KERNEL ?  &kernel_pool : &user_pool;
-    mutex_acquire(&mem_pool->mutex);
-
-    task_struct_t *cur = running_thread();
-
-    // 先将虚拟内存位图中对应的位图设置为1
-    int32_t bit_idx = -1;
-    if (cur->pgdir != NULL && pf == PF_USER){
-        // 若是用户进程申请用户内存，并且用户进程已经有虚拟内存页，则修改用户进程虚拟内存位图
-        bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
-    } else if (cur->pgdir == NULL && pf == PF_KERNEL) {
-        bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 1);
-    } else 
-        PANIC("get_a_page: kernel allocates usersapce or user allocate kernelspace is not allowed!");
-
+static int32_t buddy_alloc(pool_t *m_pool, uint32_t order){
+    if (order >= BUDDY_MAX_ORDER)
+        return -1;
+
+    intr_status_t old_status = intr_disable();
+    // 找到第一个有空闲块的阶
+    uint32_t cur_order = order;
+    while (cur_order < BUDDY_MAX_ORDER && m_pool->free_cnt[cur_order] == 0)
+        cur_order++;
+    if (cur_order == BUDDY_MAX_ORDER){
+        intr_set_status(old_status);
+        return -1;
+    }
 
-    // 分配一个物理页
-    void *page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL)
-        return NULL;
-    
-    // 页表中添加虚拟页和物理页的映射
-    page_table_add((void*)vaddr, page_phyaddr);
-    
-    // 释放锁
-    mutex_release(&mem_pool->mutex);
+    page_t *page = elem2entry(page_t, lru, m_pool->free_area[cur_order].head.next);
+    uint32_t pg_idx = page - m_pool->pages;
+    buddy_unlink(m_pool, pg_idx, cur_order);
 
-    return (void*) vaddr;
+    // 高阶块逐级拆分, 后一半作为低一阶的空闲块放回
+    while (cur_order > order){
+        cur_order--;
+        buddy_push(m_pool, pg_idx + (1 << cur_order), cur_order);
+    }
+    intr_set_status(old_status);
+    return pg_idx;
 }
 
 
 /**
- * @brief get_a_page_without_opvaddrbitmap用于从内核物理内存池或者用户物理内存池中分配一个页并将该页与虚拟地址vaddr所属的虚拟页绑定.
- *        get_a_page_without_opvaddrbitmap和get_a_page的区别就是该函数不会操作虚拟地址位图.
- *        即该函数会分配一个物理页, 然后在当前的页目录中添加vaddr和申请得到的物理页的映射.
- *        该函数专门用于fork是分配内存用
+ * @brief buddy_free用于将页号为pg_idx的order阶块归还到伙伴系统中, 若伙伴块也空闲, 则逐级合并
  * 
- * @param pf 分配页的内存池
- * @param vaddr 需要绑定的地址
- * @return void* 被绑定后的地址，等于(void*) vaddr
+ * @param m_pool 块所属的内存池
+ * @param pg_idx 块首页在内存池中的页号
+ * @param order 块的阶数
  */
-void *get_a_page_without_opvaddrbitmap(pool_flags_t pf, uint32_t vaddr){
-    pool_t *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    mutex_acquire(&mem_pool->mutex);
-    void *page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL){
-        mutex_release(&mem_pool->mutex);
-        return NULL;
+static void buddy_free(pool_t *m_pool, uint32_t pg_idx, uint32_t order){
+    ASSERT(pg_idx < m_pool->page_cnt && !(m_pool->pages[pg_idx].flags & PAGE_BUDDY));
+
+    intr_status_t old_status = intr_disable();
+    while (order < BUDDY_MAX_ORDER - 1){
+        uint32_t buddy_idx = pg_idx ^ (1 << order);
+        // 伙伴块不存在, 不空闲或者没有完整的空闲, 则无法合并
+        if (buddy_idx >= m_pool->page_cnt || !(m_pool->pages[buddy_idx].flags & PAGE_BUDDY) || m_pool->pages[buddy_idx].order != order)
+            break;
+        buddy_unlink(m_pool, buddy_idx, order);
+        pg_idx &= buddy_idx;
+        order++;
     }
-    page_table_add((void*)vaddr, page_phyaddr);
-    mutex_release(&mem_pool->mutex);
-    return (void*)vaddr;
+    buddy_push(m_pool, pg_idx, order);
+    intr_set_status(old_status);
 }
 
 
-/**
- * @brief free_a_phy_page用于将pg_phy_page执指向的物理页的位图清0
- * 
- * @param pg_phy_page 需要在位图中清0的物理页地址
- */
-void free_a_phy_page(uint32_t pg_phy_page){
-    pool_t *mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_page >= user_pool.phy_addr_start){
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_page - user_pool.phy_addr_start) / PG_SIZE;
-    } else {
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_page - kernel_pool.phy_addr_start) / PG_SIZE;
+static void buddy_free_range(pool_t *m_pool, uint32_t pg_start, uint32_t pg_end){
+    while (pg_start < pg_end){
+        uint32_t order = 0;
+        // 找到对齐且不超过范围的最大块
+        while (order < BUDDY_MAX_ORDER - 1 && (pg_start & ((1 << (order + 1)) - 1)) == 0 && pg_start + (1 << (order + 1)) <= pg_end)
+            order++;
+        buddy_free(m_pool, pg_start, order);
+        pg_start += 1 << order;
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
 }
 
 
 /**
- * @brief addr_v2p用于将虚拟地址转为物理地址
+ * @brief pcp_drain用于将order-0快速路径中缓存的单页归还cnt个给伙伴系统
  * 
- * @param vaddr 需要转换的虚拟地址
- * @return uint32_t 虚拟地址对应的物理地址
+ * @param m_pool 内存池
+ * @param cnt 要归还的页数
  */
-uint32_t addr_v2p(uint32_t vaddr){
-    uint32_t *page_addr = pte_addr(vaddr);
-    // 去掉页表项低12位的页表项属性，而后拼接虚拟地址的低12位页内偏移得到物理地址
-    return ((*page_addr & 0xFFFFF000) + (vaddr & 0x00000FFF));
+static void pcp_drain(pool_t *m_pool, uint32_t cnt){
+    intr_status_t old_status = intr_disable();
+    while (cnt-- > 0 && m_pool->pcp_cnt > 0)
+        buddy_free(m_pool, m_pool->pcp_pages[--m_pool->pcp_cnt], 0);
+    intr_set_status(old_status);
 }
 
 
-
 /**
- * @brief pfree(Physical Free)用于将给定的物理地址所属于的页回收到物理内存池
- * 
- * @details 由于使用Bitmap的方式管理物理内存, 而Bitmap中一位表示4K大小的内存, 即一个页.
- *          而回收本质上就是把对应页在bitmap中的占用位的清0即可. 这样做一方面减小了开销, 
- *          但是却造成了内存泄露的问题, 所以在用户申请一个页的时候, 需要memset清0
+ * @brief zero_drain用于将预先清0的单页全部归还给伙伴系统, 在分配连续的页失败的时候使用
  * 
- * @param pg_phy_addr 
+ * @param m_pool 内存池
  */
-void pfree(uint32_t pg_phy_addr){
-    pool_t *mem_pool;
-    uint32_t bit_idx = 0;
-    if (user_pool.phy_addr_start <= pg_phy_addr){
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
-    } else {
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
-    }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
+static void zero_drain(pool_t *m_pool){
+    intr_status_t old_status = intr_disable();
+    while (m_pool->zero_cnt > 0)
+        buddy_free(m_pool, m_pool->zero_pages[--m_pool->zero_cnt], 0);
+    intr_set_status(old_status);
 }
 
 
 /**
- * @brief page_table_pte_remove用于将vaddr指向的虚拟内存地址所在的虚拟页从对应的页表中取消和物理页的映射
+ * @brief pg_order用于计算容纳pg_cnt个页所需要的最小阶数
  * 
- * @param vaddr 要取消映射的虚拟地址
+ * @param pg_cnt 页数
+ * @return uint32_t 最小阶数
  */
-static void page_table_pte_remove(uint32_t vaddr){
-    uint32_t *pte = pte_addr(vaddr);
-    *pte &= ~PG_P_1;
-    // invlpg update tlb
-    asm volatile (
-        "invlpg %0"
-        : 
-        : "m" (vaddr)
-        : "memory"
-    );
+static uint32_t pg_order(uint32_t pg_cnt){
+    uint32_t order = 0;
+    while ((1U << order) < pg_cnt)
+        order++;
+    return order;
 }
 
 
 /**
- * @brief vaddr_remove用于在虚拟内存池中释放_vaddr开始的连续pg_cnt个页
+ * @brief page_prep用于初始化刚刚从内存池中分配出去的物理页的描述符, 分配出去的页引用计数为1
  * 
- * @param pf 释放的内存池
- * @param _vaddr 开始释放的页的地址
- * @param pg_cnt 释放的页数
+ * @param page 刚分配出去的物理页的描述符
  */
-static void vaddr_remove(pool_flags_t pf, void* _vaddr, uint32_t pg_cnt){
-    uint32_t bit_idx_start = 0;
-    uint32_t vaddr = (uint32_t) _vaddr;
-    uint32_t cnt = 0;
-
-    if (pf == PF_KERNEL){
-        // release from kernel virtual memory
-        bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt)
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
-    } else {
-        // release from user virtual memory
-        task_struct_t *cur = running_thread();
-        bit_idx_start = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt)
-            bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
-    }
+static void page_prep(page_t *page){
+    ASSERT(page->refcount == 0 && !(page->flags & PAGE_BUDDY));
+    page->refcount = 1;
+    page->flags = 0;
+    page->owner = NULL;
+    page->vaddr = 0;
 }
 
 
 /**
- * @brief mfree_page将释放以虚拟地址vaddr所在的物理页为起始的pg_cnt个物理页.
- *      注意, 此函数将按照整页整页的形式释放内存
+ * @brief palloc_local用于在m_pool指向的内存池中分配1个物理页, 不会从另一个内存池中借用
+ * 
+ * @details 单页分配首先走order-0快速路径, 直接从pcp中弹出一个页. 若pcp为空, 则一次从伙伴系统中取出
+ *          一个PCP_REFILL_ORDER阶的块填充pcp, 从而均摊伙伴系统的开销
+ * 
+ * @param m_pool 要分配物理页的内存池的地址
+ * @return void* 若成功，则返回物理页第一个字节的物理地址，若失败则返回NULL
+ */
+static void* palloc_local(pool_t* m_pool){
+    intr_status_t old_status = intr_disable();
+    if (m_pool->pcp_cnt == 0){
+        int32_t pg_idx = buddy_alloc(m_pool, PCP_REFILL_ORDER);
+        if (pg_idx != -1){
+            // 倒序压栈, 这样先弹出的是低地址的页
+            for (int32_t cnt = (1 << PCP_REFILL_ORDER) - 1; cnt >= 0; cnt--)
+                m_pool->pcp_pages[m_pool->pcp_cnt++] = pg_idx + cnt;
+        } else if ((pg_idx = buddy_alloc(m_pool, 0)) != -1){
+            // 内存池中已经没有连续的块了, 退化为单页分配
+            m_pool->pcp_pages[m_pool->pcp_cnt++] = pg_idx;
+        } else if (m_pool->zero_cnt > 0){
+            // 最后使用预先清0的页
+            m_pool->pcp_pages[m_pool->pcp_cnt++] = m_pool->zero_pages[--m_pool->zero_cnt];
+        } else {
+            intr_set_status(old_status);
+            return NULL;
+        }
+    }
+    uint32_t bit_idx = m_pool->pcp_pages[--m_pool->pcp_cnt];
+    page_prep(&m_pool->pages[bit_idx]);
+    intr_set_status(old_status);
+
+    uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
+    return (void*) page_phyaddr;
+}
+
+
+/**
+ * @brief palloc用于为m_pool的使用者分配1个物理页. 优先从m_pool中分配, m_pool耗尽以后再从另一个内存池中借用,
+ *        但是另一个内存池的空闲页不能低于它的水位线
+ * 
+ * @param m_pool 要分配物理页的内存池的地址
+ * @return void* 若成功，则返回物理页第一个字节的物理地址，若失败则返回NULL
+ */
+static void* palloc(pool_t* m_pool){
+    void *page_phyaddr = palloc_local(m_pool);
+    // 高端内存池只用于用户页, 既不借出也不借入
+    if (page_phyaddr != NULL || m_pool == &high_pool)
+        return page_phyaddr;
+
+    pool_t *lender = m_pool == &kernel_pool ? &user_pool : &kernel_pool;
+    intr_status_t old_status = intr_disable();
+    if (lender->free_pages + lender->pcp_cnt + lender->zero_cnt > lender->watermark &&
+        (page_phyaddr = palloc_local(lender)) != NULL){
+        phy2page((uint32_t) page_phyaddr)->flags |= PAGE_BORROWED;
+        lender->lent_pages++;
+        m_pool->borrowed_pages++;
+    }
+    intr_set_status(old_status);
+    return page_phyaddr;
+}
+
+
+/**
+ * @brief palloc_contig_align用于在m_pool指向的内存池中分配pg_cnt个物理上连续的页, 并且第一个页的物理地址按照align_pages个页对齐
+ * 
+ * @details 首先分配一个能容纳pg_cnt个页的最小的块, 然后将块尾部多余的页归还给伙伴系统. 伙伴块只是相对于内存池的起始地址对齐,
+ *          所以需要对齐的时候多分配align_pages - 1个页, 从中选出对齐的一段, 块头部多余的页也归还给伙伴系统.
+ *          若当前没有足够大的块, 则先将pcp中缓存的单页和预先清0的单页归还给伙伴系统以便合并, 然后再重试一次
+ * 
+ * @param m_pool 要分配物理页的内存池的地址
+ * @param pg_cnt 要分配的物理页数
+ * @param align_pages 第一个页的物理页帧号的对齐, 必须是2的幂
+ * @return void* 若成功，则返回第一个物理页第一个字节的物理地址，若失败则返回NULL
+ */
+static void* palloc_contig_align(pool_t *m_pool, uint32_t pg_cnt, uint32_t align_pages){
+    ASSERT(align_pages > 0 && (align_pages & (align_pages - 1)) == 0);
+    uint32_t order = pg_order(pg_cnt + align_pages - 1);
+    if (order >= BUDDY_MAX_ORDER)
+        return NULL;
+
+    int32_t pg_idx = buddy_alloc(m_pool, order);
+    if (pg_idx == -1 && (m_pool->pcp_cnt > 0 || m_pool->zero_cnt > 0)){
+        pcp_drain(m_pool, m_pool->pcp_cnt);
+        zero_drain(m_pool);
+        pg_idx = buddy_alloc(m_pool, order);
+    }
+    if (pg_idx == -1)
+        return NULL;
+
+    // 归还对齐的一段前后多余的页
+    uint32_t block_end = pg_idx + (1 << order);
+    uint32_t start_pfn = PFN(m_pool->phy_addr_start) + pg_idx;
+    uint32_t start = pg_idx + (DIV_CEILING(start_pfn, align_pages) * align_pages - start_pfn);
+    buddy_free_range(m_pool, pg_idx, start);
+    buddy_free_range(m_pool, start + pg_cnt, block_end);
+    for (uint32_t cnt = 0; cnt < pg_cnt; cnt++)
+        page_prep(&m_pool->pages[start + cnt]);
+    return (void*) (start * PG_SIZE + m_pool->phy_addr_start);
+}
+
+
+/**
+ * @brief palloc_contig用于在m_pool指向的内存池中分配pg_cnt个物理上连续的页
+ * 
+ * @param m_pool 要分配物理页的内存池的地址
+ * @param pg_cnt 要分配的物理页数
+ * @return void* 若成功，则返回第一个物理页第一个字节的物理地址，若失败则返回NULL
+ */
+static void* palloc_contig(pool_t *m_pool, uint32_t pg_cnt){
+    return palloc_contig_align(m_pool, pg_cnt, 1);
+}
+
+
+/**
+ * @brief page_clear用于将物理页清0, 物理页可以在高端内存中
+ */
+static void page_clear(uint32_t pg_phy_addr){
+    void *vaddr = kmap_page(pg_phy_addr);
+    memset(vaddr, 0, PG_SIZE);
+    kunmap_page(vaddr);
+}
+
+
+/**
+ * @brief palloc_zero用于在m_pool指向的内存池中分配1个内容全为0的物理页. 优先使用idle线程预先清0的页,
+ *        没有的时候再分配一个页并同步清0
+ * 
+ * @param m_pool 要分配物理页的内存池的地址
+ * @return void* 若成功，则返回物理页第一个字节的物理地址，若失败则返回NULL
+ */
+static void* palloc_zero(pool_t *m_pool){
+    intr_status_t old_status = intr_disable();
+    if (m_pool->zero_cnt > 0){
+        uint32_t pg_idx = m_pool->zero_pages[--m_pool->zero_cnt];
+        page_prep(&m_pool->pages[pg_idx]);
+        intr_set_status(old_status);
+        return (void*) (pg_idx * PG_SIZE + m_pool->phy_addr_start);
+    }
+    intr_set_status(old_status);
+
+    void *page_phyaddr = palloc(m_pool);
+    if (page_phyaddr == NULL)
+        return NULL;
+    page_clear((uint32_t) page_phyaddr);
+    return page_phyaddr;
+}
+
+
+/**
+ * @brief mem_zero_refill用于为预先清0的单页补充一个页, 由idle线程在系统空闲的时候调用.
+ *        每次只清0一个页, 这样有线程就绪的时候idle线程可以尽快让出CPU
+ * 
+ * @return true 补充了一个页
+ * @return false 所有内存池预先清0的单页都已经足够, 或者内存池中已经没有空闲的页了
+ */
+bool mem_zero_refill(void){
+    pool_t *pools[3] = {&kernel_pool, &user_pool, &high_pool};
+    for (uint32_t pool_idx = 0; pool_idx < 3; pool_idx++){
+        pool_t *m_pool = pools[pool_idx];
+        if (m_pool->zero_cnt >= ZERO_HIGH)
+            continue;
+        // 内存池中除了预先清0的页以外没有空闲的页了, 再分配就是取出预先清0的页
+        if (m_pool->pcp_cnt == 0 && m_pool->free_pages == 0)
+            continue;
+        void *page_phyaddr = palloc_local(m_pool);
+        if (page_phyaddr == NULL)
+            continue;
+
+        page_clear((uint32_t) page_phyaddr);
+        intr_status_t old_status = intr_disable();
+        uint32_t pg_idx = ((uint32_t) page_phyaddr - m_pool->phy_addr_start) / PG_SIZE;
+        m_pool->pages[pg_idx].refcount = 0;
+        m_pool->zero_pages[m_pool->zero_cnt++] = pg_idx;
+        intr_set_status(old_status);
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * @brief phy_addr2pool用于获得物理地址pg_phy_addr所属的内存池
+ * 
+ * @param pg_phy_addr 物理地址
+ * @return pool_t* 物理地址所属的内存池
+ */
+static pool_t* phy_addr2pool(uint32_t pg_phy_addr){
+    if (pg_phy_addr >= high_pool.phy_addr_start)
+        return &high_pool;
+    return pg_phy_addr >= user_pool.phy_addr_start ? &user_pool : &kernel_pool;
+}
+
+
+/**
+ * @brief pfree_page用于将物理地址pg_phy_addr所在的物理页归还到所属的内存池中. 单页首先放入order-0快速路径中,
+ *        当快速路径中的页过多时, 批量归还给伙伴系统并进行合并. 只有引用计数已经减为0的页才能归还, 借出的页归还给出借的内存池
+ * 
+ * @param pg_phy_addr 要归还的物理页的物理地址
+ */
+static void pfree_page(uint32_t pg_phy_addr){
+    pool_t *mem_pool = phy_addr2pool(pg_phy_addr);
+    uint32_t pg_idx = (pg_phy_addr - mem_pool->phy_addr_start) / PG_SIZE;
+    ASSERT(pg_idx < mem_pool->page_cnt && mem_pool->pages[pg_idx].refcount == 0);
+
+    intr_status_t old_status = intr_disable();
+    // 借出的页归还给原来的内存池
+    if (mem_pool->pages[pg_idx].flags & PAGE_BORROWED){
+        mem_pool->pages[pg_idx].flags &= ~PAGE_BORROWED;
+        mem_pool->lent_pages--;
+        (mem_pool == &kernel_pool ? &user_pool : &kernel_pool)->borrowed_pages--;
+    }
+    if (mem_pool->pcp_cnt == PCP_HIGH)
+        pcp_drain(mem_pool, PCP_BATCH);
+    mem_pool->pcp_pages[mem_pool->pcp_cnt++] = pg_idx;
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief phy2page用于获得物理地址pg_phy_addr所在的物理页的描述符
+ *
+ * @param pg_phy_addr 物理地址
+ * @return page_t* 物理页的描述符
+ */
+page_t *phy2page(uint32_t pg_phy_addr){
+    ASSERT(PFN(pg_phy_addr) < mem_map_cnt);
+    return &mem_map[PFN(pg_phy_addr)];
+}
+
+
+/**
+ * @brief page2phy用于获得描述符page对应的物理页的物理地址
+ *
+ * @param page 物理页描述符
+ * @return uint32_t 物理页的物理地址
+ */
+uint32_t page2phy(page_t *page){
+    return (uint32_t) (page - mem_map) * PG_SIZE;
+}
+
+
+/**
+ * @brief get_page用于增加物理页的引用计数, 例如物理页被映射到了另一个页表项中
+ *
+ * @param page 物理页描述符
+ */
+void get_page(page_t *page){
+    intr_status_t old_status = intr_disable();
+    ASSERT(page->refcount > 0);
+    page->refcount++;
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief put_page用于减少物理页的引用计数, 引用计数减为0的时候物理页归还给所属的内存池
+ *
+ * @param page 物理页描述符
+ */
+void put_page(page_t *page){
+    intr_status_t old_status = intr_disable();
+    ASSERT(page->refcount > 0 && !(page->flags & PAGE_RESERVED));
+    if (--page->refcount == 0){
+        if (page->flags & PAGE_LRU){
+            list_remove(&page->lru);
+            page->flags &= ~PAGE_LRU;
+        }
+        page->flags &= ~PAGE_KSM;
+        pfree_page(page2phy(page));
+    }
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief page_set_user用于将page标记为owner在vaddr处独占映射的用户页, 并加入LRU链表等待回收
+ *
+ * @param page 物理页描述符
+ * @param owner 映射该页的进程
+ * @param vaddr 该页在owner中映射的虚拟地址
+ */
+static void page_set_user(page_t *page, task_struct_t *owner, uint32_t vaddr){
+    intr_status_t old_status = intr_disable();
+    page->flags |= PAGE_USER;
+    page->owner = owner;
+    page->vaddr = vaddr;
+    if (!(page->flags & PAGE_LRU)){
+        page->flags |= PAGE_LRU;
+        list_append(&lru_list, &page->lru);
+    }
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief palloc_user用于为用户页分配一个物理页. 优先使用高端内存, 把低端内存留给内核; 高端内存池和用户内存池都耗尽的时候
+ *        先换出一些用户页, 然后重试
+ *
+ * @note 调用的时候不能持有用户内存池的锁, 否则换出的时候可能和等待该锁的磁盘操作死锁, 此时不会换出
+ *
+ * @param zero 是否需要内容全为0的页
+ * @return void* 若成功，则返回物理页第一个字节的物理地址，若失败则返回NULL
+ */
+static void *palloc_user(bool zero){
+    for (uint32_t tries = 0; ; tries++){
+        mutex_acquire(&high_pool.mutex);
+        void *page_phyaddr = zero ? palloc_zero(&high_pool) : palloc(&high_pool);
+        mutex_release(&high_pool.mutex);
+        if (page_phyaddr == NULL){
+            mutex_acquire(&user_pool.mutex);
+            page_phyaddr = zero ? palloc_zero(&user_pool) : palloc(&user_pool);
+            mutex_release(&user_pool.mutex);
+        }
+        if (page_phyaddr != NULL || tries == RECLAIM_RETRIES || mem_reclaim(RECLAIM_BATCH) == 0)
+            return page_phyaddr;
+    }
+}
+
+
+
+/* ================================================================================================================== */
+/* ================================================= 通用内存分配函数 ================================================== */
+/* ================================================================================================================== */
+
+
+// 申请一个页的流程：
+//      1. 首先需要在虚拟内存池中申请得到一个虚拟页
+//      2. 然后需要在物理内存池中申请得到一个物理页
+//      3. 最后在页表中完成虚拟页和物理页的映射, 即完成虚拟地址转物理地址
+// 举个例子：
+//      1. 首先申请虚拟内存中的一个页，假设目前可用的就是0x1000_1000~0x1000_1FFF这个页
+//      2. 然后在物理内存池中申请一个页，假设可用的物理地址就是0xD0AF_C000~0xD0AF_CFFF这个页
+//      3. 0x1000_1000虚拟地址拆出来就是：0b0001_0000_00:0b00_0000_0001:0x000
+//          3.1 首先在页目录表中查询040偏移对应的页表的物理地址，假设页表物理地址是0x12345000
+//          3.2 然后在页表物理地址中将001对应的页的物理地址s设置为0xD0AF_C000
+//      但是存在问题：
+//          1. 页目录项可能不存在，此时需要新建一个页表
+
+/**
+ * @brief vaddr_get用于在指定的虚拟内存池中申请pg_cnt个虚拟页
+ * 
+ * @param pf 申请内存的内存池
+ * @param pg_cnt 申请的虚拟页个数
+ * @return void* 若申请成功则返回虚拟页的起始地址，失败则返回NULL
+ */
+static void* vaddr_get(pool_flags_t pf, uint32_t pg_cnt){
+    int vaddr_start = 0, bit_idx_start = -1;
+    if (pf == PF_KERNEL){
+        // 从内核虚拟内存池中分配页
+        // 扫描虚拟内存池中的bitmap, 查看是否存在pg_cnt个连续的页
+        if ((bit_idx_start = bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt)) == -1)
+            return NULL;
+        // 设置位图中的位
+        bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 1);
+        vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
+    } else {
+        // 从用户虚拟内存池中分配页
+        // 用户进程的虚拟地址由有序的区域链表管理, 在区域之间的空隙中分配
+        if ((vaddr_start = vma_alloc(running_thread(), pg_cnt, 0)) == 0)
+            return NULL;
+
+        // 0xC000_0000 ~ 0xC000_0FFF将用于存储用户的三级栈，因此分配得到的空间覆盖这里
+        ASSERT((uint32_t) vaddr_start < (0xC0000000 - PG_SIZE));
+    }
+    return (void *) vaddr_start;
+}
+
+
+/**
+ * @brief mem_stat_add用于调整内存的统计计数. 页回收会修改其他进程的计数, 进程退出的时候由其他线程释放页表, 所以关中断修改
+ */
+static inline void mem_stat_add(uint32_t *counter, int32_t delta){
+    intr_status_t old_status = intr_disable();
+    *counter += delta;
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief page_table_map用于在页表中添加虚拟地址所属的虚拟页与物理地址所属的物理页的映射, 页表项的属性由flags给出.
+ *        若虚拟地址所属的页表不存在, 则会先从内核物理内存池中分配一个页表. 内核空间的页表在loader中已经全部建立,
+ *        所以只有映射用户地址的时候才可能失败
+ * 
+ * @param _vaddr 被映射的虚拟地址
+ * @param _page_phyaddr 要映射到的物理地址
+ * @param flags 页表项的属性, 例如PG_US_U | PG_RW_W | PG_P_1
+ * @return true 映射成功
+ * @return false 没有物理页用于分配页表, 此时页表没有被修改
+ */
+static bool page_table_map(void* _vaddr, void* _page_phyaddr, uint32_t flags){
+    uint32_t vaddr = (uint32_t) _vaddr;
+    uint32_t page_phyaddr = (uint32_t) _page_phyaddr;
+    // 所有进程的内核空间都是相同的, 内核空间的页设置为全局页, 切换进程的时候不需要刷新
+    if (vaddr >= 0xC0000000)
+        flags |= PG_G;
+
+    // 获取页表地址和页地址，这两个包含在pde和pte中
+    // Attention 等下手动查一下页表
+    uint32_t* pt_addr = pde_addr(vaddr);
+    uint32_t* p_addr = pte_addr(vaddr);
+
+    // 直接执行*p_add可能会报错，因为*p_addr所在的页表pt_addr可能为空，所以必须要确保在页表创建完成后再执行*p_addr，否则会引起page_fault
+    // 首先确定虚拟地址的*pt_addr存在
+    if (*pt_addr & 0x00000001){
+        ASSERT(!(*p_addr & 0x00000001));            // 确保当前pte没有被使用，即
+        if (!(*p_addr & 0x00000001))
+            *p_addr = (page_phyaddr | flags);
+        else{
+            PANIC("pte repeat");
+        }
+    } else {
+        // pt_addr不存在，需要首先进行创建页目录项
+        uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool);
+        if (pt_phyaddr == 0)
+            return false;
+        *pt_addr = (pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+        mem_stat_add(&pgtable_pages, 1);
+        // 记录用户进程建立了哪些页表, fork和exit只需要处理这些页表
+        if (vaddr < 0xC0000000)
+            pgtable_mark(running_thread(), PDE_IDX(vaddr));
+        // 页表中的数据要清0，避免原有的数据被误认为是页表项
+        memset((void *) ((int)p_addr & 0xFFFFF000), 0, PG_SIZE);
+        ASSERT(!(*p_addr & 0x00000001));
+        *p_addr = (page_phyaddr | flags);
+    }
+    if (vaddr < 0xC0000000)
+        mem_stat_add(&running_thread()->rss_pages, 1);
+    return true;
+}
+
+
+/**
+ * @brief page_table_add用于在页表中添加虚拟地址所属的虚拟页与物理地址所属的物理页的映射。
+ *        注意，给出虚拟地址和物理地址即可，会自动计算需要映射的虚拟页和物理页会被
+ * 
+ * @param _vaddr 被映射的虚拟地址
+ * @param _page_phyaddr 要映射到的物理地址
+ * @return true 映射成功
+ * @return false 没有物理页用于分配页表
+ */
+static bool page_table_add(void* _vaddr, void* _page_phyaddr){
+    return page_table_map(_vaddr, _page_phyaddr, PG_US_U | PG_RW_W | PG_P_1);
+}
+
+
+/**
+ * @brief get_a_page用于从指定的内存池中分配一个页，并将该页与虚拟地址vaddr所属的虚拟页绑定
+ * 
+ * @param pf 分配页的内存池
+ * @param vaddr 需要绑定的地址
+ * @return void* 被绑定后的地址，等于(void*) vaddr
+ */
+void *get_a_page(pool_flags_t pf, uint32_t vaddr){
+    pool_t *mem_pool = pf & PF_KERNEL ?  &kernel_pool : &user_pool;
+    mutex_acquire(&mem_pool->mutex);
+
+    task_struct_t *cur = running_thread();
+
+    // 先保留虚拟页
+    int32_t bit_idx = -1;
+    if (cur->pgdir != NULL && pf == PF_USER){
+        // 若是用户进程申请用户内存，则在用户进程的区域中保留该页. 多个段可能共用一个页, 已经保留的页不需要再保留
+        if (vma_find(cur, vaddr) == NULL && vma_add(cur, vaddr & 0xFFFFF000, 1, 0) == NULL){
+            mutex_release(&mem_pool->mutex);
+            return NULL;
+        }
+    } else if (cur->pgdir == NULL && pf == PF_KERNEL) {
+        bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
+        ASSERT(bit_idx > 0);
+        bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 1);
+    } else 
+        PANIC("get_a_page: kernel allocates usersapce or user allocate kernelspace is not allowed!");
+
+
+    // 分配一个物理页, 用户页在内存池耗尽的时候会先换出一些页
+    void *page_phyaddr = palloc(mem_pool);
+    if (page_phyaddr == NULL && pf == PF_USER){
+        mutex_release(&mem_pool->mutex);
+        page_phyaddr = palloc_user(false);
+        mutex_acquire(&mem_pool->mutex);
+    }
+    if (page_phyaddr == NULL){
+        mutex_release(&mem_pool->mutex);
+        return NULL;
+    }
+    // 页表中添加虚拟页和物理页的映射, 页表分配失败的时候归还刚分配的物理页
+    if (!page_table_add((void*)vaddr, page_phyaddr)){
+        pfree((uint32_t) page_phyaddr);
+        mutex_release(&mem_pool->mutex);
+        return NULL;
+    }
+    if (pf == PF_USER)
+        page_set_user(phy2page((uint32_t) page_phyaddr), cur, vaddr);
+    
+    // 释放锁
+    mutex_release(&mem_pool->mutex);
+
+    return (void*) vaddr;
+}
+
+
+/**
+ * @brief get_a_page_without_opvaddrbitmap用于从内核物理内存池或者用户物理内存池中分配一个页并将该页与虚拟地址vaddr所属的虚拟页绑定.
+ *        get_a_page_without_opvaddrbitmap和get_a_page的区别就是该函数不会操作虚拟地址位图.
+ *        即该函数会分配一个物理页, 然后在当前的页目录中添加vaddr和申请得到的物理页的映射.
+ *        该函数专门用于fork是分配内存用
+ * 
+ * @param pf 分配页的内存池
+ * @param vaddr 需要绑定的地址
+ * @return void* 被绑定后的地址，等于(void*) vaddr
+ */
+void *get_a_page_without_opvaddrbitmap(pool_flags_t pf, uint32_t vaddr){
+    pool_t *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    mutex_acquire(&mem_pool->mutex);
+    void *page_phyaddr = palloc(mem_pool);
+    if (page_phyaddr == NULL){
+        mutex_release(&mem_pool->mutex);
+        return NULL;
+    }
+    if (!page_table_add((void*)vaddr, page_phyaddr)){
+        pfree((uint32_t) page_phyaddr);
+        mutex_release(&mem_pool->mutex);
+        return NULL;
+    }
+    mutex_release(&mem_pool->mutex);
+    return (void*)vaddr;
+}
+
+
+/**
+ * @brief free_a_phy_page用于释放对pg_phy_page指向的物理页的一次引用, 最后一个引用释放时物理页归还到所属的内存池的伙伴系统中
+ * 
+ * @param pg_phy_page 需要归还的物理页地址
+ */
+void free_a_phy_page(uint32_t pg_phy_page){
+    put_page(phy2page(pg_phy_page));
+}
+
+
+/**
+ * @brief free_page_table用于释放用户进程的一个页表, 进程退出的时候调用. 页表中的页需要已经释放
+ * 
+ * @param pt_phy_addr 页表的物理地址
+ */
+void free_page_table(uint32_t pt_phy_addr){
+    mem_stat_add(&pgtable_pages, -1);
+    put_page(phy2page(pt_phy_addr));
+}
+
+
+/**
+ * @brief addr_v2p用于将虚拟地址转为物理地址
+ * 
+ * @param vaddr 需要转换的虚拟地址
+ * @return uint32_t 虚拟地址对应的物理地址
+ */
+uint32_t addr_v2p(uint32_t vaddr){
+    // 4MB的大页没有页表, 页目录项中直接就是大页的物理地址
+    uint32_t pde = *pde_addr(vaddr);
+    if (pde & PG_PS)
+        return (pde & 0xFFC00000) + (vaddr & 0x003FFFFF);
+    uint32_t *page_addr = pte_addr(vaddr);
+    // 去掉页表项低12位的页表项属性，而后拼接虚拟地址的低12位页内偏移得到物理地址
+    return ((*page_addr & 0xFFFFF000) + (vaddr & 0x00000FFF));
+}
+
+
+
+/**
+ * @brief pfree(Physical Free)用于将给定的物理地址所属于的页回收到物理内存池
+ * 
+ * @details 物理内存由伙伴系统管理, 释放的是对物理页的一次引用, 引用计数减为0时回收的页首先进入order-0快速路径, 之后再批量归还给伙伴系统并与伙伴块合并.
+ *          回收的时候并不会清除页中的数据, 所以在用户申请一个页的时候, 需要memset清0
+ * 
+ * @param pg_phy_addr 
+ */
+void pfree(uint32_t pg_phy_addr){
+    put_page(phy2page(pg_phy_addr));
+}
+
+
+/**
+ * @brief tlb_flush_page用于使TLB中vaddr所在的虚拟页的缓存失效, 修改了已经存在的页表项之后必须调用
+ * 
+ * @param vaddr 页表项被修改的虚拟地址
+ */
+static inline void tlb_flush_page(uint32_t vaddr){
+    // invlpg update tlb
+    asm volatile (
+        "invlpg %0"
+        : 
+        : "m" (*(uint8_t *) vaddr)
+        : "memory"
+    );
+}
+
+
+/**
+ * @brief page_table_pte_remove用于将vaddr指向的虚拟内存地址所在的虚拟页从对应的页表中取消和物理页的映射
+ * 
+ * @param vaddr 要取消映射的虚拟地址
+ */
+static void page_table_pte_remove(uint32_t vaddr){
+    uint32_t *pte = pte_addr(vaddr);
+    *pte &= ~PG_P_1;
+    tlb_flush_page(vaddr);
+    if (vaddr < 0xC0000000)
+        mem_stat_add(&running_thread()->rss_pages, -1);
+}
+
+
+/**
+ * @brief tlb_flush_all用于刷新整个TLB. 重新装入cr3不会刷新全局页, 所以内核空间的映射被修改的时候需要开关一次CR4的PGE位
+ * 
+ * @param global 是否需要刷新全局页
+ */
+static void tlb_flush_all(bool global){
+    if (global){
+        uint32_t cr4;
+        asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+        asm volatile ("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE) : "memory");
+        asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    } else {
+        uint32_t cr3;
+        asm volatile ("movl %%cr3, %0" : "=r" (cr3));
+        asm volatile ("movl %0, %%cr3" : : "r" (cr3) : "memory");
+    }
+}
+
+
+/**
+ * @brief unmap_batch_init用于初始化一次批量取消映射
+ *
+ * @param batch 需要初始化的批量取消映射
+ */
+void unmap_batch_init(unmap_batch_t *batch){
+    batch->start = 0xFFFFFFFF;
+    batch->end = 0;
+    batch->pte_cnt = 0;
+    batch->page_cnt = 0;
+}
+
+
+/**
+ * @brief unmap_batch_flush用于刷新batch中已清除的页表项的TLB, 然后释放暂存的物理页.
+ *        范围内的页数不超过UNMAP_BATCH_FLUSH_MAX的时候逐页invlpg, 否则刷新整个TLB
+ *
+ * @param batch 批量取消映射
+ */
+static void unmap_batch_flush(unmap_batch_t *batch){
+    if (batch->pte_cnt == 0)
+        return;
+
+    if ((batch->end - batch->start) / PG_SIZE <= UNMAP_BATCH_FLUSH_MAX){
+        for (uint32_t vaddr = batch->start; vaddr < batch->end; vaddr += PG_SIZE)
+            tlb_flush_page(vaddr);
+    } else
+        tlb_flush_all(batch->end > 0xC0000000);
+
+    // 关中断一次性释放所有的物理页
+    intr_status_t old_status = intr_disable();
+    for (uint32_t idx = 0; idx < batch->page_cnt; idx++)
+        put_page(phy2page(batch->pages[idx]));
+    intr_set_status(old_status);
+
+    unmap_batch_init(batch);
+}
+
+
+/**
+ * @brief unmap_batch_add用于清除当前页表中vaddr所在虚拟页的页表项, 页表项对应的物理页在TLB刷新之后释放一次引用.
+ *        虚拟页没有映射物理页的时候什么都不做
+ *
+ * @param batch 批量取消映射
+ * @param vaddr 要取消映射的虚拟页
+ */
+void unmap_batch_add(unmap_batch_t *batch, uint32_t vaddr){
+    vaddr &= 0xFFFFF000;
+    // 按需分配的页可能还没有被访问过, 此时没有物理页需要释放
+    if (!(*pde_addr(vaddr) & PG_P_1))
+        return;
+    uint32_t *pte = pte_addr(vaddr);
+    if (!(*pte & PG_P_1)){
+        // 换出的页只需要释放槽
+        if (*pte & PG_SWAP){
+            swap_put(SWAP_PTE_SLOT(*pte));
+            *pte = 0;
+        }
+        return;
+    }
+
+    // 暂存的物理页满了, 先刷新一次
+    if (batch->page_cnt == UNMAP_BATCH_PAGES)
+        unmap_batch_flush(batch);
+
+    batch->pages[batch->page_cnt++] = *pte & 0xFFFFF000;
+    *pte &= ~PG_P_1;
+    batch->pte_cnt++;
+    if (vaddr < 0xC0000000)
+        mem_stat_add(&running_thread()->rss_pages, -1);
+    if (vaddr < batch->start)
+        batch->start = vaddr;
+    if (vaddr + PG_SIZE > batch->end)
+        batch->end = vaddr + PG_SIZE;
+}
+
+
+/**
+ * @brief unmap_batch_finish用于结束一次批量取消映射: 刷新TLB并释放所有暂存的物理页
+ *
+ * @param batch 批量取消映射
+ */
+void unmap_batch_finish(unmap_batch_t *batch){
+    unmap_batch_flush(batch);
+}
+
+
+/**
+ * @brief vaddr_remove用于在虚拟内存池中释放_vaddr开始的连续pg_cnt个页
+ * 
+ * @param pf 释放的内存池
+ * @param _vaddr 开始释放的页的地址
+ * @param pg_cnt 释放的页数
+ */
+static void vaddr_remove(pool_flags_t pf, void* _vaddr, uint32_t pg_cnt){
+    uint32_t bit_idx_start = 0;
+    uint32_t vaddr = (uint32_t) _vaddr;
+
+    if (pf == PF_KERNEL){
+        // release from kernel virtual memory
+        bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
+        bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 0);
+    } else {
+        // release from user virtual memory. 普通区域只会在中间拆分一次, 内存不足的时候区域保留着, 只是浪费了一些虚拟地址
+        vma_remove(running_thread(), vaddr, vaddr + pg_cnt * PG_SIZE, 0);
+    }
+}
+
+
+/**
+ * @brief mfree_page将释放以虚拟地址vaddr所在的物理页为起始的pg_cnt个物理页.
+ *      注意, 此函数将按照整页整页的形式释放内存
  * 
  * @param pf 要释放的内存池
  * @param _vaddr 要释放的
  * @param pg_cnt 要释放的物理页的数量
  */
-void mfree_page(pool_flags_t pf, void *_vaddr, uint32_t pg_cnt){
-    uint32_t pg_phy_addr;
-    uint32_t vaddr = (int32_t) _vaddr;
-    uint32_t page_cnt = 0;
+void mfree_page(pool_flags_t pf, void *_vaddr, uint32_t pg_cnt){
+    uint32_t vaddr = (int32_t) _vaddr;
+    uint32_t page_cnt = 0;
+
+    // 对vaddr进行合法性检查
+    // 要释放的页必须要大于等于1页, vaddr也必须指向虚拟页开始
+    ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
+
+    // 直接映射区中的内存没有单独的虚拟页和页表项, 只需要释放物理页
+    if (vaddr >= DIRECT_MAP_BASE && vaddr < direct_map_end){
+        ASSERT(pf & PF_KERNEL && vaddr + pg_cnt * PG_SIZE <= direct_map_end);
+        intr_status_t old_status = intr_disable();
+        while (page_cnt < pg_cnt)
+            pfree(vaddr - DIRECT_MAP_BASE + page_cnt++ * PG_SIZE);
+        intr_set_status(old_status);
+        return;
+    }
+    
+    // 释放vaddr执行的内存要干的三件事
+    //      1. 在页表中释放虚拟页和物理页的映射
+    //      2. 释放vaddr所在的物理页
+    //      3. 释放vaddr所在的虚拟页
+    // 页表项逐个清除, TLB在最后统一刷新, 物理页在TLB刷新之后批量释放. 零页和写时复制共享的页只会减少引用计数
+    // 内存池之间可以互相借用物理页, 所以根据pf而不是物理地址判断释放的是哪类内存, 物理页由pfree归还给所属的内存池
+    unmap_batch_t batch;
+    unmap_batch_init(&batch);
+    for (; page_cnt < pg_cnt; page_cnt++, vaddr += PG_SIZE){
+        // 要释放的内核页必须已经映射, 此外不能释放: 底端1MB的内核, 页目录表, 内核页表以及物理页描述符
+        ASSERT(pf == PF_USER || ((*pte_addr(vaddr) & PG_P_1) && kernel_pool.phy_addr_start <= (*pte_addr(vaddr) & 0xFFFFF000)));
+        unmap_batch_add(&batch, vaddr);
+    }
+    unmap_batch_finish(&batch);
+
+    // 统一释放虚拟页
+    vaddr_remove(pf, _vaddr, pg_cnt);
+}
+
+/* ================================================================================================================== */
+/* ================================================== 内核分配一个页 ================================================== */
+/* ================================================================================================================== */
+
+/**
+ * @brief pte_addr用于获得指向给定虚拟地址所在的物理页的地址，即pte中的物理地址
+ * 
+ * @param vaddr 需要获得pde地址的虚拟地址
+ * @return uint32_t* 虚拟地址的pte地址
+ */
+uint32_t* pte_addr(uint32_t vaddr){
+    // 先访问页目录本身，然后访问页目录的偏移，得到PTE的地址
+    uint32_t *pte = (uint32_t*) (0xFFC00000 + ((vaddr & 0xFFC00000) >> 10) + PTE_IDX(vaddr) * 4);
+    return pte;
+}
+
+
+/**
+ * @brief pde_addr用于获得指向给定虚拟地址所在的页表的地址，即pde中的物理地址
+ * 
+ * @param vaddr 需要获得pde地址的虚拟地址
+ * @return uint32_t* 虚拟地址的pte地址
+ */
+uint32_t* pde_addr(uint32_t vaddr){
+    uint32_t *pde = (uint32_t*) ((0xFFFFF000) + PDE_IDX(vaddr) * 4);
+    return pde;
+}
+
+
+
+
+/**
+ * @brief malloc_page从pf指定的内存池中分配pg_cnt个页. 多个页时优先分配物理上连续的页,
+ *        若内存池中没有足够大的连续块, 则逐页分配. 用户内存池只分配虚拟页, 物理页在第一次访问时按需分配
+ * 
+ * @param pf 指定要分配的内存池
+ * @param pg_cnt 要分配的页
+ * @return void* 若分配成功，则返回虚拟地址，失败则返回NULL
+ */
+void *malloc_page(pool_flags_t pf, uint32_t pg_cnt){
+    ASSERT(pg_cnt > 0 && pg_cnt < 3840);
+    // 内核的大块内存优先使用直接映射区, 物理上连续的页已经被4MB的大页映射了, 不需要分配虚拟页和修改页表
+    if (pf & PF_LARGE){
+        ASSERT(pf & PF_KERNEL);
+        uint32_t page_phyaddr = (uint32_t) palloc_contig(&kernel_pool, pg_cnt);
+        if (page_phyaddr != 0 && DIRECT_MAP_BASE + page_phyaddr + pg_cnt * PG_SIZE <= direct_map_end)
+            return kmap(page_phyaddr);
+        if (page_phyaddr != 0)
+            for (uint32_t cnt = 0; cnt < pg_cnt; cnt++)
+                pfree(page_phyaddr + cnt * PG_SIZE);
+        pf = PF_KERNEL;
+    }
+
+    // malloc_page的流程：
+    //      1. 首先需要在虚拟内存池中申请得到一个虚拟页
+    //      2. 然后需要在物理内存池中申请得到一个物理页
+    //      3. 最后在页表中完成虚拟页和物理页的映射, 即完成虚拟地址转物理地址
+
+    // 分配虚拟页
+    void* vaddr_start = vaddr_get(pf, pg_cnt);
+    if (vaddr_start == NULL)
+        return NULL;
+
+    // 用户进程的页只保留虚拟地址, 在第一次访问的时候由缺页中断分配物理页
+    if (pf == PF_USER)
+        return vaddr_start;
+
+    uint32_t vaddr = (uint32_t) vaddr_start, cnt = pg_cnt;
+    pool_t* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+
+    // 多个页优先从伙伴系统中分配物理上连续的页
+    if (pg_cnt > 1){
+        uint32_t page_phyaddr = (uint32_t) palloc_contig(mem_pool, pg_cnt);
+        if (page_phyaddr != 0){
+            while (cnt-- > 0){
+                page_table_add((void*) vaddr, (void*) page_phyaddr);
+                vaddr += PG_SIZE;
+                page_phyaddr += PG_SIZE;
+            }
+            return vaddr_start;
+        }
+    }
+
+    // 分配物理页, 并对每个物理页进行映射
+    while (cnt-- > 0){
+        void *page_phyaddr = palloc(mem_pool);
+        // 如果申请物理页失败，已经获得虚拟页要归还，后面再实现，也可以实现换页
+        if (page_phyaddr == NULL)
+            return NULL;
+        // 在二级页表中插入页表项
+        page_table_add((void*) vaddr, page_phyaddr);
+        // 下一个虚拟页
+        vaddr += PG_SIZE;
+    }
+    return vaddr_start;
+}
+
+
+/**
+ * @brief malloc_page_extend用于在malloc_page分配的页之后紧接着再分配pg_cnt个页, 用于原地扩大已经分配的内存.
+ *        直接映射区中的内存不能扩大
+ *
+ * @param pf 内存所在的内存池, PF_KERNEL或者PF_USER
+ * @param vaddr_end 已经分配的最后一个页之后的地址
+ * @param pg_cnt 要追加的页数
+ * @return true 追加成功
+ * @return false 之后的虚拟页已经被使用, 或者没有物理页, 此时没有分配任何页
+ */
+static bool malloc_page_extend(pool_flags_t pf, void *vaddr_end, uint32_t pg_cnt){
+    uint32_t vaddr = (uint32_t) vaddr_end;
+    // 用户页只保留虚拟地址, 与之前的普通区域合并
+    if (pf == PF_USER)
+        return vma_add(running_thread(), vaddr, pg_cnt, 0) != NULL;
+    if (vaddr >= DIRECT_MAP_BASE)
+        return false;
+
+    uint32_t bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
+    if (bit_idx + pg_cnt > kernel_vaddr.vaddr_bitmap.btmp_byte_len * 8)
+        return false;
+    for (uint32_t cnt = 0; cnt < pg_cnt; cnt++)
+        if (bitmap_scan_test(&kernel_vaddr.vaddr_bitmap, bit_idx + cnt))
+            return false;
+    bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx, pg_cnt, 1);
+
+    for (uint32_t cnt = 0; cnt < pg_cnt; cnt++){
+        void *page_phyaddr = palloc(&kernel_pool);
+        if (page_phyaddr == NULL){
+            // 已经映射的页连同虚拟页一起释放, 剩下的只释放虚拟页
+            if (cnt > 0)
+                mfree_page(PF_KERNEL, vaddr_end, cnt);
+            bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx + cnt, pg_cnt - cnt, 0);
+            return false;
+        }
+        page_table_add((void *) (vaddr + cnt * PG_SIZE), page_phyaddr);
+    }
+    return true;
+}
+
+
+/**
+ * @brief malloc_kernel_page_zero用于从内核内存池中分配pg_cnt个内容全为0的页. 单页优先使用预先清0的页,
+ *        多个页则优先使用直接映射区, 分配后同步清0
+ * 
+ * @param pg_cnt 要分配的页
+ * @return void* 若分配成功，则返回虚拟地址，失败则返回NULL
+ */
+static void *malloc_kernel_page_zero(uint32_t pg_cnt){
+    if (pg_cnt > 1){
+        void *vaddr = malloc_page(PF_KERNEL | PF_LARGE, pg_cnt);
+        if (vaddr != NULL)
+            memset(vaddr, 0, pg_cnt * PG_SIZE);
+        return vaddr;
+    }
+
+    void *vaddr = vaddr_get(PF_KERNEL, 1);
+    if (vaddr == NULL)
+        return NULL;
+    void *page_phyaddr = palloc_zero(&kernel_pool);
+    if (page_phyaddr == NULL){
+        vaddr_remove(PF_KERNEL, vaddr, 1);
+        return NULL;
+    }
+    page_table_add(vaddr, page_phyaddr);
+    return vaddr;
+}
+
+
+/**
+ * @brief get_kernel_page用于从内核内存池中申请pg_cnt个页
+ * 
+ * @param pg_cnt 要申请的页的数量
+ * @return void* 申请成功则返回得到的虚拟地址，若失败则返回NULL
+ */
+void *get_kernel_pages(uint32_t pg_cnt){
+    mutex_acquire(&kernel_pool.mutex);
+    void* vaddr = malloc_kernel_page_zero(pg_cnt);
+    mutex_release(&kernel_pool.mutex);
+    return vaddr;
+}
+
+
+/**
+ * @brief dma_alloc用于分配size字节物理上连续的内存, 供总线主控DMA(例如PRD表和DMA缓冲区)使用. 内存直接使用伙伴系统中的块,
+ *        通过直接映射区访问, 所以不需要修改页表. 内核内存池中没有足够大的块的时候再从用户内存池中分配, 两者都在直接映射区中
+ *
+ * @details 一个按照2^k个页对齐的2^k个页的块不会跨越任何更大的2的幂的边界, 所以有边界限制的时候, 起始地址同时按照
+ *          不小于size的2的幂对齐即可
+ *
+ * @param size 需要的字节数, 分配的时候按页取整
+ * @param align 物理地址的对齐, 必须是2的幂, 不足一页的按一页对齐
+ * @param boundary 分配的内存不能跨越的物理地址边界, 例如PRD表和PRD描述的缓冲区不能跨越64KB. 必须是2的幂, 为0表示没有限制
+ * @param phy_addr 存放分配的内存的物理地址
+ * @return void* 若分配成功, 则返回直接映射区中的虚拟地址, 内容全为0; 失败或者size超过了boundary则返回NULL
+ */
+void *dma_alloc(uint32_t size, uint32_t align, uint32_t boundary, uint32_t *phy_addr){
+    ASSERT(size > 0 && (align & (align - 1)) == 0 && (boundary & (boundary - 1)) == 0);
+    if (boundary != 0 && size > boundary)
+        return NULL;
+
+    uint32_t pg_cnt = DIV_CEILING(size, PG_SIZE);
+    uint32_t align_pages = align > PG_SIZE ? align / PG_SIZE : 1;
+    if (boundary != 0 && align_pages < (1U << pg_order(pg_cnt)))
+        align_pages = 1 << pg_order(pg_cnt);
+
+    pool_t *pools[2] = {&kernel_pool, &user_pool};
+    for (uint32_t pool_idx = 0; pool_idx < 2; pool_idx++){
+        mutex_acquire(&pools[pool_idx]->mutex);
+        void *page_phyaddr = palloc_contig_align(pools[pool_idx], pg_cnt, align_pages);
+        mutex_release(&pools[pool_idx]->mutex);
+        if (page_phyaddr == NULL)
+            continue;
+
+        *phy_addr = (uint32_t) page_phyaddr;
+        void *vaddr = kmap((uint32_t) page_phyaddr);
+        memset(vaddr, 0, pg_cnt * PG_SIZE);
+        return vaddr;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief dma_free用于释放dma_alloc分配的内存
+ *
+ * @param vaddr dma_alloc返回的虚拟地址
+ * @param size 分配时的字节数
+ */
+void dma_free(void *vaddr, uint32_t size){
+    ASSERT((uint32_t) vaddr >= DIRECT_MAP_BASE && (uint32_t) vaddr < direct_map_end);
+    uint32_t page_phyaddr = (uint32_t) vaddr - DIRECT_MAP_BASE;
+    for (uint32_t cnt = 0; cnt < DIV_CEILING(size, PG_SIZE); cnt++)
+        pfree(page_phyaddr + cnt * PG_SIZE);
+}
+
+
+
+
+/* ================================================================================================================== */
+/* ================================================= 用户进程分配一个页 ================================================ */
+/* ================================================================================================================== */
+
+
+/**
+ * @brief get_user_page用于从用户内存池中申请pg_cnt个页
+ * 
+ * @param pg_cnt 要申请的页的数量
+ * @return void* 申请成功则返回得到的虚拟地址，若失败则返回NULL
+ */
+void* get_user_pages(uint32_t pg_cnt){
+    // 未来可能会有多个用户进程，因此需要上锁
+    mutex_acquire(&user_pool.mutex);
+    // 用户页在第一次访问时由缺页中断分配并清0, 所以这里不需要memset
+    void *vaddr = malloc_page(PF_USER, pg_cnt);
+    mutex_release(&user_pool.mutex);
+    return vaddr;
+}
+
+
+/**
+ * @brief free_user_pages用于释放当前进程从vaddr开始的pg_cnt个用户页, 包括已经映射的物理页和虚拟页
+ * 
+ * @param vaddr 要释放的第一个页
+ * @param pg_cnt 要释放的页数
+ */
+void free_user_pages(void *vaddr, uint32_t pg_cnt){
+    mutex_acquire(&user_pool.mutex);
+    mfree_page(PF_USER, vaddr, pg_cnt);
+    mutex_release(&user_pool.mutex);
+}
+
+
+
+/* ================================================================================================================== */
+/* ================================================== 缺页中断处理 ==================================================== */
+/* ================================================================================================================== */
+
+// 用户进程的堆和栈都是按需分配的:
+//      1. 分配用户内存的时候只在用户进程的区域(vma_t)中保留虚拟页, 并不分配物理页, 也不修改页表
+//      2. 第一次读一个保留的虚拟页的时候, 将其只读映射到全0的零页, 读出的内容都是0, 不需要分配物理页
+//      3. 第一次写一个保留的虚拟页(或者写映射到零页的虚拟页)的时候, 才分配一个清0的物理页, 可读写映射
+// fork的时候父子进程写时复制(Copy-On-Write)共享所有的用户页:
+//      1. fork只复制页表, 父子进程中可写的页都改为只读, 并在页表项中设置PG_COW
+//      2. 第一次写PG_COW的页的时候, 若该页的引用计数大于1, 即还被其他进程共享, 则复制一份新页; 否则直接恢复为可写
+// 用户内存池耗尽的时候, 用户页会被换出(压缩存放在内存中或者写入交换分区), 页表项中记录槽号, 再次访问的时候从槽中读回, 见页回收部分
+// 访问没有保留的用户虚拟页, 或者访问内核地址引起的缺页依旧是错误
+
+/// 缺页中断错误码的P位, 为1表示是页保护错误, 为0表示页不存在
+#define PF_ERR_P 0x1
+/// 缺页中断错误码的W/R位, 为1表示是写操作引起的缺页
+#define PF_ERR_W 0x2
+/// CR0的WP位, 为1时内核写只读的用户页也会引起缺页中断
+#define CR0_WP 0x00010000
+
+
+/**
+ * @brief page_is_zero用于判断pg_phy_addr是否是共享的零页. 零页只读映射在多个用户进程中, 内核始终持有零页的一个引用, 所以零页不会被释放
+ *
+ * @param pg_phy_addr 物理页地址
+ * @return true pg_phy_addr是零页
+ * @return false pg_phy_addr不是零页
+ */
+static bool page_is_zero(uint32_t pg_phy_addr){
+    return (pg_phy_addr & 0xFFFFF000) == zero_page_phyaddr;
+}
+
+
+/**
+ * @brief kmap用于获得pg_phy_addr所在的物理页在直接映射区中的内核虚拟地址, 用于访问没有内核虚拟地址的页表和内核内存池中的物理页.
+ *        高端内存中的页不在直接映射区中, 要使用kmap_page
+ *
+ * @param pg_phy_addr 需要访问的物理页
+ * @return void* 物理页在直接映射区中的地址
+ */
+void *kmap(uint32_t pg_phy_addr){
+    ASSERT(pg_phy_addr < direct_map_end - DIRECT_MAP_BASE);
+    return (void *) (DIRECT_MAP_BASE + (pg_phy_addr & 0xFFFFF000));
+}
+
+
+/**
+ * @brief kmap_page用于获得任意物理页在内核中可以访问的地址. 直接映射区中的页直接返回其地址, 高端内存中的页临时映射到
+ *        临时映射区中. 用户页可能在高端内存中, 所以内核访问用户页的内容都要使用kmap_page, 用完以后调用kunmap_page
+ *
+ * @note 每个调用者同时只持有很少的临时映射, 所以临时映射区用完说明有调用者没有解除映射
+ *
+ * @param pg_phy_addr 需要访问的物理页
+ * @return void* 物理页在内核中的地址, 所有进程中都有效
+ */
+void *kmap_page(uint32_t pg_phy_addr){
+    if (pg_phy_addr < direct_map_end - DIRECT_MAP_BASE)
+        return kmap(pg_phy_addr);
+
+    intr_status_t old_status = intr_disable();
+    uint32_t slot = kmap_next;
+    for (uint32_t cnt = 0; cnt < KMAP_SLOTS && (kmap_used[slot / 32] & (1U << (slot % 32))); cnt++)
+        slot = (slot + 1) % KMAP_SLOTS;
+    if (kmap_used[slot / 32] & (1U << (slot % 32)))
+        PANIC("kmap_page: no free kmap slot");
+    kmap_used[slot / 32] |= 1U << (slot % 32);
+    kmap_next = (slot + 1) % KMAP_SLOTS;
+
+    // 页表项在解除映射的时候已经刷新了TLB, 所以这里不需要刷新
+    uint32_t vaddr = KMAP_BASE + slot * PG_SIZE;
+    *pte_addr(vaddr) = (pg_phy_addr & 0xFFFFF000) | PG_G | PG_US_S | PG_RW_W | PG_P_1;
+    intr_set_status(old_status);
+    return (void *) vaddr;
+}
+
+
+/**
+ * @brief kunmap_page用于解除kmap_page建立的临时映射, 直接映射区中的地址不需要解除
+ *
+ * @param vaddr kmap_page返回的地址
+ */
+void kunmap_page(void *vaddr){
+    if ((uint32_t) vaddr < KMAP_BASE)
+        return;
+
+    uint32_t slot = ((uint32_t) vaddr - KMAP_BASE) / PG_SIZE;
+    intr_status_t old_status = intr_disable();
+    ASSERT(kmap_used[slot / 32] & (1U << (slot % 32)));
+    *pte_addr((uint32_t) vaddr) = 0;
+    tlb_flush_page((uint32_t) vaddr);
+    kmap_used[slot / 32] &= ~(1U << (slot % 32));
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief page_table_fork用于将当前用户进程的用户空间以写时复制的方式共享给子进程. 子进程的页表从内核物理内存池中分配,
+ *        父子进程中可写的页都被改为只读并设置PG_COW. 该函数只复制页表, 所以开销只和页表的大小有关
+ *
+ * @param child_pgdir 子进程的页目录表, 其中用户空间的页目录项必须都为空
+ * @return int32_t 成功则返回0, 失败则返回-1. 失败时已经复制的页表依旧在子进程的页目录表中, 需要调用page_table_fork_undo释放
+ */
+int32_t page_table_fork(uint32_t *child_pgdir){
+    ASSERT(running_thread()->pgdir != NULL);
+
+    // 只需要检查进程建立过的页表, 开销和进程实际使用的地址空间成正比
+    task_struct_t *cur = running_thread();
+    for (uint32_t pde_idx = 0; pde_idx < USER_PDE_CNT; pde_idx++){
+        if (!pgtable_test(cur, pde_idx) || !(*pde_addr(pde_idx << 22) & PG_P_1))
+            continue;
+
+        // 分配页表的时候可能会阻塞, 所以要在填写页表之前分配
+        mutex_acquire(&kernel_pool.mutex);
+        uint32_t pt_phyaddr = (uint32_t) palloc(&kernel_pool);
+        mutex_release(&kernel_pool.mutex);
+        if (pt_phyaddr == 0){
+            // 已经改为只读的页表项同样需要刷新TLB
+            tlb_flush_all(false);
+            return -1;
+        }
+
+        intr_status_t old_status = intr_disable();
+        uint32_t *parent_pt = pte_addr(pde_idx << 22);
+        uint32_t *child_pt = kmap(pt_phyaddr);
+        for (uint32_t pte_idx = 0; pte_idx < 1024; pte_idx++){
+            uint32_t pte = parent_pt[pte_idx];
+            if (pte & PG_P_1){
+                // 可写的页父子进程都改为只读, 只读的页(写时复制的页和零页)直接共享, 子进程的映射增加一个引用
+                if (pte & PG_RW_W)
+                    pte = (pte & ~PG_RW_W) | PG_COW;
+                parent_pt[pte_idx] = pte;
+                get_page(phy2page(pte & 0xFFFFF000));
+            } else if (pte & PG_SWAP)
+                // 换出的页父子进程共享槽, 各自换入的时候得到自己的一份
+                swap_dup(SWAP_PTE_SLOT(pte));
+            child_pt[pte_idx] = pte;
+        }
+        child_pgdir[pde_idx] = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+        pgtable_pages++;
+        intr_set_status(old_status);
+    }
+
+    // 父进程大量的页表项从可写变为了只读, 直接重新加载cr3刷新整个TLB
+    tlb_flush_all(false);
+    return 0;
+}
+
+
+/**
+ * @brief page_table_fork_undo用于在fork失败的时候释放page_table_fork为子进程复制的页表. 页表中共享的页和槽归还子进程
+ *        的那一次引用, 子进程自己的页直接释放. 子进程没有运行过, 也不在线程队列中, 所以只能通过直接映射区访问它的页表
+ *
+ * @param child_pgdir 子进程的页目录表
+ */
+void page_table_fork_undo(uint32_t *child_pgdir){
+    for (uint32_t pde_idx = 0; pde_idx < USER_PDE_CNT; pde_idx++){
+        if (!(child_pgdir[pde_idx] & PG_P_1))
+            continue;
+
+        uint32_t pt_phyaddr = child_pgdir[pde_idx] & 0xFFFFF000;
+        uint32_t *child_pt = kmap(pt_phyaddr);
+        for (uint32_t pte_idx = 0; pte_idx < 1024; pte_idx++){
+            uint32_t pte = child_pt[pte_idx];
+            if (pte & PG_P_1)
+                put_page(phy2page(pte & 0xFFFFF000));
+            else if (pte & PG_SWAP)
+                swap_put(SWAP_PTE_SLOT(pte));
+        }
+        child_pgdir[pde_idx] = 0;
+        free_page_table(pt_phyaddr);
+    }
+}
+
+
+/**
+ * @brief page_fault_cow用于处理对写时复制页的写操作. 若该页还被其他进程共享, 则复制一份新页替换原来的映射;
+ *        否则owner是最后一个使用者, 直接恢复可写即可
+ *
+ * @param owner 写该页的进程, 一般是当前进程. fork的时候也用于在子进程运行之前为它复制页
+ * @param vaddr 引起缺页的虚拟页
+ * @param pte vaddr在owner页表中的页表项
+ * @return true 处理成功
+ * @return false 没有可用的物理页
+ */
+static bool page_fault_cow(task_struct_t *owner, uint32_t vaddr, uint32_t *pte){
+    // 缺页可能发生在已经持有用户内存池锁的时候, 好在锁是可重入的. 分配的时候可能会阻塞, 所以先分配
+    void *page_phyaddr = NULL;
+    if (phy2page(*pte & 0xFFFFF000)->refcount > 1){
+        page_phyaddr = palloc_user(false);
+        if (page_phyaddr == NULL)
+            return false;
+    }
+
+    intr_status_t old_status = intr_disable();
+    page_t *page = phy2page(*pte & 0xFFFFF000);
+    if (page->refcount == 1){
+        // 在分配的时候其他共享者已经复制走了, owner独占该页. 该页原来的拥有者可能是别的进程, 改为owner才能被回收.
+        // 合并得到的页恢复可写以后内容会改变, 不能再作为合并的目标
+        page->flags &= ~PAGE_KSM;
+        page_set_user(page, owner, vaddr);
+        *pte = (*pte & ~PG_COW) | PG_RW_W;
+        tlb_flush_page(vaddr);
+        intr_set_status(old_status);
+        if (page_phyaddr != NULL)
+            pfree((uint32_t) page_phyaddr);
+        return true;
+    }
+
+    // owner的页表不一定是当前的页表, 所以通过临时映射复制
+    void *copy = kmap_page((uint32_t) page_phyaddr);
+    void *orig = kmap_page(page2phy(page));
+    memcpy(copy, orig, PG_SIZE);
+    kunmap_page(orig);
+    kunmap_page(copy);
+    page_set_user(phy2page((uint32_t) page_phyaddr), owner, vaddr);
+    *pte = (uint32_t) page_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    tlb_flush_page(vaddr);
+    put_page(page);
+    intr_set_status(old_status);
+    return true;
+}
+
+
+/**
+ * @brief page_fault_file用于处理文件映射的缺页: 分配一个物理页, 从文件中读入对应的内容, 并按照映射的权限映射到vaddr
+ *
+ * @param vma vaddr所在的文件映射
+ * @param vaddr 引起缺页的虚拟页
+ * @return true 处理成功
+ * @return false 没有可用的物理页, 或者没有物理页用于分配页表
+ */
+static bool page_fault_file(vma_t *vma, uint32_t vaddr){
+    void *page_phyaddr = palloc_user(false);
+    if (page_phyaddr == NULL)
+        return false;
 
-    // 对vaddr进行合法性检查
-    // 要释放的页必须要大于等于1页, vaddr也必须指向虚拟页开始
-    ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
-    pg_phy_addr = addr_v2p(vaddr);
-    // 要释放的物理页必须是整数, 此外不能释放: 底端1MB的内核, 0x100000~0x101000的页目录表, 0x101000~0x102000的第一个页表
-    ASSERT((pg_phy_addr % PG_SIZE == 0) && pg_phy_addr >= 0x102000);
-    
-    // 释放vaddr执行的内存要干的三件事
-    //      1. 释放vaddr所在的物理页
-    //      2. 释放vaddr所在的虚拟页
-    //      3. 在页表中释放虚拟页和物理页的映射
-    vaddr -= PG_SIZE;
-    if (pg_phy_addr >= user_pool.phy_addr_start) {
-        // 释放用户物理内存池
-        while (page_cnt++ < pg_cnt){
-            vaddr += PG_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
-            ASSERT((pg_phy_addr % PG_SIZE == 0) && user_pool.phy_addr_start <= pg_phy_addr);
-
-            // 先释放物理页
-            pfree(pg_phy_addr);
-            // 稍后统一释放虚拟页
-
-            // 清除虚拟页和物理页的映射
-            page_table_pte_remove(vaddr);
-        }
-        // 统一释放虚拟页
-        vaddr_remove(pf, _vaddr, pg_cnt);
-    } else {
-        while (page_cnt++ < pg_cnt){
-            vaddr += PG_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
-            ASSERT((pg_phy_addr % PG_SIZE == 0) && kernel_pool.phy_addr_start <= pg_phy_addr && pg_phy_addr < user_pool.phy_addr_start)
+    // 读文件的时候会阻塞, 不能持有内存池的锁. 页直接通过内核中的映射读入, 不经过文件系统的缓冲区
+    void *content = kmap_page((uint32_t) page_phyaddr);
+    mmap_fill_page(vma, vaddr, content);
+    kunmap_page(content);
+
+    if (!page_table_map((void *) vaddr, page_phyaddr, PG_US_U | (vma->prot & PROT_WRITE ? PG_RW_W : PG_RW_R) | PG_P_1)){
+        pfree((uint32_t) page_phyaddr);
+        return false;
+    }
+    page_set_user(phy2page((uint32_t) page_phyaddr), running_thread(), vaddr);
+    return true;
+}
 
-            // 先释放物理页
-            pfree(pg_phy_addr);
-            // 稍后统一释放虚拟页
 
-            // 清除虚拟页和物理页的映射
-            page_table_pte_remove(vaddr);
+/**
+ * @brief page_fault_swap用于将换出的页读回: 分配一个物理页, 读入槽中的内容, 然后释放对槽的引用.
+ *        换入的页是owner私有的, 所以原来可写或者写时复制的页都直接可写映射
+ *
+ * @param owner 访问该页的进程, 一般是当前进程. fork的时候也用于在子进程运行之前为它换入页
+ * @param vaddr 引起缺页的虚拟页
+ * @param pte vaddr在owner页表中的页表项, 其中记录了槽号
+ * @return true 处理成功
+ * @return false 没有可用的物理页
+ */
+static bool page_fault_swap(task_struct_t *owner, uint32_t vaddr, uint32_t *pte){
+    void *page_phyaddr = palloc_user(false);
+    if (page_phyaddr == NULL)
+        return false;
+
+    // 该页可能正在被换出, 获得交换的锁以后槽中的内容才是完整的
+    mutex_acquire(&swap_mutex);
+    uint32_t swap_pte = *pte;
+    void *content = kmap_page((uint32_t) page_phyaddr);
+    swap_read(SWAP_PTE_SLOT(swap_pte), content);
+    kunmap_page(content);
+    swap_put(SWAP_PTE_SLOT(swap_pte));
+    page_set_user(phy2page((uint32_t) page_phyaddr), owner, vaddr);
+    // 页表项原来不存在, TLB中没有缓存, 不需要刷新
+    *pte = (uint32_t) page_phyaddr | PG_US_U | (swap_pte & (PG_RW_W | PG_COW) ? PG_RW_W : PG_RW_R) | PG_P_1;
+    mem_stat_add(&owner->rss_pages, 1);
+    mutex_release(&swap_mutex);
+    return true;
+}
+
+
+/**
+ * @brief page_fault_demand用于为当前用户进程按需映射vaddr所在的虚拟页
+ *
+ * @param vaddr 引起缺页的虚拟地址
+ * @param write 缺页是否是由写操作引起的
+ * @return true 成功映射, 引起缺页的指令可以重新执行
+ * @return false vaddr不是当前进程保留的虚拟页, 或者没有可用的物理页(包括分配页表的时候)
+ */
+static bool page_fault_demand(uint32_t vaddr, bool write){
+    task_struct_t *cur = running_thread();
+    vaddr &= 0xFFFFF000;
+    if (cur->pgdir == NULL || vaddr >= 0xC0000000)
+        return false;
+
+    // 只有在进程的区域中保留了的虚拟页才能按需分配, mmap区域还要检查权限
+    vma_t *vma = vma_find(cur, vaddr);
+    if (vma == NULL || ((vma->flags & VMA_MMAP) && write && !(vma->prot & PROT_WRITE)))
+        return false;
+
+    uint32_t *pte = pte_addr(vaddr);
+    // 换出的页从槽中读回
+    if ((*pde_addr(vaddr) & PG_P_1) && !(*pte & PG_P_1) && (*pte & PG_SWAP))
+        return page_fault_swap(cur, vaddr, pte);
+
+    if ((*pde_addr(vaddr) & PG_P_1) && (*pte & PG_P_1)){
+        // 页已经存在, 只有写写时复制的页和零页才是合法的
+        if (!write)
+            return false;
+        if (*pte & PG_COW)
+            return page_fault_cow(cur, vaddr, pte);
+        if (!page_is_zero(*pte))
+            return false;
+        // 先取消零页的映射, 下面再分配物理页
+        page_table_pte_remove(vaddr);
+        *pte = 0;
+        put_page(phy2page(zero_page_phyaddr));
+    }
+
+    // 文件映射的页从文件中读入
+    if (vma->inode != NULL)
+        return page_fault_file(vma, vaddr);
+
+    if (!write){
+        get_page(phy2page(zero_page_phyaddr));
+        if (!page_table_map((void *) vaddr, (void *) zero_page_phyaddr, PG_US_U | PG_RW_R | PG_P_1)){
+            put_page(phy2page(zero_page_phyaddr));
+            return false;
         }
-        vaddr_remove(pf, _vaddr, pg_cnt);
+        return true;
+    }
+
+    // 缺页可能发生在已经持有用户内存池锁的时候, 例如arena_alloc_block初始化新的arena, 好在锁是可重入的
+    void *page_phyaddr = palloc_user(true);
+    if (page_phyaddr == NULL)
+        return false;
+    mutex_acquire(&user_pool.mutex);
+    bool mapped = page_table_add((void *) vaddr, page_phyaddr);
+    mutex_release(&user_pool.mutex);
+    if (!mapped){
+        pfree((uint32_t) page_phyaddr);
+        return false;
     }
+    page_set_user(phy2page((uint32_t) page_phyaddr), cur, vaddr);
+    return true;
 }
 
-/* ================================================================================================================== */
-/* ================================================== 内核分配一个页 ================================================== */
-/* ================================================================================================================== */
 
 /**
- * @brief pte_addr用于获得指向给定虚拟地址所在的物理页的地址，即pte中的物理地址
- * 
- * @param vaddr 需要获得pde地址的虚拟地址
- * @return uint32_t* 虚拟地址的pte地址
+ * @brief page_fault_handler是缺页中断的处理函数. 按需分配的页和写时复制的页处理后直接返回, 重新执行引起缺页的指令;
+ *        其他的缺页则是真正的错误: 用户态引起的缺页, 以及用户进程访问用户地址引起的缺页(例如写只读的映射, 野指针,
+ *        没有可用的物理页)只结束该进程; 内核访问内核地址引起的缺页是内核的错误, 直接停机
+ *
+ * @param vec_nr 中断向量号, kernel.S中在压入中断向量号之前压入了intr_stack_t的其余部分,
+ *        所以vec_nr的地址就是intr_stack_t的地址
  */
-uint32_t* pte_addr(uint32_t vaddr){
-    // 先访问页目录本身，然后访问页目录的偏移，得到PTE的地址
-    uint32_t *pte = (uint32_t*) (0xFFC00000 + ((vaddr & 0xFFC00000) >> 10) + PTE_IDX(vaddr) * 4);
-    return pte;
+static void page_fault_handler(uint32_t vec_nr){
+    intr_stack_t *frame = (intr_stack_t *) &vec_nr;
+    uint32_t fault_vaddr;
+    // 缺页中断发生后，CPU会将缺页的地址放到CR2上
+    asm volatile ("movl %%cr2, %0" : "=r" (fault_vaddr));
+
+    if (page_fault_demand(fault_vaddr, frame->err_code & PF_ERR_W))
+        return;
+
+    task_struct_t *cur = running_thread();
+    bool user_fault = (frame->cs & 3) == 3 || (cur->pgdir != NULL && fault_vaddr < 0xC0000000);
+    put_str("\n#PF Page-Fault Exception: 0x"), put_int(vec_nr);
+    put_str("\ninvalid addr: 0x"), put_int(fault_vaddr);
+    put_str(", error code: 0x"), put_int(frame->err_code);
+    put_str(", eip: 0x"), put_int((uint32_t) frame->eip), put_char('\n');
+    if (!user_fault)
+        PANIC("page fault");
+
+    put_str("process "), put_str(cur->name), put_str(" (pid 0x"), put_int(cur->pid), put_str(") killed\n");
+    sys_exit(-1);
 }
 
 
 /**
- * @brief pde_addr用于获得指向给定虚拟地址所在的页表的地址，即pde中的物理地址
- * 
- * @param vaddr 需要获得pde地址的虚拟地址
- * @return uint32_t* 虚拟地址的pte地址
+ * @brief page_fault_init用于初始化缺页中断处理: 分配零页, 开启CR0的WP位, 并注册缺页中断处理函数
+ *
+ * @note 必须开启WP位, 否则内核代为写用户缓冲区(例如read系统调用)的时候会直接写到共享的零页或者写时复制的页中
  */
-uint32_t* pde_addr(uint32_t vaddr){
-    uint32_t *pde = (uint32_t*) ((0xFFFFF000) + PDE_IDX(vaddr) * 4);
-    return pde;
+static void page_fault_init(void){
+    list_init(&lru_list);
+    void *zero_page = get_kernel_pages(1);
+    ASSERT(zero_page != NULL);
+    zero_page_phyaddr = addr_v2p((uint32_t) zero_page);
+
+    uint32_t cr0;
+    asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+    asm volatile ("movl %0, %%cr0" : : "r" (cr0 | CR0_WP) : "memory");
+
+    register_handler(0x0e, page_fault_handler);
 }
 
 
 
+/* ================================================================================================================== */
+/* ==================================================== 页回收 ======================================================== */
+/* ================================================================================================================== */
+
+// 用户内存池耗尽的时候, 使用时钟(second chance)算法换出用户页:
+//      1. 进程独占的用户页在映射的时候加入LRU链表的尾部, 链表头就是时钟的指针
+//      2. 从链表头取出一个页, 若页表项的A位为1, 说明最近被访问过, 清除A位后放回链表尾部, 给它第二次机会
+//      3. 否则分配一个槽, 页表项改为记录槽号的换出项, 将页存入槽后释放物理页. 同值页和能压缩的页存放在内存中,
+//         其余的页写入交换分区, 见swap.h
+// 被多个进程共享的页(写时复制的页)无法修改所有的页表项, 所以不会换出, 只是放回链表尾部等待共享结束
+
 
 /**
- * @brief malloc_page从pf指定的内存池中分配pg_cnt个页
- * 
- * @param pf 指定要分配的内存池
- * @param pg_cnt 要分配的页
- * @return void* 若分配成功，则返回虚拟地址，失败则返回NULL
+ * @brief page_owner_pte用于获得用户页page在拥有者页表中的页表项. 拥有者必须还在运行, 并且页表项确实映射了page
+ *
+ * @param page 用户页
+ * @return uint32_t* 成功则返回页表项在直接映射区中的地址; 若page被共享, 或者无法确定映射page的页表项, 则返回NULL
  */
-void *malloc_page(pool_flags_t pf, uint32_t pg_cnt){
-    ASSERT(pg_cnt > 0 && pg_cnt < 3840);
-    // malloc_page的流程：
-    //      1. 首先需要在虚拟内存池中申请得到一个虚拟页
-    //      2. 然后需要在物理内存池中申请得到一个物理页
-    //      3. 最后在页表中完成虚拟页和物理页的映射, 即完成虚拟地址转物理地址
+uint32_t *page_owner_pte(page_t *page){
+    task_struct_t *owner = page->owner;
+    // 拥有者可能已经退出, 所以先确认它还在线程队列中, 然后才能访问它的TCB. 退出中的进程的页表已经在释放了
+    if (page->refcount != 1 || owner == NULL || !elem_find(&thread_all_list, &owner->all_list_tag) ||
+        owner->pgdir == NULL || owner->status == TASK_HANGING || owner->status == TASK_DIED)
+        return NULL;
 
-    // 分配虚拟页
-    void* vaddr_start = vaddr_get(pf, pg_cnt);
-    if (vaddr_start == NULL)
+    uint32_t pde = owner->pgdir[PDE_IDX(page->vaddr)];
+    if (!(pde & PG_P_1))
+        return NULL;
+    uint32_t *pte = (uint32_t *) kmap(pde & 0xFFFFF000) + PTE_IDX(page->vaddr);
+    if (!(*pte & PG_P_1) || (*pte & 0xFFFFF000) != page2phy(page))
         return NULL;
+    return pte;
+}
 
-    uint32_t vaddr = (uint32_t) vaddr_start, cnt = pg_cnt;
-    pool_t* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
 
-    // 分配物理页, 并对每个物理页进行映射
-    while (cnt-- > 0){
-        void *page_phyaddr = palloc(mem_pool);
-        // 如果申请物理页失败，已经获得虚拟页要归还，后面再实现，也可以实现换页
-        if (page_phyaddr == NULL)
-            return NULL;
-        // 在二级页表中插入页表项
-        page_table_add((void*) vaddr, page_phyaddr);
-        // 下一个虚拟页
-        vaddr += PG_SIZE;
-    }
-    return vaddr_start;
+/**
+ * @brief lru_flush_page用于在修改了owner的页表项之后刷新TLB. 只有owner的页目录表正在使用的时候TLB中才可能有缓存
+ *
+ * @param owner 页表项所属的进程
+ * @param vaddr 页表项对应的虚拟地址
+ */
+static void lru_flush_page(task_struct_t *owner, uint32_t vaddr){
+    uint32_t cr3;
+    asm volatile ("movl %%cr3, %0" : "=r" (cr3));
+    if ((cr3 & 0xFFFFF000) == owner->pgdir_phyaddr)
+        tlb_flush_page(vaddr);
 }
 
 
 /**
- * @brief get_kernel_page用于从内核内存池中申请pg_cnt个页
+ * @brief mem_reclaim用于在物理内存不足的时候将最多cnt个用户页换出, 换出的物理页归还给用户内存池
  * 
- * @param pg_cnt 要申请的页的数量
- * @return void* 申请成功则返回得到的虚拟地址，若失败则返回NULL
+ * @param cnt 最多换出的页数
+ * @return uint32_t 实际回收的页数. 没有启用交换, 槽已经用完, 或者当前线程持有用户内存池的锁的时候返回0
  */
-void *get_kernel_pages(uint32_t pg_cnt){
-    mutex_acquire(&kernel_pool.mutex);
-    void* vaddr = malloc_page(PF_KERNEL, pg_cnt);
-    if (vaddr != NULL)
-        memset(vaddr, 0, pg_cnt * PG_SIZE);
-    mutex_release(&kernel_pool.mutex);
-    return vaddr;
-}
+uint32_t mem_reclaim(uint32_t cnt){
+    if (!swap_usable() || user_pool.mutex.holder == running_thread())
+        return 0;
+
+    mutex_acquire(&swap_mutex);
+    uint32_t reclaimed = 0;
+    // 每个页最多检查两次, 第一次清除A位, 第二次就可以换出了
+    uint32_t scan = 2 * list_len(&lru_list);
+    while (reclaimed < cnt && scan-- > 0){
+        intr_status_t old_status = intr_disable();
+        if (list_empty(&lru_list)){
+            intr_set_status(old_status);
+            break;
+        }
+        page_t *page = elem2entry(page_t, lru, list_pop(&lru_list));
+        uint32_t *pte = page_owner_pte(page);
+        if (pte == NULL){
+            // 共享的页等共享结束; 其他的页等下次被独占映射的时候再加入链表
+            if (page->refcount > 1)
+                list_append(&lru_list, &page->lru);
+            else
+                page->flags &= ~PAGE_LRU;
+            intr_set_status(old_status);
+            continue;
+        }
+
+        task_struct_t *owner = page->owner;
+        if (*pte & PG_A){
+            // 第二次机会
+            *pte &= ~PG_A;
+            lru_flush_page(owner, page->vaddr);
+            list_append(&lru_list, &page->lru);
+            intr_set_status(old_status);
+            continue;
+        }
 
+        // 不能压缩又不能写交换分区的页留在内存中
+        void *content = kmap_page(page2phy(page));
+        bool staged = swap_stage(content);
+        kunmap_page(content);
+        if (!staged){
+            list_append(&lru_list, &page->lru);
+            intr_set_status(old_status);
+            continue;
+        }
+        int32_t slot = swap_alloc();
+        if (slot == -1){
+            list_append(&lru_list, &page->lru);
+            intr_set_status(old_status);
+            break;
+        }
+        // 先取消映射再写入槽, 这样写的时候拥有者不会再修改该页. 拥有者此时访问该页会在换入的时候等待swap_mutex
+        *pte = SWAP_PTE(slot, *pte);
+        owner->rss_pages--;
+        lru_flush_page(owner, page->vaddr);
+        page->flags &= ~PAGE_LRU;
+        intr_set_status(old_status);
+
+        // 物理页的最后一个引用在这里释放, 无处存放的时候槽持有物理页, 不算作回收
+        if (swap_write(slot, page))
+            reclaimed++;
+        put_page(page);
+    }
+    mutex_release(&swap_mutex);
+    return reclaimed;
+}
 
 
 
 /* ================================================================================================================== */
-/* ================================================= 用户进程分配一个页 ================================================ */
+/* ==================================================== 页合并 ======================================================== */
 /* ================================================================================================================== */
 
+// 内容相同的独占用户页(例如多个进程中相同的程序代码, 全0的栈和堆)由ksm.c在系统空闲的时候找出来,
+// 合并为一个只读的写时复制页, 全0的页直接合并到零页. 写合并后的页的时候和fork以后一样复制一份
+
 
 /**
- * @brief get_user_page用于从用户内存池中申请pg_cnt个页
- * 
- * @param pg_cnt 要申请的页的数量
- * @return void* 申请成功则返回得到的虚拟地址，若失败则返回NULL
+ * @brief page_merge用于将独占的用户页page合并到内容相同的kpage中: page的页表项改为只读映射kpage, 原来可写的页
+ *        设置PG_COW, 写的时候再复制一份. 调用者需要关中断, 并在同一个关中断的区间内确认两个页的内容相同
+ *
+ * @param page 需要合并的用户页
+ * @param kpage 合并的目标. 为NULL时合并到零页, 只有可写的页才能合并到零页; 为page时只是将page改为只读, 作为以后合并的目标
+ * @return true 合并成功, page为kpage以外的页的时候, page的引用已经释放
+ * @return false page不是独占的用户页, 或者不能合并到零页
  */
-void* get_user_pages(uint32_t pg_cnt){
-    // 未来可能会有多个用户进程，因此需要上锁
-    mutex_acquire(&user_pool.mutex);
-    void *vaddr = malloc_page(PF_USER, pg_cnt);
-    // if (vaddr != NULL)
-    memset(vaddr, 0, pg_cnt * PG_SIZE);
-    mutex_release(&user_pool.mutex);
-    return vaddr;
+bool page_merge(page_t *page, page_t *kpage){
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t *pte = page_owner_pte(page);
+    if (pte == NULL)
+        return false;
+
+    bool writable = *pte & (PG_RW_W | PG_COW);
+    uint32_t flags = PG_US_U | PG_RW_R | PG_P_1 | (writable ? PG_COW : 0);
+    if (kpage == NULL){
+        // 写零页的时候缺页处理会分配新的页, 所以只读的页合并到零页就变成可写的了
+        if (!writable)
+            return false;
+        kpage = phy2page(zero_page_phyaddr);
+        flags &= ~PG_COW;
+    }
+
+    if (kpage != page)
+        get_page(kpage);
+    else
+        page->flags |= PAGE_KSM;
+    *pte = page2phy(kpage) | flags;
+    lru_flush_page(page->owner, page->vaddr);
+    if (kpage != page)
+        put_page(page);
+    return true;
 }
 
 
@@ -627,78 +2359,504 @@ void* get_user_pages(uint32_t pg_cnt){
 /* ================================================================================================================== */
 
 
-
 /**
  * @brief arena是存储某一类型内存单元的容器, 即例如uint16_t是250ml农夫山泉, 对应的arena就是一个装满250ml农夫山泉的箱子
- *          此外, arena使用链表管理小内存块, 而大内存块直接作为整体
+ *          此外, arena使用自己的链表管理其中空闲的小内存块, 而大内存块直接作为整体
  * 
  * @details 类似于task_sturct结构本身只有几十个字节, 但是在创建的时候却是每次创建一个task_struct_t, 都会分配一个物理页,
  *          而后task_struct初始化在该页的顶部, 而task_struct内部会有一个指针来管理该页.
  *          同样, 后面每次创建一个arena, 都会分配一个或者多个物理页, 而后arena将位于第一个物理页的前面, 以管理所有的内存
+ * 
+ * @note arena中记录的是内存块描述符的下标而不是指针, 因为用户堆中的arena在fork以后会被子进程继承, 
+ *       而子进程有自己的内存块描述符
  */
 typedef struct __arena_t {
-    /// @brief 小内存块链表
-    mem_block_desc_t *desc;
-    /// @brief 当前内存仓库空闲的mem_block数
+    /// @brief arena所属的内存块描述符的下标
+    uint32_t desc_idx;
+    /// @brief 当前内存仓库空闲的mem_block数, 大内存块arena则为占用的页数
     uint32_t free_cnt;
     /// @brief 是否为大内存块arena
     bool large;
+    /// @brief arena中空闲的mem_block链表
+    list_t free_list;
+    /// @brief 内存块描述符中有空闲内存块的arena链表的节点
+    list_elem_t arena_tag;
 } arena_t;
 
 
+/// @brief 每种大小的内存块最多保留的完全空闲的arena数, 避免反复分配和释放导致反复映射和取消映射页
+#define MEM_ARENA_KEEP 1
+
+/// @brief 每种内存块的大小, 2024字节是一个arena中能放下两个内存块的最大的大小
+static const uint16_t mem_block_sizes[MEM_UNIT_CNT] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 2024
+};
+
+
+/**
+ * @brief block_desc_init用于初始化mem_block_desc_t
+ * @param desc_array 指向将要初始化的mem_block_desc_t的指针
+ */
+void block_desc_init(mem_block_desc_t *desc_array){
+    // 初始化每种大小的内存块的收货窗口
+    for (uint16_t desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++){
+        // 该售货窗口中售出的内存块的大小
+        desc_array[desc_idx].block_size = mem_block_sizes[desc_idx];
+        // 该售货窗口中可售出的内存块的数量
+        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(arena_t)) / mem_block_sizes[desc_idx];
+        // 初始化arena链表
+        list_init(&desc_array[desc_idx].partial_arenas);
+        desc_array[desc_idx].empty_arenas = 0;
+        // 初始化弹匣仓库
+        desc_array[desc_idx].full_mags = desc_array[desc_idx].empty_mags = NULL;
+        desc_array[desc_idx].full_cnt = desc_array[desc_idx].empty_cnt = 0;
+        desc_array[desc_idx].arena_cnt = desc_array[desc_idx].free_blocks = 0;
+    }
+}
+
+/**
+ * @brief arena2block用于给定arena, 返回其中第idx个内存块的地址
+ * 
+ * @param a 要获取内存块地址的arena
+ * @param block_size arena中内存块的大小
+ * @param idx 要获得的内存的idx
+ * @return mem_block_t 指向获得的内存块的指针
+ */
+static mem_block_t* arena2block(arena_t *a, uint32_t block_size, uint32_t idx){
+    return (mem_block_t *) ((uint32_t)a + sizeof(arena_t) + idx * block_size);
+}
+
+
+/**
+ * @brief block2arena用于给定内存块的地址, 返回内存块所属的arena的地址
+ * 
+ * @details 因为aren位于该页的最前面, 所以直接返回页地址即可. 内存块都在arena之后, 所以不会按页对齐;
+ *          按页对齐的内存块只能是sys_memalign分配的, 它的arena单独占用前一页
+ * 
+ * @param b 指向要获得arena地址的内存块的指针
+ * @return arena_t* 内存块的地址
+ */
+static arena_t* block2arena(mem_block_t *b){
+    if ((uint32_t) b % PG_SIZE == 0)
+        return (arena_t *) ((uint32_t) b - PG_SIZE);
+    return (arena_t *) ((uint32_t)b & 0xFFFFF000);
+}
+
+
+/**
+ * @brief arena_alloc_block用于从descs[desc_idx]的arena中分配一个内存块, 没有空闲的内存块时会创建新的arena. 
+ *        调用者需要持有内存池的锁
+ * 
+ * @param pf 内存块所在的内存池
+ * @param descs 内存块描述符数组
+ * @param desc_idx 内存块描述符的下标
+ * @return mem_block_t* 若分配成功, 则返回内存块; 失败则返回NULL
+ */
+static mem_block_t *arena_alloc_block(pool_flags_t pf, mem_block_desc_t *descs, uint32_t desc_idx){
+    mem_block_desc_t *desc = &descs[desc_idx];
+    arena_t *a;
+
+    // 若没有arena中有空闲的mem_block, 则创建新的arena提供mem_block
+    if (list_empty(&desc->partial_arenas)){
+        if ((a = malloc_page(pf, 1)) == NULL)
+            return NULL;
+
+        // 初始化arena, 并将arena拆分成内存块链接到arena的空闲链表中
+        a->desc_idx = desc_idx;
+        a->large = false;
+        a->free_cnt = desc->blocks_per_arena;
+        list_init(&a->free_list);
+        for (uint32_t block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+            list_append(&a->free_list, &arena2block(a, desc->block_size, block_idx)->free_elem);
+
+        // 新的arena完全空闲, 放在链表的最后
+        list_append(&desc->partial_arenas, &a->arena_tag);
+        desc->empty_arenas++;
+        desc->arena_cnt++;
+        desc->free_blocks += desc->blocks_per_arena;
+    }
+
+    // 部分空闲的arena在链表的前面, 优先使用
+    a = elem2entry(arena_t, arena_tag, desc->partial_arenas.head.next);
+    if (a->free_cnt-- == desc->blocks_per_arena)
+        desc->empty_arenas--;
+    mem_block_t *b = elem2entry(mem_block_t, free_elem, list_pop(&a->free_list));
+    desc->free_blocks--;
+    // arena已满, 从链表中移除, 释放内存块的时候再加入
+    if (a->free_cnt == 0)
+        list_remove(&a->arena_tag);
+    return b;
+}
+
+
+/**
+ * @brief arena_free_block用于将内存块b归还给所属的arena. arena完全空闲的时候, 若已经保留了足够多的空闲arena, 
+ *        则直接释放arena所在的页. 调用者需要持有内存池的锁
+ * 
+ * @param pf 内存块所在的内存池
+ * @param descs 内存块描述符数组
+ * @param b 需要归还的内存块
+ */
+static void arena_free_block(pool_flags_t pf, mem_block_desc_t *descs, mem_block_t *b){
+    arena_t *a = block2arena(b);
+    mem_block_desc_t *desc = &descs[a->desc_idx];
+
+    // 之前已满的arena重新加入链表, 放在链表的最前面
+    if (a->free_cnt == 0)
+        list_push(&desc->partial_arenas, &a->arena_tag);
+    list_push(&a->free_list, &b->free_elem);
+    desc->free_blocks++;
+
+    // 再判断管理该页的arena是否空闲, 空闲的arena整体从链表中摘下
+    if (++a->free_cnt == desc->blocks_per_arena){
+        list_remove(&a->arena_tag);
+        if (desc->empty_arenas < MEM_ARENA_KEEP){
+            list_append(&desc->partial_arenas, &a->arena_tag);
+            desc->empty_arenas++;
+        } else {
+            // 释放arena所在的页
+            desc->arena_cnt--;
+            desc->free_blocks -= desc->blocks_per_arena;
+            mfree_page(pf, a, 1);
+        }
+    }
+}
+
+
+/* ================================================================================================================== */
+/* ================================================== 线程私有的弹匣 ================================================== */
+/* ================================================================================================================== */
+
+/// @brief 仓库中最多保存的满弹匣和空弹匣数
+#define MEM_DEPOT_MAX 4
+
+/// @brief 从仓库中拿不到满弹匣的时候, 一次从arena中补充的内存块数
+#define MEM_MAG_REFILL (MEM_MAG_ROUNDS / 2 + 1)
+
+
+/**
+ * @brief mag_flush用于将弹匣中的内存块全部归还给arena
+ * 
+ * @param pf 内存块所在的内存池
+ * @param descs 内存块描述符数组
+ * @param mag 需要清空的弹匣
+ */
+static void mag_flush(pool_flags_t pf, mem_block_desc_t *descs, mem_magazine_t *mag){
+    pool_t *mem_pool = pf == PF_KERNEL ? &kernel_pool : &user_pool;
+    mutex_acquire(&mem_pool->mutex);
+    while (mag->rounds > 0)
+        arena_free_block(pf, descs, mag->blocks[--mag->rounds]);
+    mutex_release(&mem_pool->mutex);
+}
+
+
+/**
+ * @brief depot_put_empty用于将空弹匣放入仓库, 仓库中的空弹匣已经足够多的时候直接释放弹匣
+ */
+static void depot_put_empty(mem_block_desc_t *desc, mem_magazine_t *mag){
+    ASSERT(mag->rounds == 0);
+    intr_status_t old_status = intr_disable();
+    if (desc->empty_cnt < MEM_DEPOT_MAX){
+        mag->next = desc->empty_mags;
+        desc->empty_mags = mag;
+        desc->empty_cnt++;
+        mag = NULL;
+    }
+    intr_set_status(old_status);
+    if (mag != NULL)
+        kmem_cache_free(&mem_magazine_cache, mag);
+}
+
+
+/**
+ * @brief depot_get_empty用于从仓库中取出一个空弹匣, 仓库中没有空弹匣的时候创建新的弹匣
+ * 
+ * @return mem_magazine_t* 空弹匣; 若失败则返回NULL
+ */
+static mem_magazine_t *depot_get_empty(mem_block_desc_t *desc){
+    intr_status_t old_status = intr_disable();
+    mem_magazine_t *mag = desc->empty_mags;
+    if (mag != NULL){
+        desc->empty_mags = mag->next;
+        desc->empty_cnt--;
+    }
+    intr_set_status(old_status);
+
+    if (mag == NULL && (mag = kmem_cache_alloc(&mem_magazine_cache)) != NULL)
+        mag->rounds = 0;
+    return mag;
+}
+
+
+/**
+ * @brief mag_alloc用于从当前线程的弹匣中分配一个内存块. 当前弹匣为空时依次尝试上一个弹匣, 仓库中的满弹匣,
+ *        都没有的时候持有一次内存池的锁, 从arena中批量补充当前弹匣
+ * 
+ * @param mc 当前线程对应大小的弹匣
+ * @param descs 内存块描述符数组
+ * @param desc_idx 内存块描述符的下标
+ * @param pf 内存块所在的内存池
+ * @return void* 若分配成功, 则返回内存块; 失败则返回NULL
+ */
+static void *mag_alloc(mem_mag_cache_t *mc, mem_block_desc_t *descs, uint32_t desc_idx, pool_flags_t pf){
+    mem_block_desc_t *desc = &descs[desc_idx];
+
+    // 1. 当前弹匣
+    if (mc->loaded != NULL && mc->loaded->rounds > 0)
+        return mc->loaded->blocks[--mc->loaded->rounds];
+
+    // 2. 上一个弹匣
+    if (mc->prev != NULL && mc->prev->rounds > 0){
+        mem_magazine_t *tmp = mc->loaded;
+        mc->loaded = mc->prev;
+        mc->prev = tmp;
+        return mc->loaded->blocks[--mc->loaded->rounds];
+    }
+
+    // 3. 用空的上一个弹匣和仓库交换一个满弹匣
+    intr_status_t old_status = intr_disable();
+    mem_magazine_t *full = desc->full_mags;
+    if (full != NULL){
+        desc->full_mags = full->next;
+        desc->full_cnt--;
+    }
+    intr_set_status(old_status);
+    if (full != NULL){
+        if (mc->prev != NULL)
+            depot_put_empty(desc, mc->prev);
+        mc->prev = mc->loaded;
+        mc->loaded = full;
+        return mc->loaded->blocks[--mc->loaded->rounds];
+    }
+
+    // 4. 从arena中批量补充当前弹匣
+    if (mc->loaded == NULL && (mc->loaded = depot_get_empty(desc)) == NULL)
+        return NULL;
+    pool_t *mem_pool = pf == PF_KERNEL ? &kernel_pool : &user_pool;
+    mutex_acquire(&mem_pool->mutex);
+    while (mc->loaded->rounds < MEM_MAG_REFILL){
+        mem_block_t *b = arena_alloc_block(pf, descs, desc_idx);
+        if (b == NULL)
+            break;
+        mc->loaded->blocks[mc->loaded->rounds++] = b;
+    }
+    mutex_release(&mem_pool->mutex);
+
+    if (mc->loaded->rounds == 0)
+        return NULL;
+    return mc->loaded->blocks[--mc->loaded->rounds];
+}
+
+
+/**
+ * @brief mag_free用于将内存块放入当前线程的弹匣中. 当前弹匣已满时依次尝试空的上一个弹匣, 否则将上一个弹匣放入仓库并换上
+ *        一个空弹匣. 仓库中的满弹匣已经足够多的时候, 上一个弹匣中的内存块将归还给arena
+ * 
+ * @param mc 当前线程对应大小的弹匣
+ * @param descs 内存块描述符数组
+ * @param desc_idx 内存块描述符的下标
+ * @param pf 内存块所在的内存池
+ * @param b 需要释放的内存块
+ * @return true 内存块已经放入弹匣
+ * @return false 无法得到空弹匣, 内存块需要直接归还给arena
+ */
+static bool mag_free(mem_mag_cache_t *mc, mem_block_desc_t *descs, uint32_t desc_idx, pool_flags_t pf, void *b){
+    mem_block_desc_t *desc = &descs[desc_idx];
+
+    // 1. 当前弹匣
+    if (mc->loaded != NULL && mc->loaded->rounds < MEM_MAG_ROUNDS){
+        mc->loaded->blocks[mc->loaded->rounds++] = b;
+        return true;
+    }
+
+    // 2. 空的上一个弹匣
+    if (mc->prev != NULL && mc->prev->rounds == 0){
+        mem_magazine_t *tmp = mc->loaded;
+        mc->loaded = mc->prev;
+        mc->prev = tmp;
+        mc->loaded->blocks[mc->loaded->rounds++] = b;
+        return true;
+    }
+
+    // 3. 上一个弹匣已满, 放入仓库; 仓库已满的时候清空上一个弹匣, 直接作为空弹匣使用
+    mem_magazine_t *empty = NULL;
+    if (mc->prev != NULL){
+        intr_status_t old_status = intr_disable();
+        if (desc->full_cnt < MEM_DEPOT_MAX){
+            mc->prev->next = desc->full_mags;
+            desc->full_mags = mc->prev;
+            desc->full_cnt++;
+        } else
+            empty = mc->prev;
+        intr_set_status(old_status);
+        mc->prev = NULL;
+        if (empty != NULL)
+            mag_flush(pf, descs, empty);
+    }
+    if (empty == NULL && (empty = depot_get_empty(desc)) == NULL)
+        return false;
+
+    mc->prev = mc->loaded;
+    mc->loaded = empty;
+    mc->loaded->blocks[mc->loaded->rounds++] = b;
+    return true;
+}
+
+
+/**
+ * @brief mem_magazine_flush用于将线程弹匣中的内存块全部归还给arena, 并且释放弹匣. 用于内核线程退出
+ * 
+ * @param mag_cache 线程的弹匣
+ * @param pf 内存块所在的内存池
+ */
+void mem_magazine_flush(mem_mag_cache_t *mag_cache, pool_flags_t pf){
+    ASSERT(pf == PF_KERNEL);
+    for (uint32_t desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++){
+        mem_magazine_t *mags[2] = {mag_cache[desc_idx].loaded, mag_cache[desc_idx].prev};
+        for (uint32_t i = 0; i < 2; i++){
+            if (mags[i] == NULL)
+                continue;
+            mag_flush(pf, k_block_descs, mags[i]);
+            kmem_cache_free(&mem_magazine_cache, mags[i]);
+        }
+        mag_cache[desc_idx].loaded = mag_cache[desc_idx].prev = NULL;
+    }
+}
+
+
 /**
- * @brief block_desc_init用于初始化mem_block_desc_t
- * @param desc_array 指向将要初始化的mem_block_desc_t的指针
+ * @brief mem_magazine_destroy用于释放用户进程的弹匣和仓库中的弹匣. 用户进程退出的时候整个用户堆都会被释放, 
+ *        所以弹匣中的内存块不需要归还给arena
+ * 
+ * @param mag_cache 用户进程的弹匣
+ * @param descs 用户进程的内存块描述符
  */
-void block_desc_init(mem_block_desc_t *desc_array){
-    uint16_t desc_idx, block_size = 16;
-
-    // 初始化每种大小的内存块的收货窗口
-    for (desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++, block_size *= 2){
-        // 该售货窗口中售出的内存块的大小
-        desc_array[desc_idx].block_size = block_size;
-        // 该售货窗口中可售出的内存块的数量
-        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(arena_t)) / block_size;
-        // 初始化链表
-        list_init(&desc_array[desc_idx].free_list);
+void mem_magazine_destroy(mem_mag_cache_t *mag_cache, mem_block_desc_t *descs){
+    for (uint32_t desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++){
+        if (mag_cache[desc_idx].loaded != NULL)
+            kmem_cache_free(&mem_magazine_cache, mag_cache[desc_idx].loaded);
+        if (mag_cache[desc_idx].prev != NULL)
+            kmem_cache_free(&mem_magazine_cache, mag_cache[desc_idx].prev);
+        mag_cache[desc_idx].loaded = mag_cache[desc_idx].prev = NULL;
+
+        mem_magazine_t **stacks[2] = {&descs[desc_idx].full_mags, &descs[desc_idx].empty_mags};
+        for (uint32_t i = 0; i < 2; i++)
+            while (*stacks[i] != NULL){
+                mem_magazine_t *mag = *stacks[i];
+                *stacks[i] = mag->next;
+                kmem_cache_free(&mem_magazine_cache, mag);
+            }
+        descs[desc_idx].full_cnt = descs[desc_idx].empty_cnt = 0;
     }
 }
 
+
 /**
- * @brief arena2block用于给定arena, 返回其中第idx个内存块的地址
+ * @brief mag_clone用于为子进程复制一个弹匣
  * 
- * @param a 要获取内存块地址的arena
- * @param idx 要获得的内存的idx
- * @return mem_block_t 指向获得的内存块的指针
+ * @param mag 需要复制的弹匣
+ * @param ok 复制失败的时候将被设置为false
+ * @return mem_magazine_t* 复制得到的弹匣
+ */
+static mem_magazine_t *mag_clone(mem_magazine_t *mag, bool *ok){
+    if (mag == NULL)
+        return NULL;
+    mem_magazine_t *new_mag = kmem_cache_alloc(&mem_magazine_cache);
+    if (new_mag == NULL){
+        *ok = false;
+        return NULL;
+    }
+    memcpy(new_mag, mag, sizeof(mem_magazine_t));
+    return new_mag;
+}
+
+
+/**
+ * @brief heap_fork_write用于修改子进程用户堆中的一个字. 子进程还没有运行, 所以不切换到它的页表, 而是像子进程自己写该页
+ *        一样先处理写时复制和换出, 得到子进程独占的页, 然后通过临时映射写入. 这样复制出来的页的拥有者是子进程
+ *
+ * @param child 子进程
+ * @param uaddr 子进程用户堆中需要修改的字
+ * @param val 写入的值
+ * @return true 写入成功
+ * @return false 没有可用的物理页, 或者该页没有映射
  */
-static mem_block_t* arena2block(arena_t *a, uint32_t idx){
-    return (mem_block_t *) ((uint32_t)a + sizeof(arena_t) + idx * a->desc->block_size);
+static bool heap_fork_write(task_struct_t *child, void *uaddr, uint32_t val){
+    uint32_t vaddr = (uint32_t) uaddr & 0xFFFFF000;
+    uint32_t pde = child->pgdir[vaddr >> 22];
+    if (!(pde & PG_P_1))
+        return false;
+
+    uint32_t *pte = (uint32_t *) kmap(pde & 0xFFFFF000) + ((vaddr >> 12) & 0x3FF);
+    if (!(*pte & PG_P_1) && (*pte & PG_SWAP) && !page_fault_swap(child, vaddr, pte))
+        return false;
+    if (!(*pte & PG_P_1))
+        return false;
+    if ((*pte & PG_COW) && !page_fault_cow(child, vaddr, pte))
+        return false;
+
+    uint32_t *page = kmap_page(*pte & 0xFFFFF000);
+    page[((uint32_t) uaddr & 0xFFF) / sizeof(uint32_t)] = val;
+    kunmap_page(page);
+    return true;
 }
 
 
 /**
- * @brief block2arena用于给定内存块的地址, 返回内存块所属的arena的地址
+ * @brief mem_heap_fork用于在fork的时候修正子进程用户堆的管理信息. 子进程的TCB复制自父进程, 其中的内存块描述符和
+ *        弹匣都需要修正:
+ *              1. arena链表的第一个和最后一个arena位于子进程的用户堆中, 仍然指向父进程TCB中的链表头尾
+ *              2. 弹匣和仓库中的弹匣仍然是父进程的, 需要为子进程复制一份
  * 
- * @details 因为aren位于该页的最前面, 所以直接返回页地址即可
+ * @note 子进程用户堆中的arena通过heap_fork_write修改, 不需要切换到子进程的页表
  * 
- * @param b 指向要获得arena地址的内存块的指针
- * @return arena_t* 内存块的地址
+ * @param child 子进程, 页表和区域已经复制
+ * @param parent 父进程
+ * @return int32_t 成功返回0; 失败返回-1. 失败时子进程的弹匣要么已经复制, 要么被置空, 可以用mem_magazine_destroy释放
  */
-static arena_t* block2arena(mem_block_t *b){
-    return (arena_t *) ((uint32_t)b & 0xFFFFF000);
+int32_t mem_heap_fork(task_struct_t *child, task_struct_t *parent){
+    bool ok = true;
+    mem_block_desc_t *child_descs = child->u_block_desc;
+    mem_mag_cache_t *child_mags = child->mag_cache;
+    for (uint32_t desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++){
+        list_t *child_list = &child_descs[desc_idx].partial_arenas;
+        if (list_empty(&parent->u_block_desc[desc_idx].partial_arenas))
+            list_init(child_list);
+        else if (!heap_fork_write(child, &child_list->head.next->prev, (uint32_t) &child_list->head) ||
+                 !heap_fork_write(child, &child_list->tail.prev->next, (uint32_t) &child_list->tail))
+            // 继续复制弹匣, 保证失败的时候子进程的弹匣都不再指向父进程的
+            ok = false;
+
+        child_mags[desc_idx].loaded = mag_clone(child_mags[desc_idx].loaded, &ok);
+        child_mags[desc_idx].prev = mag_clone(child_mags[desc_idx].prev, &ok);
+        mem_magazine_t **stacks[2] = {&child_descs[desc_idx].full_mags, &child_descs[desc_idx].empty_mags};
+        for (uint32_t i = 0; i < 2; i++)
+            for (mem_magazine_t **pmag = stacks[i]; *pmag != NULL; pmag = &(*pmag)->next)
+                if ((*pmag = mag_clone(*pmag, &ok)) == NULL)
+                    break;
+    }
+    return ok ? 0 : -1;
+}
+
+
+/**
+ * @brief heap_large_stat用于获得当前线程使用的堆中大内存块的统计, 内核线程使用内核堆, 用户进程使用自己的用户堆
+ */
+static inline mem_large_stat_t *heap_large_stat(task_struct_t *cur){
+    return cur->pgdir == NULL ? &k_large_stat : &cur->u_large_stat;
 }
 
 
 /**
- * @brief sys_malloc是malloc系统调用的实现函数, 用于在当前进程的堆中申请size个字节的内存
+ * @brief heap_malloc用于在当前进程的堆中申请size个字节的内存
  * 
  * @details 开启虚拟内存以后, 只有真正的分配物理页, 在页表中添加物理页和虚拟页的映射才会接触到物理页,
- *          除此以外所有分配内存, 分配的都是虚拟内存
+ *          除此以外所有分配内存, 分配的都是虚拟内存. 小内存块首先从当前线程的弹匣中分配, 不需要获取内存池的锁
  * 
  * @param size 要申请的内存字节数
  * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
  */
-void* sys_malloc(uint32_t size){
+static void *heap_malloc(uint32_t size){
     pool_flags_t pf;
     pool_t *mem_pool;
     uint32_t pool_size;
@@ -724,24 +2882,22 @@ void* sys_malloc(uint32_t size){
     if (size <= 0 || pool_size <= size)
         return NULL;
 
-    arena_t *a;
-    mem_block_t *b;
-    // 下面要动共享数据了, 所以提前上锁
-    mutex_acquire(&mem_pool->mutex);
-
-    if (size > 1024){
-        // 超过最大1024字节的mem_block_desc, 直接分配整个页
+    if (size > descs[MEM_UNIT_CNT - 1].block_size){
+        arena_t *a;
+        // 下面要动共享数据了, 所以提前上锁
+        mutex_acquire(&mem_pool->mutex);
+        // 超过最大的mem_block_desc, 直接分配整个页
         uint32_t page_cnt = DIV_CEILING(size + sizeof(arena_t), PG_SIZE);
-        if ((a = malloc_page(pf, page_cnt)) == NULL){
+        if ((a = (pf == PF_KERNEL ? malloc_kernel_page_zero(page_cnt) : malloc_page(pf, page_cnt))) == NULL){
             // 分配失败, 释放锁, 直接放回
             mutex_release(&mem_pool->mutex);
             return NULL;
         }
-        memset(a, 0, page_cnt * PG_SIZE);
-
-        a->desc = NULL;
+        // 用户进程的页在第一次访问时才分配, 分配的时候已经清0了
         a->free_cnt = page_cnt;
         a->large = true;
+        heap_large_stat(cur)->cnt++;
+        heap_large_stat(cur)->pages += page_cnt;
         // 分配完毕, 释放锁
         mutex_release(&mem_pool->mutex);
 
@@ -752,91 +2908,715 @@ void* sys_malloc(uint32_t size){
         for (desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++)
             if (size <= descs[desc_idx].block_size)
                 break;
-    
-        // 若mem_block_desc的free_list中已经没有可用的mem_block, 则创建新的arena提供mem_block
-        if (list_empty(&descs[desc_idx].free_list)){
-            if ((a = malloc_page(pf, 1)) == NULL){
-                mutex_release(&mem_pool->mutex);
-                return NULL;
-            }
-            // 初始化arena
-            memset(a, 0, PG_SIZE);
 
-            // 下面将arena拆分成内存块, 即将内存块链接到链表中, 必须要关中断
-            intr_status_t old_status = intr_disable();
-            a->desc = &descs[desc_idx];
-            a->large = false;
-            a->free_cnt = descs[desc_idx].blocks_per_arena;
-            for (uint32_t block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena; block_idx++){
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
-            }
-            intr_set_status(old_status);
+        // 优先从当前线程的弹匣中分配
+        void *b = mag_alloc(&cur->mag_cache[desc_idx], descs, desc_idx, pf);
+        if (b == NULL){
+            mutex_acquire(&mem_pool->mutex);
+            b = arena_alloc_block(pf, descs, desc_idx);
+            mutex_release(&mem_pool->mutex);
+            if (b == NULL)
+                return NULL;
         }
-
-        // 开始分配内存
-        b = elem2entry(mem_block_t, free_elem, list_pop(&(descs[desc_idx].free_list)));
         memset(b, 0, descs[desc_idx].block_size);
-
-        a = block2arena(b);
-        a->free_cnt--;
-        mutex_release(&mem_pool->mutex);
-        return (void*) b;
+        return b;
     }
 }
 
 
 /**
- * @brief sys_free用于释放sys_malloc分配的内存
+ * @brief sys_malloc是malloc系统调用的实现函数, 用于在当前进程的堆中申请size个字节的内存, 见heap_malloc
+ * 
+ * @param size 要申请的内存字节数
+ * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
+ */
+void* sys_malloc(uint32_t size){
+    void *ptr = heap_malloc(size);
+    mem_trace_alloc(ptr, size, (uint32_t) __builtin_return_address(0));
+    return ptr;
+}
+
+
+/**
+ * @brief heap_free用于释放当前进程的堆中的内存
  * 
  * @param ptr 指向由sys_malloc分配的物理内存
  */
-void sys_free(void* ptr){
+static void heap_free(void* ptr){
     ASSERT(ptr != NULL);
 
     // ASSERT是一个宏, 所以如果在debug.h中开启了NODEBUG宏, 就不会进行检查
     if (ptr != NULL){
         pool_flags_t PF;
         pool_t *mem_pool;
+        mem_block_desc_t *descs;
+        task_struct_t *cur = running_thread();
 
-        if (running_thread()->pgdir == NULL){
+        if (cur->pgdir == NULL){
             // 释放内核线程的堆
             ASSERT((uint32_t)ptr >= K_HEAP_START);
             PF = PF_KERNEL;
             mem_pool = &kernel_pool;
+            descs = k_block_descs;
         } else {
             // 释放用户线程的堆
             PF = PF_USER;
             mem_pool = &user_pool;
+            descs = cur->u_block_desc;
         }
 
-        // 下面要操作共享数据了, 所以需要锁来保护
-        mutex_acquire(&mem_pool->mutex);
-
         mem_block_t *b = (mem_block_t*)ptr;
         arena_t *a = block2arena(b);
 
         ASSERT(a->large == 0 || a->large == 1)
-        if (a->desc == NULL && a->large == 1)
-            // 大于1024字节的内存是直接按照页的形式分配的, 释放的时候也要按照页的形式释放
+        if (a->large == 1){
+            // 大内存块是直接按照页的形式分配的, 释放的时候也要按照页的形式释放
+            mutex_acquire(&mem_pool->mutex);
+            heap_large_stat(cur)->cnt--;
+            heap_large_stat(cur)->pages -= a->free_cnt;
             mfree_page(PF, a, a->free_cnt);
-        else {
-            // 小于1024字节的内存是按照单元的形式分配的, 释放的时候首先为该内存建立节点, 然后加入到空闲链表中
-            list_append(&a->desc->free_list, &b->free_elem);
-
-            // 再判断管理该页的arena是否空闲, 如果空闲就直接释放arena
-            if (++a->free_cnt == a->desc->blocks_per_arena){
-                // 依次释放该Arena中的全部mem_block
-                for (uint32_t block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++){
-                    mem_block_t *bb = arena2block(a, block_idx);
-                    ASSERT(elem_find(&a->desc->free_list, &bb->free_elem));
-                    list_remove(&bb->free_elem);
-                }
-                // 释放arena所在的页
-                mfree_page(PF, a, 1);
+            mutex_release(&mem_pool->mutex);
+        } else {
+            // 小内存块优先放入当前线程的弹匣, 放不下的时候再归还给arena
+            ASSERT(a->desc_idx < MEM_UNIT_CNT);
+            if (!mag_free(&cur->mag_cache[a->desc_idx], descs, a->desc_idx, PF, b)){
+                mutex_acquire(&mem_pool->mutex);
+                arena_free_block(PF, descs, b);
+                mutex_release(&mem_pool->mutex);
             }
         }
+    }
+}
+
+
+/**
+ * @brief sys_free用于释放sys_malloc分配的内存
+ * 
+ * @param ptr 指向由sys_malloc分配的物理内存
+ */
+void sys_free(void* ptr){
+    mem_trace_free(ptr, (uint32_t) __builtin_return_address(0));
+    heap_free(ptr);
+}
+
+
+/**
+ * @brief sys_calloc是calloc系统调用的实现函数, 用于在当前进程的堆中申请nmemb个size字节的内存, 内容全为0.
+ *        sys_malloc返回的内存已经全为0了: 小内存块分配的时候清0, 内核的大内存块分配的时候清0,
+ *        用户的大内存块在第一次访问的时候才分配已经清0的页, 所以这里只需要检查溢出
+ *
+ * @param nmemb 元素的个数
+ * @param size 每个元素的字节数
+ * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
+ */
+void *sys_calloc(uint32_t nmemb, uint32_t size){
+    if (size != 0 && nmemb > 0xFFFFFFFF / size)
+        return NULL;
+    void *ptr = heap_malloc(nmemb * size);
+    mem_trace_alloc(ptr, nmemb * size, (uint32_t) __builtin_return_address(0));
+    return ptr;
+}
+
+
+/**
+ * @brief heap_realloc用于将当前进程的堆中ptr指向的内存调整为size个字节, 原来的内容保持不变
+ *
+ * @details 能原地调整的时候不复制内容:
+ *              1. 小内存块: size不超过内存块的大小
+ *              2. 大内存块: 缩小的时候释放多余的页; 扩大的时候若之后的虚拟页没有被使用, 则直接追加
+ *          否则重新分配一块内存, 复制原来的内容后释放原来的内存
+ *
+ * @param ptr sys_malloc, sys_calloc, sys_memalign或者sys_realloc返回的内存, 为NULL的时候等同于sys_malloc
+ * @param size 调整后的字节数, 为0的时候等同于sys_free
+ * @return void* 若成功, 则返回调整后的内存的首地址; 失败则返回NULL, 此时原来的内存不变
+ */
+static void *heap_realloc(void *ptr, uint32_t size){
+    if (ptr == NULL)
+        return heap_malloc(size);
+    if (size == 0){
+        heap_free(ptr);
+        return NULL;
+    }
+
+    task_struct_t *cur = running_thread();
+    pool_flags_t pf = cur->pgdir == NULL ? PF_KERNEL : PF_USER;
+    pool_t *mem_pool = cur->pgdir == NULL ? &kernel_pool : &user_pool;
+    mem_block_desc_t *descs = cur->pgdir == NULL ? k_block_descs : cur->u_block_desc;
+    if (mem_pool->pool_size <= size)
+        return NULL;
+
+    arena_t *a = block2arena(ptr);
+    uint32_t old_size;
+    if (!a->large){
+        old_size = descs[a->desc_idx].block_size;
+        if (size <= old_size)
+            return ptr;
+    } else {
+        uint32_t offset = (uint32_t) ptr - (uint32_t) a;
+        uint32_t old_cnt = a->free_cnt, new_cnt = DIV_CEILING(offset + size, PG_SIZE);
+        old_size = old_cnt * PG_SIZE - offset;
+        bool done = true;
+        mutex_acquire(&mem_pool->mutex);
+        if (new_cnt < old_cnt)
+            mfree_page(pf, (void *) ((uint32_t) a + new_cnt * PG_SIZE), old_cnt - new_cnt);
+        else if (new_cnt > old_cnt)
+            done = malloc_page_extend(pf, (void *) ((uint32_t) a + old_cnt * PG_SIZE), new_cnt - old_cnt);
+        if (done){
+            heap_large_stat(cur)->pages += new_cnt - old_cnt;
+            a->free_cnt = new_cnt;
+        }
+        mutex_release(&mem_pool->mutex);
+        if (done)
+            return ptr;
+    }
+
+    void *new_ptr = heap_malloc(size);
+    if (new_ptr == NULL)
+        return NULL;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    heap_free(ptr);
+    return new_ptr;
+}
+
+
+/**
+ * @brief sys_realloc是realloc系统调用的实现函数, 用于将ptr指向的内存调整为size个字节, 原来的内容保持不变, 见heap_realloc.
+ *        分配追踪中记为一次释放和一次分配, 原地调整的时候也是如此
+ *
+ * @param ptr sys_malloc, sys_calloc, sys_memalign或者sys_realloc返回的内存, 为NULL的时候等同于sys_malloc
+ * @param size 调整后的字节数, 为0的时候等同于sys_free
+ * @return void* 若成功, 则返回调整后的内存的首地址; 失败则返回NULL, 此时原来的内存不变
+ */
+void *sys_realloc(void *ptr, uint32_t size){
+    void *new_ptr = heap_realloc(ptr, size);
+    uint32_t site = (uint32_t) __builtin_return_address(0);
+    if (new_ptr != NULL || size == 0)
+        mem_trace_free(ptr, site);
+    mem_trace_alloc(new_ptr, size, site);
+    return new_ptr;
+}
+
+
+/**
+ * @brief heap_memalign用于在当前进程的堆中申请size个字节的内存, 首地址按照align对齐. 返回的内存用sys_free释放, 内容全为0
+ *
+ * @details 小内存块只按4字节对齐, 所以更大的对齐都按照大内存块分配:
+ *              1. 小于一页的对齐: arena和返回的地址在同一页中, 多分配align - 1个字节
+ *              2. 按页或者更大的对齐: 返回的地址按页对齐, arena单独占用它之前的一页. 多分配align字节, 然后释放arena之前和内存之后多余的页
+ *
+ * @param align 对齐的字节数, 必须是2的幂
+ * @param size 要申请的内存字节数
+ * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
+ */
+static void *heap_memalign(uint32_t align, uint32_t size){
+    if (align == 0 || (align & (align - 1)) != 0 || size == 0)
+        return NULL;
+    if (align <= sizeof(uint32_t))
+        return heap_malloc(size);
+
+    task_struct_t *cur = running_thread();
+    pool_flags_t pf = cur->pgdir == NULL ? PF_KERNEL : PF_USER;
+    pool_t *mem_pool = cur->pgdir == NULL ? &kernel_pool : &user_pool;
+    if (mem_pool->pool_size <= size || mem_pool->pool_size - size <= align)
+        return NULL;
+
+    uint32_t data_cnt = DIV_CEILING(size, PG_SIZE);
+    uint32_t page_cnt = align < PG_SIZE ? DIV_CEILING(sizeof(arena_t) + align - 1 + size, PG_SIZE) : align / PG_SIZE + data_cnt;
+
+    mutex_acquire(&mem_pool->mutex);
+    arena_t *a = pf == PF_KERNEL ? malloc_kernel_page_zero(page_cnt) : malloc_page(pf, page_cnt);
+    if (a == NULL){
         mutex_release(&mem_pool->mutex);
+        return NULL;
+    }
+
+    uint32_t ptr;
+    if (align < PG_SIZE)
+        ptr = DIV_CEILING((uint32_t) (a + 1), align) * align;
+    else {
+        ptr = DIV_CEILING((uint32_t) a + PG_SIZE, align) * align;
+        uint32_t head_cnt = (ptr - PG_SIZE - (uint32_t) a) / PG_SIZE;
+        uint32_t tail_cnt = page_cnt - head_cnt - 1 - data_cnt;
+        if (head_cnt > 0)
+            mfree_page(pf, a, head_cnt);
+        if (tail_cnt > 0)
+            mfree_page(pf, (void *) (ptr + data_cnt * PG_SIZE), tail_cnt);
+        a = (arena_t *) (ptr - PG_SIZE);
+        page_cnt = 1 + data_cnt;
+    }
+    a->free_cnt = page_cnt;
+    a->large = true;
+    heap_large_stat(cur)->cnt++;
+    heap_large_stat(cur)->pages += page_cnt;
+    mutex_release(&mem_pool->mutex);
+    return (void *) ptr;
+}
+
+
+/**
+ * @brief sys_memalign是memalign系统调用的实现函数, 用于在当前进程的堆中申请size个字节的内存, 首地址按照align对齐, 见heap_memalign
+ *
+ * @param align 对齐的字节数, 必须是2的幂
+ * @param size 要申请的内存字节数
+ * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
+ */
+void *sys_memalign(uint32_t align, uint32_t size){
+    void *ptr = heap_memalign(align, size);
+    mem_trace_alloc(ptr, size, (uint32_t) __builtin_return_address(0));
+    return ptr;
+}
+
+
+/**
+ * @brief sys_brk是brk系统调用的实现函数, 用于将当前进程的堆顶(program break)设置为addr.
+ *        堆从进程的程序段之后开始, 增长的部分只保留虚拟页, 物理页在访问的时候按需分配; 收缩的部分立即释放
+ * 
+ * @param addr 新的堆顶
+ * @return int32_t 成功返回0; 若addr低于堆的起始地址, 或者需要的虚拟页已经被占用, 则返回-1
+ */
+int32_t sys_brk(void *addr){
+    task_struct_t *cur = running_thread();
+    uint32_t new_brk = (uint32_t) addr;
+    // 内核线程和没有从文件加载的进程没有堆
+    if (cur->pgdir == NULL || cur->heap_start == 0 || new_brk < cur->heap_start || new_brk > 0xC0000000)
+        return -1;
+
+    uint32_t old_end = DIV_CEILING(cur->brk, PG_SIZE) * PG_SIZE;
+    uint32_t new_end = DIV_CEILING(new_brk, PG_SIZE) * PG_SIZE;
+    if (new_end > old_end){
+        // 堆向上增长的虚拟页必须都还没有被占用, 用户栈所在的虚拟页在创建进程的时候就保留了, 所以堆不会覆盖栈.
+        // 内核为进程分配的用户页和mmap区域由vma_alloc从栈下面向下分配, 不会占用堆顶之上的虚拟页
+        if (vma_add(cur, old_end, (new_end - old_end) / PG_SIZE, 0) == NULL)
+            return -1;
+    } else if (new_end < old_end)
+        free_user_pages((void *) new_end, (old_end - new_end) / PG_SIZE);
+    cur->brk = new_brk;
+    return 0;
+}
+
+
+/**
+ * @brief sys_sbrk是sbrk系统调用的实现函数, 用于将当前进程的堆顶移动increment个字节
+ * 
+ * @param increment 堆顶移动的字节数, 可以为负数. 为0时用于获得当前的堆顶
+ * @return void* 成功则返回原来的堆顶; 失败则返回(void *) -1
+ */
+void *sys_sbrk(int32_t increment){
+    task_struct_t *cur = running_thread();
+    uint32_t old_brk = cur->brk;
+    // 检查回绕
+    if ((increment > 0 && old_brk + increment < old_brk) || (increment < 0 && old_brk < (uint32_t) -increment))
+        return (void *) -1;
+    if (sys_brk((void *) (old_brk + increment)) == -1)
+        return (void *) -1;
+    return (void *) old_brk;
+}
+
+
+/* ================================================================================================================== */
+/* ==================================================== 内存统计 ====================================================== */
+/* ================================================================================================================== */
+
+// meminfo读取的都是在分配和释放的时候维护的计数, 开销是固定的:
+//      1. 内存池: 伙伴系统中各阶的空闲块数和空闲页数, 快速路径缓存的单页数, 预先清0的页数, 借用的页数
+//      2. 堆: 每种大小的内存块的arena数和空闲内存块数, 大内存块的个数和页数
+//      3. 页表: 用户进程的页表在建立, fork复制和进程退出的时候计数
+//      4. 进程映射的用户页数: 页表项变为存在或者不存在的时候计数, 写时复制和页合并只是替换物理页, 不改变计数
+//      5. 交换: 换出和换入以及释放槽的时候计数
+//      6. 页合并: 合并的次数在合并的时候计数, 当前合并的页数要遍历合并表, 合并表的大小是固定的
+
+/**
+ * @brief meminfo_pool用于获得m_pool的使用情况. 内存池的计数在持有锁或者关中断的时候修改, 这里关中断读取一份一致的快照,
+ *        读取的结果先放在内核栈上, 写入用户缓冲区的时候可能会缺页, 不能关中断
+ *
+ * @param m_pool 内存池
+ * @param info 存放结果的位置
+ */
+static void meminfo_pool(pool_t *m_pool, meminfo_pool_t *info){
+    meminfo_pool_t snap;
+    intr_status_t old_status = intr_disable();
+    snap.total_pages = m_pool->total_pages;
+    snap.free_pages = m_pool->free_pages + m_pool->pcp_cnt + m_pool->zero_cnt;
+    snap.zero_pages = m_pool->zero_cnt;
+    snap.lent_pages = m_pool->lent_pages;
+    snap.borrowed_pages = m_pool->borrowed_pages;
+    for (uint32_t order = 0; order < BUDDY_MAX_ORDER; order++)
+        snap.free_blocks[order] = m_pool->free_cnt[order];
+    intr_set_status(old_status);
+    memcpy(info, &snap, sizeof(snap));
+}
+
+
+/**
+ * @brief meminfo_heap用于获得一个堆的使用情况
+ *
+ * @param descs 堆的内存块描述符数组
+ * @param large 堆中大内存块的统计
+ * @param info 存放结果的位置
+ */
+static void meminfo_heap(mem_block_desc_t *descs, mem_large_stat_t *large, meminfo_heap_t *info){
+    for (uint32_t desc_idx = 0; desc_idx < MEM_UNIT_CNT; desc_idx++){
+        info->classes[desc_idx].block_size = descs[desc_idx].block_size;
+        info->classes[desc_idx].arenas = descs[desc_idx].arena_cnt;
+        info->classes[desc_idx].free_blocks = descs[desc_idx].free_blocks;
+    }
+    info->large_cnt = large->cnt;
+    info->large_pages = large->pages;
+}
+
+
+/**
+ * @brief meminfo_swap用于获得交换的使用情况. 和meminfo_pool一样, 先在内核栈上取得快照, 再写入用户缓冲区
+ *
+ * @param info 存放结果的位置
+ */
+static void meminfo_swap(meminfo_swap_t *info){
+    swap_stats_t stats;
+    swap_get_stats(&stats);
+    info->slot_total = stats.slot_total;
+    info->fill_pages = stats.fill_pages;
+    info->zram_pages = stats.zram_pages;
+    info->zram_compr_bytes = stats.zram_compr_bytes;
+    info->zram_mem_bytes = stats.zram_mem_bytes;
+    info->disk_pages = stats.disk_pages;
+    info->disk_total = stats.disk_total;
+    info->swapout_cnt = stats.swapout_cnt;
+    info->swapin_cnt = stats.swapin_cnt;
+    info->swapin_ram_cnt = stats.swapin_ram_cnt;
+}
+
+
+/**
+ * @brief meminfo_ksm用于获得页合并的使用情况, 同样先在内核栈上取得快照
+ *
+ * @param info 存放结果的位置
+ */
+static void meminfo_ksm(meminfo_ksm_t *info){
+    ksm_stats_t stats;
+    ksm_get_stats(&stats);
+    info->shared_pages = stats.shared_pages;
+    info->sharing_pages = stats.sharing_pages;
+    info->merged_cnt = stats.merged_cnt;
+    info->zero_cnt = stats.zero_cnt;
+    info->full_scans = stats.full_scans;
+}
+
+
+/**
+ * @brief sys_meminfo是meminfo系统调用的实现函数, 用于获得物理内存池, 内核堆, 当前进程的堆, 页表, 当前进程映射的页,
+ *        交换以及页合并的使用情况. 这些数据都是在分配和释放的时候维护的计数, 不需要遍历
+ * 
+ * @param info 存放结果的位置, meminfo_t定义在syscall.h中
+ * @return int32_t 成功返回0; info为NULL则返回-1
+ */
+int32_t sys_meminfo(meminfo_t *info){
+    if (info == NULL)
+        return -1;
+
+    task_struct_t *cur = running_thread();
+    meminfo_pool(&kernel_pool, &info->kernel_pool);
+    meminfo_pool(&user_pool, &info->user_pool);
+    meminfo_pool(&high_pool, &info->high_pool);
+    meminfo_heap(k_block_descs, &k_large_stat, &info->kernel_heap);
+    if (cur->pgdir != NULL)
+        meminfo_heap(cur->u_block_desc, &cur->u_large_stat, &info->user_heap);
+    else
+        memset(&info->user_heap, 0, sizeof(info->user_heap));
+    info->pgtable_pages = pgtable_pages;
+    info->rss_pages = cur->rss_pages;
+    meminfo_swap(&info->swap);
+    meminfo_ksm(&info->ksm);
+    return 0;
+}
+
+
+
+/* ================================================================================================================== */
+/* ==================================================== 分配追踪 ====================================================== */
+/* ================================================================================================================== */
+
+// 分配追踪用于找出哪里在大量使用堆. 开启以后, 每次sys_malloc, sys_calloc, sys_realloc, sys_memalign和sys_free都在
+// 环形缓冲区中记录一条: 调用者的返回地址, 申请的字节数, 内存块的大小类和当时的tick数, 缓冲区满了以后覆盖最旧的记录.
+// 报告按调用者汇总缓冲区中的记录: 分配的次数和字节数, 分配速率, 以及分配以后在缓冲区中没有释放的字节数. 用户进程的分配
+// 都经过系统调用, 调用者是syscall_handler. 报告中的地址用symbolize.sh对照build/kernel.map得到所在的函数.
+// 没有开启的时候, 分配和释放只多检查一次标志
+
+/// @brief 环形缓冲区占用的页数, 第一次开启的时候分配
+#define MEM_TRACE_PAGES 8
+/// @brief 报告中汇总项的个数, 最后一项留给其余的调用者, 真实的调用者只使用前面的项
+#define MEM_TRACE_SITES 64
+/// @brief 报告中最多输出的调用者数
+#define MEM_TRACE_TOP 16
+
+#define MEM_TRACE_FREE      0x1             // 释放的记录
+#define MEM_TRACE_USER      0x2             // 用户堆中的内存, pid是所属的进程
+#define MEM_TRACE_MATCHED   0x4             // 分配的内存已经在缓冲区中被释放, 汇总的时候使用
+
+/**
+ * @brief mem_trace_rec_t是分配追踪的一条记录
+ */
+typedef struct __mem_trace_rec_t {
+    uint32_t site;                              // 调用者的返回地址
+    uint32_t ptr;                               // 分配得到或者释放的内存
+    uint32_t size;                              // 申请的字节数, 释放的记录为0
+    uint32_t tick;                              // 记录时的tick数
+    pid_t pid;                                  // 用户堆所属的进程, 内核堆为0
+    uint8_t desc_idx;                           // 内存块的大小类, MEM_UNIT_CNT表示大内存块
+    uint8_t flags;                              // MEM_TRACE_FREE, MEM_TRACE_USER, MEM_TRACE_MATCHED
+} mem_trace_rec_t;
+
+/**
+ * @brief mem_trace_site_t是报告中一个调用者的汇总
+ */
+typedef struct __mem_trace_site_t {
+    uint32_t site;                              // 调用者的返回地址
+    uint32_t alloc_cnt;                         // 分配的次数
+    uint32_t alloc_bytes;                       // 分配的字节数
+    uint32_t free_cnt;                          // 分配的内存在缓冲区中被释放的次数
+    uint32_t live_bytes;                        // 分配以后在缓冲区中没有释放的字节数
+    uint32_t classes;                           // 用到的大小类的位图, 第MEM_UNIT_CNT位表示大内存块
+} mem_trace_site_t;
+
+extern uint32_t ticks;
+
+static mem_trace_rec_t *trace_buf;
+static uint32_t trace_cap;
+/// @brief 下一条记录的位置和缓冲区中的记录数
+static uint32_t trace_head, trace_cnt;
+static bool trace_on;
+static mem_trace_site_t trace_sites[MEM_TRACE_SITES];
+
+
+/**
+ * @brief mem_trace_record用于在环形缓冲区中添加一条记录
+ *
+ * @param ptr 分配得到或者释放的内存
+ * @param size 申请的字节数, 释放的时候为0
+ * @param site 调用者的返回地址
+ * @param flags 记录的类型
+ */
+static void mem_trace_record(void *ptr, uint32_t size, uint32_t site, uint8_t flags){
+    task_struct_t *cur = running_thread();
+    uint8_t desc_idx = MEM_UNIT_CNT;
+    if (!(flags & MEM_TRACE_FREE)){
+        arena_t *a = block2arena(ptr);
+        if (!a->large)
+            desc_idx = a->desc_idx;
+    }
+    if (cur->pgdir != NULL)
+        flags |= MEM_TRACE_USER;
+
+    intr_status_t old_status = intr_disable();
+    // 关中断之前追踪可能已经被关闭了
+    if (trace_on){
+        mem_trace_rec_t *rec = &trace_buf[trace_head];
+        rec->site = site;
+        rec->ptr = (uint32_t) ptr;
+        rec->size = size;
+        rec->tick = ticks;
+        rec->pid = cur->pgdir != NULL ? cur->pid : 0;
+        rec->desc_idx = desc_idx;
+        rec->flags = flags;
+        trace_head = (trace_head + 1) % trace_cap;
+        if (trace_cnt < trace_cap)
+            trace_cnt++;
+    }
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief mem_trace_alloc用于在开启分配追踪的时候记录一次分配, 分配失败的时候不记录
+ */
+static void mem_trace_alloc(void *ptr, uint32_t size, uint32_t site){
+    if (trace_on && ptr != NULL)
+        mem_trace_record(ptr, size, site, 0);
+}
+
+
+/**
+ * @brief mem_trace_free用于在开启分配追踪的时候记录一次释放
+ */
+static void mem_trace_free(void *ptr, uint32_t site){
+    if (trace_on && ptr != NULL)
+        mem_trace_record(ptr, 0, site, MEM_TRACE_FREE);
+}
+
+
+/**
+ * @brief mem_trace_site用于获得报告中site的汇总项. 前MEM_TRACE_SITES - 1项都用完以后, 其余的调用者都计入最后一项,
+ *        最后一项的site为0, 在汇总之前已经清0
+ *
+ * @param site 调用者的返回地址
+ * @param site_cnt 真实的调用者已经使用的汇总项数
+ * @return mem_trace_site_t* site的汇总项
+ */
+static mem_trace_site_t *mem_trace_site(uint32_t site, uint32_t *site_cnt){
+    for (uint32_t idx = 0; idx < *site_cnt; idx++)
+        if (trace_sites[idx].site == site)
+            return &trace_sites[idx];
+    if (*site_cnt == MEM_TRACE_SITES - 1)
+        return &trace_sites[MEM_TRACE_SITES - 1];
+    mem_trace_site_t *ts = &trace_sites[(*site_cnt)++];
+    memset(ts, 0, sizeof(*ts));
+    ts->site = site;
+    return ts;
+}
+
+
+/**
+ * @brief mem_trace_pad用于将str追加到line中, 不足width个字符的时候用空格补齐
+ */
+static void mem_trace_pad(char *line, const char *str, uint32_t width){
+    uint32_t len = strlen(line), end = len + width;
+    strcpy(line + len, str);
+    len += strlen(str);
+    while (len < end)
+        line[len++] = ' ';
+    line[len] = 0;
+}
+
+
+/**
+ * @brief mem_trace_report用于按调用者汇总缓冲区中的记录, 按照没有释放的字节数从多到少输出. 必须在关闭追踪以后调用
+ *
+ * @details 每条释放的记录向前查找同一个堆中同一个地址最近的一次分配, 找到则这次分配已经释放. 分配的记录已经被覆盖的释放
+ *          无法归属到调用者, 单独计数. 速率是缓冲区覆盖的时间内每秒分配的次数
+ */
+static void mem_trace_report(void){
+    if (trace_cnt == 0){
+        kprintf("memtrace: no record\n");
+        return;
+    }
+
+    uint32_t first = (trace_head + trace_cap - trace_cnt) % trace_cap;
+    uint32_t lost_frees = 0;
+    for (uint32_t cnt = 0; cnt < trace_cnt; cnt++){
+        mem_trace_rec_t *rec = &trace_buf[(first + cnt) % trace_cap];
+        rec->flags &= ~MEM_TRACE_MATCHED;
+        if (!(rec->flags & MEM_TRACE_FREE))
+            continue;
+        uint32_t back = cnt;
+        for (; back > 0; back--){
+            mem_trace_rec_t *prev = &trace_buf[(first + back - 1) % trace_cap];
+            if (prev->ptr == rec->ptr && prev->pid == rec->pid && (prev->flags & MEM_TRACE_USER) == (rec->flags & MEM_TRACE_USER)){
+                // 同一个地址最近的记录是释放, 说明这次释放没有对应的分配, 例如重复释放
+                if (!(prev->flags & MEM_TRACE_FREE))
+                    prev->flags |= MEM_TRACE_MATCHED;
+                break;
+            }
+        }
+        if (back == 0)
+            lost_frees++;
+    }
+
+    uint32_t site_cnt = 0;
+    memset(&trace_sites[MEM_TRACE_SITES - 1], 0, sizeof(mem_trace_site_t));
+    for (uint32_t cnt = 0; cnt < trace_cnt; cnt++){
+        mem_trace_rec_t *rec = &trace_buf[(first + cnt) % trace_cap];
+        if (rec->flags & MEM_TRACE_FREE)
+            continue;
+        mem_trace_site_t *ts = mem_trace_site(rec->site, &site_cnt);
+        ts->alloc_cnt++;
+        ts->alloc_bytes += rec->size;
+        ts->classes |= 1U << rec->desc_idx;
+        if (rec->flags & MEM_TRACE_MATCHED)
+            ts->free_cnt++;
+        else
+            ts->live_bytes += rec->size;
+    }
+
+    // 其余调用者的汇总项用到了的时候也参与排序, 此时前面的项都已经用完, 所以汇总项依旧是连续的
+    uint32_t rank_cnt = trace_sites[MEM_TRACE_SITES - 1].alloc_cnt != 0 ? MEM_TRACE_SITES : site_cnt;
+
+    uint32_t span = trace_buf[(trace_head + trace_cap - 1) % trace_cap].tick - trace_buf[first].tick;
+    kprintf("memtrace: %d records in %d ticks, %d call sites%s, %d frees of untracked blocks\n",
+            trace_cnt, span, site_cnt, rank_cnt > site_cnt ? " and (others)" : "", lost_frees);
+    char line[96], field[16];
+    line[0] = 0;
+    mem_trace_pad(line, "SITE", 12);
+    mem_trace_pad(line, "ALLOCS", 8);
+    mem_trace_pad(line, "FREES", 8);
+    mem_trace_pad(line, "BYTES", 10);
+    mem_trace_pad(line, "LIVE", 10);
+    mem_trace_pad(line, "RATE/S", 8);
+    kprintf("%sCLASSES\n", line);
+
+    // 每次选出没有释放的字节数最多的调用者, 选出的调用者交换到前面
+    for (uint32_t rank = 0; rank < rank_cnt && rank < MEM_TRACE_TOP; rank++){
+        uint32_t best = rank;
+        for (uint32_t idx = rank + 1; idx < rank_cnt; idx++)
+            if (trace_sites[idx].live_bytes > trace_sites[best].live_bytes ||
+                (trace_sites[idx].live_bytes == trace_sites[best].live_bytes && trace_sites[idx].alloc_cnt > trace_sites[best].alloc_cnt))
+                best = idx;
+        mem_trace_site_t tmp = trace_sites[rank];
+        trace_sites[rank] = trace_sites[best];
+        trace_sites[best] = tmp;
+        mem_trace_site_t *ts = &trace_sites[rank];
+
+        line[0] = 0;
+        if (ts->site == 0)
+            mem_trace_pad(line, "(others)", 12);
+        else {
+            sprintf(field, "0x%x", ts->site);
+            mem_trace_pad(line, field, 12);
+        }
+        sprintf(field, "%d", ts->alloc_cnt);
+        mem_trace_pad(line, field, 8);
+        sprintf(field, "%d", ts->free_cnt);
+        mem_trace_pad(line, field, 8);
+        sprintf(field, "%d", ts->alloc_bytes);
+        mem_trace_pad(line, field, 10);
+        sprintf(field, "%d", ts->live_bytes);
+        mem_trace_pad(line, field, 10);
+        sprintf(field, "%d", span == 0 ? ts->alloc_cnt : ts->alloc_cnt * IRQ0_FREQUENCY / span);
+        mem_trace_pad(line, field, 8);
+        kprintf("%s", line);
+        for (uint32_t desc_idx = 0; desc_idx <= MEM_UNIT_CNT; desc_idx++)
+            if (ts->classes & (1U << desc_idx)){
+                if (desc_idx == MEM_UNIT_CNT)
+                    kprintf(" large");
+                else
+                    kprintf(" %d", mem_block_sizes[desc_idx]);
+            }
+        kprintf("\n");
+    }
+}
+
+
+/**
+ * @brief sys_memtrace是memtrace系统调用的实现函数, 用于控制分配追踪
+ *
+ * @param cmd MEMTRACE_START: 清空缓冲区并开始追踪; MEMTRACE_STOP: 停止追踪;
+ *            MEMTRACE_REPORT: 输出缓冲区中的记录按调用者汇总的报告, 报告期间暂停追踪
+ * @return int32_t 成功返回0; 命令不合法或者无法分配缓冲区则返回-1
+ */
+int32_t sys_memtrace(uint32_t cmd){
+    switch (cmd){
+        case MEMTRACE_START: {
+            // 缓冲区分配以后一直保留, 再次开启的时候直接使用
+            if (trace_buf == NULL){
+                if ((trace_buf = get_kernel_pages(MEM_TRACE_PAGES)) == NULL)
+                    return -1;
+                trace_cap = MEM_TRACE_PAGES * PG_SIZE / sizeof(mem_trace_rec_t);
+            }
+            intr_status_t old_status = intr_disable();
+            trace_head = trace_cnt = 0;
+            trace_on = true;
+            intr_set_status(old_status);
+            return 0;
+        }
+        case MEMTRACE_STOP:
+            trace_on = false;
+            return 0;
+        case MEMTRACE_REPORT: {
+            bool was_on = trace_on;
+            trace_on = false;
+            mem_trace_report();
+            trace_on = was_on;
+            return 0;
+        }
+        default:
+            return -1;
     }
-}
\ No newline at end of file
+}
@@ -12,6 +12,19 @@
 #define PG_RW_W 2       // 页表项R/W位，读/写/执行权限
 #define PG_US_S 0       // 页表项U/S位，系统级
 #define PG_US_U 4       // 页表项U/S位，用户级
+#define PG_A    0x20    // 页表项A位, 访问该页的时候由CPU置1, 用于页回收的时钟算法
+#define PG_PS   0x80    // 页目录项PS位, 为1表示页目录项直接映射一个4MB的大页, 需要开启CR4的PSE位
+#define PG_G    0x100   // 页表项G位, 为1表示全局页, 重新装入cr3的时候不会被刷新, 需要开启CR4的PGE位
+#define PG_COW  0x200   // 页表项中留给操作系统使用的第9位, 表示该页是写时复制的页
+#define PG_SWAP 0x400   // 页表项中留给操作系统使用的第10位, 不存在位为0时表示该页被换出到了交换分区, 高20位是槽号
+
+#define LARGE_PG_SIZE   0x400000        // 4MB大页的大小
+
+// 直接映射区: 物理内存从0开始使用4MB的大页线性映射到DIRECT_MAP_BASE开始的内核虚拟地址, 直到KMAP_BASE为止.
+// 直接映射区中的地址减去DIRECT_MAP_BASE就是物理地址, 并且一个TLB项就能覆盖4MB内存
+#define DIRECT_MAP_BASE 0xE0000000
+// 临时映射区: [KMAP_BASE, 0xFFC00000)这4MB使用一个页表, 用于临时映射直接映射区以外的物理页(高端内存), 见kmap_page
+#define KMAP_BASE       0xFF800000
 
 
 #define PDE_IDX(addr)   ((addr & 0xFFC00000) >> 22)     // 宏函数获取页目录偏移
@@ -26,19 +39,50 @@ typedef struct __virtual_addr_t {
 
 typedef enum __pool_flags {
     PF_KERNEL = 1,                              // 内核内存池
-    PF_USER = 2                                 // 用户内存池
+    PF_USER = 2,                                // 用户内存池
+    PF_LARGE = 4                                // 和PF_KERNEL一起使用, 优先分配物理上连续的页并返回直接映射区中的地址
 } pool_flags_t;
 
-// kernel_pool和user_pool是物理内存池，并且由于是共享数据，因此实际上对其的操作要保证原子性
-extern struct __pool_t kernel_pool, user_pool;
+
+#define PAGE_RESERVED   0x1             // 该页不归物理内存池管理, 例如低端1MB, 页目录表, 内核页表以及物理页描述符本身
+#define PAGE_BUDDY      0x2             // 该页是伙伴系统中某个空闲块的首页
+#define PAGE_USER       0x4             // 该页映射在用户进程的用户空间中
+#define PAGE_BORROWED   0x8             // 该页是从另一个物理内存池中借用的
+#define PAGE_LRU        0x10            // 该页在回收用的LRU链表中
+#define PAGE_KSM        0x20            // 该页是多个内容相同的用户页合并得到的只读页, 见ksm.h
+
+#define PFN(addr)       ((uint32_t) (addr) >> 12)       // 宏函数获取物理地址的页帧号
+
+
+/**
+ * @brief page_t是物理页描述符, 系统中每个物理页都有一个描述符, 所有的描述符组成以页帧号(PFN)为下标的数组mem_map.
+ *        物理页的分配和释放都通过描述符中的引用计数完成, 所以一个物理页可以被多个进程共享
+ */
+typedef struct __page_t {
+    list_elem_t lru;                            // 空闲时链接在伙伴系统的空闲块链表中, 分配后可以链接在回收用的LRU链表中
+    uint16_t flags;                             // 物理页的标志, PAGE_XXX
+    uint8_t order;                              // 空闲块的阶数, 只对PAGE_BUDDY的页有意义
+    uint32_t refcount;                          // 引用计数, 为0表示物理页空闲. 用户页每被一个页表项映射一次就加1
+    void *owner;                                // 物理页的拥有者, 用户页为第一次映射该页的进程, 内核页为NULL
+    uint32_t vaddr;                             // 物理页在拥有者中映射的虚拟地址
+} page_t;
+
+/// 以页帧号为下标的物理页描述符数组
+extern page_t *mem_map;
+/// mem_map中的描述符个数, 即物理内存的页数
+extern uint32_t mem_map_cnt;
+
+// kernel_pool和user_pool是物理内存池，并且由于是共享数据，因此实际上对其的操作要保证原子性.
+// high_pool管理直接映射区以外, 4GB以下的物理内存(高端内存), 只用于用户页. 4GB以上的物理内存需要PAE, 目前不支持
+extern struct __pool_t kernel_pool, user_pool, high_pool;
 
 /**
  * @brief mem_init用于初始化系统的内存
  * 
  * @details mem_init干的事:
  *              1. 初始化页粒度内存管理系统:
- *                  1.1 初始化内核使用的物理内存Bitmap
- *                  1.2 初始化用户使用的物理内存Bitmap
+ *                  1.1 初始化内核物理内存池的伙伴系统
+ *                  1.2 初始化用户物理内存池的伙伴系统
  *                  1.3 初始化内核使用的虚拟内存Bitmap
  *              2. 初始化细粒度内存管理系统
  */
@@ -62,7 +106,9 @@ uint32_t* pte_addr(uint32_t vaddr);
 
 
 /**
- * @brief malloc_page从pf指定的内存池中分配pg_cnt个页
+ * @brief malloc_page从pf指定的内存池中分配pg_cnt个页. 多个页时优先分配物理上连续的页,
+ *        若内存池中没有足够大的连续块, 则逐页分配. 内核内存指定PF_LARGE时, 物理上连续的页直接使用4MB大页映射的直接映射区,
+ *        不需要修改页表, 分配不到连续的页时再按照普通的页分配
  * 
  * @param pf 指定要分配的内存池
  * @param pg_cnt 要分配的页
@@ -80,6 +126,28 @@ void *malloc_page(pool_flags_t pf, uint32_t pg_cnt);
 void *get_kernel_pages(uint32_t pg_cnt);
 
 
+/**
+ * @brief dma_alloc用于分配size字节物理上连续的内存, 供总线主控DMA(例如PRD表和DMA缓冲区)使用. 内存直接使用伙伴系统中的块,
+ *        通过直接映射区访问, 所以不需要修改页表
+ *
+ * @param size 需要的字节数, 分配的时候按页取整
+ * @param align 物理地址的对齐, 必须是2的幂, 不足一页的按一页对齐
+ * @param boundary 分配的内存不能跨越的物理地址边界, 例如PRD表和PRD描述的缓冲区不能跨越64KB. 必须是2的幂, 为0表示没有限制
+ * @param phy_addr 存放分配的内存的物理地址
+ * @return void* 若分配成功, 则返回直接映射区中的虚拟地址, 内容全为0; 失败或者size超过了boundary则返回NULL
+ */
+void *dma_alloc(uint32_t size, uint32_t align, uint32_t boundary, uint32_t *phy_addr);
+
+
+/**
+ * @brief dma_free用于释放dma_alloc分配的内存
+ *
+ * @param vaddr dma_alloc返回的虚拟地址
+ * @param size 分配时的字节数
+ */
+void dma_free(void *vaddr, uint32_t size);
+
+
 /**
  * @brief get_user_page用于从用户内存池中申请pg_cnt个页
  * 
@@ -89,6 +157,55 @@ void *get_kernel_pages(uint32_t pg_cnt);
 void *get_user_pages(uint32_t pg_cnt);
 
 
+/**
+ * @brief free_user_pages用于释放当前进程从vaddr开始的pg_cnt个用户页, 包括已经映射的物理页和虚拟页
+ * 
+ * @param vaddr 要释放的第一个页
+ * @param pg_cnt 要释放的页数
+ */
+void free_user_pages(void *vaddr, uint32_t pg_cnt);
+
+
+/**
+ * @brief mem_reclaim用于在物理内存不足的时候将最多cnt个用户页换出, 换出的物理页归还给用户内存池
+ * 
+ * @param cnt 最多换出的页数
+ * @return uint32_t 实际回收的页数. 没有启用交换, 槽已经用完, 或者当前线程持有用户内存池的锁的时候返回0
+ */
+uint32_t mem_reclaim(uint32_t cnt);
+
+
+/**
+ * @brief page_owner_pte用于获得用户页page在拥有者页表中的页表项. 拥有者必须还在运行, 并且页表项确实映射了page
+ *
+ * @param page 用户页
+ * @return uint32_t* 成功则返回页表项在直接映射区中的地址; 若page被共享, 或者无法确定映射page的页表项, 则返回NULL
+ */
+uint32_t *page_owner_pte(page_t *page);
+
+
+/**
+ * @brief page_merge用于将独占的用户页page合并到内容相同的kpage中: page的页表项改为只读映射kpage, 原来可写的页
+ *        设置PG_COW, 写的时候再复制一份. 调用者需要关中断, 并在同一个关中断的区间内确认两个页的内容相同
+ *
+ * @param page 需要合并的用户页
+ * @param kpage 合并的目标. 为NULL时合并到零页, 只有可写的页才能合并到零页; 为page时只是将page改为只读, 作为以后合并的目标
+ * @return true 合并成功, page为kpage以外的页的时候, page的引用已经释放
+ * @return false page不是独占的用户页, 或者不能合并到零页
+ */
+bool page_merge(page_t *page, page_t *kpage);
+
+
+/**
+ * @brief mem_zero_refill用于为预先清0的单页补充一个页, 由idle线程在系统空闲的时候调用.
+ *        每次只清0一个页, 这样有线程就绪的时候idle线程可以尽快让出CPU
+ * 
+ * @return true 补充了一个页
+ * @return false 所有内存池预先清0的单页都已经足够, 或者内存池中已经没有空闲的页了
+ */
+bool mem_zero_refill(void);
+
+
 /**
  * @brief get_a_page用于从指定的内存池中分配一个页，并将该页与虚拟地址vaddr所属的虚拟页绑定
  * 
@@ -100,13 +217,21 @@ void *get_a_page(pool_flags_t pf, uint32_t vaddr);
 
 
 /**
- * @brief free_a_phy_page用于将pg_phy_page执指向的物理页的位图清0
+ * @brief free_a_phy_page用于释放对pg_phy_page指向的物理页的一次引用, 最后一个引用释放时物理页归还到所属的内存池的伙伴系统中
  * 
- * @param pg_phy_page 需要在位图中清0的物理页地址
+ * @param pg_phy_page 需要归还的物理页地址
  */
 void free_a_phy_page(uint32_t pg_phy_page);
 
 
+/**
+ * @brief free_page_table用于释放用户进程的一个页表, 进程退出的时候调用. 页表中的页需要已经释放
+ * 
+ * @param pt_phy_addr 页表的物理地址
+ */
+void free_page_table(uint32_t pt_phy_addr);
+
+
 /**
  * @brief mfree_page将释放以虚拟地址vaddr所在的物理页为起始的pg_cnt个物理页
  * 
@@ -126,43 +251,199 @@ void mfree_page(pool_flags_t pf, void *_vaddr, uint32_t pg_cnt);
 uint32_t addr_v2p(uint32_t vaddr);
 
 
+/**
+ * @brief phy2page用于获得物理地址pg_phy_addr所在的物理页的描述符
+ *
+ * @param pg_phy_addr 物理地址
+ * @return page_t* 物理页的描述符
+ */
+page_t *phy2page(uint32_t pg_phy_addr);
+
+
+/**
+ * @brief page2phy用于获得描述符page对应的物理页的物理地址
+ *
+ * @param page 物理页描述符
+ * @return uint32_t 物理页的物理地址
+ */
+uint32_t page2phy(page_t *page);
+
+
+/**
+ * @brief kmap用于获得pg_phy_addr所在的物理页在直接映射区中的内核虚拟地址, 用于访问没有内核虚拟地址的页表和内核内存池中的物理页.
+ *        高端内存中的页不在直接映射区中, 要使用kmap_page
+ *
+ * @param pg_phy_addr 需要访问的物理页
+ * @return void* 物理页在直接映射区中的地址
+ */
+void *kmap(uint32_t pg_phy_addr);
+
+
+/**
+ * @brief kmap_page用于获得任意物理页在内核中可以访问的地址. 直接映射区中的页直接返回其地址, 高端内存中的页临时映射到
+ *        临时映射区中. 用户页可能在高端内存中, 所以内核访问用户页的内容都要使用kmap_page, 用完以后调用kunmap_page
+ *
+ * @param pg_phy_addr 需要访问的物理页
+ * @return void* 物理页在内核中的地址, 所有进程中都有效
+ */
+void *kmap_page(uint32_t pg_phy_addr);
+
+
+/**
+ * @brief kunmap_page用于解除kmap_page建立的临时映射, 直接映射区中的地址不需要解除
+ *
+ * @param vaddr kmap_page返回的地址
+ */
+void kunmap_page(void *vaddr);
+
+
+/**
+ * @brief get_page用于增加物理页的引用计数, 例如物理页被映射到了另一个页表项中
+ *
+ * @param page 物理页描述符
+ */
+void get_page(page_t *page);
+
+
+/**
+ * @brief put_page用于减少物理页的引用计数, 引用计数减为0的时候物理页归还给所属的内存池
+ *
+ * @param page 物理页描述符
+ */
+void put_page(page_t *page);
+
 
 /**
- * @brief 内存块单元, 本质是链表中的, 将被连接在mem_block_desc_t.free_list中
+ * @brief page_table_fork用于将当前用户进程的用户空间以写时复制的方式共享给子进程. 子进程的页表从内核物理内存池中分配,
+ *        父子进程中可写的页都被改为只读并设置PG_COW. 该函数只复制页表, 所以开销只和页表的大小有关
+ *
+ * @param child_pgdir 子进程的页目录表, 其中用户空间的页目录项必须都为空
+ * @return int32_t 成功则返回0, 失败则返回-1. 失败时已经复制的页表依旧在子进程的页目录表中, 需要调用page_table_fork_undo释放
+ */
+int32_t page_table_fork(uint32_t *child_pgdir);
+
+
+/**
+ * @brief page_table_fork_undo用于在fork失败的时候释放page_table_fork为子进程复制的页表. 页表中共享的页和槽归还子进程
+ *        的那一次引用, 子进程自己的页直接释放
+ *
+ * @param child_pgdir 子进程的页目录表
+ */
+void page_table_fork_undo(uint32_t *child_pgdir);
+
+
+/// 批量取消映射时最多逐页invlpg的页数, 超过以后直接刷新整个TLB
+#define UNMAP_BATCH_FLUSH_MAX 32
+/// 批量取消映射时暂存的待释放物理页数, 暂存满了以后先刷新TLB再释放
+#define UNMAP_BATCH_PAGES 16
+
+/**
+ * @brief unmap_batch_t用于批量取消映射. 清除页表项的时候只记录被取消映射的虚拟地址范围和物理页,
+ *        最后统一刷新一次TLB, 再批量释放物理页. 物理页必须在TLB刷新之后才能释放, 否则其他使用者可能通过过时的TLB项访问到该页
+ */
+typedef struct __unmap_batch_t {
+    uint32_t start;                             // 已清除页表项的最低虚拟地址
+    uint32_t end;                               // 已清除页表项的最高虚拟页的下一页
+    uint32_t pte_cnt;                           // 已清除的页表项数
+    uint32_t pages[UNMAP_BATCH_PAGES];          // 等待TLB刷新后释放的物理页
+    uint32_t page_cnt;                          // 等待释放的物理页数
+} unmap_batch_t;
+
+
+/**
+ * @brief unmap_batch_init用于初始化一次批量取消映射
+ *
+ * @param batch 需要初始化的批量取消映射
+ */
+void unmap_batch_init(unmap_batch_t *batch);
+
+
+/**
+ * @brief unmap_batch_add用于清除当前页表中vaddr所在虚拟页的页表项, 页表项对应的物理页在TLB刷新之后释放一次引用.
+ *        虚拟页没有映射物理页的时候什么都不做
+ *
+ * @param batch 批量取消映射
+ * @param vaddr 要取消映射的虚拟页
+ */
+void unmap_batch_add(unmap_batch_t *batch, uint32_t vaddr);
+
+
+/**
+ * @brief unmap_batch_finish用于结束一次批量取消映射: 刷新TLB并释放所有暂存的物理页
+ *
+ * @param batch 批量取消映射
+ */
+void unmap_batch_finish(unmap_batch_t *batch);
+
+
+
+/**
+ * @brief 内存块单元, 本质是链表中的, 将被连接在所属arena的free_list中
  * 
  */
 typedef struct __mem_block_t {
     list_elem_t free_elem;
 } mem_block_t;
 
+
+/// @brief 每个弹匣中最多保存的内存块数
+#define MEM_MAG_ROUNDS 15
+
+/**
+ * @brief 弹匣(magazine)是线程私有的内存块缓存, 一个弹匣只保存同一种大小的内存块. 线程分配和释放小内存块的时候
+ *        首先操作自己的弹匣, 不需要获取内存池的锁; 只有弹匣空了或者满了的时候才和mem_block_desc_t中的仓库交换弹匣
+ */
+typedef struct __mem_magazine_t {
+    /// @brief 仓库中弹匣栈的下一个弹匣
+    struct __mem_magazine_t *next;
+    /// @brief 弹匣中的内存块数
+    uint32_t rounds;
+    /// @brief 弹匣中的内存块
+    void *blocks[MEM_MAG_ROUNDS];
+} mem_magazine_t;
+
+/**
+ * @brief 线程持有的某种大小的内存块的弹匣. loaded是当前使用的弹匣, prev是上一个弹匣, 
+ *        保留两个弹匣可以避免分配和释放在弹匣空满的临界点上反复和仓库交换弹匣
+ */
+typedef struct __mem_mag_cache_t {
+    mem_magazine_t *loaded;
+    mem_magazine_t *prev;
+} mem_mag_cache_t;
+
+
 /**
- * @brief 内存块描述符, 或者说内存块售货窗口, 本质就是一个链表. 
- *          目前一共有7种不同size的内存描述符, 分别是: 16字节, 32字节, 64字节, 128字节, 256字节, 512字节, 1024字节
+ * @brief 内存块描述符, 或者说内存块售货窗口, 本质就是一个arena链表. 
+ *          目前一共有13种不同size的内存描述符, 分别是: 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 2024字节
  *          在申请内存的时候, 根据申请的内存块大小不同的, 分别从不同block_size的mem_block_desc中去获取内存
  * 
  * @details Memory view of mem_block_desc_t, Arena and mem_block. Page is a free virtual memory page.
+ *          Every arena keeps its own free list, so an arena can be unlinked in O(1) once all its blocks are free.
  * 
- *    mem_block_desc_t  ----------------
- *                      |  block_size  |
- *                      ----------------
- *                      |  blocks...   |
- *                      ----------------
- *        ,------------ |  free_list   |
- *        |             ----------------
- *        |                             ^
- *        |                              \
- *        |   Page                        \                 Offset:
- *        |   ------------------------------\-------                Page Start
- *        |   |   Arena   ------------------ |     |
- *        |   |           |  Arena.desc    |-'     |                0x000
+ *    mem_block_desc_t  ------------------
+ *                      |  block_size    |
+ *                      ------------------
+ *                      |  blocks...     |
+ *                      ------------------
+ *        ,------------ | partial_arenas |  arenas with free blocks, partially used ones first
+ *        |             ------------------
+ *        |
+ *        |   Page                                          Offset:
+ *        |   --------------------------------------                Page Start
+ *        |   |   Arena   ------------------       |
+ *        |   |           | Arena.desc_idx |       |                0x000
  *        |   |           ------------------       |
- *        |   |           |  Arena.free_cnt|       |                0x003
+ *        |   |           | Arena.free_cnt |       |                0x004
  *        |   |           ------------------       |
- *        |   |           |  Arena.large   |       |                0x007
+ *        |   |           |  Arena.large   |       |                0x008
  *        |   |           ------------------       |
- *        |   |------------------------------------|
- *        |   |        -------------------------   |
- *        '--------->  |  mem_block.list_elem  | ------,            0x00B
+ *        |   |     ,---- | Arena.free_list|       |                0x00C
+ *        |   |     |     ------------------       |
+ *        '-------->|     | Arena.arena_tag| ------------> next arena
+ *            |     |     ------------------       |
+ *            |------------------------------------|
+ *            |     |  -------------------------   |
+ *            |     '->|  mem_block.list_elem  | ------,            0x024
  *            |        |-----------------------|   |   |
  *            |        |          free         |   |   |              The small chunk of memory consists of mem_block.list_elem and free space to use 
  *            |        |          space        |   |   |               is what user will actually use after malloc, i.e. (void*)malloc(xxx) will point
@@ -171,17 +452,17 @@ typedef struct __mem_block_t {
  *            |        -------------------------   |   |               since free will rebuild a mem_block.list_elem on the head of the memory chunk.
  *            |                                    |   |               
  *            |        -------------------------   |   |
- *        ,----------  |  mem_block.list_elem  | <-----'            0x00B + sizeof(free sapce to use)
- *        |   |        |-----------------------|   |
- *        |   |        |          free         |   |
- *        |   |        |          space        |   |
- *        |   |        |          to           |   |
- *        |   |        |          use          |   |
- *        |   |        -------------------------   |
- *        V   |                                    |
- *        .   |                   .                |                .
- *        .   |                   .                |                .
- *        .   |                   .                |                .
+ *            |   ,--  |  mem_block.list_elem  | <-----'            0x024 + block_size
+ *            |   |    |-----------------------|   |
+ *            |   |    |          free         |   |
+ *            |   |    |          space        |   |
+ *            |   |    |          to           |   |
+ *            |   |    |          use          |   |
+ *            |   |    -------------------------   |
+ *            |   V                                |
+ *            |   .               .                |                .
+ *            |   .               .                |                .
+ *            |   .               .                |                .
  *            |                                    |
  *            --------------------------------------                Page End
  */
@@ -190,12 +471,34 @@ typedef struct __mem_block_desc_t{
     uint32_t block_size;
     /// @brief 当前内存售货窗口中每箱水中的瓶子数
     uint32_t blocks_per_arena;
-    /// @brief 连接所有block的链表, 每个元素都memory block
-    list_t free_list;
+    /// @brief 有空闲内存块的arena链表, 部分空闲的arena在前, 完全空闲的arena在后
+    list_t partial_arenas;
+    /// @brief 完全空闲但是没有释放的arena数
+    uint32_t empty_arenas;
+    /// @brief 弹匣仓库中装满内存块的弹匣栈
+    mem_magazine_t *full_mags;
+    /// @brief 弹匣仓库中的空弹匣栈
+    mem_magazine_t *empty_mags;
+    /// @brief 弹匣仓库中满弹匣和空弹匣的个数
+    uint16_t full_cnt, empty_cnt;
+    /// @brief arena的个数, 包括已满的arena
+    uint32_t arena_cnt;
+    /// @brief 所有arena中空闲的内存块数, 弹匣中缓存的内存块不算空闲
+    uint32_t free_blocks;
 } mem_block_desc_t;
 
-/// @brief 内存块描述符个数, 一共有7种不同size的内存描述符
-#define MEM_UNIT_CNT 7
+/// @brief 内存块描述符个数, 一共有13种不同size的内存描述符
+#define MEM_UNIT_CNT 13
+
+/**
+ * @brief 堆中按页分配的大内存块的统计, 内核堆和每个用户进程的堆各有一份, 在持有内存池的锁的时候修改
+ */
+typedef struct __mem_large_stat_t {
+    /// @brief 大内存块的个数
+    uint32_t cnt;
+    /// @brief 大内存块占用的虚拟页数, 包括arena所在的页
+    uint32_t pages;
+} mem_large_stat_t;
 
 
 /**
@@ -208,9 +511,8 @@ void block_desc_init(mem_block_desc_t *desc_array);
 /**
  * @brief pfree(Physical Free)用于将给定的物理地址所属于的页回收到物理内存池
  * 
- * @details 由于使用Bitmap的方式管理物理内存, 而Bitmap中一位表示4K大小的内存, 即一个页.
- *          而回收本质上就是把对应页在bitmap中的占用位的清0即可. 这样做一方面减小了开销, 
- *          但是却造成了内存泄露的问题, 所以在用户申请一个页的时候, 需要memset清0
+ * @details 物理内存由伙伴系统管理, 回收的页首先进入order-0快速路径, 之后再批量归还给伙伴系统并与伙伴块合并.
+ *          回收的时候并不会清除页中的数据, 所以在用户申请一个页的时候, 需要memset清0
  * 
  * @param pg_phy_addr 
  */
@@ -220,7 +522,7 @@ void pfree(uint32_t pg_phy_addr);
  * @brief sys_malloc是malloc系统调用的实现函数, 用于在当前进程的堆中申请size个字节的内存
  * 
  * @details 开启虚拟内存以后, 只有真正的分配物理页, 在页表中添加物理页和虚拟页的映射才会接触到物理页,
- *          除此以外所有分配内存, 分配的都是虚拟内存
+ *          除此以外所有分配内存, 分配的都是虚拟内存. 小内存块首先从当前线程的弹匣中分配, 不需要获取内存池的锁
  * 
  * @param size 要申请的内存字节数
  * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
@@ -236,6 +538,116 @@ void* sys_malloc(uint32_t size);
 void sys_free(void* ptr);
 
 
+/**
+ * @brief sys_calloc是calloc系统调用的实现函数, 用于在当前进程的堆中申请nmemb个size字节的内存, 内容全为0
+ *
+ * @param nmemb 元素的个数
+ * @param size 每个元素的字节数
+ * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
+ */
+void *sys_calloc(uint32_t nmemb, uint32_t size);
+
+
+/**
+ * @brief sys_realloc是realloc系统调用的实现函数, 用于将ptr指向的内存调整为size个字节, 原来的内容保持不变.
+ *        能原地调整的时候不复制内容
+ *
+ * @param ptr sys_malloc, sys_calloc, sys_memalign或者sys_realloc返回的内存, 为NULL的时候等同于sys_malloc
+ * @param size 调整后的字节数, 为0的时候等同于sys_free
+ * @return void* 若成功, 则返回调整后的内存的首地址; 失败则返回NULL, 此时原来的内存不变
+ */
+void *sys_realloc(void *ptr, uint32_t size);
+
+
+/**
+ * @brief sys_memalign是memalign系统调用的实现函数, 用于在当前进程的堆中申请size个字节的内存, 首地址按照align对齐.
+ *        返回的内存用sys_free释放, 内容全为0
+ *
+ * @param align 对齐的字节数, 必须是2的幂
+ * @param size 要申请的内存字节数
+ * @return void* 若分配成功, 则返回申请得到的内存的首地址; 失败则返回NULL
+ */
+void *sys_memalign(uint32_t align, uint32_t size);
+
+
+/**
+ * @brief sys_brk是brk系统调用的实现函数, 用于将当前进程的堆顶(program break)设置为addr.
+ *        堆从进程的程序段之后开始, 增长的部分只保留虚拟页, 物理页在访问的时候按需分配; 收缩的部分立即释放
+ * 
+ * @param addr 新的堆顶
+ * @return int32_t 成功返回0; 若addr低于堆的起始地址, 或者需要的虚拟页已经被占用, 则返回-1
+ */
+int32_t sys_brk(void *addr);
+
+
+/**
+ * @brief sys_sbrk是sbrk系统调用的实现函数, 用于将当前进程的堆顶移动increment个字节
+ * 
+ * @param increment 堆顶移动的字节数, 可以为负数. 为0时用于获得当前的堆顶
+ * @return void* 成功则返回原来的堆顶; 失败则返回(void *) -1
+ */
+void *sys_sbrk(int32_t increment);
+
+
+struct __meminfo_t;
+
+/**
+ * @brief sys_meminfo是meminfo系统调用的实现函数, 用于获得物理内存池, 内核堆, 当前进程的堆, 页表, 当前进程映射的页,
+ *        交换以及页合并的使用情况. 这些数据都是在分配和释放的时候维护的计数, 不需要遍历
+ * 
+ * @param info 存放结果的位置, meminfo_t定义在syscall.h中
+ * @return int32_t 成功返回0; info为NULL则返回-1
+ */
+int32_t sys_meminfo(struct __meminfo_t *info);
+
+
+/**
+ * @brief sys_memtrace是memtrace系统调用的实现函数, 用于控制分配追踪. 开启以后, 堆的每次分配和释放都在环形缓冲区中记录
+ *        调用者的返回地址, 申请的字节数, 大小类和tick数; 报告按调用者汇总分配次数, 速率和没有释放的字节数
+ *
+ * @param cmd MEMTRACE_START: 清空缓冲区并开始追踪; MEMTRACE_STOP: 停止追踪;
+ *            MEMTRACE_REPORT: 输出缓冲区中的记录按调用者汇总的报告, 报告期间暂停追踪
+ * @return int32_t 成功返回0; 命令不合法或者无法分配缓冲区则返回-1
+ */
+int32_t sys_memtrace(uint32_t cmd);
+
+
+/**
+ * @brief mem_magazine_flush用于将线程弹匣中的内存块全部归还给arena, 并且释放弹匣. 用于内核线程退出
+ * 
+ * @param mag_cache 线程的弹匣
+ * @param pf 内存块所在的内存池
+ */
+void mem_magazine_flush(mem_mag_cache_t *mag_cache, pool_flags_t pf);
+
+
+/**
+ * @brief mem_magazine_destroy用于释放用户进程的弹匣和仓库中的弹匣. 用户进程退出的时候整个用户堆都会被释放, 
+ *        所以弹匣中的内存块不需要归还给arena
+ * 
+ * @param mag_cache 用户进程的弹匣
+ * @param descs 用户进程的内存块描述符
+ */
+void mem_magazine_destroy(mem_mag_cache_t *mag_cache, mem_block_desc_t *descs);
+
+
+struct __task_struct;
+
+/**
+ * @brief mem_heap_fork用于在fork的时候修正子进程用户堆的管理信息. 子进程的TCB复制自父进程, 其中的内存块描述符和
+ *        弹匣都需要修正:
+ *              1. arena链表的第一个和最后一个arena位于子进程的用户堆中, 仍然指向父进程TCB中的链表头尾
+ *              2. 弹匣和仓库中的弹匣仍然是父进程的, 需要为子进程复制一份
+ * 
+ * @note 子进程用户堆中的arena通过临时映射修改, 不需要切换到子进程的页表
+ * 
+ * @param child 子进程, 页表和区域已经复制
+ * @param parent 父进程
+ * @return int32_t 成功返回0; 失败返回-1. 失败时子进程的弹匣要么已经复制, 要么被置空, 可以用mem_magazine_destroy释放
+ */
+int32_t mem_heap_fork(struct __task_struct *child, struct __task_struct *parent);
+
+
 
 /**
  * @brief get_a_page_without_opvaddrbitmap用于从指定的内存池中分配一个页并将该页与虚拟地址vaddr所属的虚拟页绑定.
@@ -0,0 +1,123 @@
+#include "mmap.h"
+#include "global.h"
+#include "memory.h"
+#include "thread.h"
+#include "file.h"
+#include "fs.h"
+#include "pipe.h"
+#include "debug.h"
+#include "interrupt.h"
+
+/// @brief 一次mmap最多映射的页数, 与malloc_page的限制相同
+#define MMAP_MAX_PAGES 3840
+
+
+/**
+ * @brief mmap_fill_page用于将文件映射中vaddr所在的页的内容读入page
+ *
+ * @param vma vaddr所在的文件映射
+ * @param vaddr 缺页的虚拟地址
+ * @param page 需要填充的页, 必须是内核可以访问的地址
+ */
+void mmap_fill_page(vma_t *vma, uint32_t vaddr, void *page){
+    ASSERT(vma->inode != NULL);
+    file_read_page(vma->inode, vma->offset + ((vaddr & 0xFFFFF000) - vma->start), page);
+}
+
+
+/**
+ * @brief mmap_unmap_all用于取消当前进程所有的映射, 用于execv替换进程的映像
+ */
+void mmap_unmap_all(void){
+    task_struct_t *cur = running_thread();
+    list_elem_t *elem = cur->vma_list.head.next;
+    while (elem != &cur->vma_list.tail){
+        vma_t *vma = elem2entry(vma_t, vma_tag, elem);
+        elem = elem->next;
+        if (vma->flags & VMA_MMAP){
+            uint32_t start = vma->start, end = vma->end;
+            // 整个区域取消的时候不需要拆分, 不会失败
+            vma_remove(cur, start, end, VMA_MMAP);
+            free_user_pages((void *) start, (end - start) / PG_SIZE);
+        }
+    }
+}
+
+
+/**
+ * @brief sys_mmap是mmap系统调用的实现函数, 用于在当前进程中建立匿名映射或者文件的私有映射
+ *
+ * @param args mmap的参数
+ * @return void* 成功则返回映射的起始地址; 失败则返回MAP_FAILED
+ */
+void *sys_mmap(mmap_args_t *args){
+    task_struct_t *cur = running_thread();
+    uint32_t pg_cnt = DIV_CEILING(args->length, PG_SIZE);
+    // 只支持私有映射, 共享映射需要写回文件
+    if (cur->pgdir == NULL || pg_cnt == 0 || pg_cnt >= MMAP_MAX_PAGES || !(args->flags & MAP_PRIVATE) || args->offset % PG_SIZE != 0)
+        return MAP_FAILED;
+
+    inode_t *inode = NULL;
+    if (!(args->flags & MAP_ANONYMOUS)){
+        // 只能映射普通文件
+        int32_t fd = args->fd;
+        if (fd <= stderr_no || fd >= MAX_FILE_OPEN_PER_PROC || cur->fd_table[fd] == -1 || is_pipe(fd))
+            return MAP_FAILED;
+        inode = file_table[fd_local2global(fd)].fd_inode;
+        // 超过文件最大长度的偏移不可能对应文件中的内容
+        if (args->offset >= MAX_FILE_SIZE)
+            return MAP_FAILED;
+    }
+
+    // 只保留虚拟页, 物理页在缺页的时候再分配
+    uint32_t start = vma_alloc(cur, pg_cnt, VMA_MMAP);
+    if (start == 0)
+        return MAP_FAILED;
+
+    vma_t *vma = vma_find(cur, start);
+    vma->prot = args->prot;
+    vma->inode = inode;
+    vma->offset = args->offset;
+    if (inode != NULL){
+        // 映射持有文件的一次打开计数, 关闭文件描述符以后映射依旧有效
+        intr_status_t old_status = intr_disable();
+        inode->i_open_cnt++;
+        intr_set_status(old_status);
+    }
+    return (void *) start;
+}
+
+
+/**
+ * @brief sys_munmap是munmap系统调用的实现函数, 用于取消[addr, addr + length)中所有mmap建立的映射.
+ *        映射被部分取消的时候, 剩下的部分依旧保留
+ *
+ * @param addr 需要取消映射的起始地址, 必须按页对齐
+ * @param length 需要取消映射的字节数
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t sys_munmap(void *addr, uint32_t length){
+    task_struct_t *cur = running_thread();
+    uint32_t start = (uint32_t) addr;
+    uint32_t end = start + DIV_CEILING(length, PG_SIZE) * PG_SIZE;
+    if (cur->pgdir == NULL || start % PG_SIZE != 0 || length == 0 || end < start)
+        return -1;
+
+    // 逐个区域取消, 只有mmap区域中的页会被释放
+    list_elem_t *elem = cur->vma_list.head.next;
+    while (elem != &cur->vma_list.tail){
+        vma_t *vma = elem2entry(vma_t, vma_tag, elem);
+        elem = elem->next;
+        if (vma->start >= end)
+            break;
+
+        uint32_t lo = start > vma->start ? start : vma->start;
+        uint32_t hi = end < vma->end ? end : vma->end;
+        if (!(vma->flags & VMA_MMAP) || lo >= hi)
+            continue;
+        if (vma_remove(cur, lo, hi, VMA_MMAP) == -1)
+            return -1;
+        free_user_pages((void *) lo, (hi - lo) / PG_SIZE);
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __KERNEL_MMAP_H
+#define __KERNEL_MMAP_H
+
+#include "stdint.h"
+#include "syscall.h"
+#include "vma.h"
+
+/**
+ * @brief mmap_fill_page用于将文件映射中vaddr所在的页的内容读入page
+ *
+ * @param vma vaddr所在的文件映射
+ * @param vaddr 缺页的虚拟地址
+ * @param page 需要填充的页, 必须是内核可以访问的地址
+ */
+void mmap_fill_page(vma_t *vma, uint32_t vaddr, void *page);
+
+
+/**
+ * @brief mmap_unmap_all用于取消当前进程所有的映射, 用于execv替换进程的映像
+ */
+void mmap_unmap_all(void);
+
+
+/**
+ * @brief sys_mmap是mmap系统调用的实现函数, 用于在当前进程中建立匿名映射或者文件的私有映射
+ *
+ * @param args mmap的参数
+ * @return void* 成功则返回映射的起始地址; 失败则返回MAP_FAILED
+ */
+void *sys_mmap(mmap_args_t *args);
+
+
+/**
+ * @brief sys_munmap是munmap系统调用的实现函数, 用于取消[addr, addr + length)中所有mmap建立的映射.
+ *        映射被部分取消的时候, 剩下的部分依旧保留
+ *
+ * @param addr 需要取消映射的起始地址, 必须按页对齐
+ * @param length 需要取消映射的字节数
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t sys_munmap(void *addr, uint32_t length);
+
+#endif
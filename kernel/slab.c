@@ -0,0 +1,234 @@
+#include "slab.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "debug.h"
+#include "print.h"
+#include "interrupt.h"
+
+/// @brief 每个对象缓存中最多保留的完全空闲的slab数, 多余的slab将归还给内核内存池
+#define KMEM_EMPTY_SLABS 1
+
+list_t kmem_cache_list;
+
+/**
+ * @brief slab_t位于slab页的最前面, 用于描述slab页
+ */
+typedef struct __slab_t {
+    kmem_cache_t *cache;                        // slab所属的对象缓存
+    list_elem_t slab_tag;                       // 对象缓存中slab链表的节点
+    void *free_obj;                             // 空闲对象链表
+    uint32_t inuse;                             // 已经分配出去的对象数
+} slab_t;
+
+
+/**
+ * @brief obj_link返回对象中存放空闲链表指针的位置
+ */
+static inline void **obj_link(kmem_cache_t *cache, void *obj){
+    return (void **) ((uint32_t) obj + cache->free_off);
+}
+
+
+/**
+ * @brief obj2slab用于给定对象的地址, 返回对象所在的slab. 因为slab_t位于slab页的最前面, 所以直接返回页地址即可
+ */
+static inline slab_t *obj2slab(void *obj){
+    return (slab_t *) ((uint32_t) obj & 0xFFFFF000);
+}
+
+
+/**
+ * @brief kmem_init用于初始化对象缓存系统, 需要在mem_init之后, 任何kmem_cache_init之前调用
+ */
+void kmem_init(void){
+    put_str("kmem_init start\n");
+    list_init(&kmem_cache_list);
+    put_str("kmem_init done\n");
+}
+
+
+/**
+ * @brief kmem_cache_init用于初始化cache指向的对象缓存
+ *
+ * @param cache 需要初始化的对象缓存
+ * @param name 对象缓存的名字
+ * @param size 对象的大小
+ * @param align 对象的对齐要求, 必须为2的幂
+ * @param ctor 对象的构造函数, 可以为NULL
+ */
+void kmem_cache_init(kmem_cache_t *cache, const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor){
+    ASSERT(size > 0 && align > 0 && (align & (align - 1)) == 0 && align <= PG_SIZE);
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+
+    memset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->obj_size = size;
+    cache->ctor = ctor;
+    list_init(&cache->slabs);
+
+    // 有构造函数的时候, 空闲链表指针不能覆盖构造好的对象, 所以放在对象的后面
+    uint32_t link_end;
+    if (ctor == NULL){
+        cache->free_off = 0;
+        link_end = size > sizeof(void *) ? size : sizeof(void *);
+    } else {
+        cache->free_off = DIV_CEILING(size, sizeof(void *)) * sizeof(void *);
+        link_end = cache->free_off + sizeof(void *);
+    }
+    cache->slot_size = DIV_CEILING(link_end, align) * align;
+
+    // 一个页中能放下至少两个对象的时候按照小对象处理, 否则按照页对象处理
+    cache->obj_off = DIV_CEILING(sizeof(slab_t), align) * align;
+    if (cache->obj_off < PG_SIZE && (PG_SIZE - cache->obj_off) / cache->slot_size >= 2)
+        cache->objs_per_slab = (PG_SIZE - cache->obj_off) / cache->slot_size;
+    else {
+        cache->objs_per_slab = 0;
+        cache->pages_per_obj = DIV_CEILING(size, PG_SIZE);
+    }
+
+    intr_status_t old_status = intr_disable();
+    ASSERT(!elem_find(&kmem_cache_list, &cache->cache_tag));
+    list_append(&kmem_cache_list, &cache->cache_tag);
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief slab_grow用于为cache申请一个新的slab页, 并将其切分为对象
+ *
+ * @param cache 需要增加slab的对象缓存
+ * @return true 成功
+ * @return false 内核内存池中没有可用的物理页
+ */
+static bool slab_grow(kmem_cache_t *cache){
+    slab_t *slab = get_kernel_pages(1);
+    if (slab == NULL)
+        return false;
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_obj = NULL;
+
+    // 从后向前切分对象, 这样空闲链表中的对象是按照地址递增的顺序排列的
+    for (int32_t obj_idx = cache->objs_per_slab - 1; obj_idx >= 0; obj_idx--){
+        void *obj = (void *) ((uint32_t) slab + cache->obj_off + obj_idx * cache->slot_size);
+        if (cache->ctor != NULL)
+            cache->ctor(obj);
+        *obj_link(cache, obj) = slab->free_obj;
+        slab->free_obj = obj;
+    }
+
+    // 新的slab完全空闲, 放在链表的最后
+    intr_status_t old_status = intr_disable();
+    list_append(&cache->slabs, &slab->slab_tag);
+    cache->empty_slabs++;
+    cache->total_objs += cache->objs_per_slab;
+    intr_set_status(old_status);
+    return true;
+}
+
+
+/**
+ * @brief kmem_cache_alloc用于从cache中分配一个对象. 若设置了构造函数, 返回的对象处于构造后的状态;
+ *        否则对象的内容是未定义的
+ *
+ * @param cache 要分配对象的对象缓存
+ * @return void* 若分配成功, 则返回对象的地址; 若失败则返回NULL
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache){
+    void *obj;
+    intr_status_t old_status = intr_disable();
+
+    // 页对象
+    if (cache->objs_per_slab == 0){
+        if (cache->page_obj_cnt > 0){
+            obj = cache->page_objs[--cache->page_obj_cnt];
+            cache->active_objs++;
+            intr_set_status(old_status);
+            return obj;
+        }
+        intr_set_status(old_status);
+
+        if ((obj = get_kernel_pages(cache->pages_per_obj)) == NULL)
+            return NULL;
+        if (cache->ctor != NULL)
+            cache->ctor(obj);
+
+        old_status = intr_disable();
+        cache->total_objs++;
+        cache->active_objs++;
+        intr_set_status(old_status);
+        return obj;
+    }
+
+    // 小对象, 没有空闲对象的时候申请新的slab. 申请物理页的时候可能会阻塞, 所以要先开中断
+    while (list_empty(&cache->slabs)){
+        intr_set_status(old_status);
+        if (!slab_grow(cache))
+            return NULL;
+        old_status = intr_disable();
+    }
+
+    slab_t *slab = elem2entry(slab_t, slab_tag, cache->slabs.head.next);
+    obj = slab->free_obj;
+    slab->free_obj = *obj_link(cache, obj);
+    if (slab->inuse++ == 0)
+        cache->empty_slabs--;
+    // slab已满, 从链表中移除, 释放对象的时候再加入
+    if (slab->free_obj == NULL)
+        list_remove(&slab->slab_tag);
+    cache->active_objs++;
+
+    intr_set_status(old_status);
+    return obj;
+}
+
+
+/**
+ * @brief kmem_cache_free用于将obj指向的对象归还给cache
+ *
+ * @param cache 对象所属的对象缓存
+ * @param obj 需要归还的对象
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj){
+    ASSERT(obj != NULL);
+    intr_status_t old_status = intr_disable();
+    cache->active_objs--;
+
+    // 页对象, 优先缓存起来
+    if (cache->objs_per_slab == 0){
+        if (cache->page_obj_cnt < KMEM_PAGE_STASH){
+            cache->page_objs[cache->page_obj_cnt++] = obj;
+            intr_set_status(old_status);
+            return;
+        }
+        cache->total_objs--;
+        mfree_page(PF_KERNEL, obj, cache->pages_per_obj);
+        intr_set_status(old_status);
+        return;
+    }
+
+    slab_t *slab = obj2slab(obj);
+    ASSERT(slab->cache == cache);
+
+    // 之前已满的slab重新加入链表, 放在链表的最前面
+    if (slab->free_obj == NULL)
+        list_push(&cache->slabs, &slab->slab_tag);
+    *obj_link(cache, obj) = slab->free_obj;
+    slab->free_obj = obj;
+
+    if (--slab->inuse == 0){
+        list_remove(&slab->slab_tag);
+        if (cache->empty_slabs >= KMEM_EMPTY_SLABS){
+            // 已经有足够的空闲slab了, 归还slab页
+            cache->total_objs -= cache->objs_per_slab;
+            mfree_page(PF_KERNEL, slab, 1);
+        } else {
+            list_append(&cache->slabs, &slab->slab_tag);
+            cache->empty_slabs++;
+        }
+    }
+    intr_set_status(old_status);
+}
@@ -0,0 +1,83 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+
+#include "stdint.h"
+#include "list.h"
+
+/// @brief 页对象缓存中最多缓存的已构造的页对象数
+#define KMEM_PAGE_STASH 8
+
+/// @brief 对象的构造函数, 对象在第一次从slab中切分出来的时候调用, 此后对象在分配和释放之间保持构造后的状态
+typedef void (*kmem_ctor_t)(void *obj);
+
+/**
+ * @brief kmem_cache_t是固定大小的内核对象的对象缓存.
+ *
+ * @details 对象缓存从内核物理内存池中分配内存, 与当前运行的线程是内核线程还是用户进程无关. 对象分为两类:
+ *              1. 小对象: 一个页中能放下至少两个对象的时候, 对象按照对齐后的大小紧密排列在一个slab页中,
+ *                 slab页的开头是描述slab的slab_t, 空闲的对象串成单链表
+ *              2. 页对象: 对象大小接近或者超过一页(例如TCB和页目录表), 每个对象独占对齐的若干页,
+ *                 释放的对象会先缓存在page_objs中, 缓存满了以后才归还给内核内存池
+ *
+ * @note 若设置了构造函数, 则释放对象前使用者需要将对象恢复到构造后的状态
+ */
+typedef struct __kmem_cache_t {
+    const char *name;                           // 对象缓存的名字
+    uint32_t obj_size;                          // 对象实际的大小
+    uint32_t slot_size;                         // 对象在slab中占用的大小, 包括对齐和空闲链表指针
+    uint32_t free_off;                          // 空闲链表指针在对象中的偏移
+    uint32_t obj_off;                           // 第一个对象在slab页中的偏移
+    uint32_t objs_per_slab;                     // 每个slab中的对象数, 为0表示页对象
+    uint32_t pages_per_obj;                     // 页对象占用的页数
+    kmem_ctor_t ctor;                           // 对象的构造函数, 可以为NULL
+    list_t slabs;                               // 有空闲对象的slab, 部分使用的在前, 完全空闲的在后
+    uint32_t empty_slabs;                       // 完全空闲的slab数
+    void *page_objs[KMEM_PAGE_STASH];           // 缓存的已构造的页对象
+    uint32_t page_obj_cnt;                      // 缓存的页对象数
+    uint32_t total_objs;                        // 对象缓存中的对象总数
+    uint32_t active_objs;                       // 已经分配出去的对象数
+    list_elem_t cache_tag;                      // 所有对象缓存链表的节点
+} kmem_cache_t;
+
+
+/// @brief 系统中所有的对象缓存
+extern list_t kmem_cache_list;
+
+
+/**
+ * @brief kmem_init用于初始化对象缓存系统, 需要在mem_init之后, 任何kmem_cache_init之前调用
+ */
+void kmem_init(void);
+
+
+/**
+ * @brief kmem_cache_init用于初始化cache指向的对象缓存
+ *
+ * @param cache 需要初始化的对象缓存
+ * @param name 对象缓存的名字
+ * @param size 对象的大小
+ * @param align 对象的对齐要求, 必须为2的幂
+ * @param ctor 对象的构造函数, 可以为NULL
+ */
+void kmem_cache_init(kmem_cache_t *cache, const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+
+
+/**
+ * @brief kmem_cache_alloc用于从cache中分配一个对象. 若设置了构造函数, 返回的对象处于构造后的状态;
+ *        否则对象的内容是未定义的
+ *
+ * @param cache 要分配对象的对象缓存
+ * @return void* 若分配成功, 则返回对象的地址; 若失败则返回NULL
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+
+/**
+ * @brief kmem_cache_free用于将obj指向的对象归还给cache
+ *
+ * @param cache 对象所属的对象缓存
+ * @param obj 需要归还的对象
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+#endif
@@ -0,0 +1,403 @@
+#include "swap.h"
+#include "ide.h"
+#include "fs.h"
+#include "global.h"
+#include "memory.h"
+#include "slab.h"
+#include "bitmap.h"
+#include "lz4.h"
+#include "debug.h"
+#include "kstdio.h"
+#include "interrupt.h"
+#include "string.h"
+#include "thread.h"
+
+/// @brief 交换分区中每个块占用的扇区数
+#define SWAP_SECS_PER_BLOCK (PG_SIZE / SECTOR_SIZE)
+
+/// @brief 槽的状态
+#define SLOT_EMPTY 0                            // 空闲, 或者已经分配但是还没有写入
+#define SLOT_FILL 1                             // 同值页, data是填充的32位值
+#define SLOT_ZRAM 2                             // 压缩页, data是压缩数据的地址
+#define SLOT_DISK 3                             // 交换分区中的页, data是块号
+#define SLOT_PAGE 4                             // 槽持有的物理页, data是物理页的物理地址
+
+/// @brief 压缩页对象的开头2个字节记录压缩后的长度
+#define ZRAM_HDR 2
+/// @brief 压缩页的对象缓存的个数
+#define ZRAM_CLASS_CNT 8
+/// @brief 最大的压缩页对象, 一个slab页中正好能放下两个
+#define ZRAM_MAX_SIZE 2032
+/// @brief 压缩页最多占用的内存为物理内存的1/ZRAM_LIMIT_DIV
+#define ZRAM_LIMIT_DIV 8
+
+extern list_t partition_list;
+
+mutex_t swap_mutex;
+
+/**
+ * @brief swap_slot_t描述一个槽
+ */
+typedef struct __swap_slot_t {
+    uint16_t refcnt;                            // 槽的引用计数, 为0表示空闲
+    uint8_t type;                               // 槽中的页的存放方式, SLOT_XXX
+    uint8_t zclass;                             // 压缩页所在的对象缓存的下标
+    uint32_t data;                              // 与type有关的数据
+} swap_slot_t;
+
+/// @brief 所有的槽, 为NULL表示没有启用交换
+static swap_slot_t *slots;
+/// @brief 槽的总数
+static uint32_t slot_total;
+/// @brief 下一次从这个槽开始查找空闲的槽
+static uint32_t slot_hint;
+
+/// @brief 使用的交换分区, 为NULL表示没有交换分区
+static partition_t *swap_part;
+/// @brief 交换分区中块的位图
+static bitmap_t block_bitmap;
+
+/**
+ * 压缩页的对象缓存, 每个对象缓存的对象大小保证一个slab页中放下整数个对象的时候浪费的空间最少.
+ * 压缩后超过最大的对象的页不值得压缩
+ */
+static const uint32_t zram_class_size[ZRAM_CLASS_CNT] = {64, 128, 256, 512, 808, 1008, 1352, ZRAM_MAX_SIZE};
+static kmem_cache_t zram_cache[ZRAM_CLASS_CNT];
+static const char *zram_cache_name[ZRAM_CLASS_CNT] = {
+    "zram-64", "zram-128", "zram-256", "zram-512", "zram-808", "zram-1008", "zram-1352", "zram-2032"
+};
+
+/// @brief swap_stage暂存的结果, 受swap_mutex保护
+static uint8_t stage_type;
+static uint32_t stage_fill;
+static uint32_t stage_len;
+static uint8_t stage_buf[ZRAM_MAX_SIZE];
+static uint16_t lz4_table[LZ4_HASH_SIZE];
+
+static swap_stats_t swap_stats;
+
+
+/**
+ * @brief find_swap_partition是list_traversal的回调函数, 用于找到第一个交换分区
+ */
+static bool find_swap_partition(list_elem_t *elem, int arg UNUSED){
+    partition_t *part = elem2entry(partition_t, part_tag, elem);
+    return part->fs_type == PART_TYPE_SWAP && part->sec_cnt >= SWAP_SECS_PER_BLOCK;
+}
+
+
+/**
+ * @brief swap_disk_init用于初始化第一个交换分区的块位图
+ */
+static void swap_disk_init(void){
+    list_elem_t *elem = list_traversal(&partition_list, find_swap_partition, (int) NULL);
+    if (elem == NULL){
+        kprintf("    no swap partition, swap to memory only\n");
+        return;
+    }
+
+    partition_t *part = elem2entry(partition_t, part_tag, elem);
+    uint32_t total = part->sec_cnt / SWAP_SECS_PER_BLOCK;
+    block_bitmap.btmp_byte_len = DIV_CEILING(total, 8);
+    block_bitmap.bits = get_kernel_pages(DIV_CEILING(block_bitmap.btmp_byte_len, PG_SIZE));
+    if (block_bitmap.bits == NULL){
+        kprintf("    no memory for swap blocks, swap to memory only\n");
+        return;
+    }
+    bitmap_init(&block_bitmap);
+    // 位图最后一个字节中超出块数的位视为已使用
+    for (uint32_t idx = total; idx < block_bitmap.btmp_byte_len * 8; idx++)
+        bitmap_set(&block_bitmap, idx, 1);
+    swap_part = part;
+    swap_stats.disk_total = total;
+    kprintf("    swap on %s: %d blocks\n", part->name, total);
+}
+
+
+/**
+ * @brief swap_init用于初始化槽和压缩页的对象缓存, 并在所有的分区中查找第一个交换分区. 没有交换分区的时候只使用内存
+ */
+void swap_init(void){
+    kprintf("swap_init start\n");
+    mutex_init(&swap_mutex);
+    for (uint32_t idx = 0; idx < ZRAM_CLASS_CNT; idx++)
+        kmem_cache_init(&zram_cache[idx], zram_cache_name[idx], zram_class_size[idx], sizeof(uint32_t), NULL);
+    swap_stats.zram_limit = mem_map_cnt / ZRAM_LIMIT_DIV * PG_SIZE;
+    swap_disk_init();
+
+    // 内存中能存放的页数和物理页数相当, 再加上交换分区中的块
+    uint32_t total = mem_map_cnt + swap_stats.disk_total;
+    slots = get_kernel_pages(DIV_CEILING(total * sizeof(swap_slot_t), PG_SIZE));
+    if (slots == NULL){
+        kprintf("    no memory for swap slots, swap disabled\n");
+        return;
+    }
+    memset(slots, 0, total * sizeof(swap_slot_t));
+    slot_total = total;
+    swap_stats.slot_total = total;
+    kprintf("    %d slots, zram limit %dKB\n", slot_total, swap_stats.zram_limit / 1024);
+    kprintf("swap_init done\n");
+}
+
+
+/**
+ * @brief swap_usable用于判断当前能否换出页, 即槽是否已经初始化
+ *
+ * @return true 可以换出
+ * @return false 不能换出
+ */
+bool swap_usable(void){
+    return slots != NULL;
+}
+
+
+/**
+ * @brief disk_usable用于判断当前线程能否读写交换分区
+ */
+static bool disk_usable(void){
+    return swap_part != NULL && swap_part->my_disk->my_channel->mutex.holder != running_thread();
+}
+
+
+/**
+ * @brief zram_class返回能放下size字节的最小的压缩页对象缓存的下标
+ */
+static uint32_t zram_class(uint32_t size){
+    uint32_t idx = 0;
+    while (zram_class_size[idx] < size)
+        idx++;
+    return idx;
+}
+
+
+/**
+ * @brief swap_stage用于在换出page之前检查它的内容: 同值页记录填充值, 其余的页压缩到暂存区, 随后的swap_write
+ *        直接使用暂存的结果. 必须在持有swap_mutex并且关中断的情况下, 在修改页表项之前调用, 这样检查的就是换出时的内容
+ *
+ * @param page 需要换出的页, 必须是内核可以访问的地址
+ * @return true page可以换出
+ * @return false page既不能压缩, 也没有可用的交换分区, 不应该换出. 当前线程正持有交换分区所在通道的锁
+ *         (例如正在读写同一个通道上的硬盘)的时候交换分区不可用, 否则会打断正在进行的读写
+ */
+bool swap_stage(void *page){
+    ASSERT(swap_mutex.holder == running_thread() && intr_get_status() == INTR_OFF);
+    uint32_t *words = page;
+    uint32_t idx = 1;
+    while (idx < PG_SIZE / sizeof(uint32_t) && words[idx] == words[0])
+        idx++;
+    if (idx == PG_SIZE / sizeof(uint32_t)){
+        stage_type = SLOT_FILL;
+        stage_fill = words[0];
+        return true;
+    }
+
+    if (swap_stats.zram_mem_bytes < swap_stats.zram_limit){
+        uint32_t len = lz4_compress(page, PG_SIZE, stage_buf + ZRAM_HDR, sizeof(stage_buf) - ZRAM_HDR, lz4_table);
+        if (len > 0 && swap_stats.zram_mem_bytes + zram_class_size[zram_class(len + ZRAM_HDR)] <= swap_stats.zram_limit){
+            stage_type = SLOT_ZRAM;
+            stage_len = len;
+            return true;
+        }
+    }
+
+    stage_type = SLOT_DISK;
+    return disk_usable();
+}
+
+
+/**
+ * @brief swap_alloc用于分配一个空闲的槽, 分配得到的槽引用计数为1
+ *
+ * @return int32_t 成功则返回槽号; 槽已经用完则返回-1
+ */
+int32_t swap_alloc(void){
+    intr_status_t old_status = intr_disable();
+    for (uint32_t cnt = 0; cnt < slot_total; cnt++){
+        uint32_t slot = (slot_hint + cnt) % slot_total;
+        if (slots[slot].refcnt == 0){
+            ASSERT(slots[slot].type == SLOT_EMPTY);
+            slots[slot].refcnt = 1;
+            slot_hint = slot + 1;
+            intr_set_status(old_status);
+            return slot;
+        }
+    }
+    intr_set_status(old_status);
+    return -1;
+}
+
+
+/**
+ * @brief swap_dup用于增加slot的引用计数, 用于fork时子进程复制换出的页表项
+ *
+ * @param slot 槽号
+ */
+void swap_dup(uint32_t slot){
+    intr_status_t old_status = intr_disable();
+    ASSERT(slot < slot_total && slots[slot].refcnt > 0 && slots[slot].refcnt < 0xFFFF);
+    slots[slot].refcnt++;
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief slot_clear用于释放槽中的页占用的内存, 块或者物理页, 并更新统计信息. 必须关中断调用
+ *
+ * @param s 需要清空的槽
+ */
+static void slot_clear(swap_slot_t *s){
+    switch (s->type){
+        case SLOT_FILL:
+            swap_stats.fill_pages--;
+            break;
+        case SLOT_ZRAM:
+            swap_stats.zram_pages--;
+            swap_stats.zram_compr_bytes -= *(uint16_t *) s->data;
+            swap_stats.zram_mem_bytes -= zram_class_size[s->zclass];
+            kmem_cache_free(&zram_cache[s->zclass], (void *) s->data);
+            break;
+        case SLOT_DISK:
+            swap_stats.disk_pages--;
+            bitmap_set(&block_bitmap, s->data, 0);
+            break;
+        case SLOT_PAGE:
+            swap_stats.kept_pages--;
+            put_page(phy2page(s->data));
+            break;
+    }
+    s->type = SLOT_EMPTY;
+}
+
+
+/**
+ * @brief swap_put用于减少slot的引用计数, 引用计数减为0的时候释放槽中的页, 槽空闲
+ *
+ * @param slot 槽号
+ */
+void swap_put(uint32_t slot){
+    intr_status_t old_status = intr_disable();
+    ASSERT(slot < slot_total && slots[slot].refcnt > 0);
+    // 还在写入的槽由swap_write在写完以后释放
+    if (--slots[slot].refcnt == 0)
+        slot_clear(&slots[slot]);
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief swap_write用于将最近一次swap_stage检查的page存入slot, 必须持有swap_mutex. 调用者随后释放自己对page的引用
+ *
+ * @param slot 槽号
+ * @param page 需要存入的物理页
+ * @return true page的内容已经存放到了别处, 释放引用以后page归还给内存池
+ * @return false 没有地方存放, 槽持有了page的一个引用
+ */
+bool swap_write(uint32_t slot, page_t *page){
+    ASSERT(slot < slot_total && swap_mutex.holder == running_thread());
+    swap_slot_t *s = &slots[slot];
+    uint8_t type = stage_type;
+    uint32_t data = 0, zclass = 0;
+
+    if (type == SLOT_FILL)
+        data = stage_fill;
+    else if (type == SLOT_ZRAM){
+        // 对象缓存中没有空闲对象的时候申请物理页可能会阻塞, 暂存区由swap_mutex保护, 不会被覆盖
+        zclass = zram_class(stage_len + ZRAM_HDR);
+        uint8_t *obj = kmem_cache_alloc(&zram_cache[zclass]);
+        if (obj != NULL){
+            *(uint16_t *) stage_buf = stage_len;
+            memcpy(obj, stage_buf, stage_len + ZRAM_HDR);
+            data = (uint32_t) obj;
+        } else
+            type = SLOT_DISK;
+    }
+
+    if (type == SLOT_DISK){
+        intr_status_t old_status = intr_disable();
+        int32_t block = disk_usable() ? bitmap_scan(&block_bitmap, 1) : -1;
+        if (block != -1)
+            bitmap_set(&block_bitmap, block, 1);
+        intr_set_status(old_status);
+
+        if (block != -1){
+            void *content = kmap_page(page2phy(page));
+            ide_write(swap_part->my_disk, swap_part->start_lba + block * SWAP_SECS_PER_BLOCK, content, SWAP_SECS_PER_BLOCK);
+            kunmap_page(content);
+            data = block;
+        } else
+            type = SLOT_PAGE;
+    }
+
+    if (type == SLOT_PAGE){
+        get_page(page);
+        data = page2phy(page);
+    }
+
+    intr_status_t old_status = intr_disable();
+    s->type = type;
+    s->zclass = zclass;
+    s->data = data;
+    swap_stats.swapout_cnt++;
+    switch (type){
+        case SLOT_FILL: swap_stats.fill_pages++; break;
+        case SLOT_ZRAM:
+            swap_stats.zram_pages++;
+            swap_stats.zram_compr_bytes += stage_len;
+            swap_stats.zram_mem_bytes += zram_class_size[zclass];
+            break;
+        case SLOT_DISK: swap_stats.disk_pages++; break;
+        case SLOT_PAGE: swap_stats.kept_pages++; break;
+    }
+    // 写的时候拥有者可能已经退出或者取消了映射, 槽的最后一个引用已经释放
+    if (s->refcnt == 0)
+        slot_clear(s);
+    intr_set_status(old_status);
+    return type != SLOT_PAGE;
+}
+
+
+/**
+ * @brief swap_read用于将slot中的一页读入page, 必须持有swap_mutex
+ *
+ * @param slot 槽号
+ * @param page 读入的页, 必须是内核可以访问的地址
+ */
+void swap_read(uint32_t slot, void *page){
+    ASSERT(slot < slot_total && swap_mutex.holder == running_thread());
+    swap_slot_t *s = &slots[slot];
+    ASSERT(s->refcnt > 0 && s->type != SLOT_EMPTY);
+
+    if (s->type == SLOT_FILL){
+        uint32_t *words = page;
+        for (uint32_t idx = 0; idx < PG_SIZE / sizeof(uint32_t); idx++)
+            words[idx] = s->data;
+    } else if (s->type == SLOT_ZRAM){
+        uint8_t *obj = (uint8_t *) s->data;
+        if (lz4_decompress(obj + ZRAM_HDR, *(uint16_t *) obj, page, PG_SIZE) != PG_SIZE)
+            PANIC("swap_read: corrupted zram page");
+    } else if (s->type == SLOT_DISK)
+        ide_read(swap_part->my_disk, swap_part->start_lba + s->data * SWAP_SECS_PER_BLOCK, page, SWAP_SECS_PER_BLOCK);
+    else {
+        void *content = kmap_page(s->data);
+        memcpy(page, content, PG_SIZE);
+        kunmap_page(content);
+    }
+
+    intr_status_t old_status = intr_disable();
+    swap_stats.swapin_cnt++;
+    if (s->type != SLOT_DISK)
+        swap_stats.swapin_ram_cnt++;
+    intr_set_status(old_status);
+}
+
+
+/**
+ * @brief swap_get_stats用于获得交换的统计信息
+ *
+ * @param stats 存放统计信息的位置
+ */
+void swap_get_stats(swap_stats_t *stats){
+    intr_status_t old_status = intr_disable();
+    *stats = swap_stats;
+    intr_set_status(old_status);
+}
@@ -0,0 +1,124 @@
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+
+#include "stdint.h"
+#include "sync.h"
+#include "memory.h"
+
+/**
+ * 换出的页存放在槽(slot)中. 用户页被换出以后, 页表项中不存在位为0, 设置PG_SWAP, 高20位是槽号.
+ * fork的时候父子进程共享槽, 所以每个槽有自己的引用计数, 最后一个引用释放的时候槽才空闲.
+ * 槽中的页按照以下的顺序存放, 前面的方式不可用的时候才使用后面的方式:
+ *      1. 同值页: 整页都是同一个32位值(例如全0的页), 只记录这个值, 不占用内存
+ *      2. 压缩页: 压缩以后存放在内存中, 比读写交换分区快得多. 压缩页占用的内存有上限
+ *      3. 交换分区: 交换分区以页为单位划分为块, 每个块占用连续的8个扇区
+ *      4. 以上都不可用的时候, 槽直接持有原来的物理页, 这样换出总能完成, 只是没有回收到内存
+ */
+
+/// @brief 换出的页的页表项中的槽号
+#define SWAP_PTE_SLOT(pte) ((pte) >> 12)
+/// @brief 槽号为slot的换出的页的页表项, flags中保留原来页表项的R/W位和PG_COW
+#define SWAP_PTE(slot, flags) (((slot) << 12) | PG_SWAP | ((flags) & (PG_RW_W | PG_COW)))
+
+/// @brief 交换的锁, 换出的时候从修改页表项到写完槽一直持有, 换入的时候也要先获得, 这样不会读到还没有写完的槽
+extern mutex_t swap_mutex;
+
+/**
+ * @brief swap_stats_t是交换的统计信息. 压缩率为zram_pages * PG_SIZE / zram_compr_bytes,
+ *        命中率为swapin_ram_cnt / swapin_cnt, 即换入的时候不需要读交换分区的比例
+ */
+typedef struct __swap_stats_t {
+    uint32_t slot_total;                        // 槽的总数
+    uint32_t fill_pages;                        // 当前换出的同值页数
+    uint32_t zram_pages;                        // 当前换出的压缩页数
+    uint32_t zram_compr_bytes;                  // 压缩页压缩后的总字节数
+    uint32_t zram_mem_bytes;                    // 压缩页实际占用的内存字节数
+    uint32_t zram_limit;                        // 压缩页最多占用的内存字节数
+    uint32_t disk_pages;                        // 当前在交换分区中的页数
+    uint32_t disk_total;                        // 交换分区能存放的页数, 没有交换分区的时候为0
+    uint32_t kept_pages;                        // 当前无处存放而由槽持有的物理页数
+    uint32_t swapout_cnt;                       // 累计换出的次数
+    uint32_t swapin_cnt;                        // 累计换入的次数
+    uint32_t swapin_ram_cnt;                    // 累计从内存中换入的次数
+} swap_stats_t;
+
+
+/**
+ * @brief swap_init用于初始化槽和压缩页的对象缓存, 并在所有的分区中查找第一个交换分区. 没有交换分区的时候只使用内存
+ */
+void swap_init(void);
+
+
+/**
+ * @brief swap_usable用于判断当前能否换出页, 即槽是否已经初始化
+ *
+ * @return true 可以换出
+ * @return false 不能换出
+ */
+bool swap_usable(void);
+
+
+/**
+ * @brief swap_stage用于在换出page之前检查它的内容: 同值页记录填充值, 其余的页压缩到暂存区, 随后的swap_write
+ *        直接使用暂存的结果. 必须在持有swap_mutex并且关中断的情况下, 在修改页表项之前调用, 这样检查的就是换出时的内容
+ *
+ * @param page 需要换出的页, 必须是内核可以访问的地址
+ * @return true page可以换出
+ * @return false page既不能压缩, 也没有可用的交换分区, 不应该换出. 当前线程正持有交换分区所在通道的锁
+ *         (例如正在读写同一个通道上的硬盘)的时候交换分区不可用, 否则会打断正在进行的读写
+ */
+bool swap_stage(void *page);
+
+
+/**
+ * @brief swap_alloc用于分配一个空闲的槽, 分配得到的槽引用计数为1
+ *
+ * @return int32_t 成功则返回槽号; 槽已经用完则返回-1
+ */
+int32_t swap_alloc(void);
+
+
+/**
+ * @brief swap_dup用于增加slot的引用计数, 用于fork时子进程复制换出的页表项
+ *
+ * @param slot 槽号
+ */
+void swap_dup(uint32_t slot);
+
+
+/**
+ * @brief swap_put用于减少slot的引用计数, 引用计数减为0的时候释放槽中的页, 槽空闲
+ *
+ * @param slot 槽号
+ */
+void swap_put(uint32_t slot);
+
+
+/**
+ * @brief swap_write用于将最近一次swap_stage检查的page存入slot, 必须持有swap_mutex. 调用者随后释放自己对page的引用
+ *
+ * @param slot 槽号
+ * @param page 需要存入的物理页
+ * @return true page的内容已经存放到了别处, 释放引用以后page归还给内存池
+ * @return false 没有地方存放, 槽持有了page的一个引用
+ */
+bool swap_write(uint32_t slot, page_t *page);
+
+
+/**
+ * @brief swap_read用于将slot中的一页读入page, 必须持有swap_mutex
+ *
+ * @param slot 槽号
+ * @param page 读入的页, 必须是内核可以访问的地址
+ */
+void swap_read(uint32_t slot, void *page);
+
+
+/**
+ * @brief swap_get_stats用于获得交换的统计信息
+ *
+ * @param stats 存放统计信息的位置
+ */
+void swap_get_stats(swap_stats_t *stats);
+
+#endif
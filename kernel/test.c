@@ -8,6 +8,14 @@ void test_all(void){
 
     /* -------------------- Test memory -------------------- */
     test_memory();
+    // test_buddy();
+    test_heap_realloc();
+    test_heap_memalign();
+    test_heap_calloc();
+    test_demand_paging();
+    test_cow_fork();
+    test_swap_tiers();
+    test_ksm_merge();
 
 
     /* ---------------------- Test user prog ---------------------- */
@@ -467,4 +475,415 @@ void test_stat(void){
     } else 
         kprintf("%s open fail\n", path);
     kprintf("/--------------- %s test done ---------------/\n", __func__);
-}
\ No newline at end of file
+}
+
+
+void test_buddy(void){
+    kprintf("Start buddy test...\n");
+    for (uint32_t pg_cnt = 2; pg_cnt <= 64; pg_cnt *= 2){
+        uint32_t *vaddr = get_kernel_pages(pg_cnt);
+        if (vaddr == NULL){
+            kprintf("get_kernel_pages(%d) failed!\n", pg_cnt);
+            continue;
+        }
+        // 多页分配应当是物理上连续的
+        uint32_t phy_start = addr_v2p((uint32_t) vaddr);
+        for (uint32_t i = 1; i < pg_cnt; i++){
+            if (addr_v2p((uint32_t) vaddr + i * PG_SIZE) != phy_start + i * PG_SIZE){
+                kprintf("%d pages at 0x%x are not contiguous!\n", pg_cnt, (uint32_t) vaddr);
+                break;
+            }
+        }
+        kprintf("Alloc %d pages, phy_addr: 0x%x\n", pg_cnt, phy_start);
+        mfree_page(PF_KERNEL, vaddr, pg_cnt);
+    }
+}
+
+// 堆测试用的内容只和偏移以及seed有关, 调整大小以后可以检查原来的内容是否保留
+static void heap_fill(uint8_t *buf, uint32_t size, uint8_t seed){
+    for (uint32_t i = 0; i < size; i++)
+        buf[i] = (uint8_t) (i * 7 + seed);
+}
+
+static bool heap_check(uint8_t *buf, uint32_t size, uint8_t seed){
+    for (uint32_t i = 0; i < size; i++)
+        if (buf[i] != (uint8_t) (i * 7 + seed))
+            return false;
+    return true;
+}
+
+// meminfo_t比较大, 不放在栈上
+static meminfo_t heap_info_before, heap_info_after;
+
+// 测试中分配的大内存块都释放以后, 内核堆中大内存块的个数和页数应当复原
+static bool heap_large_released(void){
+    sys_meminfo(&heap_info_after);
+    return heap_info_before.kernel_heap.large_cnt == heap_info_after.kernel_heap.large_cnt &&
+           heap_info_before.kernel_heap.large_pages == heap_info_after.kernel_heap.large_pages;
+}
+
+
+void test_heap_realloc(void){
+    kprintf("Start realloc test...\n");
+    // 依次经过: 同一个小内存块内, 小内存块之间, 小内存块和大内存块之间, 大内存块原地增长和缩小
+    uint32_t sizes[] = {8, 24, 100, 1000, 1024, 3000, 5000, 12000, 40000, 9000, 4000, 500, 16, 1};
+    uint32_t cnt = sizeof(sizes) / sizeof(uint32_t);
+    sys_meminfo(&heap_info_before);
+
+    uint32_t old_size = sizes[0];
+    uint8_t *ptr = sys_realloc(NULL, old_size);
+    if (ptr == NULL){
+        kprintf("    realloc(NULL, %d) failed!\n", old_size);
+        return;
+    }
+    heap_fill(ptr, old_size, 0);
+    for (uint32_t idx = 1; idx < cnt; idx++){
+        uint32_t size = sizes[idx];
+        uint8_t *new_ptr = sys_realloc(ptr, size);
+        if (new_ptr == NULL){
+            kprintf("    realloc %d -> %d failed!\n", old_size, size);
+            sys_free(ptr);
+            return;
+        }
+        bool kept = heap_check(new_ptr, old_size < size ? old_size : size, idx - 1);
+        kprintf("    realloc %d -> %d: %s, %s\n", old_size, size, new_ptr == ptr ? "in place" : "moved", kept ? "content kept" : "content CORRUPTED");
+        heap_fill(new_ptr, size, idx);
+        ptr = new_ptr;
+        old_size = size;
+    }
+
+    // 失败的时候原来的内存不变
+    bool failed = sys_realloc(ptr, 0xF0000000) == NULL && heap_check(ptr, old_size, cnt - 1);
+    kprintf("    realloc to 0xF0000000: %s\n", failed ? "fails, block kept" : "BROKEN");
+    kprintf("    realloc to 0: %s\n", sys_realloc(ptr, 0) == NULL ? "freed" : "BROKEN");
+    kprintf("    large blocks: %s\n", heap_large_released() ? "all released" : "LEAKED");
+}
+
+
+void test_heap_memalign(void){
+    kprintf("Start memalign test...\n");
+    sys_meminfo(&heap_info_before);
+    // 小于一页的对齐在arena之后找对齐的地址; 不小于一页的对齐, arena位于对齐地址的前一页, 多余的页释放
+    for (uint32_t align = 8; align <= 8 * PG_SIZE; align *= 8){
+        uint32_t sizes[] = {1, 100, PG_SIZE, 3 * PG_SIZE + 5};
+        for (uint32_t idx = 0; idx < sizeof(sizes) / sizeof(uint32_t); idx++){
+            uint32_t size = sizes[idx];
+            uint8_t *ptr = sys_memalign(align, size);
+            if (ptr == NULL){
+                kprintf("    memalign(%d, %d) failed!\n", align, size);
+                continue;
+            }
+            bool ok = (uint32_t) ptr % align == 0;
+            heap_fill(ptr, size, idx);
+            // 对齐分配的内存是大内存块, 可以原地或者搬移增长
+            uint8_t *grown = sys_realloc(ptr, size + 2 * PG_SIZE);
+            if (grown == NULL)
+                sys_free(ptr);
+            else {
+                ok = ok && heap_check(grown, size, idx);
+                sys_free(grown);
+            }
+            kprintf("    memalign(%d, %d) at 0x%x: %s\n", align, size, (uint32_t) ptr, ok && grown != NULL ? "ok" : "FAIL");
+        }
+    }
+    kprintf("    invalid align 24: %s\n", sys_memalign(24, 16) == NULL ? "rejected" : "BROKEN");
+    kprintf("    large blocks: %s\n", heap_large_released() ? "all released" : "LEAKED");
+}
+
+
+void test_heap_calloc(void){
+    kprintf("Start calloc test...\n");
+    // 先写脏内存块再释放, calloc复用这些内存块的时候也必须清0
+    uint32_t sizes[] = {16, 200, 1000, 3000, 10000};
+    for (uint32_t idx = 0; idx < sizeof(sizes) / sizeof(uint32_t); idx++){
+        uint32_t size = sizes[idx];
+        uint8_t *dirty = sys_malloc(size);
+        if (dirty != NULL){
+            memset(dirty, 0xAB, size);
+            sys_free(dirty);
+        }
+        uint8_t *ptr = sys_calloc(size / 4, 4);
+        if (ptr == NULL){
+            kprintf("    calloc(%d, 4) failed!\n", size / 4);
+            continue;
+        }
+        uint32_t i = 0;
+        while (i < size && ptr[i] == 0)
+            i++;
+        kprintf("    calloc(%d, 4): %s\n", size / 4, i == size ? "zeroed" : "NOT ZEROED");
+        sys_free(ptr);
+    }
+    kprintf("    calloc(0x10000, 0x10000): %s\n", sys_calloc(0x10000, 0x10000) == NULL ? "overflow rejected" : "BROKEN");
+}
+
+
+// 地址空间测试: 当前的内核线程临时使用一个只有测试区域的用户地址空间, 访问用户地址的时候和用户进程一样经过缺页中断,
+// 分配的页都记在当前线程名下. 期间不能调用sys_malloc, 否则会从当前线程的用户堆中分配
+#define TEST_USER_VADDR 0x10000000
+
+static bool user_space_enter(uint32_t pg_cnt){
+    task_struct_t *cur = running_thread();
+    uint32_t *pgdir = create_page_dir();
+    if (pgdir == NULL)
+        return false;
+    if (vma_add(cur, TEST_USER_VADDR, pg_cnt, 0) == NULL){
+        release_page_dir(pgdir);
+        return false;
+    }
+    memset(cur->user_pgtables, 0, sizeof(cur->user_pgtables));
+    cur->rss_pages = 0;
+    cur->pgdir_phyaddr = addr_v2p((uint32_t) pgdir);
+    cur->pgdir = pgdir;
+    page_dir_activate(cur);
+    return true;
+}
+
+// 和fork失败的时候一样, 通过直接映射区释放页表中所有的页和槽, 然后释放区域和页目录表
+static void user_space_leave(void){
+    task_struct_t *cur = running_thread();
+    uint32_t *pgdir = cur->pgdir;
+    cur->pgdir = NULL;
+    cur->pgdir_phyaddr = KERNEL_PAGE_DIR_PHYADDR;
+    page_table_fork_undo(pgdir);
+    vma_release(cur);
+    release_page_dir(pgdir);
+    cur->rss_pages = 0;
+}
+
+// vaddr在当前页表中的页表项, 页表不存在的时候为0. 不能直接读pte_addr, 页表不存在的时候读它会引起内核的缺页
+static uint32_t user_pte(void *vaddr){
+    return *pde_addr((uint32_t) vaddr) & PG_P_1 ? *pte_addr((uint32_t) vaddr) : 0;
+}
+
+// 子进程页目录表中vaddr的页表项. 子进程没有运行过, 只能通过直接映射区访问它的页表
+static uint32_t child_pte(uint32_t *child_pgdir, void *vaddr){
+    uint32_t pde = child_pgdir[(uint32_t) vaddr >> 22];
+    return pde & PG_P_1 ? ((uint32_t *) kmap(pde & 0xFFFFF000))[((uint32_t) vaddr >> 12) & 0x3FF] : 0;
+}
+
+
+void test_demand_paging(void){
+    kprintf("Start demand paging test...\n");
+    if (!user_space_enter(3)){
+        kprintf("    enter user space failed!\n");
+        return;
+    }
+    task_struct_t *cur = running_thread();
+    volatile uint32_t *first = (uint32_t *) TEST_USER_VADDR;
+    volatile uint32_t *second = (uint32_t *) (TEST_USER_VADDR + PG_SIZE);
+    volatile uint32_t *third = (uint32_t *) (TEST_USER_VADDR + 2 * PG_SIZE);
+    kprintf("    reserved pages: %s\n", user_pte((void *) first) == 0 ? "not mapped" : "MAPPED");
+
+    // 读没有映射的页映射到零页, 两个页共享同一个只读的物理页
+    bool ok = *first == 0 && *second == 0;
+    uint32_t pte = user_pte((void *) first), zero_phyaddr = pte & 0xFFFFF000;
+    ok = ok && (user_pte((void *) second) & 0xFFFFF000) == zero_phyaddr && !(pte & PG_RW_W) && cur->rss_pages == 2;
+    kprintf("    read: %s\n", ok ? "zero page mapped read-only" : "FAIL");
+    uint32_t zero_refcount = phy2page(zero_phyaddr)->refcount;
+
+    // 写零页的时候分配新的页, 另一个页依旧映射零页
+    *first = 0x12345678;
+    pte = user_pte((void *) first);
+    ok = *first == 0x12345678 && first[1] == 0 && (pte & PG_RW_W) && (pte & 0xFFFFF000) != zero_phyaddr &&
+         *second == 0 && phy2page(zero_phyaddr)->refcount == zero_refcount - 1 && cur->rss_pages == 2;
+    kprintf("    write after read: %s\n", ok ? "private page replaces zero page" : "FAIL");
+
+    // 直接写没有映射的页, 得到的是全为0的可写页
+    third[PG_SIZE / 4 - 1] = 7;
+    pte = user_pte((void *) third);
+    ok = third[0] == 0 && third[PG_SIZE / 4 - 1] == 7 && (pte & PG_RW_W) && (pte & 0xFFFFF000) != zero_phyaddr &&
+         cur->rss_pages == 3;
+    kprintf("    write: %s\n", ok ? "zeroed private page" : "FAIL");
+
+    user_space_leave();
+    kprintf("    zero page references: %s\n", phy2page(zero_phyaddr)->refcount == zero_refcount - 2 ? "released" : "LEAKED");
+}
+
+
+void test_cow_fork(void){
+    kprintf("Start copy-on-write fork test...\n");
+    if (!user_space_enter(2)){
+        kprintf("    enter user space failed!\n");
+        return;
+    }
+    task_struct_t *cur = running_thread();
+    uint8_t *buf = (uint8_t *) TEST_USER_VADDR;
+
+    // 相邻的普通区域合并, 从中间取消保留的时候拆分, 重叠的区域不能保留
+    vma_t *vma = vma_add(cur, TEST_USER_VADDR + 2 * PG_SIZE, 2, 0);
+    bool ok = vma != NULL && vma->start == TEST_USER_VADDR && vma->end == TEST_USER_VADDR + 4 * PG_SIZE;
+    ok = ok && vma_remove(cur, TEST_USER_VADDR + PG_SIZE, TEST_USER_VADDR + 2 * PG_SIZE, 0) == 0 &&
+         vma_find(cur, TEST_USER_VADDR + PG_SIZE) == NULL && vma_find(cur, TEST_USER_VADDR + 3 * PG_SIZE) != NULL;
+    ok = ok && vma_add(cur, TEST_USER_VADDR, 2, 0) == NULL;
+    kprintf("    vma merge, split and overlap: %s\n", ok ? "ok" : "FAIL");
+
+    heap_fill(buf, PG_SIZE, 1);
+    uint32_t orig_phyaddr = user_pte(buf) & 0xFFFFF000;
+    page_t *orig = phy2page(orig_phyaddr);
+
+    // fork以后父子进程映射同一个只读的写时复制页
+    uint32_t *child_pgdir = create_page_dir();
+    if (child_pgdir == NULL || page_table_fork(child_pgdir) == -1){
+        kprintf("    page_table_fork failed!\n");
+        if (child_pgdir != NULL){
+            page_table_fork_undo(child_pgdir);
+            release_page_dir(child_pgdir);
+        }
+        user_space_leave();
+        return;
+    }
+    uint32_t pte = user_pte(buf), cpte = child_pte(child_pgdir, buf);
+    ok = (pte & PG_COW) && !(pte & PG_RW_W) && cpte == pte && orig->refcount == 2;
+    kprintf("    fork: %s\n", ok ? "page shared copy-on-write" : "FAIL");
+
+    // 父进程写的时候得到一份复制, 子进程的页不变
+    buf[0] ^= 0xFF;
+    pte = user_pte(buf);
+    bool written = buf[0] == (uint8_t) (1 ^ 0xFF);
+    buf[0] ^= 0xFF;
+    uint8_t *child_view = kmap_page(orig_phyaddr);
+    ok = written && heap_check(buf, PG_SIZE, 1) && heap_check(child_view, PG_SIZE, 1) && (pte & PG_RW_W) &&
+         !(pte & PG_COW) && (pte & 0xFFFFF000) != orig_phyaddr && orig->refcount == 1 &&
+         child_pte(child_pgdir, buf) == cpte && cur->rss_pages == 1;
+    kunmap_page(child_view);
+    kprintf("    write after fork: %s\n", ok ? "parent copied, child kept the original" : "FAIL");
+    page_table_fork_undo(child_pgdir);
+    release_page_dir(child_pgdir);
+
+    // 其他共享者都已经释放的时候, 最后一个使用者写的时候直接恢复可写, 不复制
+    child_pgdir = create_page_dir();
+    if (child_pgdir != NULL && page_table_fork(child_pgdir) == 0){
+        page_table_fork_undo(child_pgdir);
+        uint32_t phyaddr = user_pte(buf) & 0xFFFFF000;
+        buf[0] ^= 0xFF;
+        pte = user_pte(buf);
+        ok = (pte & 0xFFFFF000) == phyaddr && (pte & PG_RW_W) && !(pte & PG_COW) && phy2page(phyaddr)->refcount == 1;
+        kprintf("    write as the last sharer: %s\n", ok ? "made writable in place" : "FAIL");
+    } else if (child_pgdir != NULL)
+        page_table_fork_undo(child_pgdir);
+    if (child_pgdir != NULL)
+        release_page_dir(child_pgdir);
+
+    user_space_leave();
+}
+
+
+// 交换测试用的三种页, 依次应当存放到同值页, 压缩页和交换分区中
+static void swap_fill(uint32_t *words, uint32_t kind){
+    uint32_t seed = 0x2545F491;
+    for (uint32_t idx = 0; idx < PG_SIZE / sizeof(uint32_t); idx++){
+        if (kind == 0)
+            words[idx] = 0x5A5A5A5A;
+        else if (kind == 1)
+            words[idx] = idx % 64;
+        else {
+            seed = seed * 1103515245 + 12345;
+            words[idx] = seed ^ (seed >> 16);
+        }
+    }
+}
+
+// 交换的统计信息中kind对应的那一种存放方式的页数
+static uint32_t swap_tier_pages(swap_stats_t *stats, uint32_t kind){
+    return kind == 0 ? stats->fill_pages : (kind == 1 ? stats->zram_pages : stats->disk_pages);
+}
+
+
+void test_swap_tiers(void){
+    kprintf("Start swap test...\n");
+    if (!swap_usable()){
+        kprintf("    swap is not initialized!\n");
+        return;
+    }
+    uint32_t *page = get_kernel_pages(1), *back = get_kernel_pages(1);
+    if (page == NULL || back == NULL){
+        kprintf("    get_kernel_pages failed!\n");
+        if (page != NULL)
+            mfree_page(PF_KERNEL, page, 1);
+        if (back != NULL)
+            mfree_page(PF_KERNEL, back, 1);
+        return;
+    }
+
+    char *tiers[] = {"same-filled", "zram", "disk"};
+    swap_stats_t before, after;
+    for (uint32_t kind = 0; kind < 3; kind++){
+        swap_fill(page, kind);
+        int32_t slot = swap_alloc();
+        if (slot == -1){
+            kprintf("    %s: swap_alloc failed!\n", tiers[kind]);
+            continue;
+        }
+
+        // 和换出的时候一样, 持有交换的锁并关中断检查内容, 然后写入槽
+        swap_get_stats(&before);
+        mutex_acquire(&swap_mutex);
+        intr_status_t old_status = intr_disable();
+        bool staged = swap_stage(page);
+        intr_set_status(old_status);
+        if (!staged){
+            mutex_release(&swap_mutex);
+            swap_put(slot);
+            kprintf("    %s: no place to store the page, skipped\n", tiers[kind]);
+            continue;
+        }
+        swap_write(slot, phy2page(addr_v2p((uint32_t) page)));
+        memset(back, 0, PG_SIZE);
+        swap_read(slot, back);
+        mutex_release(&swap_mutex);
+        swap_get_stats(&after);
+
+        // 只有从交换分区读入的不算命中
+        bool stored = swap_tier_pages(&after, kind) == swap_tier_pages(&before, kind) + 1 &&
+                      after.swapin_cnt == before.swapin_cnt + 1 &&
+                      after.swapin_ram_cnt == before.swapin_ram_cnt + (kind != 2);
+        bool same = memcmp(page, back, PG_SIZE) == 0;
+        swap_put(slot);
+        swap_get_stats(&after);
+        bool freed = swap_tier_pages(&after, kind) == swap_tier_pages(&before, kind);
+        kprintf("    %s: %s, %s, %s\n", tiers[kind], stored ? "stored in its tier" : "WRONG TIER",
+                same ? "content kept" : "content CORRUPTED", freed ? "slot freed" : "slot LEAKED");
+    }
+    mfree_page(PF_KERNEL, page, 1);
+    mfree_page(PF_KERNEL, back, 1);
+}
+
+
+void test_ksm_merge(void){
+    kprintf("Start page merging test...\n");
+    if (!user_space_enter(2)){
+        kprintf("    enter user space failed!\n");
+        return;
+    }
+    uint8_t *first = (uint8_t *) TEST_USER_VADDR, *second = (uint8_t *) (TEST_USER_VADDR + PG_SIZE);
+    heap_fill(first, PG_SIZE, 3);
+    heap_fill(second, PG_SIZE, 3);
+    page_t *kpage = phy2page(user_pte(first) & 0xFFFFF000), *page = phy2page(user_pte(second) & 0xFFFFF000);
+
+    // 和ksm_scan_page一样, 在同一个关中断的区间内确认内容相同, 先把第一个页改为只读作为目标, 再把第二个页合并过去
+    intr_status_t old_status = intr_disable();
+    bool merged = memcmp(first, second, PG_SIZE) == 0 && page_merge(kpage, kpage) && page_merge(page, kpage);
+    intr_set_status(old_status);
+    uint32_t pte1 = user_pte(first), pte2 = user_pte(second), kphyaddr = page2phy(kpage);
+    bool ok = merged && (pte1 & 0xFFFFF000) == kphyaddr && (pte2 & 0xFFFFF000) == kphyaddr &&
+              (pte1 & PG_COW) && (pte2 & PG_COW) && !((pte1 | pte2) & PG_RW_W) && kpage->refcount == 2 &&
+              (kpage->flags & PAGE_KSM) && heap_check(second, PG_SIZE, 3);
+    kprintf("    merge: %s\n", ok ? "both pages map one read-only page" : "FAIL");
+
+    // 写其中一个页的时候复制一份, 另一个页依旧映射合并后的页
+    second[0] ^= 0xFF;
+    pte2 = user_pte(second);
+    bool written = second[0] == (uint8_t) (3 ^ 0xFF);
+    second[0] ^= 0xFF;
+    ok = written && heap_check(second, PG_SIZE, 3) && heap_check(first, PG_SIZE, 3) && (pte2 & PG_RW_W) &&
+         (pte2 & 0xFFFFF000) != kphyaddr && (user_pte(first) & 0xFFFFF000) == kphyaddr && kpage->refcount == 1;
+    kprintf("    write after merge: %s\n", ok ? "writer copied, other page kept" : "FAIL");
+
+    // 最后一个使用者写的时候直接恢复可写, 合并后的页不再作为合并的目标
+    first[0] ^= 0xFF;
+    pte1 = user_pte(first);
+    ok = (pte1 & 0xFFFFF000) == kphyaddr && (pte1 & PG_RW_W) && !(kpage->flags & PAGE_KSM);
+    kprintf("    write as the last user: %s\n", ok ? "made writable in place, unmerged" : "FAIL");
+
+    user_space_leave();
+}
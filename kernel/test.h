@@ -11,6 +11,8 @@
 #include "global.h"
 #include "thread.h"
 #include "memory.h"
+#include "vma.h"
+#include "swap.h"
 #include "syscall.h"
 #include "process.h"
 #include "interrupt.h"
@@ -30,6 +32,14 @@ void test_kernel_thread(void);
 
 // memory test
 void test_memory(void);
+void test_buddy(void);
+void test_heap_realloc(void);
+void test_heap_memalign(void);
+void test_heap_calloc(void);
+void test_demand_paging(void);
+void test_cow_fork(void);
+void test_swap_tiers(void);
+void test_ksm_merge(void);
 
 // file system test
 void test_create_close_unlink(void);
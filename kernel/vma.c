@@ -0,0 +1,246 @@
+#include "vma.h"
+#include "global.h"
+#include "memory.h"
+#include "thread.h"
+#include "process.h"
+#include "slab.h"
+#include "inode.h"
+#include "debug.h"
+#include "print.h"
+#include "interrupt.h"
+
+/// @brief 区域描述符的对象缓存
+static kmem_cache_t vma_cache;
+
+
+/**
+ * @brief vma_init用于初始化区域描述符的对象缓存
+ */
+void vma_init(void){
+    put_str("vma_init start\n");
+    kmem_cache_init(&vma_cache, "vma", sizeof(vma_t), sizeof(uint32_t), NULL);
+    put_str("vma_init done\n");
+}
+
+
+/**
+ * @brief vma_find用于在tcb的区域中查找vaddr所在的区域
+ *
+ * @param tcb 需要查找的进程
+ * @param vaddr 需要查找的虚拟地址
+ * @return vma_t* 找到则返回vaddr所在的区域; 否则返回NULL
+ */
+vma_t *vma_find(task_struct_t *tcb, uint32_t vaddr){
+    list_elem_t *elem = tcb->vma_list.head.next;
+    while (elem != &tcb->vma_list.tail){
+        vma_t *vma = elem2entry(vma_t, vma_tag, elem);
+        // 区域按照起始地址升序排列, 后面的区域都在vaddr之后
+        if (vaddr < vma->start)
+            return NULL;
+        if (vaddr < vma->end)
+            return vma;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief vma_dup用于复制一个区域描述符, 映射的文件增加一次打开计数
+ *
+ * @param vma 需要复制的区域描述符
+ * @return vma_t* 成功则返回复制得到的区域描述符; 失败则返回NULL
+ */
+static vma_t *vma_dup(vma_t *vma){
+    vma_t *new_vma = kmem_cache_alloc(&vma_cache);
+    if (new_vma == NULL)
+        return NULL;
+    *new_vma = *vma;
+    if (new_vma->inode != NULL){
+        intr_status_t old_status = intr_disable();
+        new_vma->inode->i_open_cnt++;
+        intr_set_status(old_status);
+    }
+    return new_vma;
+}
+
+
+/**
+ * @brief vma_free用于释放区域描述符并关闭映射的文件, 区域描述符必须已经从进程的区域链表中移除
+ *
+ * @param vma 需要释放的区域描述符
+ */
+static void vma_free(vma_t *vma){
+    if (vma->inode != NULL)
+        inode_close(vma->inode);
+    kmem_cache_free(&vma_cache, vma);
+}
+
+
+/**
+ * @brief vma_add用于在tcb中保留[start, start + pg_cnt * PG_SIZE)这段虚拟地址. 普通区域会和相邻的普通区域合并
+ *
+ * @param tcb 需要保留虚拟地址的进程
+ * @param start 起始地址, 必须按页对齐
+ * @param pg_cnt 保留的页数
+ * @param flags 0或者VMA_MMAP
+ * @return vma_t* 成功则返回包含这段虚拟地址的区域; 若和已有的区域重叠或者没有内存, 则返回NULL
+ */
+vma_t *vma_add(task_struct_t *tcb, uint32_t start, uint32_t pg_cnt, uint32_t flags){
+    uint32_t end = start + pg_cnt * PG_SIZE;
+    ASSERT(start % PG_SIZE == 0 && pg_cnt > 0);
+    if (start < USER_VADDR_START || end > 0xC0000000 || end <= start)
+        return NULL;
+
+    // 找到新区域前后的区域, 顺便检查是否重叠
+    vma_t *prev = NULL, *next = NULL;
+    list_elem_t *elem = tcb->vma_list.head.next;
+    while (elem != &tcb->vma_list.tail){
+        vma_t *vma = elem2entry(vma_t, vma_tag, elem);
+        if (vma->start >= end){
+            next = vma;
+            break;
+        }
+        if (vma->end > start)
+            return NULL;
+        prev = vma;
+        elem = elem->next;
+    }
+
+    // 普通区域和首尾相接的普通区域合并, 这样进程的区域数只和程序段, 堆, 栈以及mmap的次数有关
+    bool merge_prev = flags == 0 && prev != NULL && prev->flags == 0 && prev->end == start;
+    bool merge_next = flags == 0 && next != NULL && next->flags == 0 && next->start == end;
+    if (merge_prev && merge_next){
+        prev->end = next->end;
+        list_remove(&next->vma_tag);
+        vma_free(next);
+        return prev;
+    } else if (merge_prev){
+        prev->end = end;
+        return prev;
+    } else if (merge_next){
+        next->start = start;
+        return next;
+    }
+
+    vma_t *vma = kmem_cache_alloc(&vma_cache);
+    if (vma == NULL)
+        return NULL;
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->prot = 0;
+    vma->inode = NULL;
+    vma->offset = 0;
+    list_insert_before(next != NULL ? &next->vma_tag : &tcb->vma_list.tail, &vma->vma_tag);
+    return vma;
+}
+
+
+/**
+ * @brief vma_alloc用于在tcb中找到最高的pg_cnt个连续的没有保留的虚拟页并保留. 堆从程序段之后向上增长, 其他的区域
+ *        从用户栈下面向下分配, 这样堆顶之上的虚拟页在地址空间用完之前一直留给brk
+ *
+ * @param tcb 需要保留虚拟地址的进程
+ * @param pg_cnt 保留的页数
+ * @param flags 0或者VMA_MMAP
+ * @return uint32_t 成功则返回保留的虚拟地址的起始地址; 失败则返回0
+ */
+uint32_t vma_alloc(task_struct_t *tcb, uint32_t pg_cnt, uint32_t flags){
+    uint32_t size = pg_cnt * PG_SIZE;
+    uint32_t end = 0xC0000000;
+    // 自顶向下首次适应, 从最高的区域开始在区域之间的空隙中查找
+    list_elem_t *elem = tcb->vma_list.tail.prev;
+    while (elem != &tcb->vma_list.head){
+        vma_t *vma = elem2entry(vma_t, vma_tag, elem);
+        if (vma->end <= end && end - vma->end >= size)
+            break;
+        if (vma->start < end)
+            end = vma->start;
+        elem = elem->prev;
+    }
+
+    // 区域都不低于USER_VADDR_START, 所以end也不会低于它
+    if (size == 0 || end - USER_VADDR_START < size)
+        return 0;
+    uint32_t start = end - size;
+    return vma_add(tcb, start, pg_cnt, flags) != NULL ? start : 0;
+}
+
+
+/**
+ * @brief vma_remove用于取消tcb中[start, end)与flags相同的区域的保留, 区域被部分取消的时候, 剩下的部分依旧保留.
+ *        该函数只修改区域, 不释放已经映射的页
+ *
+ * @param tcb 需要取消保留的进程
+ * @param start 起始地址, 必须按页对齐
+ * @param end 结束地址(不包括), 必须按页对齐
+ * @param flags 只取消flags与之相同的区域
+ * @return int32_t 成功返回0; 需要拆分区域但没有内存的时候返回-1, 此时没有任何区域被修改
+ */
+int32_t vma_remove(task_struct_t *tcb, uint32_t start, uint32_t end, uint32_t flags){
+    ASSERT(start % PG_SIZE == 0 && end % PG_SIZE == 0);
+    list_elem_t *elem = tcb->vma_list.head.next;
+    while (elem != &tcb->vma_list.tail){
+        vma_t *vma = elem2entry(vma_t, vma_tag, elem);
+        elem = elem->next;
+        if (vma->start >= end)
+            break;
+        if (vma->end <= start || vma->flags != flags)
+            continue;
+
+        if (start > vma->start && end < vma->end){
+            // 取消中间的部分, 后半部分成为新的区域. 区域互不重叠, 所以这是唯一被修改的区域
+            vma_t *tail = vma_dup(vma);
+            if (tail == NULL)
+                return -1;
+            tail->start = end;
+            tail->offset = vma->offset + (end - vma->start);
+            vma->end = start;
+            list_insert_before(elem, &tail->vma_tag);
+            break;
+        } else if (start > vma->start)
+            vma->end = start;
+        else if (end < vma->end){
+            vma->offset += end - vma->start;
+            vma->start = end;
+        } else {
+            list_remove(&vma->vma_tag);
+            vma_free(vma);
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @brief vma_fork用于为子进程复制父进程的所有区域. 区域中的页已经随着页表写时复制给子进程了
+ *
+ * @param child 子进程
+ * @param parent 父进程
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t vma_fork(task_struct_t *child, task_struct_t *parent){
+    // 子进程的TCB是从父进程复制的, 区域链表要重新建立
+    list_init(&child->vma_list);
+    list_elem_t *elem = parent->vma_list.head.next;
+    while (elem != &parent->vma_list.tail){
+        vma_t *vma = vma_dup(elem2entry(vma_t, vma_tag, elem));
+        if (vma == NULL)
+            return -1;
+        list_append(&child->vma_list, &vma->vma_tag);
+        elem = elem->next;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief vma_release用于释放tcb所有的区域描述符并关闭映射的文件, 区域中的页由调用者随页表一起释放
+ *
+ * @param tcb 需要释放区域的进程
+ */
+void vma_release(task_struct_t *tcb){
+    while (!list_empty(&tcb->vma_list))
+        vma_free(elem2entry(vma_t, vma_tag, list_pop(&tcb->vma_list)));
+}
@@ -0,0 +1,100 @@
+#ifndef __KERNEL_VMA_H
+#define __KERNEL_VMA_H
+
+#include "stdint.h"
+#include "list.h"
+#include "types.h"
+
+struct __task_struct;
+
+/// @brief mmap建立的区域, 带有自己的权限和文件, 不与相邻的区域合并
+#define VMA_MMAP 0x1
+
+/**
+ * @brief vma_t描述用户进程中一段连续的保留的虚拟地址[start, end). 一个进程的所有区域按照起始地址升序排列在进程的vma_list中,
+ *        互不重叠. 区域中的虚拟页在保留的时候并不分配物理页, 物理页在缺页的时候才分配:
+ *              1. 普通区域: 程序段, 堆, 栈以及malloc_page分配的用户页, 相邻的普通区域会合并为一个
+ *              2. mmap区域: 匿名映射和普通的按需分配一样使用零页, 文件映射从文件中读入对应的一页
+ */
+typedef struct __vma_t {
+    uint32_t start;                             // 区域的起始地址, 按页对齐
+    uint32_t end;                               // 区域的结束地址(不包括), 按页对齐
+    uint32_t flags;                             // 0或者VMA_MMAP
+    uint32_t prot;                              // mmap区域的权限, PROT_READ, PROT_WRITE
+    inode_t *inode;                             // mmap区域映射的文件, 匿名映射为NULL
+    uint32_t offset;                            // start在文件中对应的偏移
+    list_elem_t vma_tag;                        // 进程的区域链表的节点
+} vma_t;
+
+
+/**
+ * @brief vma_init用于初始化区域描述符的对象缓存
+ */
+void vma_init(void);
+
+
+/**
+ * @brief vma_find用于在tcb的区域中查找vaddr所在的区域
+ *
+ * @param tcb 需要查找的进程
+ * @param vaddr 需要查找的虚拟地址
+ * @return vma_t* 找到则返回vaddr所在的区域; 否则返回NULL
+ */
+vma_t *vma_find(struct __task_struct *tcb, uint32_t vaddr);
+
+
+/**
+ * @brief vma_add用于在tcb中保留[start, start + pg_cnt * PG_SIZE)这段虚拟地址. 普通区域会和相邻的普通区域合并
+ *
+ * @param tcb 需要保留虚拟地址的进程
+ * @param start 起始地址, 必须按页对齐
+ * @param pg_cnt 保留的页数
+ * @param flags 0或者VMA_MMAP
+ * @return vma_t* 成功则返回包含这段虚拟地址的区域; 若和已有的区域重叠或者没有内存, 则返回NULL
+ */
+vma_t *vma_add(struct __task_struct *tcb, uint32_t start, uint32_t pg_cnt, uint32_t flags);
+
+
+/**
+ * @brief vma_alloc用于在tcb中找到最高的pg_cnt个连续的没有保留的虚拟页并保留. 堆从程序段之后向上增长, 其他的区域
+ *        从用户栈下面向下分配, 这样堆顶之上的虚拟页在地址空间用完之前一直留给brk
+ *
+ * @param tcb 需要保留虚拟地址的进程
+ * @param pg_cnt 保留的页数
+ * @param flags 0或者VMA_MMAP
+ * @return uint32_t 成功则返回保留的虚拟地址的起始地址; 失败则返回0
+ */
+uint32_t vma_alloc(struct __task_struct *tcb, uint32_t pg_cnt, uint32_t flags);
+
+
+/**
+ * @brief vma_remove用于取消tcb中[start, end)与flags相同的区域的保留, 区域被部分取消的时候, 剩下的部分依旧保留.
+ *        该函数只修改区域, 不释放已经映射的页
+ *
+ * @param tcb 需要取消保留的进程
+ * @param start 起始地址, 必须按页对齐
+ * @param end 结束地址(不包括), 必须按页对齐
+ * @param flags 只取消flags与之相同的区域
+ * @return int32_t 成功返回0; 需要拆分区域但没有内存的时候返回-1, 此时没有任何区域被修改
+ */
+int32_t vma_remove(struct __task_struct *tcb, uint32_t start, uint32_t end, uint32_t flags);
+
+
+/**
+ * @brief vma_fork用于为子进程复制父进程的所有区域. 区域中的页已经随着页表写时复制给子进程了
+ *
+ * @param child 子进程
+ * @param parent 父进程
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t vma_fork(struct __task_struct *child, struct __task_struct *parent);
+
+
+/**
+ * @brief vma_release用于释放tcb所有的区域描述符并关闭映射的文件, 区域中的页由调用者随页表一起释放
+ *
+ * @param tcb 需要释放区域的进程
+ */
+void vma_release(struct __task_struct *tcb);
+
+#endif
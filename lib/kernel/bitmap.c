@@ -5,6 +5,52 @@
 #include "interrupt.h"
 #include "debug.h"
 
+/// @brief 位图中32位字的个数
+#define BTMP_WORD_CNT(btmp) (DIV_CEILING((btmp)->btmp_byte_len, 4))
+
+
+/**
+ * @brief bit_ffs返回x中最低的为1的位的下标, x不能为0
+ */
+static inline uint32_t bit_ffs(uint32_t x){
+    uint32_t idx;
+    asm volatile ("bsfl %1, %0" : "=r" (idx) : "rm" (x));
+    return idx;
+}
+
+
+/**
+ * @brief btmp_word返回位图中第word_idx个32位字. 位图末尾不足一个字的部分, 超出位图范围的位视为已使用
+ */
+static uint32_t btmp_word(bitmap_t *btmp, uint32_t word_idx){
+    uint32_t byte_idx = word_idx * 4;
+    if (byte_idx + 4 <= btmp->btmp_byte_len)
+        return *(uint32_t *)(btmp->bits + byte_idx);
+
+    // 末尾不足一个字, 逐字节拼接
+    uint32_t word = 0xFFFFFFFF;
+    for (uint32_t i = 0; byte_idx + i < btmp->btmp_byte_len; i++){
+        word &= ~(0xFFU << (i * 8));
+        word |= (uint32_t)btmp->bits[byte_idx + i] << (i * 8);
+    }
+    return word;
+}
+
+
+/**
+ * @brief summary_update根据位图中第word_idx个字是否已满更新摘要位图
+ */
+static void summary_update(bitmap_t *btmp, uint32_t word_idx){
+    if (btmp->summary == NULL)
+        return;
+    uint32_t mask = 1 << (word_idx % BITMAP_WORD_BITS);
+    if (btmp_word(btmp, word_idx) == 0xFFFFFFFF)
+        btmp->summary[word_idx / BITMAP_WORD_BITS] |= mask;
+    else
+        btmp->summary[word_idx / BITMAP_WORD_BITS] &= ~mask;
+}
+
+
 /**
  * @brief 位图bitmap的初始化函数
  * 
@@ -12,8 +58,28 @@
  */
 void bitmap_init(bitmap_t *btmp){
     memset(btmp->bits, 0, btmp->btmp_byte_len);
+    btmp->hint = 0;
+    if (btmp->summary != NULL)
+        bitmap_build_summary(btmp, btmp->summary);
 }
 
+
+/**
+ * @brief bitmap_build_summary用于为位图附加二级摘要位图, 并根据位图当前的内容重建摘要位图.
+ *        当位图的内容不是通过bitmap_set修改的时候(例如直接从磁盘读入), 也需要调用该函数重建摘要位图
+ * 
+ * @param btmp 指向bitmap的指针
+ * @param summary 摘要位图, 至少BITMAP_SUMMARY_BYTES(btmp->btmp_byte_len)字节
+ */
+void bitmap_build_summary(bitmap_t *btmp, uint32_t *summary){
+    btmp->summary = summary;
+    memset(summary, 0, BITMAP_SUMMARY_BYTES(btmp->btmp_byte_len));
+    uint32_t word_cnt = BTMP_WORD_CNT(btmp);
+    for (uint32_t word_idx = 0; word_idx < word_cnt; word_idx++)
+        summary_update(btmp, word_idx);
+}
+
+
 /**
  * @brief 判断位图中指定的位是否位1
  * 
@@ -30,54 +96,111 @@ bool bitmap_scan_test(bitmap_t *btmp, uint32_t bit_idx){
 
 
 /**
- * @brief 在位图中申请连续的cnt个位，若成功则返回起始位的下标，失败则返回-1
+ * @brief btmp_find_run在位图的[start, end)位中寻找连续cnt个为0的位. 
+ *        整字为0或者整字为1时整字处理, 摘要位图中标记为满的字直接跳过, 其余情况使用bsf找到0/1的边界
+ * 
+ * @param btmp 指向bitmap的指针
+ * @param start 开始寻找的位
+ * @param end 结束寻找的位(不包含)
+ * @param cnt 连续的位数
+ * @return int 成功则返回起始位的下标, 失败返回-1
+ */
+static int btmp_find_run(bitmap_t *btmp, uint32_t start, uint32_t end, uint32_t cnt){
+    uint32_t run = 0, run_start = 0;
+    uint32_t bit = start;
+
+    while (bit < end){
+        uint32_t word_idx = bit / BITMAP_WORD_BITS;
+        uint32_t offset = bit % BITMAP_WORD_BITS;
+
+        // 摘要位图: 整个摘要字都满则跳过1024位, 否则跳过已满的字
+        if (btmp->summary != NULL && offset == 0){
+            uint32_t sum = btmp->summary[word_idx / BITMAP_WORD_BITS];
+            if (word_idx % BITMAP_WORD_BITS == 0 && sum == 0xFFFFFFFF){
+                run = 0;
+                bit += BITMAP_WORD_BITS * BITMAP_WORD_BITS;
+                continue;
+            }
+            if (sum & (1 << (word_idx % BITMAP_WORD_BITS))){
+                run = 0;
+                bit += BITMAP_WORD_BITS;
+                continue;
+            }
+        }
+
+        uint32_t avail = BITMAP_WORD_BITS - offset;
+        if (avail > end - bit)
+            avail = end - bit;
+        uint32_t word = btmp_word(btmp, word_idx) >> offset;
+        uint32_t mask = avail == BITMAP_WORD_BITS ? 0xFFFFFFFF : (1U << avail) - 1;
+
+        // 整字空闲
+        if ((word & mask) == 0){
+            if (run == 0)
+                run_start = bit;
+            run += avail;
+            if (run >= cnt)
+                return run_start;
+            bit += avail;
+            continue;
+        }
+        // 整字已满
+        if ((word & mask) == mask){
+            run = 0;
+            bit += avail;
+            continue;
+        }
+
+        // 字内0和1交替, 使用bsf找到边界
+        while (avail > 0){
+            uint32_t len;
+            if ((word & 1) == 0){
+                len = word == 0 ? avail : bit_ffs(word);
+                if (len > avail)
+                    len = avail;
+                if (run == 0)
+                    run_start = bit;
+                run += len;
+                if (run >= cnt)
+                    return run_start;
+            } else {
+                len = ~word == 0 ? BITMAP_WORD_BITS : bit_ffs(~word);
+                if (len > avail)
+                    len = avail;
+                run = 0;
+            }
+            word = len >= BITMAP_WORD_BITS ? 0 : word >> len;
+            bit += len;
+            avail -= len;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @brief 在位图中申请连续的cnt个位，若成功则返回起始位的下标，失败则返回-1. 
+ *        扫描从上次分配结束的位置(hint)开始, 到达位图末尾后再从头扫描到hint
  * 
  * @param btmp 指向bitmap的指针
  * @param cnt 连续的位数
  * @return int 起始位的下标
  */
 int bitmap_scan(bitmap_t *btmp, uint32_t cnt){
-    uint32_t idx_byte = 0;
-
-    // 先逐字节比较
-    while ((0xFF == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_byte_len))
-        idx_byte++;
-    
-    ASSERT(idx_byte < btmp->btmp_byte_len);
-    // 内存池中无可用空间
-    if (idx_byte == btmp->btmp_byte_len)
+    uint32_t total = btmp->btmp_byte_len * 8;
+    if (cnt == 0 || cnt > total)
         return -1;
-    
-    // 字节内逐位比较
-    int idx_bit = 0;
-    // 找到空闲位
-    while ((uint8_t) (BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
-        idx_bit++;
-
-    int bit_idx_start = idx_byte * 8 + idx_bit;
-    // 若只要分配1位，则直接返回
-    if (cnt == 1)
-        return bit_idx_start;
-
-    // 否则从当前位开始，逐位向后寻找
-    uint32_t bit_left = (btmp->btmp_byte_len * 8 - bit_idx_start);
-    uint32_t next_bit = bit_idx_start + 1;
-    uint32_t count = 1;
-
-    bit_idx_start = -1;
-    while (bit_left-- > 0){
-        if (!(bitmap_scan_test(btmp, next_bit)))
-            count++;                // next_bit为0，则又找到一个空闲位
-        else
-            count = 0;
-        
-        if (count == cnt){
-            bit_idx_start = next_bit - cnt + 1;
-            break;
-        }
-        next_bit++;
+
+    uint32_t hint = btmp->hint < total ? btmp->hint : 0;
+    int bit_idx_start = btmp_find_run(btmp, hint, total, cnt);
+    // 回绕, 跨越hint的连续位也需要找到
+    if (bit_idx_start == -1 && hint != 0){
+        uint32_t end = hint + cnt - 1;
+        bit_idx_start = btmp_find_run(btmp, 0, end < total ? end : total, cnt);
     }
 
+    if (bit_idx_start != -1)
+        btmp->hint = (bit_idx_start + cnt) % total;
     return bit_idx_start;
 }
 
@@ -99,4 +222,51 @@ void bitmap_set(bitmap_t *btmp, uint32_t bit_idx, int8_t value){
         btmp->bits[byte_idx] |= (BITMAP_MASK << bit_odd);           // 设置1位
     else
         btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd);          // 设置0位
-}
\ No newline at end of file
+
+    summary_update(btmp, bit_idx / BITMAP_WORD_BITS);
+}
+
+
+/**
+ * @brief bitmap_set_range用于将bitmap中从bit_idx开始的连续cnt位设置为value, 整字节的部分直接memset
+ * 
+ * @param btmp 指向bitmap的指针
+ * @param bit_idx 要设置的第一位的索引
+ * @param cnt 要设置的位数
+ * @param value 要设置的值
+ */
+void bitmap_set_range(bitmap_t *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value){
+    ASSERT((value == 1) || (value == 0));
+    if (cnt == 0)
+        return;
+    ASSERT(bit_idx + cnt <= btmp->btmp_byte_len * 8);
+
+    uint32_t bit_end = bit_idx + cnt;
+    uint32_t idx = bit_idx;
+    // 开头不足一个字节的部分逐位设置
+    while (idx < bit_end && idx % 8 != 0){
+        if (value)
+            btmp->bits[idx / 8] |= (BITMAP_MASK << (idx % 8));
+        else
+            btmp->bits[idx / 8] &= ~(BITMAP_MASK << (idx % 8));
+        idx++;
+    }
+    // 中间的整字节
+    if (bit_end - idx >= 8){
+        uint32_t byte_cnt = (bit_end - idx) / 8;
+        memset(btmp->bits + idx / 8, value ? 0xFF : 0, byte_cnt);
+        idx += byte_cnt * 8;
+    }
+    // 结尾不足一个字节的部分
+    while (idx < bit_end){
+        if (value)
+            btmp->bits[idx / 8] |= (BITMAP_MASK << (idx % 8));
+        else
+            btmp->bits[idx / 8] &= ~(BITMAP_MASK << (idx % 8));
+        idx++;
+    }
+
+    // 每个被修改过的字更新一次摘要位图
+    for (uint32_t word_idx = bit_idx / BITMAP_WORD_BITS; word_idx <= (bit_end - 1) / BITMAP_WORD_BITS; word_idx++)
+        summary_update(btmp, word_idx);
+}
@@ -5,9 +5,25 @@
 
 #define BITMAP_MASK 1
 
+/// @brief 位图按照32位的字进行扫描, 每个字32位
+#define BITMAP_WORD_BITS 32
+
+/// @brief 为btmp_byte_len字节长的位图提供二级摘要位图所需要的字节数, 摘要位图中每一位描述位图中的一个32位字
+#define BITMAP_SUMMARY_BYTES(byte_len) (DIV_CEILING(DIV_CEILING(byte_len, 4), BITMAP_WORD_BITS) * 4)
+
+/**
+ * @brief bitmap_t是位图. 位图以32位字为单位进行扫描, 并且可以附加一个可选的二级摘要位图summary,
+ *        摘要位图中的第i位为1表示位图中第i个32位字已满, 扫描时可以整字跳过. 
+ *        此外, 位图中还记录了一个next-fit游标hint, 每次扫描都从上次分配结束的位置开始
+ * 
+ * @note 位图的使用者只需要设置btmp_byte_len和bits, 其余成员为0即可正常工作. 若需要使用摘要位图,
+ *       则需要调用bitmap_build_summary为位图提供BITMAP_SUMMARY_BYTES(btmp_byte_len)字节的摘要位图
+ */
 typedef struct __bitmap_t{
     uint32_t btmp_byte_len;             // 位图的长度，以字节位长度
     uint8_t *bits;                      // 指向位图的指针
+    uint32_t *summary;                  // 指向二级摘要位图的指针, 为NULL时不使用摘要位图
+    uint32_t hint;                      // next-fit游标, 下次扫描开始的位
 } bitmap_t;
 
 /**
@@ -18,6 +34,16 @@ typedef struct __bitmap_t{
 void bitmap_init(bitmap_t* btmp);
 
 
+/**
+ * @brief bitmap_build_summary用于为位图附加二级摘要位图, 并根据位图当前的内容重建摘要位图.
+ *        当位图的内容不是通过bitmap_set修改的时候(例如直接从磁盘读入), 也需要调用该函数重建摘要位图
+ * 
+ * @param btmp 指向bitmap的指针
+ * @param summary 摘要位图, 至少BITMAP_SUMMARY_BYTES(btmp->btmp_byte_len)字节
+ */
+void bitmap_build_summary(bitmap_t *btmp, uint32_t *summary);
+
+
 /**
  * @brief 判断位图中指定的位是否位1
  * 
@@ -48,4 +74,15 @@ int bitmap_scan(bitmap_t *btmp, uint32_t cnt);
  */
 void bitmap_set(bitmap_t *btmp, uint32_t bit_idx, int8_t value);
 
+
+/**
+ * @brief bitmap_set_range用于将bitmap中从bit_idx开始的连续cnt位设置为value, 整字节的部分直接memset
+ * 
+ * @param btmp 指向bitmap的指针
+ * @param bit_idx 要设置的第一位的索引
+ * @param cnt 要设置的位数
+ * @param value 要设置的值
+ */
+void bitmap_set_range(bitmap_t *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "lz4.h"
+#include "stdint.h"
+#include "global.h"
+#include "string.h"
+#include "debug.h"
+
+/// @brief 最短的匹配长度
+#define LZ4_MIN_MATCH 4
+/// @brief 输入的最后5个字节必须是字面量
+#define LZ4_LAST_LITERALS 5
+/// @brief 最后一个匹配必须在输入结束前至少12个字节开始
+#define LZ4_MFLIMIT 12
+/// @brief 匹配的最大偏移
+#define LZ4_MAX_OFFSET 65535
+
+
+/**
+ * @brief lz4_hash返回4字节序列seq在哈希表中的下标
+ */
+static inline uint32_t lz4_hash(uint32_t seq){
+    return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+
+/**
+ * @brief lz4_put_len用于输出长度len超出token部分的扩展字节
+ */
+static inline uint32_t lz4_put_len(uint8_t *dst, uint32_t op, uint32_t len){
+    while (len >= 255){
+        dst[op++] = 255;
+        len -= 255;
+    }
+    dst[op++] = len;
+    return op;
+}
+
+
+/**
+ * @brief lz4_emit用于输出一个序列. mlen为0表示最后一个只有字面量的序列
+ *
+ * @param dst 输出的位置
+ * @param op 指向已经输出的字节数
+ * @param dst_cap dst的容量
+ * @param lit 字面量
+ * @param lit_len 字面量的长度
+ * @param offset 匹配的偏移
+ * @param mlen 匹配的长度
+ * @return true 成功
+ * @return false dst放不下
+ */
+static bool lz4_emit(uint8_t *dst, uint32_t *op, uint32_t dst_cap, const uint8_t *lit, uint32_t lit_len, uint32_t offset, uint32_t mlen){
+    // 按照最坏情况检查容量: token, 两个长度的扩展字节, 字面量和偏移
+    uint32_t need = 1 + (lit_len / 255 + 1) + lit_len + 2 + (mlen / 255 + 1);
+    if (need > dst_cap - *op)
+        return false;
+
+    uint32_t pos = *op;
+    uint8_t *token = &dst[pos++];
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15)
+        pos = lz4_put_len(dst, pos, lit_len - 15);
+    memcpy(dst + pos, lit, lit_len);
+    pos += lit_len;
+
+    if (mlen > 0){
+        dst[pos++] = offset & 0xFF;
+        dst[pos++] = offset >> 8;
+        mlen -= LZ4_MIN_MATCH;
+        *token |= mlen >= 15 ? 15 : mlen;
+        if (mlen >= 15)
+            pos = lz4_put_len(dst, pos, mlen - 15);
+    }
+    *op = pos;
+    return true;
+}
+
+
+/**
+ * @brief lz4_compress用于将src开始的src_len字节压缩到dst中
+ *
+ * @param src 需要压缩的数据
+ * @param src_len 需要压缩的字节数, 不能超过LZ4_MAX_INPUT
+ * @param dst 压缩后数据的存放位置
+ * @param dst_cap dst的容量
+ * @param table 工作区, 长度为LZ4_HASH_SIZE
+ * @return uint32_t 成功则返回压缩后的字节数; 若压缩后的数据放不进dst, 则返回0
+ */
+uint32_t lz4_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap, uint16_t *table){
+    ASSERT(src_len <= LZ4_MAX_INPUT);
+    // 哈希表中记录的是位置加1, 0表示没有记录
+    memset(table, 0, LZ4_HASH_SIZE * sizeof(uint16_t));
+
+    uint32_t ip = 0, anchor = 0, op = 0;
+    while (ip + LZ4_MFLIMIT <= src_len){
+        uint32_t seq = *(const uint32_t *) (src + ip);
+        uint32_t hash = lz4_hash(seq);
+        uint32_t ref = table[hash];
+        table[hash] = ip + 1;
+        if (ref == 0 || ip - (ref - 1) > LZ4_MAX_OFFSET || *(const uint32_t *) (src + ref - 1) != seq){
+            ip++;
+            continue;
+        }
+
+        // 向后扩展匹配, 但是不能覆盖最后的字面量
+        ref--;
+        uint32_t mlen = LZ4_MIN_MATCH;
+        while (ip + mlen < src_len - LZ4_LAST_LITERALS && src[ref + mlen] == src[ip + mlen])
+            mlen++;
+        if (!lz4_emit(dst, &op, dst_cap, src + anchor, ip - anchor, ip - ref, mlen))
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if (!lz4_emit(dst, &op, dst_cap, src + anchor, src_len - anchor, 0, 0))
+        return 0;
+    return op;
+}
+
+
+/**
+ * @brief lz4_get_len用于读取长度的扩展字节并累加到len上
+ *
+ * @return true 成功
+ * @return false 扩展字节超出了src
+ */
+static inline bool lz4_get_len(const uint8_t *src, uint32_t src_len, uint32_t *ip, uint32_t *len){
+    uint8_t byte;
+    do {
+        if (*ip >= src_len)
+            return false;
+        byte = src[(*ip)++];
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+
+/**
+ * @brief lz4_decompress用于将src开始的src_len字节压缩数据解压缩到dst中. 解压缩的时候会检查所有的长度和偏移,
+ *        损坏的数据不会导致越界访问
+ *
+ * @param src 压缩后的数据
+ * @param src_len 压缩后的字节数
+ * @param dst 解压缩后数据的存放位置
+ * @param dst_cap dst的容量
+ * @return int32_t 成功则返回解压缩后的字节数; 数据损坏或者dst放不下则返回-1
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap){
+    uint32_t ip = 0, op = 0;
+    while (ip < src_len){
+        uint8_t token = src[ip++];
+
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15 && !lz4_get_len(src, src_len, &ip, &lit_len))
+            return -1;
+        if (lit_len > src_len - ip || lit_len > dst_cap - op)
+            return -1;
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        // 最后一个序列只有字面量
+        if (ip == src_len)
+            break;
+
+        if (src_len - ip < 2)
+            return -1;
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return -1;
+        uint32_t mlen = token & 0xF;
+        if (mlen == 15 && !lz4_get_len(src, src_len, &ip, &mlen))
+            return -1;
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > dst_cap - op)
+            return -1;
+
+        // 匹配可能和正在输出的数据重叠(例如重复的字节), 所以逐字节复制
+        const uint8_t *match = dst + op - offset;
+        for (uint32_t idx = 0; idx < mlen; idx++)
+            dst[op++] = match[idx];
+    }
+    return op;
+}
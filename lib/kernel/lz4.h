@@ -0,0 +1,46 @@
+#ifndef __LIB_KERNEL_LZ4_H
+#define __LIB_KERNEL_LZ4_H
+
+#include "stdint.h"
+
+/**
+ * LZ4块格式的压缩和解压缩. 压缩后的数据由若干序列组成, 每个序列为:
+ *      token(高4位是字面量长度, 低4位是匹配长度减4) [字面量长度的扩展字节] 字面量 偏移(2字节, 小端) [匹配长度的扩展字节]
+ * 长度字段为15的时候后面跟着扩展字节, 每个扩展字节累加到长度上, 直到遇到不为255的字节. 最后一个序列只有字面量.
+ * 这里的压缩只做单次哈希查找, 不追求压缩率, 主要用于压缩用户页这类大量重复的数据
+ */
+
+/// @brief 压缩使用的哈希表的项数的对数
+#define LZ4_HASH_LOG 12
+/// @brief 压缩使用的哈希表的项数, 调用者需要提供这么多项的uint16_t数组作为工作区
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_LOG)
+/// @brief 一次最多压缩的字节数, 哈希表中记录的位置要能放进uint16_t
+#define LZ4_MAX_INPUT 0xFFFE
+
+
+/**
+ * @brief lz4_compress用于将src开始的src_len字节压缩到dst中
+ *
+ * @param src 需要压缩的数据
+ * @param src_len 需要压缩的字节数, 不能超过LZ4_MAX_INPUT
+ * @param dst 压缩后数据的存放位置
+ * @param dst_cap dst的容量
+ * @param table 工作区, 长度为LZ4_HASH_SIZE
+ * @return uint32_t 成功则返回压缩后的字节数; 若压缩后的数据放不进dst, 则返回0
+ */
+uint32_t lz4_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap, uint16_t *table);
+
+
+/**
+ * @brief lz4_decompress用于将src开始的src_len字节压缩数据解压缩到dst中. 解压缩的时候会检查所有的长度和偏移,
+ *        损坏的数据不会导致越界访问
+ *
+ * @param src 压缩后的数据
+ * @param src_len 压缩后的字节数
+ * @param dst 解压缩后数据的存放位置
+ * @param dst_cap dst的容量
+ * @return int32_t 成功则返回解压缩后的字节数; 数据损坏或者dst放不下则返回-1
+ */
+int32_t lz4_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_cap);
+
+#endif
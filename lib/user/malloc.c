@@ -0,0 +1,305 @@
+#include "syscall.h"
+#include "stdint.h"
+#include "string.h"
+#include "assert.h"
+
+/**
+ * 用户态的堆分配器, 只链接到crt中. 分配器的状态都在用户程序自己的数据段中, 所以每个进程(包括fork出来的子进程)各有一份.
+ *
+ * 堆是通过sbrk向内核申请的一段连续的虚拟内存, 分配器从堆顶切分内存块:
+ *      1. 小内存块: 按照2的幂分为UMALLOC_CLASS_CNT种, 每一种有自己的空闲链表, 分配和释放只是链表的出栈和入栈
+ *      2. 大内存块: 释放后放入一个首次适应的空闲链表, 分配的时候剩下的部分足够大就切分出来.
+ *         与堆顶相邻的大内存块释放的时候直接并入堆顶, 堆顶空闲的内存足够多的时候归还给内核
+ * 只有堆顶的内存不够用或者需要归还给内核的时候才会进入内核.
+ * 堆的起始地址和每次扩展的大小都按页对齐, 内存块的大小都是16的倍数, 所以内存块按照16字节对齐, 返回的地址按照8字节对齐
+ */
+
+/// 最小的内存块的大小, 包括头部
+#define UMALLOC_MIN_SIZE 16
+/// 小内存块的种类数: 16, 32, ..., 2048
+#define UMALLOC_CLASS_CNT 8
+/// 最大的小内存块的大小, 包括头部
+#define UMALLOC_MAX_SMALL (UMALLOC_MIN_SIZE << (UMALLOC_CLASS_CNT - 1))
+/// 每次通过sbrk扩展堆的最小字节数
+#define UMALLOC_GROW 0x4000
+/// 堆顶的空闲内存超过该字节数时归还给内核
+#define UMALLOC_TRIM 0x10000
+/// 已分配的内存块头部的魔数, 用于检查free的参数
+#define UMALLOC_MAGIC 0x19980802
+
+/**
+ * @brief chunk_hdr_t是内存块的头部, 紧挨着返回给用户的内存之前
+ */
+typedef struct __chunk_hdr_t {
+    uint32_t size;                              // 内存块的总大小, 包括头部
+    uint32_t magic;                             // 已分配的内存块为UMALLOC_MAGIC, 空闲的内存块为0
+} chunk_hdr_t;
+
+/**
+ * @brief free_chunk_t是空闲的内存块, 空闲链表的指针放在原来用户数据的位置
+ */
+typedef struct __free_chunk_t {
+    chunk_hdr_t hdr;
+    struct __free_chunk_t *next;
+} free_chunk_t;
+
+
+/// 小内存块的空闲链表
+static free_chunk_t *small_free[UMALLOC_CLASS_CNT];
+/// 大内存块的空闲链表
+static free_chunk_t *large_free;
+/// [heap_top, heap_end)是已经向内核申请但还没有切分的内存, heap_end就是进程的堆顶
+static uint8_t *heap_top, *heap_end;
+/// [heap_clean, heap_end)是通过sbrk得到以后还没有切分过的内存, 内核在第一次访问的时候才分配已经清0的页, 所以其中全为0
+static uint8_t *heap_clean;
+
+
+/**
+ * @brief heap_carve用于从堆顶切分一个size字节的内存块, 堆顶的内存不够的时候通过sbrk扩展堆
+ *
+ * @param size 内存块的大小, 包括头部
+ * @return chunk_hdr_t* 成功则返回内存块; 失败则返回NULL
+ */
+static chunk_hdr_t *heap_carve(uint32_t size){
+    if ((uint32_t) (heap_end - heap_top) < size){
+        uint32_t grow = size > UMALLOC_GROW ? size : UMALLOC_GROW;
+        grow = (grow + 0xFFF) & 0xFFFFF000;
+        uint8_t *old_brk = sbrk(grow);
+        if (old_brk == (void *) -1)
+            return NULL;
+        // 第一次扩展堆, 堆顶剩下的内存和新申请的内存是连续的
+        if (old_brk != heap_end)
+            heap_top = heap_clean = old_brk;
+        heap_end = old_brk + grow;
+    }
+
+    chunk_hdr_t *chunk = (chunk_hdr_t *) heap_top;
+    heap_top += size;
+    if (heap_clean < heap_top)
+        heap_clean = heap_top;
+    chunk->size = size;
+    return chunk;
+}
+
+
+/**
+ * @brief heap_trim用于在堆顶空闲的内存过多的时候将整页归还给内核, 保留UMALLOC_GROW字节供之后的分配使用
+ */
+static void heap_trim(void){
+    if ((uint32_t) (heap_end - heap_top) < UMALLOC_TRIM)
+        return;
+    uint32_t release = (heap_end - heap_top - UMALLOC_GROW) & 0xFFFFF000;
+    if (sbrk(-(int32_t) release) != (void *) -1){
+        heap_end -= release;
+        // 归还的页再次申请的时候是新的页
+        if (heap_clean > heap_end)
+            heap_clean = heap_end;
+    }
+}
+
+
+/**
+ * @brief small_class返回大小为size的内存块所属的小内存块种类
+ */
+static uint32_t small_class(uint32_t size){
+    uint32_t class_idx = 0;
+    while ((uint32_t) (UMALLOC_MIN_SIZE << class_idx) < size)
+        class_idx++;
+    return class_idx;
+}
+
+
+/**
+ * @brief malloc将从当前进程的堆中申请size个字节的内存
+ * @param size 要申请字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败则返回NULL
+ */
+void *malloc(uint32_t size){
+    if (size > 0x7FFFFFFF)
+        return NULL;
+    uint32_t chunk_size = size + sizeof(chunk_hdr_t);
+    free_chunk_t *chunk;
+
+    if (chunk_size <= UMALLOC_MAX_SMALL){
+        // 小内存块优先从空闲链表中分配
+        uint32_t class_idx = small_class(chunk_size);
+        if ((chunk = small_free[class_idx]) != NULL)
+            small_free[class_idx] = chunk->next;
+        else if ((chunk = (free_chunk_t *) heap_carve(UMALLOC_MIN_SIZE << class_idx)) == NULL)
+            return NULL;
+    } else {
+        // 大内存块首次适应, 剩下的部分至少是一个最大的小内存块的时候才切分
+        chunk_size = (chunk_size + UMALLOC_MIN_SIZE - 1) & ~(UMALLOC_MIN_SIZE - 1);
+        free_chunk_t **prev = &large_free;
+        while ((chunk = *prev) != NULL && chunk->hdr.size < chunk_size)
+            prev = &chunk->next;
+
+        if (chunk != NULL){
+            *prev = chunk->next;
+            if (chunk->hdr.size - chunk_size > UMALLOC_MAX_SMALL){
+                free_chunk_t *rest = (free_chunk_t *) ((uint8_t *) chunk + chunk_size);
+                rest->hdr.size = chunk->hdr.size - chunk_size;
+                rest->hdr.magic = 0;
+                rest->next = large_free;
+                large_free = rest;
+                chunk->hdr.size = chunk_size;
+            }
+        } else if ((chunk = (free_chunk_t *) heap_carve(chunk_size)) == NULL)
+            return NULL;
+    }
+
+    chunk->hdr.magic = UMALLOC_MAGIC;
+    return (void *) (&chunk->hdr + 1);
+}
+
+
+/**
+ * @brief free用于将ptr执向的内存归还到当前进程的堆中. 注意, 归还的
+ *      内存必须是malloc分配得到的内存
+ * @param ptr 指向要归还的内存的指针
+ */
+void free(void *ptr){
+    if (ptr == NULL)
+        return;
+    free_chunk_t *chunk = (free_chunk_t *) ((chunk_hdr_t *) ptr - 1);
+    assert(chunk->hdr.magic == UMALLOC_MAGIC);
+    chunk->hdr.magic = 0;
+
+    if (chunk->hdr.size <= UMALLOC_MAX_SMALL){
+        uint32_t class_idx = small_class(chunk->hdr.size);
+        chunk->next = small_free[class_idx];
+        small_free[class_idx] = chunk;
+    } else if ((uint8_t *) chunk + chunk->hdr.size == heap_top){
+        // 与堆顶相邻的大内存块直接并入堆顶
+        heap_top = (uint8_t *) chunk;
+        heap_trim();
+    } else {
+        chunk->next = large_free;
+        large_free = chunk;
+    }
+}
+
+
+/**
+ * @brief chunk_shrink用于将已分配的大内存块chunk缩小为size字节, 剩下的部分足够大的时候切分出来释放.
+ *        大内存块缩小以后依旧是大内存块, 否则释放的时候会被当作小内存块
+ */
+static void chunk_shrink(chunk_hdr_t *chunk, uint32_t size){
+    if (size <= UMALLOC_MAX_SMALL)
+        size = UMALLOC_MAX_SMALL + UMALLOC_MIN_SIZE;
+    if (chunk->size <= size || chunk->size - size <= UMALLOC_MAX_SMALL)
+        return;
+    chunk_hdr_t *rest = (chunk_hdr_t *) ((uint8_t *) chunk + size);
+    rest->size = chunk->size - size;
+    rest->magic = UMALLOC_MAGIC;
+    chunk->size = size;
+    free(rest + 1);
+}
+
+
+/**
+ * @brief calloc将从当前进程的堆中申请nmemb个size字节的内存, 内容全为0. 从堆顶新切分的内存中,
+ *        heap_clean之后的部分还没有被使用过, 已经全为0了, 只需要清0之前的部分
+ * @param nmemb 元素的个数
+ * @param size 每个元素的字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败(包括nmemb * size溢出)则返回NULL
+ */
+void *calloc(uint32_t nmemb, uint32_t size){
+    if (size != 0 && nmemb > 0xFFFFFFFF / size)
+        return NULL;
+    uint32_t bytes = nmemb * size;
+    uint8_t *clean = heap_clean;
+    uint8_t *ptr = malloc(bytes);
+    if (ptr != NULL && ptr < clean)
+        memset(ptr, 0, (uint32_t) (clean - ptr) < bytes ? (uint32_t) (clean - ptr) : bytes);
+    return ptr;
+}
+
+
+/**
+ * @brief realloc用于将ptr指向的内存调整为size个字节, 原来的内容保持不变. 能原地调整的时候不复制内容:
+ *          1. 小内存块: size不超过内存块的大小
+ *          2. 大内存块: 缩小的时候切分出多余的部分释放; 与堆顶相邻的时候直接从堆顶扩展
+ *        否则重新申请一块内存, 复制原来的内容后释放原来的内存
+ * @param ptr malloc, calloc, memalign或者realloc返回的内存, 为NULL的时候等同于malloc
+ * @param size 调整后的字节数, 为0的时候等同于free
+ * @return void* 若成功, 则返回调整后的内存第一个字节的地址; 失败则返回NULL, 此时原来的内存不变
+ */
+void *realloc(void *ptr, uint32_t size){
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0){
+        free(ptr);
+        return NULL;
+    }
+    if (size > 0x7FFFFFFF)
+        return NULL;
+    chunk_hdr_t *chunk = (chunk_hdr_t *) ptr - 1;
+    assert(chunk->magic == UMALLOC_MAGIC);
+
+    uint32_t chunk_size = size + sizeof(chunk_hdr_t);
+    if (chunk->size <= UMALLOC_MAX_SMALL){
+        if (chunk_size <= chunk->size)
+            return ptr;
+    } else {
+        chunk_size = (chunk_size + UMALLOC_MIN_SIZE - 1) & ~(UMALLOC_MIN_SIZE - 1);
+        if (chunk_size <= chunk->size){
+            chunk_shrink(chunk, chunk_size);
+            return ptr;
+        }
+        if ((uint8_t *) chunk + chunk->size == heap_top){
+            // 堆不连续的时候新切分的内存不与chunk相邻, 此时放回堆顶
+            chunk_hdr_t *ext = heap_carve(chunk_size - chunk->size);
+            if ((uint8_t *) ext == (uint8_t *) chunk + chunk->size){
+                chunk->size = chunk_size;
+                return ptr;
+            }
+            if (ext != NULL)
+                heap_top = (uint8_t *) ext;
+        }
+    }
+
+    void *new_ptr = malloc(size);
+    if (new_ptr == NULL)
+        return NULL;
+    uint32_t old_size = chunk->size - sizeof(chunk_hdr_t);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    free(ptr);
+    return new_ptr;
+}
+
+
+/**
+ * @brief memalign将从当前进程的堆中申请size个字节的内存, 首地址按照align对齐. 多申请一块内存, 从中找到对齐的地址,
+ *        对齐的地址之前的部分切分出来作为大内存块释放, 所以这部分要么为空, 要么大于最大的小内存块
+ * @param align 对齐的字节数, 必须是2的幂
+ * @param size 要申请字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败则返回NULL
+ */
+void *memalign(uint32_t align, uint32_t size){
+    if (align == 0 || (align & (align - 1)) != 0 || align > 0x10000000 || size > 0x7FFFFFFF - align - 2 * UMALLOC_MAX_SMALL)
+        return NULL;
+    // 返回的地址本来就按照8字节对齐
+    if (align <= sizeof(chunk_hdr_t))
+        return malloc(size);
+
+    // 切分以后剩下的部分也要大于最大的小内存块
+    uint8_t *raw = malloc(size + align + 2 * UMALLOC_MAX_SMALL);
+    if (raw == NULL)
+        return NULL;
+    chunk_hdr_t *chunk = (chunk_hdr_t *) raw - 1;
+    uint32_t addr = (uint32_t) raw, aligned = (addr + align - 1) & ~(align - 1);
+    while (aligned != addr && aligned - addr <= UMALLOC_MAX_SMALL)
+        aligned += align;
+
+    if (aligned != addr){
+        chunk_hdr_t *head = chunk;
+        chunk = (chunk_hdr_t *) aligned - 1;
+        chunk->size = head->size - (aligned - addr);
+        chunk->magic = UMALLOC_MAGIC;
+        head->size = aligned - addr;
+        free(head + 1);
+    }
+    chunk_shrink(chunk, (size + sizeof(chunk_hdr_t) + UMALLOC_MIN_SIZE - 1) & ~(UMALLOC_MIN_SIZE - 1));
+    return (void *) aligned;
+}
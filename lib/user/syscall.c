@@ -68,6 +68,8 @@ int32_t write(int32_t fd, const void *buf, uint32_t count){
     return _syscall3(SYS_WRITE, fd, buf, count);
 }
 
+// crt中的malloc和free由用户态分配器(malloc.c)实现, 内核中直接运行的进程没有独立的数据段, 只能使用系统调用
+#ifndef CRT_MALLOC
 /**
  * @brief malloc系统调用将从当前进程的堆中申请size个字节的内存
  * @param size 要申请字节数
@@ -88,6 +90,50 @@ void free(void *ptr){
 }
 
 
+/**
+ * @brief calloc将从当前进程的堆中申请nmemb个size字节的内存. malloc系统调用返回的内存已经全为0了, 所以只需要检查溢出
+ * @param nmemb 元素的个数
+ * @param size 每个元素的字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败则返回NULL
+ */
+void *calloc(uint32_t nmemb, uint32_t size){
+    if (size != 0 && nmemb > 0xFFFFFFFF / size)
+        return NULL;
+    return malloc(nmemb * size);
+}
+
+
+/**
+ * @brief realloc系统调用用于将ptr指向的内存调整为size个字节, 原来的内容保持不变
+ * @param ptr malloc系统调用分配得到的内存, 为NULL的时候等同于malloc
+ * @param size 调整后的字节数, 为0的时候等同于free
+ * @return void* 若成功, 则返回调整后的内存第一个字节的地址; 失败则返回NULL, 此时原来的内存不变
+ */
+void *realloc(void *ptr, uint32_t size){
+    return (void *) _syscall2(SYS_REALLOC, ptr, size);
+}
+
+
+/**
+ * @brief memalign系统调用将从当前进程的堆中申请size个字节的内存, 首地址按照align对齐
+ * @param align 对齐的字节数, 必须是2的幂
+ * @param size 要申请字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败则返回NULL
+ */
+void *memalign(uint32_t align, uint32_t size){
+    return (void *) _syscall2(SYS_MEMALIGN, align, size);
+}
+#endif
+
+
+/**
+ * @brief aligned_alloc和memalign相同, size应当是align的整数倍
+ */
+void *aligned_alloc(uint32_t align, uint32_t size){
+    return memalign(align, size);
+}
+
+
 /**
  * @brief open系统调用用于打开一个指定的文件, 如果文件不存在的话, 则会创建文件, 而后打开该文件
  * 
@@ -350,4 +396,76 @@ void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd){
  */
 void help(void){
     _syscall0(SYS_HELP);
-}
\ No newline at end of file
+}
+
+
+/**
+ * @brief brk系统调用用于将当前进程的堆顶设置为addr
+ * 
+ * @param addr 新的堆顶
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t brk(void *addr){
+    return _syscall1(SYS_BRK, addr);
+}
+
+
+/**
+ * @brief sbrk系统调用用于将当前进程的堆顶移动increment个字节
+ * 
+ * @param increment 堆顶移动的字节数, 可以为负数. 为0时用于获得当前的堆顶
+ * @return void* 成功则返回原来的堆顶; 失败则返回(void *) -1
+ */
+void *sbrk(int32_t increment){
+    return (void *) _syscall1(SYS_SBRK, increment);
+}
+
+
+/**
+ * @brief mmap系统调用用于在当前进程中建立匿名映射或者文件的私有映射, 映射的页在第一次访问的时候才分配和读入
+ * 
+ * @param addr 建议的映射地址, 目前忽略
+ * @param length 映射的字节数
+ * @param prot PROT_READ, PROT_WRITE
+ * @param flags 必须包含MAP_PRIVATE, 匿名映射还要包含MAP_ANONYMOUS
+ * @param fd 文件映射的文件描述符, 匿名映射时忽略
+ * @param offset 文件映射在文件中的偏移, 必须按页对齐
+ * @return void* 成功则返回映射的起始地址; 失败则返回MAP_FAILED
+ */
+void *mmap(void *addr, uint32_t length, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset){
+    mmap_args_t args = {addr, length, prot, flags, fd, offset};
+    return (void *) _syscall1(SYS_MMAP, &args);
+}
+
+
+/**
+ * @brief munmap系统调用用于取消[addr, addr + length)中所有mmap建立的映射
+ * 
+ * @param addr 需要取消映射的起始地址, 必须按页对齐
+ * @param length 需要取消映射的字节数
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t munmap(void *addr, uint32_t length){
+    return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+/**
+ * @brief meminfo系统调用用于获得物理内存池, 内核堆, 当前进程的堆, 页表以及当前进程映射的页的使用情况
+ * 
+ * @param info 存放结果的位置
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t meminfo(meminfo_t *info){
+    return _syscall1(SYS_MEMINFO, info);
+}
+
+
+/**
+ * @brief memtrace系统调用用于控制内核的分配追踪, 报告中的地址可以用symbolize.sh对照build/kernel.map得到函数名
+ * 
+ * @param cmd MEMTRACE_START, MEMTRACE_STOP或者MEMTRACE_REPORT
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t memtrace(uint32_t cmd){
+    return _syscall1(SYS_MEMTRACE, cmd);
+}
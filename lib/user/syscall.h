@@ -32,10 +32,120 @@ typedef enum __SYSCALL_NR_t {
     SYS_EXIT,
     SYS_PIPE,
     SYS_FD_REDIRECT,
-    SYS_HELP
+    SYS_HELP,
+    SYS_BRK,
+    SYS_SBRK,
+    SYS_MMAP,
+    SYS_MUNMAP,
+    SYS_REALLOC,
+    SYS_MEMALIGN,
+    SYS_MEMINFO,
+    SYS_MEMTRACE
 } SYSCALL_NR_t;
 
 
+#define PROT_READ       0x1             // 映射的页可读
+#define PROT_WRITE      0x2             // 映射的页可写
+#define MAP_PRIVATE     0x02            // 私有映射, 对映射的修改不会写回文件, 也不会被其他进程看到
+#define MAP_ANONYMOUS   0x20            // 匿名映射, 不对应任何文件, 内容全为0
+#define MAP_FAILED      ((void *) -1)   // mmap失败时的返回值
+
+/**
+ * @brief mmap_args_t是mmap系统调用的参数. 系统调用最多只能通过寄存器传递3个参数, 所以mmap的参数通过结构体传递
+ */
+typedef struct __mmap_args_t {
+    void *addr;                         // 建议的映射地址, 目前忽略
+    uint32_t length;                    // 映射的字节数
+    uint32_t prot;                      // PROT_READ, PROT_WRITE
+    uint32_t flags;                     // 必须包含MAP_PRIVATE, 匿名映射还要包含MAP_ANONYMOUS
+    int32_t fd;                         // 文件映射的文件描述符, 匿名映射时忽略
+    uint32_t offset;                    // 文件映射在文件中的偏移, 必须按页对齐
+} mmap_args_t;
+
+
+#define MEMTRACE_START  0               // 清空追踪缓冲区并开始追踪堆的分配和释放
+#define MEMTRACE_STOP   1               // 停止追踪
+#define MEMTRACE_REPORT 2               // 输出按调用者汇总的报告
+
+/// @brief meminfo中伙伴系统的阶数, 与内核中的BUDDY_MAX_ORDER相同
+#define MEMINFO_ORDER_CNT 11
+/// @brief meminfo中内存块的种类数, 与内核中的MEM_UNIT_CNT相同
+#define MEMINFO_CLASS_CNT 13
+
+/**
+ * @brief meminfo_pool_t是一个物理内存池的使用情况. 已使用的页数为total_pages - free_pages
+ */
+typedef struct __meminfo_pool_t {
+    uint32_t total_pages;               // 内存池中可用的物理页数, 不包括空洞
+    uint32_t free_pages;                // 空闲页数, 包括快速路径缓存的单页和预先清0的页
+    uint32_t zero_pages;                // 预先清0的空闲页数
+    uint32_t lent_pages;                // 借给另一个内存池的页数
+    uint32_t borrowed_pages;            // 从另一个内存池借用的页数
+    uint32_t free_blocks[MEMINFO_ORDER_CNT];    // 伙伴系统中各阶空闲块的个数
+} meminfo_pool_t;
+
+/**
+ * @brief meminfo_class_t是堆中一种大小的内存块的使用情况. 线程弹匣中缓存的内存块算作已分配
+ */
+typedef struct __meminfo_class_t {
+    uint32_t block_size;                // 内存块的大小
+    uint32_t arenas;                    // arena的个数, 每个arena占用一页
+    uint32_t free_blocks;               // arena中空闲的内存块数
+} meminfo_class_t;
+
+/**
+ * @brief meminfo_heap_t是一个堆(内核堆或者用户进程的堆)的使用情况
+ */
+typedef struct __meminfo_heap_t {
+    meminfo_class_t classes[MEMINFO_CLASS_CNT];
+    uint32_t large_cnt;                 // 按页分配的大内存块的个数
+    uint32_t large_pages;               // 大内存块占用的虚拟页数
+} meminfo_heap_t;
+
+/**
+ * @brief meminfo_swap_t是交换的使用情况. 压缩率为zram_pages * 4096 / zram_compr_bytes,
+ *        命中率为swapin_ram_cnt / swapin_cnt, 即换入的时候不需要读交换分区的比例
+ */
+typedef struct __meminfo_swap_t {
+    uint32_t slot_total;                // 槽的总数
+    uint32_t fill_pages;                // 当前换出的同值页数
+    uint32_t zram_pages;                // 当前换出的压缩页数
+    uint32_t zram_compr_bytes;          // 压缩页压缩后的总字节数
+    uint32_t zram_mem_bytes;            // 压缩页实际占用的内存字节数
+    uint32_t disk_pages;                // 当前在交换分区中的页数
+    uint32_t disk_total;                // 交换分区能存放的页数, 没有交换分区的时候为0
+    uint32_t swapout_cnt;               // 累计换出的次数
+    uint32_t swapin_cnt;                // 累计换入的次数
+    uint32_t swapin_ram_cnt;            // 累计从内存中换入的次数
+} meminfo_swap_t;
+
+/**
+ * @brief meminfo_ksm_t是页合并的使用情况. sharing_pages即页合并节省的物理页数
+ */
+typedef struct __meminfo_ksm_t {
+    uint32_t shared_pages;              // 当前作为合并目标的物理页数
+    uint32_t sharing_pages;             // 当前合并到这些页上的页数
+    uint32_t merged_cnt;                // 累计合并的页数, 不包括合并到零页的
+    uint32_t zero_cnt;                  // 累计合并到零页的页数
+    uint32_t full_scans;                // 累计完成的扫描轮数
+} meminfo_ksm_t;
+
+/**
+ * @brief meminfo_t是meminfo系统调用的结果. 所有的数据都是在分配和释放的时候维护的计数, 读取的开销是固定的
+ */
+typedef struct __meminfo_t {
+    meminfo_pool_t kernel_pool;         // 内核内存池
+    meminfo_pool_t user_pool;           // 用户内存池
+    meminfo_pool_t high_pool;           // 高端内存池, 没有高端内存的时候全为0
+    meminfo_heap_t kernel_heap;         // 内核堆
+    meminfo_heap_t user_heap;           // 当前进程的用户堆
+    uint32_t pgtable_pages;             // 所有用户进程的页表占用的物理页数
+    uint32_t rss_pages;                 // 当前进程映射的用户页数, 包括共享的页和零页
+    meminfo_swap_t swap;                // 交换
+    meminfo_ksm_t ksm;                  // 页合并
+} meminfo_t;
+
+
 /**
  * @brief getpid返回当前用户进程的PID
  * @return uint32_t 用户进程的PID
@@ -55,20 +165,115 @@ int32_t write(int32_t fd, const void *buf, uint32_t count);
 
 
 /**
- * @brief malloc系统调用将从当前进程的堆中申请size个字节的内存
+ * @brief malloc将从当前进程的堆中申请size个字节的内存.
+ *        内核中直接运行的进程使用malloc系统调用; 从文件加载的用户程序使用crt中的用户态分配器, 只在堆不够用的时候通过sbrk进入内核
  * @param size 要申请字节数
  * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败则返回NULL
  */
 void* malloc(uint32_t size);
 
 /**
- * @brief free系统调用用于将ptr执向的内存归还到当前进程的堆中. 注意, 归还的
- *      内存必须是malloc系统调用分配得到的内存
+ * @brief free用于将ptr执向的内存归还到当前进程的堆中. 注意, 归还的
+ *      内存必须是malloc分配得到的内存
  * @param ptr 指向要归还的内存的指针
  */
 void free(void *ptr);
 
 
+/**
+ * @brief calloc将从当前进程的堆中申请nmemb个size字节的内存, 内容全为0. 已经全为0的内存不会再清0
+ * @param nmemb 元素的个数
+ * @param size 每个元素的字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败(包括nmemb * size溢出)则返回NULL
+ */
+void *calloc(uint32_t nmemb, uint32_t size);
+
+
+/**
+ * @brief realloc用于将ptr指向的内存调整为size个字节, 原来的内容保持不变. 能原地调整的时候不复制内容
+ * @param ptr malloc, calloc, memalign或者realloc返回的内存, 为NULL的时候等同于malloc
+ * @param size 调整后的字节数, 为0的时候等同于free
+ * @return void* 若成功, 则返回调整后的内存第一个字节的地址; 失败则返回NULL, 此时原来的内存不变
+ */
+void *realloc(void *ptr, uint32_t size);
+
+
+/**
+ * @brief memalign将从当前进程的堆中申请size个字节的内存, 首地址按照align对齐, 例如按扇区或者按页对齐的读写缓冲区.
+ *        返回的内存用free释放
+ * @param align 对齐的字节数, 必须是2的幂
+ * @param size 要申请字节数
+ * @return void* 若申请成功, 则返回申请得到的内存第一个字节的地址; 失败则返回NULL
+ */
+void *memalign(uint32_t align, uint32_t size);
+
+
+/**
+ * @brief aligned_alloc和memalign相同, size应当是align的整数倍
+ */
+void *aligned_alloc(uint32_t align, uint32_t size);
+
+
+/**
+ * @brief brk系统调用用于将当前进程的堆顶设置为addr
+ * 
+ * @param addr 新的堆顶
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t brk(void *addr);
+
+
+/**
+ * @brief sbrk系统调用用于将当前进程的堆顶移动increment个字节
+ * 
+ * @param increment 堆顶移动的字节数, 可以为负数. 为0时用于获得当前的堆顶
+ * @return void* 成功则返回原来的堆顶; 失败则返回(void *) -1
+ */
+void *sbrk(int32_t increment);
+
+
+/**
+ * @brief mmap系统调用用于在当前进程中建立匿名映射或者文件的私有映射, 映射的页在第一次访问的时候才分配和读入
+ * 
+ * @param addr 建议的映射地址, 目前忽略
+ * @param length 映射的字节数
+ * @param prot PROT_READ, PROT_WRITE
+ * @param flags 必须包含MAP_PRIVATE, 匿名映射还要包含MAP_ANONYMOUS
+ * @param fd 文件映射的文件描述符, 匿名映射时忽略
+ * @param offset 文件映射在文件中的偏移, 必须按页对齐
+ * @return void* 成功则返回映射的起始地址; 失败则返回MAP_FAILED
+ */
+void *mmap(void *addr, uint32_t length, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset);
+
+
+/**
+ * @brief munmap系统调用用于取消[addr, addr + length)中所有mmap建立的映射
+ * 
+ * @param addr 需要取消映射的起始地址, 必须按页对齐
+ * @param length 需要取消映射的字节数
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t munmap(void *addr, uint32_t length);
+
+
+/**
+ * @brief meminfo系统调用用于获得物理内存池, 内核堆, 当前进程的堆, 页表, 当前进程映射的页, 交换以及页合并的使用情况
+ * 
+ * @param info 存放结果的位置
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t meminfo(meminfo_t *info);
+
+
+/**
+ * @brief memtrace系统调用用于控制内核的分配追踪, 报告中的地址可以用symbolize.sh对照build/kernel.map得到函数名
+ * 
+ * @param cmd MEMTRACE_START, MEMTRACE_STOP或者MEMTRACE_REPORT
+ * @return int32_t 成功返回0; 失败返回-1
+ */
+int32_t memtrace(uint32_t cmd);
+
+
 /**
  * @brief open系统调用用于打开一个指定的文件, 如果文件不存在的话, 则会创建文件, 而后打开该文件
  * 
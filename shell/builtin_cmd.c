@@ -256,6 +256,119 @@ void builtin_ps(uint32_t argc, char **argv __attribute__((unused))){
 }
 
 
+/**
+ * @brief meminfo_print_pool用于输出一个物理内存池的使用情况
+ */
+static void meminfo_print_pool(const char *name, meminfo_pool_t *pool){
+    printf("%s: total %d, used %d, free %d (zeroed %d), lent %d, borrowed %d\n", name, pool->total_pages,
+           pool->total_pages - pool->free_pages, pool->free_pages, pool->zero_pages, pool->lent_pages, pool->borrowed_pages);
+    printf("    free blocks by order:");
+    for (uint32_t order = 0; order < MEMINFO_ORDER_CNT; order++)
+        printf(" %d", pool->free_blocks[order]);
+    printf("\n");
+}
+
+
+/**
+ * @brief meminfo_print_heap用于输出一个堆的使用情况, 只输出有arena的内存块大小
+ */
+static void meminfo_print_heap(const char *name, meminfo_heap_t *heap){
+    printf("%s: large %d (%d pages)\n", name, heap->large_cnt, heap->large_pages);
+    for (uint32_t idx = 0; idx < MEMINFO_CLASS_CNT; idx++){
+        meminfo_class_t *cls = &heap->classes[idx];
+        if (cls->arenas != 0)
+            printf("    %d bytes: %d arenas, %d free blocks\n", cls->block_size, cls->arenas, cls->free_blocks);
+    }
+}
+
+
+/**
+ * @brief meminfo_print_swap用于输出交换的使用情况. printf只能输出整数, 压缩率和命中率都放大100倍再按小数输出
+ */
+static void meminfo_print_swap(meminfo_swap_t *swap){
+    printf("swap: %d slots, same-filled %d, zram %d, disk %d/%d\n", swap->slot_total, swap->fill_pages,
+           swap->zram_pages, swap->disk_pages, swap->disk_total);
+    if (swap->zram_compr_bytes != 0){
+        uint32_t orig_bytes = swap->zram_pages * 4096;
+        uint32_t ratio = orig_bytes / swap->zram_compr_bytes * 100 + orig_bytes % swap->zram_compr_bytes * 100 / swap->zram_compr_bytes;
+        printf("    zram: %d bytes compressed, %d bytes used, ratio %d.%d%d\n", swap->zram_compr_bytes,
+               swap->zram_mem_bytes, ratio / 100, ratio / 10 % 10, ratio % 10);
+    }
+    printf("    swapped out %d, swapped in %d", swap->swapout_cnt, swap->swapin_cnt);
+    if (swap->swapin_cnt != 0){
+        uint32_t hit = swap->swapin_ram_cnt * 100 / swap->swapin_cnt;
+        printf(" (%d%% from memory)", hit);
+    }
+    printf("\n");
+}
+
+
+/**
+ * @brief meminfo_print_ksm用于输出页合并的使用情况
+ */
+static void meminfo_print_ksm(meminfo_ksm_t *ksm){
+    printf("ksm: %d shared pages, %d pages merged into them\n", ksm->shared_pages, ksm->sharing_pages);
+    printf("    merged %d, merged into zero page %d, full scans %d\n", ksm->merged_cnt, ksm->zero_cnt, ksm->full_scans);
+}
+
+
+/**
+ * @brief builtin_meminfo是meminfo内置命令的实现函数, 输出内存池, 内核堆, shell自己的堆, 页表, 交换和页合并的使用情况, 单位都是页.
+ *        每个进程映射的页数见ps
+ * 
+ * @param argc 参数个数
+ * @param argv 参数值
+ */
+void builtin_meminfo(uint32_t argc, char **argv __attribute__((unused))){
+    if (argc != 1){
+        printf("meminfo: meminfo receives no argument!\n");
+        return;
+    }
+    meminfo_t info;
+    if (meminfo(&info) == -1){
+        printf("meminfo: get memory information failed!\n");
+        return;
+    }
+    meminfo_print_pool("kernel pool", &info.kernel_pool);
+    meminfo_print_pool("user pool", &info.user_pool);
+    if (info.high_pool.total_pages != 0)
+        meminfo_print_pool("high pool", &info.high_pool);
+    meminfo_print_heap("kernel heap", &info.kernel_heap);
+    meminfo_print_heap("shell heap", &info.user_heap);
+    printf("page tables: %d, shell resident pages: %d\n", info.pgtable_pages, info.rss_pages);
+    meminfo_print_swap(&info.swap);
+    meminfo_print_ksm(&info.ksm);
+}
+
+
+/**
+ * @brief builtin_memtrace是memtrace内置命令的实现函数, 用于开始, 停止分配追踪或者输出报告
+ * 
+ * @param argc 参数个数
+ * @param argv 参数值
+ */
+void builtin_memtrace(uint32_t argc, char **argv){
+    uint32_t cmd;
+    if (argc != 2)
+        cmd = -1;
+    else if (!strcmp("start", argv[1]))
+        cmd = MEMTRACE_START;
+    else if (!strcmp("stop", argv[1]))
+        cmd = MEMTRACE_STOP;
+    else if (!strcmp("report", argv[1]))
+        cmd = MEMTRACE_REPORT;
+    else
+        cmd = -1;
+
+    if (cmd == (uint32_t) -1){
+        printf("memtrace: usage: memtrace start|stop|report\n");
+        return;
+    }
+    if (memtrace(cmd) == -1)
+        printf("memtrace: %s failed!\n", argv[1]);
+}
+
+
 /**
  * @brief builtin_clear是clear系统调用的实现函数
  * 
@@ -59,6 +59,24 @@ void builtin_ls(uint32_t argc, char **argv);
 void builtin_ps(uint32_t argc, char **argv);
 
 
+/**
+ * @brief builtin_meminfo是meminfo内置命令的实现函数
+ * 
+ * @param argc 参数个数
+ * @param argv 参数值
+ */
+void builtin_meminfo(uint32_t argc, char **argv);
+
+
+/**
+ * @brief builtin_memtrace是memtrace内置命令的实现函数
+ * 
+ * @param argc 参数个数
+ * @param argv 参数值
+ */
+void builtin_memtrace(uint32_t argc, char **argv);
+
+
 /**
  * @brief builtin_clear是clear系统调用的实现函数
  * 
@@ -4,6 +4,17 @@
 #include "ioqueue.h"
 
 
+kmem_cache_t pipe_cache;
+
+
+/**
+ * @brief pipe_cache_init用于初始化管道环形缓冲区的对象缓存
+ */
+void pipe_cache_init(void){
+    kmem_cache_init(&pipe_cache, "pipe", sizeof(ioqueue_t), sizeof(uint32_t), NULL);
+}
+
+
 /**
  * @brief sys_fd_redirect用于将进程的文件描述符表中的old_local_fd替换为new_local_fd
  * 
@@ -44,8 +55,8 @@ bool is_pipe(uint32_t local_fd){
 int32_t sys_pipe(int32_t pipefd[2]){
     int32_t global_fd = get_free_slot_in_global();
 
-    // 申请一个内核页作为环形缓冲区
-    file_table[global_fd].fd_inode = get_kernel_pages(1);
+    // 从对象缓存中申请环形缓冲区
+    file_table[global_fd].fd_inode = kmem_cache_alloc(&pipe_cache);
     if (file_table[global_fd].fd_inode == NULL)
         return -1;
 
@@ -3,9 +3,19 @@
 
 #include "global.h"
 #include "stdint.h"
+#include "slab.h"
 
 #define PIPE_FLAG 0xFFFF
 
+/// @brief 管道环形缓冲区的对象缓存
+extern kmem_cache_t pipe_cache;
+
+
+/**
+ * @brief pipe_cache_init用于初始化管道环形缓冲区的对象缓存
+ */
+void pipe_cache_init(void);
+
 
 /**
  * @brief sys_fd_redirect是fd_redirect系统调用的实现函数. 用于将进程的文件描述符表中的old_local_fd替换为new_local_fd
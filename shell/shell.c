@@ -154,6 +154,10 @@ static void cmd_execute(uint32_t argc, char **argv){
         builtin_pwd(argc, argv);
     } else if (!strcmp("ps", argv[0])){                 // ps
         builtin_ps(argc, argv);
+    } else if (!strcmp("meminfo", argv[0])){            // meminfo
+        builtin_meminfo(argc, argv);
+    } else if (!strcmp("memtrace", argv[0])){           // memtrace
+        builtin_memtrace(argc, argv);
     } else if (!strcmp("clear", argv[0])){              // clear
         builtin_clear(argc, argv);
     } else if (!strcmp("mkdir", argv[0])){              // mkdir
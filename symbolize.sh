@@ -0,0 +1,127 @@
+#! /bin/bash
+
+# terminal colors
+purple='\e[35m'
+green='\e[32m'
+red='\e[31m'
+return='\e[0m'
+
+function red(){
+    echo -e "$red$1$return"
+}
+
+function green(){
+    echo -e "$green$1$return"
+}
+
+function purple() {
+    echo -e "$purple$1$return"
+}
+
+if [[ "$1" = "-h" ]] || [[ "$1" = "--help" ]]; then
+    echo "Tools for symbolizing kernel addresses (e.g. the report of \`memtrace report\`) against the linker map"
+    echo "Usage: "
+    echo "    ./symbolize.sh" "$(green "REPORT")" "$(purple "[MAP]")"
+    echo "     " "$(green "REPORT:")" "text containing kernel addresses such as 0xc0004a1c, \`-\` for stdin"
+    echo "     " "$(purple "MAP:")" "linker map of the kernel, build/kernel.map by default"
+    echo "Example: "
+    echo "    ./symbolize.sh memtrace.txt"
+    echo "    echo 0xc0004a1c | ./symbolize.sh -"
+    echo "Options:"
+    echo "    -h, --help      show this help message"
+    echo "Note:"
+    echo "    The map only lists global symbols, an address in a static function is shown as"
+    echo "    the closest global symbol before it plus an offset, together with its object file"
+    exit 0
+fi
+
+
+# Location
+shell_folder=$(cd "$(dirname "$0")" || exit; pwd)
+report="${1:--}"
+map="${2:-${shell_folder}/build/kernel.map}"
+
+if [[ ! -e "${map}" ]]; then
+    red "Linker map ${map} not detected, run \`make\` first"
+    exit 255
+fi
+if [[ "${report}" != "-" ]] && [[ ! -e "${report}" ]]; then
+    red "Report ${report} not detected"
+    exit 255
+fi
+
+
+# 先读入链接脚本中.text的输入段(起始地址, 大小, 目标文件)和全局符号, 然后在报告的每一行后面加上第一个内核地址所在的函数
+awk '
+function hex(str,    idx, val, digit){
+    str = tolower(str)
+    sub(/^0x/, "", str)
+    val = 0
+    for (idx = 1; idx <= length(str); idx++){
+        digit = index("0123456789abcdef", substr(str, idx, 1))
+        if (digit == 0)
+            return -1
+        val = val * 16 + digit - 1
+    }
+    return val
+}
+
+# 第一个文件: 链接脚本
+FNR == NR {
+    if ($1 ~ /^\.text/){
+        in_text = 1
+        # 段名太长的时候地址在下一行
+        if (NF == 1){
+            pending = 1
+            next
+        }
+        if (NF >= 4 && $2 ~ /^0x/ && $3 ~ /^0x/){
+            sec_start[sec_cnt] = hex($2); sec_end[sec_cnt] = hex($2) + hex($3); sec_obj[sec_cnt++] = $4
+        }
+        pending = 0
+        next
+    }
+    if ($1 ~ /^\./){
+        in_text = 0
+        pending = 0
+        next
+    }
+    if (pending && NF >= 3 && $1 ~ /^0x/ && $2 ~ /^0x/){
+        sec_start[sec_cnt] = hex($1); sec_end[sec_cnt] = hex($1) + hex($2); sec_obj[sec_cnt++] = $3
+        pending = 0
+        next
+    }
+    if (in_text && NF == 2 && $1 ~ /^0x/ && $2 ~ /^[A-Za-z_][A-Za-z0-9_]*$/){
+        sym_addr[sym_cnt] = hex($1); sym_name[sym_cnt++] = $2
+    }
+    next
+}
+
+# 第二个文件: 报告
+{
+    line = $0
+    for (field = 1; field <= NF; field++){
+        if ($field !~ /^0x[0-9a-fA-F]+$/)
+            continue
+        addr = hex($field)
+        obj = ""
+        for (idx = 0; idx < sec_cnt; idx++)
+            if (sec_start[idx] <= addr && addr < sec_end[idx]){
+                obj = sec_obj[idx]
+                break
+            }
+        if (obj == "")
+            continue
+        best = -1
+        for (idx = 0; idx < sym_cnt; idx++)
+            if (sym_addr[idx] <= addr && (best == -1 || sym_addr[idx] > sym_addr[best]))
+                best = idx
+        if (best == -1)
+            line = line "  <" obj ">"
+        else
+            line = line sprintf("  <%s+0x%x %s>", sym_name[best], addr - sym_addr[best], obj)
+        break
+    }
+    print line
+}
+' "${map}" "${report}"
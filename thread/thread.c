@@ -10,9 +10,14 @@
 #include "sync.h"
 #include "stdio.h"
 #include "syscall.h"
+#include "ksm.h"
 
 
+/// @brief TCB的对象缓存, 每个TCB独占一页
+kmem_cache_t task_struct_cache;
+
 uint8_t pid_bitmap_bits[128] = {0};
+uint32_t pid_bitmap_summary[BITMAP_SUMMARY_BYTES(128) / 4] = {0};
 
 struct {
     bitmap_t pid_bitmap;
@@ -49,6 +54,7 @@ static void pid_pool_init(void){
     pid_pool.pid_start = 1;
     pid_pool.pid_bitmap.bits = pid_bitmap_bits;
     pid_pool.pid_bitmap.btmp_byte_len = 128;
+    pid_pool.pid_bitmap.summary = pid_bitmap_summary;
     bitmap_init(&pid_pool.pid_bitmap);
     mutex_init(&pid_pool.pid_mutex);
 }
@@ -141,7 +147,11 @@ task_struct_t *running_thread(void){
 static void idle(UNUSED void *unused_arg){
     while (1){
         thread_block(TASK_BLOCKED);
-        // 运行不到下面这句话
+        // 没有其他线程就绪的时候预先清0物理页, 然后合并内容相同的用户页, 一旦有线程就绪就让出CPU
+        while (list_empty(&thread_ready_list) && (mem_zero_refill() || ksm_scan()));
+        if (!list_empty(&thread_ready_list))
+            continue;
+        // 没有需要清0的页, 也不需要扫描了, 停机等待下一个中断
         asm volatile (
             "sti;"
             "hlt"
@@ -254,17 +264,19 @@ void thread_exit(task_struct_t *tcb, bool need_schedule){
         list_remove(&tcb->general_tag);
     list_remove(&tcb->all_list_tag);                            // 一定在所有队列中
 
-    // 回收页目录
+    // 回收页目录, 内核线程弹匣中的内存块要归还给内核堆
     if (tcb->pgdir != NULL)
-        mfree_page(PF_KERNEL, tcb->pgdir, 1);
-
-    // 回收TCB占用的页目录
-    if (tcb != main_thread)
-        mfree_page(PF_KERNEL, tcb, 1);
+        release_page_dir(tcb->pgdir);
+    else
+        mem_magazine_flush(tcb->mag_cache, PF_KERNEL);
 
-    // 归还PID
+    // 归还PID, 要在释放TCB之前, 释放以后TCB所在的页可能已经取消映射了
     release_pid(tcb->pid);
 
+    // 回收TCB占用的页
+    if (tcb != main_thread)
+        kmem_cache_free(&task_struct_cache, tcb);
+
     if (need_schedule){
         schedule();
         PANIC("thread_exit: should not be here\n");
@@ -302,6 +314,8 @@ void init_thread(task_struct_t *tcb, char *name, int time_slice){
         tcb->status = TASK_READY;
 
     tcb->pgdir = NULL;
+    tcb->pgdir_phyaddr = KERNEL_PAGE_DIR_PHYADDR;
+    list_init(&tcb->vma_list);
     tcb->this_tick = time_slice;
     tcb->total_ticks = 0;
     tcb->time_slice = time_slice;
@@ -335,7 +349,7 @@ void init_thread(task_struct_t *tcb, char *name, int time_slice){
  */
 task_struct_t *thread_start(char *name, int time_slice, thread_func function, void* func_args){
     // 为线程TCB/进程PCB分配内存空间
-    task_struct_t* tcb = (task_struct_t*) get_kernel_pages(1);
+    task_struct_t* tcb = (task_struct_t*) kmem_cache_alloc(&task_struct_cache);
     init_thread(tcb, name, time_slice);                     // 初始化线程TCB信息
     thread_create(tcb, function, func_args);                // 初始化线程TCB中的线程栈kstack的开头部分，使得scheduler能够正常调用
 
@@ -496,6 +510,9 @@ void thread_init(void){
     list_init(&thread_all_list);
     list_init(&thread_ready_list);
     pid_pool_init();
+    // 创建TCB和页目录表的对象缓存
+    kmem_cache_init(&task_struct_cache, "task_struct", PG_SIZE, PG_SIZE, NULL);
+    page_dir_cache_init();
     // 创建第一个用户进程init
     process_execute(init, "init");
     // 创建内核进程
@@ -523,6 +540,9 @@ static void pad_print(char *buf, int32_t buf_len, void *ptr, char format){
         case 'd':
             out_pad_0idx = sprintf(buf, "%d", *((int16_t*)ptr));
             break;
+        case 'u':
+            out_pad_0idx = sprintf(buf, "%d", *((uint32_t*)ptr));
+            break;
         case 'x':
             out_pad_0idx = sprintf(buf, "%x", *((uint32_t*)ptr));
     }
@@ -579,6 +599,9 @@ static bool elem2thread_info(list_elem_t *elem, int arg __attribute__((unused)))
     // 向屏幕上打印进程的运行时间
     pad_print(out_pad, 16, &pthread->total_ticks, 'x');
 
+    // 向屏幕上打印进程映射的用户页数
+    pad_print(out_pad, 16, &pthread->rss_pages, 'u');
+
     // 向屏幕上打印进程名
     memset(out_pad, 0, 16);
     ASSERT(strlen(pthread->name) < 17);
@@ -596,7 +619,7 @@ static bool elem2thread_info(list_elem_t *elem, int arg __attribute__((unused)))
  * 
  */
 void sys_ps(void){
-    char *ps_title = "PID            ParentPID      STAT           TICKS          COMMAND\n";
+    char *ps_title = "PID            ParentPID      STAT           TICKS          RSS            COMMAND\n";
     sys_write(stdout_no, ps_title, strlen(ps_title));
     list_traversal(&thread_all_list, elem2thread_info, 0);
 }
\ No newline at end of file
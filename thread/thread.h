@@ -15,10 +15,13 @@
 #include "list.h"
 #include "bitmap.h"
 #include "memory.h"
+#include "slab.h"
 #include "types.h"
 
 #define TASK_NAME_LEN 16
 #define MAX_FILE_OPEN_PER_PROC 8
+/// 用户空间占用的页目录项数, 即0 ~ 3GB
+#define USER_PDE_CNT 768
 
 /// 线程函数的模板
 typedef void thread_func(void*);
@@ -27,6 +30,7 @@ typedef void thread_func(void*);
 // 定义在thread.c中
 extern list_t thread_ready_list;                   ///< 就绪队列
 extern list_t thread_all_list;                     ///< 所有进程/线程队列
+extern kmem_cache_t task_struct_cache;             ///< TCB的对象缓存
 
 typedef enum __task_status {
     TASK_RUNNING,
@@ -142,10 +146,24 @@ typedef struct __task_struct {
     /* ------------------------------ 用户进程内存管理 ------------------------------ */
     /// 进程自己的页表的虚拟地址，用于区分进程和线程，线程无此项
     uint32_t *pgdir;
-    /// 用户进程的虚拟地址
-    virtual_addr_t userprog_vaddr;
+    /// 页目录表的物理地址, 在设置pgdir的时候缓存, 切换的时候直接装入cr3. 内核线程为内核页目录表的物理地址
+    uint32_t pgdir_phyaddr;
+    /// 用户进程堆的起始地址, 即程序段结束后的第一个页. 为0表示进程没有堆, 例如内核线程和直接运行内核中函数的进程
+    uint32_t heap_start;
+    /// 用户进程的堆顶(program break), 由brk/sbrk系统调用移动
+    uint32_t brk;
+    /// 用户进程保留的虚拟地址, 按照起始地址升序排列的vma_t组成的链表, 包括程序段, 堆, 栈和mmap建立的映射
+    list_t vma_list;
+    /// 用户进程建立过的页表的位图, 每一位对应一个用户空间的页目录项. fork和exit只处理这些页表, 不需要扫描全部的页目录项
+    uint32_t user_pgtables[USER_PDE_CNT / 32];
+    /// 用户进程映射的用户页数(resident set size), 包括共享的页和零页, 不包括换出的页
+    uint32_t rss_pages;
     /// 用户进程不同大小内存单元的售货窗口
     mem_block_desc_t u_block_desc[MEM_UNIT_CNT];
+    /// 用户进程的堆中大内存块的统计
+    mem_large_stat_t u_large_stat;
+    /// 线程私有的内存块弹匣, 内核线程缓存内核堆中的内存块, 用户进程缓存用户堆中的内存块
+    mem_mag_cache_t mag_cache[MEM_UNIT_CNT];
 
 
     /* ------------------------------ Miscellaneous ------------------------------ */
@@ -160,6 +178,22 @@ typedef struct __task_struct {
 } task_struct_t;
 
 
+/**
+ * @brief pgtable_mark用于记录tcb建立了第pde_idx个页目录项对应的用户页表
+ */
+static inline void pgtable_mark(task_struct_t *tcb, uint32_t pde_idx){
+    tcb->user_pgtables[pde_idx / 32] |= 1U << (pde_idx % 32);
+}
+
+
+/**
+ * @brief pgtable_test用于判断tcb是否建立过第pde_idx个页目录项对应的用户页表. 位图只是一个上界, 页目录项是否存在还需要检查
+ */
+static inline bool pgtable_test(task_struct_t *tcb, uint32_t pde_idx){
+    return tcb->user_pgtables[pde_idx / 32] & (1U << (pde_idx % 32));
+}
+
+
 /**
  * @brief fork_pid用于为子进程分配PID
  * 
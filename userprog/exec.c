@@ -4,6 +4,7 @@
 #include "string.h"
 #include "thread.h"
 #include "memory.h"
+#include "mmap.h"
 
 
 extern void intr_exit(void);
@@ -59,9 +60,10 @@ static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t
  * @brief load用于将filename指向的程序文件加载到内存中
  * 
  * @param pathname 需要加载的程序文件的名称
+ * @param seg_end 加载成功后将被设置为所有可加载段中最高的结束地址
  * @return int32_t 若加载成功, 则返回程序的起始地址(虚拟地址); 若加载失败, 则返回-1
  */
-static int32_t load(const char* pathname){
+static int32_t load(const char* pathname, uint32_t *seg_end){
     int32_t ret = -1;
 
     Elf32_Ehdr elf_header;
@@ -123,6 +125,8 @@ static int32_t load(const char* pathname){
                 ret = -1;
                 goto done;
             }
+            if (prog_header.p_vaddr + prog_header.p_memsz > *seg_end)
+                *seg_end = prog_header.p_vaddr + prog_header.p_memsz;
         }
 
         // 移动到下一个程序头偏移
@@ -152,8 +156,12 @@ int32_t sys_execv(const char* path, const char *argv[]){
     while (argv[argc++]);
     argc--;
 
+    // 旧程序的mmap映射在新程序中没有意义, 并且可能和新程序的段重叠, 所以在加载之前取消
+    mmap_unmap_all();
+
     // 加载程序到内存
-    int32_t entry_point = load(path);
+    uint32_t seg_end = 0;
+    int32_t entry_point = load(path, &seg_end);
     if (entry_point == -1){
         kprintf("%s: load %s into memory failed!\n", __func__, path);
         return -1;
@@ -161,6 +169,17 @@ int32_t sys_execv(const char* path, const char *argv[]){
 
     // 修改进程信息
     task_struct_t *cur = running_thread();
+
+    // 新程序的堆从最后一个段之后的页开始. 旧程序的堆中没有被新程序的段使用的部分要释放, 否则新程序的堆无法增长
+    uint32_t heap_start = DIV_CEILING(seg_end, PG_SIZE) * PG_SIZE;
+    if (cur->heap_start != 0){
+        uint32_t old_start = cur->heap_start > heap_start ? cur->heap_start : heap_start;
+        if (cur->brk > old_start){
+            cur->heap_start = old_start;
+            sys_brk((void *) old_start);
+        }
+    }
+    cur->heap_start = cur->brk = heap_start;
     // 修改进程名
     memcpy(cur->name, path, TASK_NAME_LEN);
     cur->name[TASK_NAME_LEN - 1] = 0;
@@ -6,18 +6,18 @@
 #include "thread.h"
 #include "process.h"
 #include "interrupt.h"
+#include "vma.h"
 
 extern void intr_exit(void);
 
 /**
- * @brief copy_pcb_vaddrbitmap_stack0用于将父线程的tcb信息复制到子线程的tcb中. 同时
- *        会为子线程单独拷贝一份虚拟内存的bitmap.
+ * @brief copy_pcb_stack0用于将父线程的tcb信息和内核栈复制到子线程的tcb中. 虚拟地址空间的区域由vma_fork单独复制
  * 
  * @param child_thread 子进程pcb
  * @param parent_thread 父进程pcb
  * @return uint32_t 复制成功则返回0
  */
-static int32_t copy_pcb_vaddrbitmap_stack0(task_struct_t *child_thread, task_struct_t *parent_thread){
+static int32_t copy_pcb_stack0(task_struct_t *child_thread, task_struct_t *parent_thread){
     // 复制整个页, 包括内核线程的tcb和内核栈
     memcpy(child_thread, parent_thread, PG_SIZE);
 
@@ -29,18 +29,6 @@ static int32_t copy_pcb_vaddrbitmap_stack0(task_struct_t *child_thread, task_str
     child_thread->parent_pid = parent_thread->pid;
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
-    block_desc_init(child_thread->u_block_desc);
-
-    // 复制父进程虚拟地址池的位图, 因为每个进程的虚拟内存都是独立的, 所以需要单独复制
-    uint32_t bitmap_pg_cnt = DIV_CEILING((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    void *vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
-    if (vaddr_btmp == NULL)
-        return -1;
-
-    // 因为上面直接复制的整个页, 所以child_thread->userprog_vaddr依旧指向父进程的bitmap
-    // 这里逐字节的复制, 然后再转换下类型
-    memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
-    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
 
     // prepare for name
     // ASSERT(strlen(child_thread->name) < 11);
@@ -49,53 +37,6 @@ static int32_t copy_pcb_vaddrbitmap_stack0(task_struct_t *child_thread, task_str
 }
 
 
-/**
- * @brief copy_body_stack3用于拷贝父进程的在内存中的所有数据给子进程, 即复制一份进程实体.
- *        该函数将被父进程调用, 此时使用的页目录表是父进程的. 
- * 
- * @param child_thread 被复制的子进程
- * @param parent_thread 被复制的父进程
- * @param buf_page 内核页, 用于缓冲用
- */
-static void copy_body_stack3(task_struct_t *child_thread, task_struct_t*parent_thread, void *buf_page){
-    uint8_t *vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_byte_len;
-
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
-    uint32_t idx_byte = 0;
-    uint32_t idx_bit = 0;
-    uint32_t prog_vaddr = 0;
-
-    // 遍历父进程的所有的虚拟页
-    while (idx_byte < btmp_bytes_len){
-        if (vaddr_btmp[idx_byte]){
-            idx_bit = 0;
-            while (idx_bit < 8){
-                // 若父进程中的该虚拟页正在使用
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]){
-                    // 计算当前页虚拟地址
-                    prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
-                    // 将父进程该虚拟页复制到buf_page中
-                    // buf_page必须是内核页, 因为不同进程的内核空间是共享的, 所以才能实现切换
-                    // cr3寄存器, 但是buf_page中的内容依旧不变
-                    memcpy(buf_page, (void*)prog_vaddr, PG_SIZE);
-                    // 使用子进程的页目录, 此后操作的就是子进程的虚拟内存
-                    page_dir_activate(child_thread);
-                    // 从用户物理内存池中申请一个页, 并映射该页到子进程的也目录表中
-                    get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
-                    // 复制buf_page中的内容到子进程的页中
-                    memcpy((void*)prog_vaddr, buf_page, PG_SIZE);
-                    // 重新切换为父进程的虚拟页表
-                    page_dir_activate(parent_thread);
-                }
-                idx_bit++;
-            }
-        }
-        idx_byte++;
-    }
-}
-
-
 /**
  * @brief 为子进程构建thread_stack. 之所以要构建thread_stack是因为该函数作为fork系统调用一部分
  *        必然是用户调用系统调用, 则一定是发生了0x80软中断. 所以在返回的时候必然是经过intr_exit的
@@ -149,38 +90,71 @@ static void update_inode_open_cnts(task_struct_t *tcb){
 
 
 /**
- * @brief copy_process用于将父进程中的信息复制给子进程
+ * @brief copy_process用于将父进程中的信息复制给子进程. 复制失败的时候释放已经为子进程分配的资源, 子进程的TCB由调用者释放
  * 
  * @param child_thread 子进程
  * @param parent_thread 被复制的父进程
  * @return uint32_t 复制成功返回0; 复制失败返回-1
  */
 static int32_t copy_process(task_struct_t *child_thread, task_struct_t *parent_thread){
-    // 分配内核缓冲页
-    void *buf_page = get_kernel_pages(1);
-    if (buf_page == NULL)
-        return -1;
+    int32_t rollback_step = 0;
 
-    // 复制父进程的pcb, 虚拟地址位图, 内核栈给子进程
-    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1)
+    // 复制父进程的pcb, 内核栈给子进程
+    if (copy_pcb_stack0(child_thread, parent_thread) == -1)
         return -1;
     
     // 为子进程创建页表
     child_thread->pgdir = create_page_dir();
-    if (child_thread->pgdir == NULL)
-        return -1;
+    if (child_thread->pgdir == NULL){
+        rollback_step = 1;              // 只需要释放PID
+        goto rollback;
+    }
+    child_thread->pgdir_phyaddr = addr_v2p((uint32_t) child_thread->pgdir);
+
+    // 父子进程写时复制共享父进程的所有用户页, 只复制页表
+    if (page_table_fork(child_thread->pgdir) == -1){
+        rollback_step = 2;              // 还要释放已经复制的页表和页目录表
+        goto rollback;
+    }
+
+    // 子进程继承父进程虚拟地址空间中所有的区域
+    if (vma_fork(child_thread, parent_thread) == -1){
+        rollback_step = 3;              // 还要释放已经复制的区域
+        goto rollback;
+    }
 
-    // 复制父进程的所有数据给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    // 子进程继承了父进程的用户堆, 修正子进程的内存块描述符和弹匣. 修改子进程的堆会为子进程复制写时复制的页,
+    // 复制出来的页属于子进程, 所以不能在子进程的页表下通过缺页中断处理, 否则页的拥有者会被记为当前的父进程
+    if (mem_heap_fork(child_thread, parent_thread) == -1){
+        rollback_step = 4;              // 还要释放已经复制的弹匣
+        goto rollback;
+    }
 
     // 构建子进程thread_stack并且修改返回值
     build_child_stack(child_thread);
 
     // 更新文件计数
     update_inode_open_cnts(child_thread);
-
-    mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
+
+rollback:
+    // 子进程的TCB复制自父进程, 还没有复制的资源仍然指向父进程的, 所以只能释放已经复制的部分
+    switch (rollback_step){
+        case 4:
+            mem_magazine_destroy(child_thread->mag_cache, child_thread->u_block_desc);
+            __attribute__ ((fallthrough));
+        case 3:
+            vma_release(child_thread);
+            __attribute__ ((fallthrough));
+        case 2:
+            page_table_fork_undo(child_thread->pgdir);
+            release_page_dir(child_thread->pgdir);
+            __attribute__ ((fallthrough));
+        case 1:
+            release_pid(child_thread->pid);
+            break;
+    }
+    return -1;
 }
 
 
@@ -192,7 +166,7 @@ static int32_t copy_process(task_struct_t *child_thread, task_struct_t *parent_t
 pid_t sys_fork(void){
     task_struct_t *parent_thread = running_thread();
 
-    task_struct_t *child_thread = get_kernel_pages(1);
+    task_struct_t *child_thread = kmem_cache_alloc(&task_struct_cache);
     if (child_thread == NULL)
         return -1;
 
@@ -200,8 +174,10 @@ pid_t sys_fork(void){
     ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
 
     // 复制所有数据
-    if (copy_process(child_thread, parent_thread) == -1)
+    if (copy_process(child_thread, parent_thread) == -1){
+        kmem_cache_free(&task_struct_cache, child_thread);
         return -1;
+    }
     
     // 插入到就绪队列中
     ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
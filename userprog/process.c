@@ -2,6 +2,7 @@
 #include "global.h"
 #include "debug.h"
 #include "memory.h"
+#include "vma.h"
 #include "thread.h"
 #include "list.h"
 #include "tss.h"
@@ -34,7 +35,7 @@ void start_process(void* filename_){
     proc_stack->eip = function;                                                             // 设置中断返回的CS:EIP
     proc_stack->cs = SELECTOR_U_CODE;                                                       // 设置中断返回的CS:EIP
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);                        // IF=1, 伪装成发生中断
-    proc_stack->esp = (void*) ((uint32_t) get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE); // 为虚拟页分配对应的物理页的同时，将ESP指向得到的页的页底
+    proc_stack->esp = (void*) (USER_STACK3_VADDR + PG_SIZE);                                 // 栈所在的虚拟页已经保留, 第一次压栈的时候按需分配物理页
     proc_stack->ss = SELECTOR_U_DATA;                                                       // 设置SS
 
     // 中断返回, 这里proc_stack放在哪都无所谓，所以用通用约束，并且调用函数前清除寄存器缓存
@@ -48,29 +49,38 @@ void start_process(void* filename_){
 }
 
 
+/// 当前装入cr3的页目录表的物理地址. 内核线程不切换页表, 所以不一定是当前运行线程的页目录表
+static uint32_t active_pgdir_phyaddr = KERNEL_PAGE_DIR_PHYADDR;
+
+
 /**
- * @brief page_dir_activate用于重新设置页目录寄存器cr3. 
- *        该函数具体干的事情: 将tcb中的pgdir的物理地址赋值给cr3寄存器
+ * @brief load_cr3用于将页目录表装入cr3. 重新装入cr3会刷新TLB中所有非全局的项
  * 
- * @param tcb 要安装页表寄存器的进程
+ * @param pgdir_phyaddr 页目录表的物理地址
  */
-void page_dir_activate(task_struct_t *tcb){
-    // 内核页表在0x100000
-    uint32_t pagedir_phy_addr = 0x100000;
-    if (tcb->pgdir != NULL){
-        // 用户进程则有自己的页目录表A
-        pagedir_phy_addr = addr_v2p((uint32_t) tcb->pgdir);
-    }
-
+static void load_cr3(uint32_t pgdir_phyaddr){
+    active_pgdir_phyaddr = pgdir_phyaddr;
     // 更新页目录寄存器cr3，cr3必须是寄存器才能够赋值的，最后清除寄存器缓存
     asm volatile (
         "movl %0, %%cr3"
         :
-        : "r" (pagedir_phy_addr)
+        : "r" (pgdir_phyaddr)
         : "memory"
     );
 }
 
+
+/**
+ * @brief page_dir_activate用于重新设置页目录寄存器cr3. 
+ *        该函数具体干的事情: 将tcb中缓存的页目录表的物理地址赋值给cr3寄存器, 若cr3中已经是该页目录表则什么都不做
+ * 
+ * @param tcb 要安装页表寄存器的进程
+ */
+void page_dir_activate(task_struct_t *tcb){
+    if (tcb->pgdir_phyaddr != active_pgdir_phyaddr)
+        load_cr3(tcb->pgdir_phyaddr);
+}
+
 /**
  * @brief process_activate用于激活一个进程
  * 
@@ -79,33 +89,37 @@ void page_dir_activate(task_struct_t *tcb){
  *      1. 将内核位于0x0010_0000的页目录表切换为用户的页目录表
  *      2. 将用户栈替换到tss中的esp0中, 以便于稍后调用
  * 
+ *      所有页目录表的内核部分都是相同的, 内核线程只访问内核空间, 所以内核线程直接借用上一个线程的页目录表,
+ *      不重新装入cr3. 这样从用户进程切换到内核线程再切换回来的时候TLB中用户空间的项依旧有效
+ * 
  * @param tcb 指向要激活的线程
  */
 void process_activate(task_struct_t *tcb){
     ASSERT(tcb != NULL);
-    // 激活该进程或线程的页表
+    // 内核线程借用当前的页目录表
+    if (tcb->pgdir == NULL)
+        return;
+
+    // 激活该进程的页表
     page_dir_activate(tcb);
 
     // 如果稍后要运行的线程是用户线程的话，由于当前还是在0特权级下，只有等下intr_exit之后才是3特权级
     // 所以如果稍后要运行的线程是用户线程的话，则需要更新tss中的esp0
-    if (tcb->pgdir){
-        update_tss_esp(tcb);
-    }
+    update_tss_esp(tcb);
 }
 
 
+kmem_cache_t page_dir_cache;
+
+
 /**
- * @brief create_page_dir用于为用户进程创建页目录表
+ * @brief page_dir_ctor是页目录表对象的构造函数. 内核部分的页目录项在loader中已经全部创建了, 不会再改变,
+ *        所以构造好的页目录表在释放之后可以直接复用, 只需要清空用户部分
  * 
- * @return uint32_t* 若创建成功, 则返回创建成功的页目录表首字节的物理地址; 失败则返回NULL
+ * @param obj 需要构造的页目录表
  */
-uint32_t* create_page_dir(void){
-    // 用户进程的页目录依旧需要一个物理页来存储
-    uint32_t* page_dir_vaddr = get_kernel_pages(1);
-    if (page_dir_vaddr == NULL){
-        console_put_str("create_page_dir: get_kernel_ failed!\n");
-        return NULL;
-    }
+static void page_dir_ctor(void *obj){
+    uint32_t *page_dir_vaddr = obj;
     // 复制页目录表的内核部分, 0x300就是第768项目, 一个页目录项占用4字节
     // 所以从768 * 4 = 0xC00处开始复制, 复制到用户
     // 768 ~ 1024一共256项, 每个页目录项4字节, 所以一共要复制1024个字节
@@ -118,25 +132,60 @@ uint32_t* create_page_dir(void){
     // 由于cr3寄存器中需要保存页目录表的物理地址，因此需要将页目录表的虚拟地址转为物理地址
     uint32_t new_page_dir_phy_addr = addr_v2p((uint32_t) page_dir_vaddr);
     page_dir_vaddr[1023] = new_page_dir_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
+}
+
+
+/**
+ * @brief page_dir_cache_init用于初始化用户进程页目录表的对象缓存
+ */
+void page_dir_cache_init(void){
+    kmem_cache_init(&page_dir_cache, "page_dir", PG_SIZE, PG_SIZE, page_dir_ctor);
+}
 
+
+/**
+ * @brief create_page_dir用于为用户进程创建页目录表
+ * 
+ * @return uint32_t* 若创建成功, 则返回创建成功的页目录表首字节的物理地址; 失败则返回NULL
+ */
+uint32_t* create_page_dir(void){
+    // 用户进程的页目录依旧需要一个物理页来存储, 从对象缓存中得到的页目录表已经包含了内核部分
+    uint32_t* page_dir_vaddr = kmem_cache_alloc(&page_dir_cache);
+    if (page_dir_vaddr == NULL){
+        console_put_str("create_page_dir: kmem_cache_alloc failed!\n");
+        return NULL;
+    }
     return page_dir_vaddr;
 }
 
 
 /**
- * @brief create_user_vaddr_bitmap用于给user_prog指向的用户进程创建虚拟内存位图
+ * @brief release_page_dir用于释放用户进程的页目录表. 用户部分的页表需要在调用前释放
+ * 
+ * @param page_dir_vaddr 需要释放的页目录表
+ */
+void release_page_dir(uint32_t *page_dir_vaddr){
+    // 内核线程可能还借用着该页目录表, 释放之前切换回内核页目录表. 这样复用该页目录表的进程也一定会重新装入cr3
+    intr_status_t old_status = intr_disable();
+    if ((page_dir_vaddr[1023] & 0xFFFFF000) == active_pgdir_phyaddr)
+        load_cr3(KERNEL_PAGE_DIR_PHYADDR);
+    intr_set_status(old_status);
+
+    // 清空用户部分, 恢复到构造后的状态
+    memset(page_dir_vaddr, 0, 0x300 * 4);
+    kmem_cache_free(&page_dir_cache, page_dir_vaddr);
+}
+
+
+/**
+ * @brief create_user_vaddr_space用于初始化user_prog指向的用户进程的虚拟地址空间, 只保留用户栈所在的区域
  * 
- * @param user_prog 需要创先虚拟内存位图的用户进程
+ * @param user_prog 需要初始化虚拟地址空间的用户进程
  */
-void create_user_vaddr_bitmap(task_struct_t *user_prog){
-    user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-    // 计算存储描述用户程序所占用的内存需要的bitmap占用的页数。用户程序中给出的地址虽然是虚拟地址, 但是每个虚拟地址都是和一个物理地址一一对应的
-    // 因此, 也需要对虚拟地址进行管理, 依旧是使用位图来管理。
-    // 由于位图要在物理内存中存储，因此这里先计算描述用户程序所占用内存的位图需要的位图占用页数
-    uint32_t bitmap_pg_cnt = DIV_CEILING((0xC0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-    user_prog->userprog_vaddr.vaddr_bitmap.btmp_byte_len = (0xC0000000 - USER_VADDR_START) / PG_SIZE / 8;
-    bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+void create_user_vaddr_space(task_struct_t *user_prog){
+    // 用户进程的虚拟地址由区域链表管理, init_thread中已经初始化为空.
+    // 保留用户栈所在的虚拟页, 这样堆不会占用栈的空间, 并且栈可以在缺页中断中按需增长
+    vma_add(user_prog, 0xC0000000 - USER_STACK_SIZE, USER_STACK_SIZE / PG_SIZE, 0);
 }
 
 
@@ -148,12 +197,14 @@ void create_user_vaddr_bitmap(task_struct_t *user_prog){
  */
 void process_execute(void *filename, char *name){
     // 初始化用户进程对应的内核线程
-    task_struct_t *tcb = get_kernel_pages(1);
+    task_struct_t *tcb = kmem_cache_alloc(&task_struct_cache);
     init_thread(tcb, name, default_time_slice);
-    create_user_vaddr_bitmap(tcb);
+    create_user_vaddr_space(tcb);
     // schedule调度的时候, 实际上运行的第一个命令就是start_process(filename)
     thread_create(tcb, start_process, filename);
     tcb->pgdir = create_page_dir();
+    if (tcb->pgdir != NULL)
+        tcb->pgdir_phyaddr = addr_v2p((uint32_t) tcb->pgdir);
     block_desc_init(tcb->u_block_desc);
 
     // 操作共享变量，必须要保证操作的原子性
@@ -3,10 +3,15 @@
 
 #include "global.h"
 #include "thread.h"
+#include "slab.h"
 
 // 默认每个进程的时间片为31个时钟中断
 #define default_time_slice 31
 #define USER_STACK3_VADDR (0xC0000000 - 0x1000)
+// 用户栈的最大大小, 用户栈所在的虚拟页在创建进程的时候全部保留, 物理页在访问的时候按需分配
+#define USER_STACK_SIZE (8 * 1024 * 1024)
+// 内核页目录表的物理地址, 在loader中创建
+#define KERNEL_PAGE_DIR_PHYADDR 0x100000
 // 用户程序起始虚拟地址, 大部分Linux程序编译出来起始地址都是0x8048000附近
 #define USER_VADDR_START 0x8048000
 
@@ -41,6 +46,16 @@ void process_activate(task_struct_t *tcb);
 void page_dir_activate(task_struct_t *tcb);
 
 
+/// @brief 用户进程页目录表的对象缓存
+extern kmem_cache_t page_dir_cache;
+
+
+/**
+ * @brief page_dir_cache_init用于初始化用户进程页目录表的对象缓存
+ */
+void page_dir_cache_init(void);
+
+
 /**
  * @brief create_page_dir用于为用户进程创建页目录表
  * 
@@ -50,11 +65,19 @@ uint32_t* create_page_dir(void);
 
 
 /**
- * @brief create_user_vaddr_bitmap用于给user_prog指向的用户进程创建虚拟内存位图
+ * @brief release_page_dir用于释放用户进程的页目录表. 用户部分的页表需要在调用前释放
+ * 
+ * @param page_dir_vaddr 需要释放的页目录表
+ */
+void release_page_dir(uint32_t *page_dir_vaddr);
+
+
+/**
+ * @brief create_user_vaddr_space用于初始化user_prog指向的用户进程的虚拟地址空间, 只保留用户栈所在的区域
  * 
- * @param user_prog 需要创先虚拟内存位图的用户进程
+ * @param user_prog 需要初始化虚拟地址空间的用户进程
  */
-void create_user_vaddr_bitmap(task_struct_t *user_prog);
+void create_user_vaddr_space(task_struct_t *user_prog);
 
 
 /**
@@ -64,17 +87,17 @@ void create_user_vaddr_bitmap(task_struct_t *user_prog);
  * 
  *      => 调用process_execute时立即运行:
  *          1. 创建一个内核线程，该内核线程将用于在3特权级下运行用户进程
- *              1.1 调用get_kernel_pages在内核存储空间中分配一个页, 用于存储TCB
+ *              1.1 从TCB的对象缓存中分配一个页, 用于存储TCB
  *              1.2 调用init_thread来初始化内核线程的TCB, 此时仅填充页顶部的内存区域
- *          2. 调用create_vaddr_bitmap来为用户虚拟内存创建位图. 
- *             因为用户进程将使用自己的虚拟空间的0~3GB, 也需要使用位图来进行管理
- *             此外, 用户进程虚拟内存的位图将保存在内核线程TCB中, 以和一般的内核线程表示区别
+ *          2. 调用create_user_vaddr_space来初始化用户虚拟地址空间.
+ *             用户进程将使用自己的虚拟空间的0~3GB, 保留的虚拟地址由TCB中有序的区域链表管理,
+ *             其大小只和进程实际使用的区域数有关
  *          3. 调用create_thread初始化内核线程栈
  *              3.1 创建intr_stack_t以伪装从用户进程中断进入到内核
  *              3.2 创建thread_stack_t以使得内核线程第一次被调度上CPU后能正常运行, 而后中断返回到特权3下的用户进程
  *          4. 为用户进程创建页目录表, 因为每个用户进程都有独立的虚拟地址
  *             而相同虚拟地址不同用户进程对应物理地址都不同, 因此每个用户进程都要有自己的页目录表
- *              4.1 内核中分配一个页, 用于存储用户进程的页目录表
+ *              4.1 从页目录表的对象缓存中分配一个页, 用于存储用户进程的页目录表
  *              4.2 将内核页目录表768~1024项复制到用户页目录表, 以使得用户虚拟地址3~4G部分都指向内核, 以支持后续的系统调用
  *              4.3 设置用户页目录表最后一项(1023)指向用户页目录表自己
  *          5. 将用于运行用户进程的内核线程插入到就绪队列和所有队列
@@ -11,8 +11,9 @@
 #include "wait_exit.h"
 #include "pipe.h"
 #include "kstdio.h"
+#include "mmap.h"
 
-#define syscall_nr 32
+#define syscall_nr 64
 
 typedef void *syscall;
 
@@ -62,6 +63,8 @@ void sys_help(void){
         "    rm: remove a regular file\n"
         "    pwd: print current working directory\n"
         "    ps: show process information\n"
+        "    meminfo: show memory pool, heap, page table, swap and ksm usage\n"
+        "    memtrace: trace heap allocations by call site. start, stop or report\n"
         "    clear: clear current screen\n"
         "    help: show this help message\n"
         "Shotcut Key:\n"
@@ -113,5 +116,13 @@ void syscall_init(void){
     syscall_table[SYS_PIPE] = sys_pipe;
     syscall_table[SYS_FD_REDIRECT] = sys_fd_redirect;
     syscall_table[SYS_HELP] = sys_help;
+    syscall_table[SYS_BRK] = sys_brk;
+    syscall_table[SYS_SBRK] = sys_sbrk;
+    syscall_table[SYS_MMAP] = sys_mmap;
+    syscall_table[SYS_MUNMAP] = sys_munmap;
+    syscall_table[SYS_REALLOC] = sys_realloc;
+    syscall_table[SYS_MEMALIGN] = sys_memalign;
+    syscall_table[SYS_MEMINFO] = sys_meminfo;
+    syscall_table[SYS_MEMTRACE] = sys_memtrace;
     put_str("syscall_init done\n");
 }
\ No newline at end of file
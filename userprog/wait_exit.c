@@ -4,21 +4,24 @@
 #include "debug.h"
 #include "thread.h"
 #include "wait_exit.h"
+#include "vma.h"
+#include "swap.h"
 
 
 /**
  * @brief release_prog_resource用于释放用户进程所占用的特殊资源. 
  *        相比于一般内核线程, 用户进程占用的特殊资源有:
  *              1. 页目录表占用的物理页
- *              2. 虚拟内存池占用的物理页
+ *              2. 虚拟地址空间的区域描述符
  *              3. 打开的文件
- *        因此, 在释放的时候也会回收上面这三个特殊的资源
+ *              4. 用户堆的弹匣
+ *        因此, 在释放的时候也会回收上面这四个特殊的资源
  * 
  * @param tcb 需要回收的线程tcb
  */
 static void release_prog_resource(task_struct_t *tcb){
     uint32_t *pgdir_vaddr = tcb->pgdir;
-    uint16_t user_pde_num = 768, pde_idx = 0;
+    uint16_t user_pde_num = USER_PDE_CNT, pde_idx = 0;
     uint32_t pde = 0;
     uint32_t *v_pde_ptr = NULL;
 
@@ -29,12 +32,12 @@ static void release_prog_resource(task_struct_t *tcb){
     uint32_t *first_pte_vaddr_in_page = NULL;
     uint32_t pg_phy_addr = 0;
 
-    // 回收页表中用户空间占用的所有物理页, 用户占用的页目录表项一共768个, 表示4G空间
+    // 回收页表中用户空间占用的所有物理页, 用户占用的页目录表项一共768个, 表示3G空间. 只需要检查进程建立过的页表
     while (pde_idx < user_pde_num){
         v_pde_ptr = pgdir_vaddr + pde_idx;
         pde = *v_pde_ptr;
         // 当前页目录项为0, 则页表中所有页表项都没有分配, 直接下一个就行了
-        if (pde & 0x00000001){
+        if (pgtable_test(tcb, pde_idx) && (pde & 0x00000001)){
             // 当前页表项为1, 页表中至少有一个页表项已经分配, 稍后循环检查即可
             first_pte_vaddr_in_page = pte_addr(pde_idx * 0x400000);
             pte_idx = 0;
@@ -44,23 +47,27 @@ static void release_prog_resource(task_struct_t *tcb){
                 pte = *v_pte_ptr;
                 // 当前页表项为0, 则该页没有进行映射, 跳过即可
                 if (pte & 0x00000001){
-                    // 当前页表项为1, 则该页经行了映射, 释放
+                    // 当前页表项为1, 则该页经行了映射, 释放. 零页和写时复制共享的页只会减少引用计数
                     pg_phy_addr = pte & 0xFFFFF000;
                     free_a_phy_page(pg_phy_addr);
-                }
+                } else if (pte & PG_SWAP)
+                    // 换出的页释放交换分区中的槽
+                    swap_put(SWAP_PTE_SLOT(pte));
                 pte_idx++;
             }
-            // 释放页表
+            // 释放页表, 并清除页目录项, 这样页回收不会再访问已经释放的页表
             pg_phy_addr = pde & 0xFFFFF000;
-            free_a_phy_page(pg_phy_addr);
+            *v_pde_ptr = 0;
+            free_page_table(pg_phy_addr);
         }
         pde_idx++;
     }
 
-    // 释放虚拟线程池
-    uint32_t bitmap_pg_cnt = tcb->userprog_vaddr.vaddr_bitmap.btmp_byte_len / PG_SIZE;
-    uint8_t *user_vaddr_pool_bitmap = tcb->userprog_vaddr.vaddr_bitmap.bits;
-    mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
+    // 释放虚拟地址空间的区域描述符, 区域中的页已经随页表释放了
+    vma_release(tcb);
+
+    // 释放用户堆的弹匣, 用户堆已经整个释放了, 弹匣中的内存块不需要归还
+    mem_magazine_destroy(tcb->mag_cache, tcb->u_block_desc);
 
     // 关闭打开的文件
     uint8_t local_fd = 3;
@@ -69,7 +76,7 @@ static void release_prog_resource(task_struct_t *tcb){
             if (is_pipe(local_fd)){
                 uint32_t global_fd = fd_local2global(local_fd);
                 if (--file_table[global_fd].fd_pos == 0){
-                    mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
+                    kmem_cache_free(&pipe_cache, file_table[global_fd].fd_inode);
                     file_table[global_fd].fd_inode = NULL;
                 }
             } else{